@@ -5,6 +5,7 @@
 
 #include "../lib/outcome.h"
 #include "../lib/sgf.h"
+#include "../lib/treefile.h"
 #include "../lib/types.h"
 
 #include "board.h"
@@ -38,6 +39,9 @@ public:
 
 	virtual void gen_sgf(SGFPrinter<Move> & sgf, int limit) const = 0;
 	virtual void load_sgf(SGFParser<Move> & sgf) = 0;
+	virtual bool save_tree(const std::string & filename, const vecmove & moves, std::string & error) = 0;
+	virtual bool can_load(const TreeFile & file, std::string & error) const = 0; //whether load_tree would accept it
+	virtual bool load_tree(const TreeFile & file, std::string & error) = 0;
 
 protected:
 	volatile bool timeout;
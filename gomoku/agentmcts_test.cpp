@@ -14,3 +14,24 @@ TEST_CASE("Gomoku::AgentMCTS::Node::to_s/from_s", "[gomoku][agentmcts]") {
 	REQUIRE(k.from_s(s));
 	REQUIRE(n.to_s() == k.to_s());
 }
+
+//in the compact layout know and bestmove share bits, so a partial proof has to keep know
+TEST_CASE("Gomoku::AgentMCTS::Node keeps know through partial proofs", "[gomoku][agentmcts]") {
+	AgentMCTS::Node n(Move("a1"));
+	n.set_know(-7);
+	REQUIRE(n.cas_proof(Outcome::UNKNOWN, Outcome::P1_DRAW, Move("b2"), 3));
+	REQUIRE(n.outcome() == Outcome::P1_DRAW);
+	REQUIRE(n.proofdepth() == 3);
+	REQUIRE(n.move() == Move("a1"));
+	REQUIRE(n.know() == -7);
+
+	n.set_outcome(Outcome::P2_DRAW);
+	REQUIRE(n.know() == -7);
+	n.set_proof(Outcome::P1_DRAW, Move("b2"), 4);
+	REQUIRE(n.know() == -7);
+
+	REQUIRE(!n.cas_proof(Outcome::UNKNOWN, Outcome::P2, Move("b2"), 5));
+	REQUIRE(n.cas_proof(Outcome::P1_DRAW, Outcome::P1, Move("b2"), 5));
+	REQUIRE(n.outcome() == Outcome::P1);
+	REQUIRE(n.bestmove() == Move("b2"));
+}
@@ -9,6 +9,7 @@
 #include "../lib/compacttree.h"
 #include "../lib/depthstats.h"
 #include "../lib/log.h"
+#include "../lib/shardedcounter.h"
 #include "../lib/string.h"
 
 #include "agent.h"
@@ -125,11 +126,12 @@ public:
 	};
 
 	class AgentThread : public AgentThreadBase<AgentPNS> {
+		CompactTree<Node>::Arena arena; //allocate tree nodes without contending with the other threads
 	public:
 		DepthStats treelen;
 		uint64_t nodes_seen;
 
-		AgentThread(AgentThreadPool<AgentPNS> * p, AgentPNS * a) : AgentThreadBase<AgentPNS>(p, a) { }
+		AgentThread(AgentThreadPool<AgentPNS> * p, AgentPNS * a) : AgentThreadBase<AgentPNS>(p, a), arena(a->ctmem) { }
 
 		void reset(){
 			nodes_seen = 0;
@@ -138,7 +140,7 @@ public:
 		void iterate(); //handles each iteration
 
 		//basic proof number search building a tree
-		bool pns(const Board & board, Node * node, int depth, uint32_t tp, uint32_t td);
+		bool pns(Board & board, Node * node, int depth, uint32_t tp, uint32_t td);
 
 		//update the phi and delta for the node
 		bool updatePDnum(Node * node);
@@ -146,14 +148,16 @@ public:
 
 
 //memory management for PNS which uses a tree to store the nodes
-	uint64_t nodes, memlimit;
+	ShardedCounter nodes;
+	uint64_t memlimit;
 	unsigned int gclimit;
 	CompactTree<Node> ctmem;
 
 	AgentThreadPool<AgentPNS> pool;
 
 
-	uint64_t nodes_seen, max_nodes_seen;
+	ShardedCounter nodes_seen;
+	uint64_t max_nodes_seen;
 
 
 	int   ab; // how deep of an alpha-beta search to run at each leaf node
@@ -207,7 +211,7 @@ public:
 		reset();
 
 
-		uint64_t nodesbefore = nodes;
+		uint64_t nodesbefore = nodes.exact();
 
 		Node child;
 
@@ -224,16 +228,16 @@ public:
 		root.swap_tree(child);
 
 		if(nodesbefore > 0)
-			logerr(std::string("PNS Nodes before: ") + to_str(nodesbefore) + ", after: " + to_str(nodes) + ", saved " + to_str(100.0*nodes/nodesbefore, 1) + "% of the tree\n");
+			logerr(std::string("PNS Nodes before: ") + to_str(nodesbefore) + ", after: " + to_str(nodes.exact()) + ", saved " + to_str(100.0*nodes.exact()/nodesbefore, 1) + "% of the tree\n");
 
-		assert(nodes == root.size());
+		assert(nodes.exact() == root.size());
 
-		if(nodes == 0)
+		if(nodes.exact() == 0)
 			clear_mem();
 	}
 
 	void set_memlimit(uint64_t lim){
-		memlimit = lim;
+		memlimit = std::min(lim, ctmem.maxmemory() / 2); //leave compacting room to copy into
 	}
 
 	void clear_mem(){
@@ -294,6 +298,27 @@ public:
 		load_sgf(sgf, rootboard, root);
 	}
 
+	bool save_tree(const std::string & filename, const vecmove & moves, std::string & error) {
+		pool.pause();
+		return TreeFile::save(filename, Board::name, "pns", rootboard.size(), moves, root, error);
+	}
+
+	bool can_load(const TreeFile & file, std::string & error) const {
+		if(!file.matches<Node>("pns")){
+			error = "File is from a different agent or build: " + file.agent();
+			return false;
+		}
+		return true;
+	}
+
+	bool load_tree(const TreeFile & file, std::string & error) {
+		if(!can_load(file, error))
+			return false;
+		clear_mem();
+		nodes = file.load(root, ctmem);
+		return true;
+	}
+
 	static void test();
 
 private:
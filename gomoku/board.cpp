@@ -1,4 +1,6 @@
 
+#include "../lib/thread.h"
+
 #include "board.h"
 
 namespace Morat {
@@ -80,9 +82,14 @@ std::string Board::to_s(bool color, std::function<std::string(Move)> func) const
 	return s;
 }
 
-std::shared_ptr<MoveValid> Board::gen_neighbor_list() const {
-	std::shared_ptr<MoveValid> list(new MoveValid[vec_size()*24]);
-	MoveValid * a = list.get();
+const MoveValid * Board::gen_neighbor_list() const {
+	//one list per size, built the first time it's needed and kept for the life of the program
+	static MoveValid * lists[max_size + 1] = {};
+	if(lists[size_])
+		return lists[size_];
+
+	MoveValid * list = new MoveValid[vec_size()*24];
+	MoveValid * a = list;
 	for(int y = 0; y < size_; y++){
 		for(int x = 0; x < size_; x++){
 			Move pos(x,y);
@@ -95,7 +102,9 @@ std::shared_ptr<MoveValid> Board::gen_neighbor_list() const {
 		}
 	}
 
-	return list;
+	if(!CAS(lists[size_], (MoveValid *)NULL, list)) //another thread built it first
+		delete[] list;
+	return lists[size_];
 }
 
 }; // namespace Gomoku
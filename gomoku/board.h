@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <ostream>
@@ -16,6 +17,7 @@
 #include "../lib/hashset.h"
 #include "../lib/move.h"
 #include "../lib/outcome.h"
+#include "../lib/rawarray.h"
 #include "../lib/string.h"
 #include "../lib/types.h"
 #include "../lib/zobrist.h"
@@ -50,6 +52,13 @@ public:
 		std::string to_s(int i) const;
 	};
 
+	//What a move changed, so undo() can take it back instead of copying the whole board.
+	struct Undo {
+		MoveValid pos;
+		Move      last_move;
+		Outcome   outcome;
+	};
+
 private:
 	int8_t size_;
 	short num_cells_;
@@ -58,9 +67,8 @@ private:
 	Side to_play_;
 	Outcome outcome_;
 
-	std::vector<Cell> cells_;
 	Zobrist<1> hash;
-	std::shared_ptr<MoveValid> neighbor_list_;
+	const MoveValid * neighbor_list_; //shared by all boards of this size
 
 public:
 	Board() = delete;
@@ -68,13 +76,19 @@ public:
 		assert(size(s));
 	}
 
+	//copy just the part in use with one memcpy, the cells are last and sized for the biggest board
+	Board(const Board & o) { *this = o; }
+	Board & operator = (const Board & o) {
+		memcpy((void *)this, (const void *)&o, o.mem_size());
+		return *this;
+	}
+
 	bool size(std::string s) {
 		if (!valid_size(s))
 			return false;
 		size_ = from_str<int>(s);
 		neighbor_list_ = gen_neighbor_list();
 		num_cells_ = vec_size();
-		cells_.resize(vec_size());
 		clear();
 		return true;
 	}
@@ -104,7 +118,7 @@ public:
 		return (min_size <= size && size <= max_size);
 	}
 
-	int mem_size() const { return sizeof(Board) + sizeof(Cell)*vec_size(); }
+	int mem_size() const { return (const char *)(cells_.data() + vec_size()) - (const char *)this; } //the part in use
 	int vec_size() const { return size_*size_; }
 	int num_cells() const { return num_cells_; }
 
@@ -165,6 +179,10 @@ public:
 	hash_t gethash() const {
 		return hash.get(0);
 	}
+	//the hash of this exact position, the same as gethash() here, but not in the games that merge symmetries
+	hash_t gethash_exact() const {
+		return hash.get(0);
+	}
 
 	void update_hash(const MoveValid & pos, Side side) {
 		int turn = side.to_i();
@@ -183,12 +201,21 @@ public:
 	bool move(const Move & pos, bool checkwin = true, bool permanent = true) {
 		return move(MoveValid(pos, xy(pos)), checkwin, permanent);
 	}
-	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true) {
+	//make a move that undo(u) can take back
+	bool move(const Move & pos, Undo & u)      { return move(MoveValid(pos, xy(pos)), true, true, &u); }
+	bool move(const MoveValid & pos, Undo & u) { return move(pos, true, true, &u); }
+	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true, Undo * undo = NULL) {
 		assert(!outcome_.solved());
 
 		if(!valid_move(pos))
 			return false;
 
+		if(undo){
+			undo->pos = pos;
+			undo->last_move = last_move_;
+			undo->outcome = outcome_;
+		}
+
 		if(checkwin) {
 			outcome_ = test_outcome(pos, to_play_);
 		}
@@ -208,6 +235,22 @@ public:
 		return true;
 	}
 
+	//take back the move that filled in u, which must be the last move made
+	void undo(const Undo & u) {
+		to_play_ = ~to_play_;
+
+		Cell & cell = cells_[u.pos.xy];
+		cell.piece = Side::NONE;
+		cell.perm = 0;
+
+		update_hash(u.pos, to_play_); //xor it back out while num_moves_ still matches the move
+		undo_pattern(u.pos);
+
+		num_moves_--;
+		last_move_ = u.last_move;
+		outcome_ = u.outcome;
+	}
+
 	//test if making this move would win, but don't actually make the move
 	Outcome test_outcome(const Move & pos) const { return test_outcome(pos, to_play()); }
 	Outcome test_outcome(const Move & pos, Side turn) const { return test_outcome(MoveValid(pos, xy(pos)), turn); }
@@ -244,7 +287,9 @@ public:
 	}
 
 private:
-	std::shared_ptr<MoveValid> gen_neighbor_list() const;
+	const MoveValid * gen_neighbor_list() const;
+
+	RawArray<Cell, max_vec_size> cells_; //last, so copies can skip the unused tail
 
 	friend class BoardGridOct;
 	friend class BoardShapeSquare;
@@ -1,6 +1,7 @@
 
 #include "../lib/catch.hpp"
 #include "../lib/string.h"
+#include "../lib/xorshift.h"
 
 #include "board.h"
 
@@ -141,3 +142,43 @@ TEST_CASE("Gomoku::Board", "[gomoku][board]") {
 		test_game(b, "g7 a1 g1 a5 g2 a2 g3 a4 g5 a3", Outcome::P2);
 	}
 }
+
+TEST_CASE("Gomoku::Board::undo", "[gomoku][board]") {
+	XORShift_uint32 rand(42);
+	for(int game = 0; game < 20; game++){
+		Board b("9");
+		std::vector<Board> boards;
+		std::vector<Board::Undo> undos;
+
+		//play randomly to the end, keeping a copy of each position
+		while(!b.outcome().solved()){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			if(moves.empty())
+				break;
+			boards.push_back(b);
+			undos.push_back(Board::Undo());
+			REQUIRE(b.move(moves[rand() % moves.size()], undos.back()));
+		}
+
+		//take them all back, checking each position including the groups against the copy
+		while(!undos.empty()){
+			b.undo(undos.back());
+			undos.pop_back();
+			const Board & o = boards.back();
+			CAPTURE(b);
+			REQUIRE(b.to_s(false) == o.to_s(false));
+			REQUIRE(b.gethash() == o.gethash());
+			REQUIRE(b.to_play() == o.to_play());
+			REQUIRE(b.moves_made() == o.moves_made());
+			REQUIRE(b.outcome() == o.outcome());
+			REQUIRE(b.win_type() == o.win_type());
+			for(auto m : o){
+				REQUIRE(b.test_outcome(m) == o.test_outcome(m));
+				REQUIRE(b.test_outcome(m, ~o.to_play()) == o.test_outcome(m, ~o.to_play()));
+			}
+			boards.pop_back();
+		}
+	}
+}
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include "../lib/distworkers.h"
 #include "../lib/gtpcommon.h"
 #include "../lib/history.h"
 #include "../lib/move.h"
@@ -28,6 +29,8 @@ public:
 
 	Agent * agent;
 
+	DistWorkers workers; //the other processes of a distributed search
+
 	GTP(FILE * i = stdin, FILE * o = stdout) : GTPCommon(i, o), hist(Board(Board::default_size)) {
 		verbose = 1;
 		genmoveextended = false;
@@ -78,23 +81,40 @@ public:
 
 		newcallback("pv",              std::bind(&GTP::gtp_pv,            this, _1), "Output the principle variation for the player tree as it stands now");
 		newcallback("move_stats",      std::bind(&GTP::gtp_move_stats,    this, _1), "Output the move stats for the player tree as it stands now");
+		newcallback("gc_stats",        std::bind(&GTP::gtp_gc_stats,      this, _1), "Output the garbage collection pause stats for the player");
 
 		newcallback("params",          std::bind(&GTP::gtp_params,        this, _1), "Set the options for the player, no args gives options");
 
 		newcallback("save_sgf",        std::bind(&GTP::gtp_save_sgf,      this, _1), "Output an sgf of the current tree");
 		newcallback("load_sgf",        std::bind(&GTP::gtp_load_sgf,      this, _1), "Load an sgf generated by save_sgf");
+		newcallback("save_tree",       std::bind(&GTP::gtp_save_tree,     this, _1), "Save the current tree in a binary format that loads much faster than an sgf");
+		newcallback("load_tree",       std::bind(&GTP::gtp_load_tree,     this, _1), "Load a tree saved by save_tree");
+
+		newcallback("dist_spawn",      std::bind(&GTP::gtp_dist_spawn,    this, _1), "Start worker processes to search along with this one: dist_spawn <num>");
+		newcallback("dist_listen",     std::bind(&GTP::gtp_dist_listen,   this, _1), "Wait for workers started with --worker <address>: dist_listen <address> <num>");
+		newcallback("dist_stop",       std::bind(&GTP::gtp_dist_stop,     this, _1), "Stop the workers of a distributed search");
+		newcallback("dist_search",     std::bind(&GTP::gtp_dist_search,   this, _1), "Sent to the workers: search, then return the runs and the new experience");
+		newcallback("dist_merge",      std::bind(&GTP::gtp_dist_merge,    this, _1), "Sent to the workers: add the experience from the other processes");
 //		newcallback("player_gammas",   std::bind(&GTP::gtp_player_gammas, this, _1), "Load the gammas for weighted random from a file");
 	}
 
 	void set_board(bool clear = true){
 		agent->set_board(*hist);
+		dist_set_board();
 	}
 
 	void move(const Move & m){
 		hist.move(m);
 		agent->move(m);
+		if(!workers.empty())
+			workers.run("playgame " + m.to_s());
 	}
 
+	std::string mcts_params_args();
+	void dist_set_params();
+	void dist_set_board();
+	void search(double time);
+
 	GTPResponse gtp_print(vecstr args);
 	GTPResponse gtp_zobrist(vecstr args);
 	GTPResponse gtp_boardsize(vecstr args);
@@ -118,6 +138,7 @@ public:
 
 
 	GTPResponse gtp_move_stats(vecstr args);
+	GTPResponse gtp_gc_stats(vecstr args);
 	GTPResponse gtp_pv(vecstr args);
 	GTPResponse gtp_genmove(vecstr args);
 	GTPResponse gtp_solve(vecstr args);
@@ -134,6 +155,14 @@ public:
 //	GTPResponse gtp_player_gammas(vecstr args);
 	GTPResponse gtp_save_sgf(vecstr args);
 	GTPResponse gtp_load_sgf(vecstr args);
+	GTPResponse gtp_save_tree(vecstr args);
+	GTPResponse gtp_load_tree(vecstr args);
+
+	GTPResponse gtp_dist_spawn(vecstr args);
+	GTPResponse gtp_dist_listen(vecstr args);
+	GTPResponse gtp_dist_stop(vecstr args);
+	GTPResponse gtp_dist_search(vecstr args);
+	GTPResponse gtp_dist_merge(vecstr args);
 
 	std::string solve_str(int outcome) const;
 };
@@ -24,6 +24,7 @@ void AgentAB::search(double time, uint64_t maxiters, int verbose) {
 
 	Time start;
 
+	Board board = rootboard; //negamax makes and undoes its moves on this board
 	uint64_t nodes_start, seen, prev_nodes_seen = 0;
 	for(unsigned int depth = 2; !timeout && (int)depth < rootboard.moves_remain() && (maxiters == 0 || depth <= maxiters); depth++){
 		maxdepth = depth;
@@ -31,7 +32,7 @@ void AgentAB::search(double time, uint64_t maxiters, int verbose) {
 		Time start_depth;
 		if (verbose)
 			logerr("Depth " + to_str(depth) + "      ");
-		negamax(rootboard, SCORE_LOSS, SCORE_WIN, depth);
+		negamax(board, SCORE_LOSS, SCORE_WIN, depth);
 		seen = nodes_seen - nodes_start;
 		if (verbose) {
 			logerr("time: " + to_str((Time() - start_depth)*1000, 0) + " msec, ");
@@ -57,7 +58,7 @@ void AgentAB::search(double time, uint64_t maxiters, int verbose) {
 }
 
 
-int16_t AgentAB::negamax(const Board & board, int16_t alpha, int16_t beta, int depth) {
+int16_t AgentAB::negamax(Board & board, int16_t alpha, int16_t beta, int depth) {
 	nodes_seen++;
 
 	Outcome won = board.outcome();
@@ -95,11 +96,12 @@ int16_t AgentAB::negamax(const Board & board, int16_t alpha, int16_t beta, int d
 		if(node->bestmove != M_UNKNOWN){
 			//try the previous best move first
 			bestmove = node->bestmove;
-			Board n = board;
-			bool move_success = n.move(bestmove);
+			Board::Undo undo;
+			bool move_success = board.move(bestmove, undo);
 
 			assert(move_success);
-			score = -negamax(n, -beta, -alpha, depth-1);
+			score = -negamax(board, -beta, -alpha, depth-1);
+			board.undo(undo);
 		}
 	}
 
@@ -108,9 +110,10 @@ int16_t AgentAB::negamax(const Board & board, int16_t alpha, int16_t beta, int d
 
 		//generate moves
 		for (auto move : board) {
-			Board b = board;
-			b.move(move);
-			int16_t value = -negamax(b, -beta, -max(alpha, score), depth-1);
+			Board::Undo undo;
+			board.move(move, undo);
+			int16_t value = -negamax(board, -beta, -max(alpha, score), depth-1);
+			board.undo(undo);
 			if (score < value) {
 				score = value;
 				bestmove = move;
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cmath>
 #include <string>
 
@@ -15,16 +16,19 @@ namespace Morat {
 namespace Havannah {
 
 const float AgentMCTS::min_rave = 0.1;
+const float AgentMCTS::gc_start = 0.8;
+const float AgentMCTS::gc_duty = 0.1;
+const uword AgentMCTS::gc_slice = 50000;
 
 std::string AgentMCTS::Node::to_s() const {
 	return "AgentMCTS::Node"
-	       ", move " + move.to_s() +
+	       ", move " + move().to_s() +
 	       ", exp " + exp.to_s() +
 	       ", rave " + rave.to_s() +
-	       ", know " + to_str(know) +
-	       ", outcome " + to_str((int)outcome.to_i()) +
-	       ", depth " + to_str((int)proofdepth) +
-	       ", best " + bestmove.to_s() +
+	       ", know " + to_str(know()) +
+	       ", outcome " + to_str((int)outcome().to_i()) +
+	       ", depth " + to_str(proofdepth()) +
+	       ", best " + bestmove().to_s() +
 	       ", children " + to_str(children.num());
 }
 
@@ -32,13 +36,11 @@ bool AgentMCTS::Node::from_s(std::string s) {
 	auto dict = parse_dict(s, ", ", " ");
 
 	if(dict.size() == 9){
-		move = Move(dict["move"]);
-		exp = ExpPair(dict["exp"]);
-		rave = ExpPair(dict["rave"]);
-		know = from_str<int>(dict["know"]);
-		outcome = Outcome(from_str<int>(dict["outcome"]));
-		proofdepth = from_str<int>(dict["depth"]);
-		bestmove = Move(dict["best"]);
+		*this = Node(Move(dict["move"]));
+		exp = ExpStats(dict["exp"]);
+		rave = RaveStats(dict["rave"]);
+		set_proof(Outcome(from_str<int>(dict["outcome"])), Move(dict["best"]), from_str<int>(dict["depth"]));
+		set_know(from_str<int>(dict["know"]));
 		// ignore children
 		return true;
 	}
@@ -48,6 +50,7 @@ bool AgentMCTS::Node::from_s(std::string s) {
 void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 	Side to_play = rootboard.to_play();
 
+	lastruns = 0;
 	if(rootboard.outcome() >= Outcome::DRAW || (time <= 0 && max_runs == 0))
 		return;
 
@@ -55,18 +58,26 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 
 	pool.pause();
 
-	if(runs)
-		logerr("Pondered " + to_str(runs) + " runs\n");
+	if(runs.exact())
+		logerr("Pondered " + to_str(runs.exact()) + " runs\n");
 
 	runs = 0;
+	transposed = 0;
 	maxruns = max_runs;
+	uint64_t gcpausesbefore = gcpauses;
 	pool.reset();
 
+	rootboard.track_wins(instantwin); //the rollouts start from copies of it
+	rootboard.bitboard_wins(bitwins);
+	lastmerge = starttime;
+
 	//let them run!
 	pool.resume();
 
 	pool.wait_pause(time);
 
+	merge_trees(); //so root holds the experience of all the trees
+
 	double time_used = Time() - starttime;
 
 
@@ -91,10 +102,12 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 		}
 		draws = gamelen.num - games;
 
-		logerr("Finished:    " + to_str(runs) + " runs in " + to_str(time_used*1000, 0) + " msec: " + to_str(runs/time_used, 0) + " Games/s\n");
+		logerr("Finished:    " + to_str(runs.exact()) + " runs in " + to_str(time_used*1000, 0) + " msec: " + to_str(runs.exact()/time_used, 0) + " Games/s\n");
 		if(gamelen.num > 0){
 			logerr("Game length: " + gamelen.to_s() + "\n");
 			logerr("Tree depth:  " + treelen.to_s() + "\n");
+			if(transpositions.enabled())
+				logerr("DAG:         " + to_str(transposed.exact()) + " runs continued through a transposition\n");
 			if(profile)
 				logerr("Times:       " + to_str(times[0], 3) + ", " + to_str(times[1], 3) + ", " + to_str(times[2], 3) + ", " + to_str(times[3], 3) + "\n");
 
@@ -124,8 +137,13 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 			}
 		}
 
-		if(root.outcome != Outcome::UNKNOWN)
-			logerr("Solved as a " + root.outcome.to_s_rel(to_play) + "\n");
+		logerr("Memory:      " + mem_stats() + "\n");
+
+		if(gcpauses > gcpausesbefore)
+			logerr("GC:          " + gc_stats() + "\n");
+
+		if(root.outcome() != Outcome::UNKNOWN)
+			logerr("Solved as a " + root.outcome().to_s_rel(to_play) + "\n");
 
 		std::string pvstr;
 		for(const auto& m : Agent::get_pv())
@@ -137,25 +155,74 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 	}
 
 	pool.reset();
+	lastruns = runs.exact();
 	runs = 0;
 
 
-	if(ponder && root.outcome < Outcome::DRAW)
+	if(ponder && root.outcome() < Outcome::DRAW)
+		pool.resume();
+}
+
+//the experience gained at the top of the tree since the last exchange, see DistSync
+std::string AgentMCTS::dist_collect(){
+	pool.pause();
+
+	std::string stats = dist.collect(root, distdepth, distvisits);
+
+	if(ponder && root.outcome() < Outcome::DRAW)
+		pool.resume();
+	return stats;
+}
+
+//add the experience collected by the other processes of a distributed search
+void AgentMCTS::dist_apply(const vecstr & stats){
+	pool.pause();
+
+	dist.apply(root, stats);
+
+	if(ponder && root.outcome() < Outcome::DRAW)
 		pool.resume();
 }
 
 AgentMCTS::AgentMCTS(const Board & b) : Agent(b), pool(this) {
 	nodes = 0;
 	runs = 0;
+	lastruns = 0;
 	gclimit = 5;
 
+	gcphase = GC_Idle;
+	gcworker = 0;
+	gcdetached = NULL;
+	gcnumdetached = gcnumfreed = 0;
+	gcnodesbefore = 0;
+	gclastalloced = 0;
+	gclastlen = 0;
+	gcpauses = 0;
+	gcpausetime = gcmaxpause = 0;
+
 	profile     = false;
 	ponder      = false;
 //#ifdef SINGLE_THREAD ... make sure only 1 thread
 	numthreads  = 1;
+	treegroup   = 0;
+	pipeline    = 0;
+	threadsmade = 0;
+	leavesmade  = 0;
+	leavesout   = 0;
+	leaffree.resize(4096);
+	leaftodo.resize(4096);
+	leafdone.resize(4096);
 	pool.set_num_threads(numthreads);
 	maxmem      = 1000*1024*1024;
 
+	distdepth   = 2;
+	distvisits  = 100;
+	distsync    = 0.5;
+
+	treesync    = 0.1;
+	treedepth   = 2;
+	treevisits  = 100;
+
 	msrave      = -2;
 	msexplore   = 0;
 
@@ -172,11 +239,13 @@ AgentMCTS::AgentMCTS(const Board & b) : Agent(b), pool(this) {
 	logdynwiden = (dynwiden ? std::log(dynwiden) : 0);
 
 	shortrave   = false;
+	ravebatch   = 0;
 	keeptree    = true;
 	minimax     = 2;
 	detectdraw  = false;
 	visitexpand = 1;
 	gcsolved    = 100000;
+	gcincremental = false;
 	longestloss = false;
 
 	localreply  = 0;
@@ -192,6 +261,7 @@ AgentMCTS::AgentMCTS(const Board & b) : Agent(b), pool(this) {
 	rolloutpattern = false;
 	lastgoodreply  = false;
 	instantwin     = 0;
+	bitwins        = false;
 
 	for(int i = 0; i < 4096; i++)
 		gammas[i] = 1;
@@ -199,9 +269,16 @@ AgentMCTS::AgentMCTS(const Board & b) : Agent(b), pool(this) {
 AgentMCTS::~AgentMCTS(){
 	pool.pause();
 	pool.set_num_threads(0);
+	free_leaves();
 
+	gc_finish();
 	root.dealloc(ctmem);
 	ctmem.compact();
+
+	for(Tree * t : sidetrees){
+		t->root.dealloc(t->ctmem);
+		delete t;
+	}
 }
 
 void AgentMCTS::set_ponder(bool p){
@@ -214,55 +291,173 @@ void AgentMCTS::set_ponder(bool p){
 	}
 }
 
+//groups of treegroup threads each grow their own tree, the first group grows root and the rest get a side tree
+void AgentMCTS::set_threads(int threads, int group, int workers){
+	pool.pause();
+	gc_finish();
+	pool.set_num_threads(0); //the threads' arenas allocate from the trees
+	free_leaves();
+
+	for(Tree * t : sidetrees){
+		t->root.dealloc(t->ctmem);
+		delete t;
+	}
+	sidetrees.clear();
+	share.clear(); //the new side trees haven't received anything
+
+	numthreads = threads;
+	treegroup = group;
+	pipeline = workers;
+
+	int groups = (treegroup > 0 ? (numthreads + treegroup - 1) / treegroup : 1);
+	for(int i = 1; i < groups; i++){
+		Tree * t = new Tree();
+		t->ctmem.set_chunksize(ctmem.chunksize());
+		t->ctmem.set_chunkalloc(ctmem.chunkalloc());
+		t->nodes = 0;
+		t->root = Node(root.move());
+		reset_root(t->root);
+		sidetrees.push_back(t);
+	}
+
+	threadsmade = 0;
+	pool.set_num_threads(numthreads + pipeline); //the search threads, then the rollout workers
+
+	if(ponder)
+		pool.resume();
+}
+
+//called as each thread is created, in order
+AgentMCTS::Tree * AgentMCTS::thread_tree(){
+	int group = (treegroup > 0 && threadsmade < numthreads ? threadsmade / treegroup : 0);
+	threadsmade++;
+	return (group > 0 ? sidetrees[group - 1] : NULL);
+}
+
+//give each tree the experience the others gained at the top of their trees since the last merge, see TreeSync
+//assumes the threads are paused
+void AgentMCTS::merge_trees(){
+	lastmerge = Time();
+	if(sidetrees.empty())
+		return;
+
+	std::vector<std::pair<TreeSync<Node> *, Node *>> trees(1, std::make_pair(&share, &root));
+	for(Tree * t : sidetrees)
+		trees.push_back(std::make_pair(&t->share, &t->root));
+
+	TreeSync<Node>::merge(trees, treedepth, treevisits);
+}
+
+//a leaf for one rollout in the pipeline, or NULL if they're all in use
+AgentMCTS::Leaf * AgentMCTS::get_leaf(){
+	Leaf * leaf;
+	if(!leaffree.pop(leaf)){
+		int made = leavesmade;
+		if(made >= leaf_limit() || !CAS(leavesmade, made, made + 1))
+			return NULL;
+		leaf = new Leaf(rootboard);
+		leaf->path.reserve(2*Board::max_vec_size + 1); //a move and maybe a transposition per ply, and the root
+	}
+	INCR(leavesout);
+	return leaf;
+}
+
+void AgentMCTS::put_leaf(Leaf * leaf){
+	leaffree.push(leaf); //always fits, leaf_limit() keeps the leaves within its capacity
+	PLUS(leavesout, -1);
+}
+
+//all the leaves are free while the threads are stopped
+void AgentMCTS::free_leaves(){
+	assert(leavesout == 0);
+	Leaf * leaf;
+	while(leaffree.pop(leaf))
+		delete leaf;
+	leavesmade = 0;
+}
+
 void AgentMCTS::set_board(const Board & board, bool clear){
 	pool.pause();
+	gc_finish();
 
 	nodes -= root.dealloc(ctmem);
 	root = Node();
 	root.exp.addwins(visitexpand+1);
 
+	for(Tree * t : sidetrees){
+		t->nodes -= t->root.dealloc(t->ctmem);
+		t->root = Node();
+		t->root.exp.addwins(visitexpand+1);
+	}
+
 	rootboard = board;
+	rootboard.track_wins(instantwin);
+	rootboard.bitboard_wins(bitwins);
+	dist.clear();
+	share.clear();
+	for(Tree * t : sidetrees)
+		t->share.clear();
 
 	if(ponder)
 		pool.resume();
 }
 void AgentMCTS::move(const Move & m){
 	pool.pause();
+	gc_finish();
+
+	uword nodesbefore = nodes.exact();
+	bool kept = (keeptree && root.children.num() > 0);
+
+	move_root(root, ctmem, nodes, m);
+	assert(nodes.exact() == root.size());
+
+	if(kept && nodesbefore > 0)
+		logerr("Nodes before: " + to_str(nodesbefore) + ", after: " + to_str(nodes.exact()) + ", saved " +  to_str(100.0*nodes.exact()/nodesbefore, 1) + "% of the tree\n");
+
+	for(Tree * t : sidetrees)
+		move_root(t->root, t->ctmem, t->nodes, m);
+
+	rootboard.move(m);
+	dist.move(m);
+	share.move(m);
+	for(Tree * t : sidetrees)
+		t->share.move(m);
+
+	reset_root(root);
+	for(Tree * t : sidetrees)
+		reset_root(t->root);
 
-	uword nodesbefore = nodes;
+	if(ponder)
+		pool.resume();
+}
 
-	if(keeptree && root.children.num() > 0){
+//replace node with its child for move m, keeping the child's subtree if keeptree
+void AgentMCTS::move_root(Node & node, CompactTree<Node> & ct, ShardedCounter & count, const Move & m){
+	if(keeptree && node.children.num() > 0){
 		Node child;
 
-		for(Node * i = root.children.begin(); i != root.children.end(); i++){
-			if(i->move == m){
+		for(Node * i = node.children.begin(); i != node.children.end(); i++){
+			if(i->move() == m){
 				child = *i;          //copy the child experience to temp
 				child.swap_tree(*i); //move the child tree to temp
 				break;
 			}
 		}
 
-		nodes -= root.dealloc(ctmem);
-		root = child;
-		root.swap_tree(child);
-
-		if(nodesbefore > 0)
-			logerr("Nodes before: " + to_str(nodesbefore) + ", after: " + to_str(nodes) + ", saved " +  to_str(100.0*nodes/nodesbefore, 1) + "% of the tree\n");
+		count -= node.dealloc(ct);
+		node = child;
+		node.swap_tree(child);
 	}else{
-		nodes -= root.dealloc(ctmem);
-		root = Node();
-		root.move = m;
+		count -= node.dealloc(ct);
+		node = Node(m);
 	}
-	assert(nodes == root.size());
-
-	rootboard.move(m);
+}
 
-	root.exp.addwins(visitexpand+1); //+1 to compensate for the virtual loss
+//get a new root ready to search from rootboard
+void AgentMCTS::reset_root(Node & node){
+	node.exp.addwins(visitexpand+1); //+1 to compensate for the virtual loss
 	if(rootboard.outcome() < Outcome::DRAW)
-		root.outcome = Outcome::UNKNOWN;
-
-	if(ponder)
-		pool.resume();
+		node.set_outcome(Outcome::UNKNOWN);
 }
 
 double AgentMCTS::gamelen() const {
@@ -279,7 +474,7 @@ std::vector<Move> AgentMCTS::get_pv(const vecmove& moves) const {
 	Side turn = rootboard.to_play();
 	unsigned int i = 0;
 	while(n && !n->children.empty()){
-		Move m = (i < moves.size() ? moves[i++] : return_move(n, turn));
+		Move m = (i < moves.size() ? moves[i++] : (n == &root ? return_move(0) : return_move(n, turn)));
 		pv.push_back(m);
 		n = find_child(n, m);
 		turn = ~turn;
@@ -316,32 +511,69 @@ std::string AgentMCTS::move_stats(const vecmove& moves) const {
 	return s;
 }
 
+Move AgentMCTS::return_move(int verbose) const {
+	Side to_play = rootboard.to_play();
+	if(sidetrees.empty())
+		return return_move(& root, to_play, verbose);
+
+	if(root.outcome() >= Outcome::DRAW)
+		return root.bestmove();
+	for(const Tree * t : sidetrees)
+		if(t->root.outcome() >= Outcome::DRAW)
+			return t->root.bestmove();
+
+	//the trees were merged at the end of the search, so root already has the experience of all of them
+	//but each tree keeps its own proofs
+	std::vector<Node> merged(root.children.begin(), root.children.end());
+	for(const Tree * t : sidetrees){
+		unsigned int i = 0;
+		for(const auto & child : t->root.children){
+			if(i >= merged.size() || merged[i].move() != child.move()) //usually in the same order
+				for(i = 0; i < merged.size() && merged[i].move() != child.move(); i++) ;
+			if(i == merged.size())
+				merged.push_back(child);
+			else if(child.outcome() >= Outcome::DRAW)
+				merged[i].set_proof(child.outcome(), child.bestmove(), child.proofdepth());
+			i++;
+		}
+	}
+
+	assert(!merged.empty());
+
+	return return_move(merged.data(), merged.data() + merged.size(), root.exp.num(), to_play, verbose);
+}
+
 Move AgentMCTS::return_move(const Node * node, Side to_play, int verbose) const {
-	if(node->outcome >= Outcome::DRAW)
-		return node->bestmove;
+	if(node->outcome() >= Outcome::DRAW)
+		return node->bestmove();
 
 	assert(!node->children.empty());
 
+	return return_move(node->children.begin(), node->children.end(), node->exp.num(), to_play, verbose);
+}
+
+//the best of the children in [begin, end), where the parent has visits experience
+Move AgentMCTS::return_move(const Node * begin, const Node * end, uword visits, Side to_play, int verbose) const {
 	double val, maxval = -1000000000000.0; //1 trillion
 
 	const Node * ret = NULL;
-	for(const auto& child : node->children) {
-		if(child.outcome >= Outcome::DRAW){
-			if(child.outcome == to_play)             val =  800000000000.0 - child.exp.num(); //shortest win
-			else if(child.outcome == Outcome::DRAW) val = -400000000000.0 + child.exp.num(); //longest tie
-			else                                    val = -800000000000.0 + child.exp.num(); //longest loss
+	for(const Node * child = begin; child != end; child++) {
+		if(child->outcome() >= Outcome::DRAW){
+			if(child->outcome() == to_play)             val =  800000000000.0 - child->exp.num(); //shortest win
+			else if(child->outcome() == Outcome::DRAW) val = -400000000000.0 + child->exp.num(); //longest tie
+			else                                       val = -800000000000.0 + child->exp.num(); //longest loss
 		}else{ //not proven
 			if(msrave == -1) //num simulations
-				val = child.exp.num();
+				val = child->exp.num();
 			else if(msrave == -2) //num wins
-				val = child.exp.sum();
+				val = child->exp.sum();
 			else
-				val = child.value(msrave, 0, 0) - msexplore*sqrt(log(node->exp.num())/(child.exp.num() + 1));
+				val = child->value(msrave, 0, 0) - msexplore*sqrt(log(visits)/(child->exp.num() + 1));
 		}
 
 		if(maxval < val){
 			maxval = val;
-			ret = &child;
+			ret = child;
 		}
 	}
 
@@ -350,41 +582,232 @@ Move AgentMCTS::return_move(const Node * node, Side to_play, int verbose) const
 	if(verbose)
 		logerr("Score:       " + to_str(ret->exp.avg()*100., 2) + "% / " + to_str(ret->exp.num()) + "\n");
 
-	return ret->move;
+	return ret->move();
+}
+
+void AgentMCTS::start_gc() {
+	if(merge_due()){
+		merge_trees();
+		if(!gc_due())
+			return;
+	}
+
+	Time starttime;
+
+	//the side trees are always collected all at once, when they run out of their share of the memory
+	//they grow about as fast as the main tree, so they share its limit and leave adjusting it to its gc
+	for(Tree * t : sidetrees){
+		if(t->ctmem.memalloced() >= tree_maxmem()){
+			logerr("Starting side tree GC with limit " + to_str(gclimit) + " ... ");
+			uint64_t nodesbefore = t->nodes.exact();
+			garbage_collect(t->root, rootboard.to_play(), t->ctmem, t->nodes);
+			t->ctmem.compact(1.0, 0.75);
+			logerr(to_str(100.0*t->nodes.exact()/nodesbefore, 1) + " % of tree remains\n");
+		}
+	}
+
+	if(ctmem.memalloced() >= tree_maxmem()){
+		//out of memory, or not incremental, so do it all at once
+		gc_finish();
+
+		logerr("Starting player GC with limit " + to_str(gclimit) + " ... ");
+		uint64_t nodesbefore = nodes.exact();
+		garbage_collect(root, rootboard.to_play(), ctmem, nodes);
+		Time gctime;
+		ctmem.compact(1.0, 0.75);
+		Time compacttime;
+		logerr(to_str(100.0*nodes.exact()/nodesbefore, 1) + " % of tree remains - " +
+			to_str((gctime - starttime)*1000, 0)  + " msec gc, " + to_str((compacttime - gctime)*1000, 0) + " msec compact\n");
+
+		gc_adjust_limit();
+	}else if(gcphase == GC_Marked){
+		//detach the marked subtrees so no thread can walk into them, then they can be freed while searching
+		transpositions.clear();
+		gcnodesbefore = nodes.exact();
+		gcnumdetached = gcmarked.size();
+		gcnumfreed = 0;
+		gcdetached = new Node[gcnumdetached];
+		for(uint i = 0; i < gcnumdetached; i++)
+			gcdetached[i].swap_tree(*gcmarked[i]);
+		gcmarked.clear();
+
+		//stop allocating from the chunks that will be compacted, same as the generation in a full gc
+		ctmem.evacuate_start(0.75);
+		gcphase = GC_Free;
+	}else if(gcphase == GC_Evacuate){
+		transpositions.clear(); //the step moves nodes
+		if(!ctmem.evacuate_step()){
+			logerr("Incremental GC with limit " + to_str(gclimit) + ": " + to_str(100.0*nodes.exact()/gcnodesbefore, 1) + " % of tree remains\n");
+			gc_adjust_limit_incremental((double)nodes.exact()/gcnodesbefore);
+			gclastalloced = ctmem.memalloced();
+			gcphase = GC_Idle;
+		}
+	}
+
+	Time endtime;
+	gclastpause = endtime;
+	gclastlen = endtime - starttime;
+	gcpauses++;
+	gcpausetime += gclastlen;
+	gcmaxpause = std::max(gcmaxpause, gclastlen);
 }
 
-void AgentMCTS::garbage_collect(Node& node, Side to_play){
+bool AgentMCTS::gc_concurrent() {
+	if(gcphase == GC_Idle){
+		//a cycle that couldn't get below the start has to wait for the tree to grow, or it would just repeat
+		uint64_t alloced = ctmem.memalloced();
+		if(alloced < gc_start*tree_maxmem() || alloced <= gclastalloced)
+			return false;
+	}else if(gcphase != GC_Free){
+		return false;
+	}
+
+	if(!CAS(gcworker, 0, 1)) //another thread is already on it
+		return false;
+
+	if(gcphase == GC_Idle){
+		//nodes only move or get freed during a pause, so the marks stay valid until the next one
+		gcphase = GC_Mark;
+		if(root.children.num() > 0 && gc_mark(root, rootboard.to_play())){
+			gcphase = GC_Marked;
+		}else{ //the search stopped, try again later
+			gcmarked.clear();
+			gcphase = GC_Idle;
+		}
+	}else if(gcphase == GC_Free){
+		//nothing can reach the detached subtrees, so they can be freed while the others search
+		uword freed = 0;
+		while(gcnumfreed < gcnumdetached && freed < gc_slice)
+			freed += gcdetached[gcnumfreed++].dealloc(ctmem);
+		nodes -= freed;
+
+		if(gcnumfreed == gcnumdetached){
+			delete[] gcdetached;
+			gcdetached = NULL;
+			gcnumdetached = gcnumfreed = 0;
+			gcphase = GC_Evacuate;
+		}
+	}
+
+	gcworker = 0;
+	return true;
+}
+
+//finish or abandon the incremental gc, assumes the threads are paused
+//it's called before anything that frees or moves nodes, so it drops the transpositions too
+void AgentMCTS::gc_finish() {
+	transpositions.clear();
+	gcmarked.clear();
+	while(gcnumfreed < gcnumdetached)
+		nodes -= gcdetached[gcnumfreed++].dealloc(ctmem);
+	delete[] gcdetached;
+	gcdetached = NULL;
+	gcnumdetached = gcnumfreed = 0;
+	while(ctmem.evacuate_step()) ;
+	gcphase = GC_Idle;
+	gclastalloced = 0;
+}
+
+void AgentMCTS::gc_adjust_limit() {
+	if(ctmem.meminuse() >= tree_maxmem()/2)
+		gclimit = (int)(gclimit*1.3);
+	else if(gclimit > rollouts*5)
+		gclimit = (int)(gclimit*0.9); //slowly decay to a minimum of 5
+}
+
+//the incremental gc starts on memalloced(), so it has to adjust on it too, and raise the limit
+//much more if it freed almost nothing, or the next cycle would start right away and repeat it
+void AgentMCTS::gc_adjust_limit_incremental(double remains) {
+	if(remains > 0.95)
+		gclimit = (int)(gclimit*2);
+	else if(ctmem.memalloced() >= gc_start*tree_maxmem())
+		gclimit = (int)(gclimit*1.3);
+	else if(gclimit > rollouts*5)
+		gclimit = (int)(gclimit*0.9);
+}
+
+std::string AgentMCTS::gc_stats() const {
+	return to_str(gcpauses) + " pauses, " +
+		to_str(gcpausetime*1000, 0) + " msec total, " +
+		to_str(gcmaxpause*1000, 1) + " msec worst, " +
+		to_str(gclastlen*1000, 1) + " msec last";
+}
+
+std::string AgentMCTS::mem_stats() const {
+	uint64_t mem = ctmem.meminuse();
+	uint64_t num = nodes.exact();
+	std::string s = to_str(num) + " nodes, " +
+		to_str(mem/(1024.0*1024.0), 1) + " Mb, " +
+		to_str(num ? (double)mem/num : 0.0, 1) + " bytes/node, " +
+		to_str(sizeof(Node)) + " bytes/Node";
+
+	if(!sidetrees.empty()){
+		uint64_t sidemem = 0, sidenum = 0;
+		for(const Tree * t : sidetrees){
+			sidemem += t->ctmem.meminuse();
+			sidenum += t->nodes.exact();
+		}
+		s += ", plus " + to_str(sidetrees.size()) + " side trees with " + to_str(sidenum) + " nodes, " + to_str(sidemem/(1024.0*1024.0), 1) + " Mb";
+	}
+	return s;
+}
+
+bool AgentMCTS::gc_keep(const Node & node, const Node & child, Side to_play) const {
+	return ((node.outcome().solved() &&       // parent is solved
+	         child.exp.num() > gcsolved &&    // keep the heavy nodes
+	         (node.outcome() != to_play ||    // loss or draw, keep the everything
+	          child.outcome() == to_play)) || // found the win, keep the proof tree
+	        (!node.outcome().solved() &&      // parent isn't solved,
+	         child.exp.num() > (child.outcome().solved() ?
+	          gcsolved :                      // only keep the heavy proof tree
+	          gclimit)));                     // but the light area still being worked on
+}
+
+void AgentMCTS::garbage_collect(Node& node, Side to_play, CompactTree<Node> & ct, ShardedCounter & count){
 	for (auto& child : node.children) {
 		if (child.children.num() == 0)
 			continue;
 
-		if ((node.outcome.solved() &&       // parent is solved
-		     child.exp.num() > gcsolved &&  // keep the heavy nodes
-		     (node.outcome != to_play ||    // loss or draw, keep the everything
-		      child.outcome == to_play)) || // found the win, keep the proof tree
-		    (!node.outcome.solved() &&      // parent isn't solved,
-		     child.exp.num() > (child.outcome.solved() ?
-		      gcsolved :                    // only keep the heavy proof tree
-		      gclimit)) ){                  // but the light area still being worked on
-			garbage_collect(child, ~to_play);
+		if (gc_keep(node, child, to_play)) {
+			garbage_collect(child, ~to_play, ct, count);
 		} else {
-			nodes -= child.dealloc(ctmem);
+			count -= child.dealloc(ct);
 		}
 	}
 }
 
+//same as garbage_collect, but only finds the subtrees to collect, so it can run while the other threads search
+//returns false if the search stopped before it finished
+bool AgentMCTS::gc_mark(Node& node, Side to_play){
+	for (auto& child : node.children) {
+		if (!pool.running())
+			return false;
+
+		if (child.children.num() == 0)
+			continue;
+
+		if (gc_keep(node, child, to_play)) {
+			if (!gc_mark(child, ~to_play))
+				return false;
+		} else {
+			gcmarked.push_back(&child);
+		}
+	}
+	return true;
+}
+
 AgentMCTS::Node * AgentMCTS::find_child(const Node * node, const Move & move) const {
 	for(auto & c : node->children)
-		if(c.move == move)
+		if(c.move() == move)
 			return &c;
 	return NULL;
 }
 
 void AgentMCTS::gen_sgf(SGFPrinter<Move> & sgf, unsigned int limit, const Node & node, Side side) const {
 	for(auto & child : node.children){
-		if(child.exp.num() >= limit && (side != node.outcome || child.outcome == node.outcome)){
+		if(child.exp.num() >= limit && (side != node.outcome() || child.outcome() == node.outcome())){
 			sgf.child_start();
-			sgf.move(side, child.move);
+			sgf.move(side, child.move());
 			sgf.comment(child.to_s());
 			gen_sgf(sgf, limit, child, ~side);
 			sgf.child_end();
@@ -402,7 +825,7 @@ void AgentMCTS::create_children_simple(const Board & board, Node * node){
 		*child++ = Node(move);
 	}
 	assert(child == node->children.end());
-	PLUS(nodes, node->children.num());
+	nodes += node->children.num();
 }
 
 void AgentMCTS::load_sgf(SGFParser<Move> & sgf, const Board & board, Node & node) {
@@ -425,5 +848,51 @@ void AgentMCTS::load_sgf(SGFParser<Move> & sgf, const Board & board, Node & node
 	}
 }
 
+bool AgentMCTS::save_tree(const std::string & filename, const vecmove & moves, std::string & error) {
+	pool.pause();
+	gc_finish();
+
+	bool ok = TreeFile::save(filename, Board::name, "mcts", rootboard.size(), moves, root, error);
+
+	if(ponder)
+		pool.resume();
+	return ok;
+}
+
+bool AgentMCTS::can_load(const TreeFile & file, std::string & error) const {
+	if(!file.matches<Node>("mcts")){
+		error = "File is from a different agent or build: " + file.agent();
+		return false;
+	}
+	return true;
+}
+
+bool AgentMCTS::load_tree(const TreeFile & file, std::string & error) {
+	if(!can_load(file, error))
+		return false;
+
+	pool.pause();
+	gc_finish();
+
+	nodes -= root.dealloc(ctmem);
+	nodes = file.load(root, ctmem);
+	assert(nodes.exact() == root.size());
+
+	//the side trees and the sync records were for the old tree
+	for(Tree * t : sidetrees){
+		t->nodes -= t->root.dealloc(t->ctmem);
+		t->root = Node();
+		t->root.exp.addwins(visitexpand+1);
+	}
+	dist.clear();
+	share.clear();
+	for(Tree * t : sidetrees)
+		t->share.clear();
+
+	if(ponder)
+		pool.resume();
+	return true;
+}
+
 }; // namespace Havannah
 }; // namespace Morat
@@ -47,6 +47,7 @@ void AgentPNS::search(double time, uint64_t maxiters, int verbose){
 
 	Time starttime;
 
+	rootboard.bitboard_wins(bitwins); //the threads search copies of it
 	pool.reset();
 	pool.resume();
 
@@ -61,8 +62,8 @@ void AgentPNS::search(double time, uint64_t maxiters, int verbose){
 		for(auto & t : pool)
 			treelen += t->treelen;
 
-		logerr("Finished:    " + to_str(nodes_seen) + " nodes created in " + to_str(time_used*1000, 0) + " msec: " + to_str(nodes_seen/time_used, 0) + " Nodes/s\n");
-		if(nodes_seen > 0){
+		logerr("Finished:    " + to_str(nodes_seen.exact()) + " nodes created in " + to_str(time_used*1000, 0) + " msec: " + to_str(nodes_seen.exact()/time_used, 0) + " Nodes/s\n");
+		if(nodes_seen.exact() > 0){
 			logerr("Tree depth:  " + treelen.to_s() + "\n");
 		}
 
@@ -84,10 +85,11 @@ void AgentPNS::search(double time, uint64_t maxiters, int verbose){
 }
 
 void AgentPNS::AgentThread::iterate(){
-	pns(agent->rootboard, &agent->root, 0, INF32/2, INF32/2);
+	Board board = agent->rootboard; //pns makes and undoes its moves on this board
+	pns(board, &agent->root, 0, INF32/2, INF32/2);
 }
 
-bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uint32_t tp, uint32_t td){
+bool AgentPNS::AgentThread::pns(Board & board, Node * node, int depth, uint32_t tp, uint32_t td){
 	// no children, create them
 	if(node->children.empty()){
 		treelen.add(depth);
@@ -102,7 +104,7 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 			return false;
 
 		CompactTree<Node>::Children temp;
-		temp.alloc(board.moves_avail(), agent->ctmem);
+		temp.alloc_temp(board.moves_avail(), arena);
 
 		if(agent->lbdist)
 			dists.run(&board);
@@ -113,11 +115,12 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 			Outcome outcome;
 
 			if(agent->ab){
-				Board next = board;
-				next.move(move);
+				Board::Undo undo;
+				board.move(move, undo);
 
 				pd = 0;
-				outcome = (agent->ab == 1 ? solve1ply(next, pd) : solve2ply(next, pd));
+				outcome = (agent->ab == 1 ? solve1ply(board, pd) : solve2ply(board, pd));
+				board.undo(undo);
 			}else{
 				pd = 1;
 				outcome = board.test_outcome(move);
@@ -130,15 +133,15 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 			i++;
 		}
 		nodes_seen += i;
-		PLUS(agent->nodes_seen, i);
-		PLUS(agent->nodes, i);
+		agent->nodes_seen += i;
+		agent->nodes += i;
 		temp.shrink(i); //if symmetry, there may be extra moves to ignore
 		node->children.swap(temp);
 		assert(temp.unlock());
 
 		updatePDnum(node);
 
-		return (agent->nodes_seen >= agent->max_nodes_seen);
+		return agent->nodes_seen.reached(agent->max_nodes_seen);
 	}
 
 	bool mem;
@@ -167,13 +170,14 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 					child = & i;
 		}
 
-		Board next = board;
-		next.move(child->move);
+		Board::Undo undo;
+		board.move(child->move, undo);
 
 		child->ref();
 		uint64_t seen_before = nodes_seen;
-		mem = pns(next, child, depth + 1, tpc, tdc);
+		mem = pns(board, child, depth + 1, tpc, tdc);
 		child->deref();
+		board.undo(undo);
 		PLUS(child->work, nodes_seen - seen_before);
 
 		if(updatePDnum(node) && !agent->df)
@@ -327,7 +331,7 @@ void AgentPNS::create_children_simple(const Board & board, Node * node){
 		node->children[i] = Node(move).outcome(outcome, board.to_play(), ties, 1);
 		i++;
 	}
-	PLUS(nodes, i);
+	nodes += i;
 	node->children.shrink(i); //if symmetry, there may be extra moves to ignore
 }
 
@@ -1,4 +1,6 @@
 
+#include "../lib/thread.h"
+
 #include "board.h"
 
 namespace Morat {
@@ -86,9 +88,14 @@ std::string Board::to_s(bool color, std::function<std::string(Move)> func) const
 	return s;
 }
 
-std::shared_ptr<MoveValid> Board::gen_neighbor_list() const {
-	std::shared_ptr<MoveValid> list(new MoveValid[vec_size()*18]);
-	MoveValid * a = list.get();
+const MoveValid * Board::gen_neighbor_list() const {
+	//one list per size, built the first time it's needed and kept for the life of the program
+	static MoveValid * lists[max_size + 1] = {};
+	if(lists[size_r_])
+		return lists[size_r_];
+
+	MoveValid * list = new MoveValid[vec_size()*18];
+	MoveValid * a = list;
 	for(int y = 0; y < size_; y++){
 		for(int x = 0; x < size_; x++){
 			Move pos(x,y);
@@ -101,7 +108,35 @@ std::shared_ptr<MoveValid> Board::gen_neighbor_list() const {
 		}
 	}
 
-	return list;
+	if(!CAS(lists[size_r_], (MoveValid *)NULL, list)) //another thread built it first
+		delete[] list;
+	return lists[size_r_];
+}
+
+const Board::BitMasks * Board::gen_bit_masks() const {
+	static BitMasks * masks[max_size + 1] = {};
+	if(masks[size_r_])
+		return masks[size_r_];
+
+	BitMasks * m = new BitMasks();
+	for(int y = 0; y < size_; y++){
+		for(int x = 0; x < size_; x++){
+			if(!on_board(x, y))
+				continue;
+			int b = Bits::index(x, y), corner = iscorner(x, y), edge = isedge(x, y);
+			m->onboard.set(b);
+			if(corner >= 0)
+				m->corners.set(b);
+			if(edge >= 0)
+				m->edges[edge].set(b);
+			if(corner >= 0 || edge >= 0)
+				m->border.set(b);
+		}
+	}
+
+	if(!CAS(masks[size_r_], (BitMasks *)NULL, m)) //another thread built it first
+		delete m;
+	return masks[size_r_];
 }
 
 int Board::iscorner(int x, int y) const {
@@ -162,6 +197,84 @@ bool Board::checkring_df(const MoveValid & pos, const Side turn) const {
 	start->mark = 0;
 	return success;
 }
+// Find a ring from the neighbors of the stone just placed at pos, in constant time, using how many
+// separate groups of turn's it joined. Counting each group's Euler characteristic, stones - links
+// + triangles of stones, its holes are 1 - that. The new stone adds 1 stone, a link per neighbor
+// of turn's, and a triangle per pair of those next to each other, so around each run of turn's
+// neighbors the links outnumber the triangles by one. Merging the groups then leaves
+// runs - groups new holes: each extra run of a group it was already touching closes a loop around
+// a cell that isn't turn's. A ring around only turn's stones has no hole, but then one of the
+// enclosed stones is next to pos, and surrounded by turn's stones now.
+bool Board::checkring_local(const MoveValid & pos, const Side turn, int groups) const {
+	const MoveValid * nb = neighbors(pos);
+	int mine = 0; //bit i is set if neighbor i is turn's
+	for(int i = 0; i < 6; i++)
+		if(nb[i].on_board() && get(nb[i]) == turn)
+			mine |= 1 << i;
+
+	int starts = mine & ~(((mine << 1) | (mine >> 5)) & 63); //the neighbors that start a run
+	if(BitsSetTable256[starts] > groups)
+		return true;
+
+	Pattern surrounded = (turn == Side::P1 ? 0x555 : 0xAAA); //off the board is 3, so never matches
+	for(int i = 0; i < 6; i++)
+		if((mine & (1 << i)) && pattern_small(nb[i]) == surrounded)
+			return true;
+	return false;
+}
+
+int Board::win_bits(const MoveValid & pos, const Bits & own, bool rings) const {
+	const BitMasks & m = *bit_masks_;
+	Bits group = Bits::cell(bit(pos)).flood(own);
+
+	int edges = 0;
+	for(int e = 0; e < 6; e++)
+		edges += (group & m.edges[e]).any();
+	if(edges >= 3)
+		return 0;
+	if((group & m.corners).count() >= 2)
+		return 1;
+	if(rings && ring_bits(pos, own))
+		return 2;
+	return -1;
+}
+
+// A ring encloses cells, of any color, that can't reach the border without crossing it. There was
+// no ring before the stone at pos, so they could reach it through pos, and some of them are next
+// to pos. A neighbor of turn's is only enclosed if all its neighbors are turn's too. The others
+// are all connected around pos unless its neighbors of turn's come in separate runs, and then
+// each region of cells that aren't turn's is flooded from a neighbor until it touches the border.
+// The regions that do are kept in seen, so the other neighbors in them are skipped.
+bool Board::ring_bits(const MoveValid & pos, const Bits & own) const {
+	const BitMasks & m = *bit_masks_;
+	const MoveValid * nb = neighbors(pos);
+	Bits open = m.onboard.andnot(own);
+
+	int mine = 0; //bit i is set if neighbor i is turn's
+	for(int i = 0; i < 6; i++){
+		if(!nb[i].on_board() || !own.get(bit(nb[i])))
+			continue;
+		mine |= 1 << i;
+		int b = bit(nb[i]);
+		if(!m.border.get(b) && (Bits::cell(b).grow() & open).none())
+			return true;
+	}
+
+	int starts = mine & ~(((mine << 1) | (mine >> 5)) & 63); //the neighbors that start a run
+	if(BitsSetTable256[starts] < 2)
+		return false;
+
+	Bits seen, region;
+	for(int i = 0; i < 6; i++){
+		if(!nb[i].on_board() || (mine & (1 << i)) || seen.get(bit(nb[i])))
+			continue;
+		if(!Bits::cell(bit(nb[i])).floods_to(open, m.border, region))
+			return true;
+		seen |= region;
+	}
+	return false;
+}
+
 // only take the 3 directions that are valid in a ring
 // the backwards directions are either invalid or not part of the shortest loop
 bool Board::followring(const MoveValid & cur, const int & dir, const Side & turn, const int & permsneeded) const {
@@ -4,23 +4,25 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <vector>
 
+#include "../lib/bitboard.h"
 #include "../lib/bitcount.h"
 #include "../lib/board_grid_hex.h"
 #include "../lib/board_shape_hex.h"
 #include "../lib/hashset.h"
 #include "../lib/move.h"
 #include "../lib/outcome.h"
+#include "../lib/rawarray.h"
 #include "../lib/string.h"
 #include "../lib/types.h"
 #include "../lib/zobrist.h"
 
-
 namespace Morat {
 namespace Havannah {
 
@@ -41,19 +43,25 @@ public:
 
 	static const int pattern_cells = 18;
 
+	//a set of cells, with the spare column the shifts need past the widest row
+	typedef BitBoard<2*max_size - 1, 2*max_size - 1, 1> Bits;
+
 	struct Cell {
 		Side    piece;   //who controls this cell, 0 for none, 1,2 for players
 		uint8_t size;    //size of this group of cells
-mutable uint16_t parent; //parent for this group of cells
+		uint16_t parent; //parent for this group of cells
 		uint8_t corner;  //which corners are this group connected to
 		uint8_t edge;    //which edges are this group connected to
 mutable uint8_t mark;    //when doing a ring search, has this position been seen?
 		uint8_t perm;    //is this a permanent piece or a randomly placed piece?
 		Pattern pattern; //the pattern of pieces for neighbors, but from their perspective. Rotate 180 for my perpective
+		uint16_t next;   //the next stone in this group, in a circular list through the whole group
+		uint8_t wins;    //whether side would win by playing here: bit side-1 without rings, bit side+1 with them
+		uint16_t winlist[2][2]; //entry i of each side's lists of winning cells, columns sized like the board
 
-		Cell() : piece(Side::NONE), size(0), parent(0), corner(0), edge(0), mark(0), perm(0), pattern(0) { }
+		Cell() : piece(Side::NONE), size(0), parent(0), corner(0), edge(0), mark(0), perm(0), pattern(0), next(0), wins(0) { }
 		Cell(Side p, unsigned int a, unsigned int s, unsigned int c, unsigned int e, Pattern t) :
-			piece(p), size(s), parent(a), corner(c), edge(e), mark(0), perm(0), pattern(t) { }
+			piece(p), size(s), parent(a), corner(c), edge(e), mark(0), perm(0), pattern(t), next(a), wins(0) { }
 
 		int numcorners() const { return BitsSetTable256[corner]; }
 		int numedges()   const { return BitsSetTable256[edge];   }
@@ -61,7 +69,38 @@ mutable uint8_t mark;    //when doing a ring search, has this position been seen
 		std::string to_s(int i) const;
 	};
 
+	//What a move changed, so undo() can take it back instead of copying the whole board.
+	//A stone touches at most 3 separate groups, so causes at most 3 merges.
+	struct Undo {
+		MoveValid pos;
+		Move      last_move;
+		Outcome   outcome;
+		int8_t    win_type;
+		int8_t    joins;       //how many groups were merged
+		uint16_t  merged[3];   //the root that was attached to another group
+		uint16_t  root[3];     //the root it was attached to
+		Cell      rootcell[3]; //that root before the merge
+		int16_t   win_count[2][2];
+		int16_t   win_len[2][2];
+	};
+
 private:
+	//the parts of the board as bitboards, shared by all boards of the same size
+	struct BitMasks {
+		Bits onboard;  //all the cells
+		Bits border;   //the edges and corners, which a ring can't enclose
+		Bits corners;
+		Bits edges[6]; //each edge, without its corners
+	};
+
+	//a group joined by a move, as it was before the move
+	struct Part {
+		uint16_t start; //the stone after its root in its list, so its own stones come next
+		uint16_t size;
+		uint8_t  corner;
+		uint8_t  edge;
+	};
+
 	int8_t size_;  // the diameter of the board
 	int8_t size_r_;  // the radius of the board
 	int8_t size_r_m1_;  // size_r_ - 1
@@ -72,10 +111,15 @@ private:
 	Side to_play_;
 	Outcome outcome_;
 	int8_t win_type_;
+	int16_t win_count_[2][2]; //how many empty cells would win for each side, [1] with rings
+	int16_t win_len_[2][2];   //the length of each of those lists of winning cells, including filled ones
+	bool track_wins_;         //whether the winning cells are kept up to date
+	bool bitboard_wins_;      //whether wins are found on the bitboards instead of the groups
 
-	std::vector<Cell> cells_;
 	Zobrist<12> hash;
-	std::shared_ptr<MoveValid> neighbor_list_;
+	const MoveValid * neighbor_list_; //shared by all boards of this size
+	const BitMasks * bit_masks_;      //shared by all boards of this size
+	Bits stones_[2];                  //each side's stones, kept up to date while bitboard_wins_
 
 public:
 	bool check_rings; // whether to look for rings at all
@@ -86,6 +130,13 @@ public:
 		assert(size(s));
 	}
 
+	//copy just the part in use with one memcpy, the cells are last and sized for the biggest board
+	Board(const Board & o) { *this = o; }
+	Board & operator = (const Board & o) {
+		memcpy((void *)this, (const void *)&o, o.mem_size());
+		return *this;
+	}
+
 	bool size(std::string s) {
 		if (!valid_size(s))
 			return false;
@@ -93,8 +144,8 @@ public:
 		size_r_m1_ = size_r_ - 1;
 		size_ = size_r_ * 2 - 1;
 		neighbor_list_ = gen_neighbor_list();
+		bit_masks_ = gen_bit_masks();
 		num_cells_ = vec_size() - size_r_ * size_r_m1_;
-		cells_.resize(vec_size());
 		clear();
 		return true;
 	}
@@ -105,6 +156,10 @@ public:
 		to_play_ = Side::P1;
 		outcome_ = Outcome::UNKNOWN;
 		win_type_ = -1;
+		memset(win_count_, 0, sizeof(win_count_));
+		memset(win_len_, 0, sizeof(win_len_));
+		track_wins_ = false;
+		bitboard_wins_ = false;
 		check_rings = true;
 		perm_rings = 0;
 		hash.clear();
@@ -127,7 +182,7 @@ public:
 		return (min_size <= size && size <= max_size);
 	}
 
-	int mem_size() const { return sizeof(Board) + sizeof(Cell)*vec_size(); }
+	int mem_size() const { return (const char *)(cells_.data() + vec_size()) - (const char *)this; } //the part in use
 	int vec_size() const { return size_*size_; }
 	int num_cells() const { return num_cells_; }
 
@@ -184,6 +239,59 @@ public:
 
 	int8_t win_type() const { return win_type_; }
 
+	//Keep the empty cells that would win the game for each side up to date as the groups merge,
+	//for wins() and win(). It costs a few tests per move, so is off until asked for. Turning it
+	//on mid game tests every empty cell once.
+	void track_wins(bool on) {
+		if(on && !track_wins_){
+			for(int p = 0; p < 2; p++){
+				for(int k = 0; k < 2; k++){
+					while(win_len_[p][k] > 0)
+						cells_[cells_[--win_len_[p][k]].winlist[p][k]].wins &= ~(1 << (p + 2*k));
+					win_count_[p][k] = 0;
+				}
+			}
+			if(outcome_ < Outcome::DRAW)
+				for(int i = 0; i < vec_size(); i++)
+					if(get(i) == Side::NONE) //the cells off the board are UNDEF
+						for(Side side : {Side::P1, Side::P2})
+							add_win(i, side, test_win(yx(i), side));
+		}
+		track_wins_ = on;
+	}
+
+	//how many empty cells would win the game for side if it played there, while tracking them
+	//and the game is in progress. Rings only count while check_rings is on, and not with
+	//perm_rings, which depends on the stones in them
+	int wins(Side side) const { return win_count_[side.to_i() - 1][rings_win()]; }
+
+	//the n-th of those cells, newest first, for n < wins(side)
+	MoveValid win(Side side, int n = 0) const {
+		int p = side.to_i() - 1, k = rings_win();
+		for(int i = win_len_[p][k] - 1; ; i--){
+			int w = cells_[i].winlist[p][k];
+			if(get(w) == Side::NONE && n-- == 0)
+				return yx(w);
+		}
+	}
+
+	//Find the wins by flooding the group of each new stone on the bitboards, and testing it against
+	//the edge and corner masks, instead of reading the union-find groups. Rings are the regions
+	//next to the stone that can no longer flood out to the border, which costs the same however
+	//tangled the groups are, so is cheap enough for every depth of a rollout. The groups are
+	//still joined, for everything else that reads them. Off until asked for.
+	void bitboard_wins(bool on) {
+		if(on && !bitboard_wins_){
+			stones_[0].clear();
+			stones_[1].clear();
+			for(int i = 0; i < vec_size(); i++)
+				if(get(i) == Side::P1 || get(i) == Side::P2)
+					stones_[get(i).to_i() - 1].set(bit(yx(i)));
+		}
+		bitboard_wins_ = on;
+	}
+	bool bitboard_wins() const { return bitboard_wins_; }
+
 	Side to_play() const {
 		return to_play_;
 	}
@@ -240,6 +348,10 @@ public:
 	hash_t gethash() const {
 		return (num_moves_ > unique_depth ? hash.get(0) : hash.get());
 	}
+	//the hash of this exact position, gethash() merges the symmetric positions near the start
+	hash_t gethash_exact() const {
+		return hash.get(0);
+	}
 
 	void update_hash(const MoveValid & pos, Side side) {
 		int turn = side.to_i();
@@ -301,12 +413,25 @@ public:
 	bool move(const Move & pos, bool checkwin = true, bool permanent = true) {
 		return move(MoveValid(pos, xy(pos)), checkwin, permanent);
 	}
-	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true) {
+	//make a move that undo(u) can take back
+	bool move(const Move & pos, Undo & u)      { return move(MoveValid(pos, xy(pos)), true, true, &u); }
+	bool move(const MoveValid & pos, Undo & u) { return move(pos, true, true, &u); }
+	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true, Undo * undo = NULL) {
 		assert(!outcome_.solved());
 
 		if(!valid_move(pos))
 			return false;
 
+		if(undo){
+			undo->pos = pos;
+			undo->last_move = last_move_;
+			undo->outcome = outcome_;
+			undo->win_type = win_type_;
+			undo->joins = 0;
+			memcpy(undo->win_count, win_count_, sizeof(win_count_));
+			memcpy(undo->win_len, win_len_, sizeof(win_len_));
+		}
+
 		last_move_ = pos;
 		num_moves_++;
 
@@ -316,19 +441,33 @@ public:
 
 		update_hash(pos, to_play_); //depends on num_moves_
 		update_pattern(pos, to_play_);
+		if(bitboard_wins_)
+			stones_[to_play_.to_i() - 1].set(bit(pos));
 
 		// join the groups for win detection
 		bool alreadyjoined = false; //useful for finding rings
+		int groups = 0; //how many separate groups it joined
+		Part parts[3];
 		auto it = neighbors_small(pos);
 		for (const MoveValid *i = it.begin(), *e = it.end(); i < e; i++) {
 			if(i->on_board() && to_play_ == get(i->xy)){
-				alreadyjoined |= join_groups(pos.xy, i->xy);
+				bool joined = join_groups(pos.xy, i->xy, undo, parts + groups);
+				alreadyjoined |= joined;
+				groups += !joined;
 				i++; //skip the next one. If it is the same group,
 					 //it is already connected and forms a corner, which we can ignore
 			}
 		}
 
-		if(checkwin){
+		if(checkwin && bitboard_wins_){
+			win_type_ = win_bits(pos, stones_[to_play_.to_i() - 1], rings_win());
+			if(win_type_ < 0 && check_rings && perm_rings > 0 && checkring_df(pos, to_play_))
+				win_type_ = 2;
+			if(win_type_ >= 0)
+				outcome_ = +to_play_;
+			else if(num_moves_ == num_cells_)
+				outcome_ = Outcome::DRAW;
+		}else if(checkwin){
 			Cell * g = & cells_[find_group(pos.xy)];
 			if(g->numedges() >= 3){
 				outcome_ = +to_play_;
@@ -336,7 +475,7 @@ public:
 			}else if(g->numcorners() >= 2){
 				outcome_ = +to_play_;
 				win_type_ = 1;
-			}else if(check_rings && alreadyjoined && g->size >= 6 && checkring_df(pos, to_play_)){
+			}else if(check_rings && alreadyjoined && g->size >= 6 && checkring(pos, to_play_, groups)){
 				outcome_ = +to_play_;
 				win_type_ = 2;
 			}else if(num_moves_ == num_cells_){
@@ -344,33 +483,75 @@ public:
 			}
 		}
 
+		if(track_wins_)
+			update_wins(pos, parts, groups);
+
 		to_play_ = ~to_play_;
 
 		return true;
 	}
 
+	//take back the move that filled in u, which must be the last move made
+	void undo(const Undo & u) {
+		to_play_ = ~to_play_;
+
+		//before the roots are restored, since the lists are stored in the cells
+		for(int p = 0; p < 2; p++)
+			for(int k = 0; k < 2; k++)
+				while(win_len_[p][k] > u.win_len[p][k])
+					cells_[cells_[--win_len_[p][k]].winlist[p][k]].wins &= ~(1 << (p + 2*k));
+		memcpy(win_count_, u.win_count, sizeof(win_count_));
+
+		for(int n = u.joins - 1; n >= 0; n--){
+			cells_[u.merged[n]].parent = u.merged[n];
+			std::swap(cells_[u.merged[n]].next, cells_[u.root[n]].next);
+			cells_[u.root[n]] = u.rootcell[n];
+		}
+
+		Cell & cell = cells_[u.pos.xy];
+		cell.piece = Side::NONE;
+		cell.perm = 0;
+		if(bitboard_wins_)
+			stones_[to_play_.to_i() - 1].unset(bit(u.pos));
+
+		update_hash(u.pos, to_play_); //xor it back out while num_moves_ still matches the move
+		undo_pattern(u.pos);
+
+		num_moves_--;
+		last_move_ = u.last_move;
+		outcome_ = u.outcome;
+		win_type_ = u.win_type;
+	}
+
 	//test if making this move would win, but don't actually make the move
 	Outcome test_outcome(const Move & pos) const { return test_outcome(pos, to_play()); }
 	Outcome test_outcome(const Move & pos, Side turn) const { return test_outcome(MoveValid(pos, xy(pos)), turn); }
 	Outcome test_outcome(const MoveValid & pos) const { return test_outcome(pos, to_play()); }
 	Outcome test_outcome(const MoveValid & pos, Side turn) const {
 		if(test_local(pos, turn)){
-			Cell testcell = cells_[find_group(pos.xy)];
-			int numgroups = 0;
-			auto it = neighbors_small(pos);
-			for (const MoveValid *i = it.begin(), *e = it.end(); i < e; i++) {
-				if(i->on_board() && turn == get(i->xy)){
-					const Cell * g = & cells_[find_group(i->xy)];
-					testcell.corner |= g->corner;
-					testcell.edge   |= g->edge;
-					testcell.size   += g->size;
-					i++; //skip the next one
-					numgroups++;
+			if(bitboard_wins_){
+				Bits own = stones_[turn.to_i() - 1];
+				own.set(bit(pos));
+				if(win_bits(pos, own, check_rings) >= 0)
+					return +turn;
+			}else{
+				Cell testcell = cells_[find_group(pos.xy)];
+				int numgroups = 0;
+				auto it = neighbors_small(pos);
+				for (const MoveValid *i = it.begin(), *e = it.end(); i < e; i++) {
+					if(i->on_board() && turn == get(i->xy)){
+						const Cell * g = & cells_[find_group(i->xy)];
+						testcell.corner |= g->corner;
+						testcell.edge   |= g->edge;
+						testcell.size   += g->size;
+						i++; //skip the next one
+						numgroups++;
+					}
 				}
-			}
 
-			if(testcell.numcorners() >= 2 || testcell.numedges() >= 3 || (check_rings && numgroups >= 2 && testcell.size >= 6 && checkring_o1(pos, turn)))
-				return +turn;
+				if(testcell.numcorners() >= 2 || testcell.numedges() >= 3 || (check_rings && numgroups >= 2 && testcell.size >= 6 && checkring_o1(pos, turn)))
+					return +turn;
+			}
 		}
 
 		if(num_moves_+1 == num_cells_)
@@ -379,49 +560,213 @@ public:
 		return Outcome::UNKNOWN;
 	}
 
+	//does the stone just placed at pos, joining this many separate groups, complete a ring? The
+	//local check only finds whether there's a ring, not which stones make it, so counting the
+	//permanent ones needs the depth first search
+	bool checkring(const MoveValid & pos, const Side turn, int groups) const {
+		return (perm_rings > 0 ? checkring_df(pos, turn) : checkring_local(pos, turn, groups));
+	}
+	bool checkring_local(const MoveValid & pos, const Side turn, int groups) const;
+	bool checkring_df(const MoveValid & pos, const Side turn) const;
+
+	//how the stone at pos wins with own as its side's stones, pos included: the win_type, or -1.
+	//Rings are only looked for if rings is set, and ignore perm_rings
+	int win_bits(const MoveValid & pos, const Bits & own, bool rings) const;
+	bool ring_bits(const MoveValid & pos, const Bits & own) const;
+
 private:
 	int iscorner(int x, int y) const;
 	int isedge(int x, int y) const;
 
-	bool checkring_df(const MoveValid & pos, const Side turn) const;
 	bool checkring_o1(const MoveValid & pos, const Side turn) const;
 	bool followring(const MoveValid & cur, const int & dir, const Side & turn, const int & permsneeded) const;
 	bool checkring_back(const MoveValid & a, const MoveValid & b, const MoveValid & c, Side turn) const;
 
-	std::shared_ptr<MoveValid> gen_neighbor_list() const;
+	const MoveValid * gen_neighbor_list() const;
+	const BitMasks * gen_bit_masks() const;
+
+	static int bit(const MoveValid & m) { return Bits::index(m.x, m.y); }
 
 	int find_group(const MoveValid & m) const { return find_group(m.xy); }
+	//no path compression, so the merges can be undone, but union by size keeps the groups shallow
 	int find_group(unsigned int i) const {
-		unsigned int p = cells_[i].parent;
-		if(p != i){
-			do{
-				p = cells_[p].parent;
-			}while(p != cells_[p].parent);
-			cells_[i].parent = p; //do path compression, but only the current one, not all, to avoid recursion
-		}
-		return p;
+		while(cells_[i].parent != i)
+			i = cells_[i].parent;
+		return i;
 	}
 
 	//join the groups of two positions, propagating group size, and edge/corner connections
-	//returns true if they're already the same group, false if they are now joined
-	bool join_groups(int i, int j){
+	//returns true if they're already the same group, false if they are now joined,
+	//in which case part gets j's group as it was before
+	bool join_groups(int i, int j, Undo * undo = NULL, Part * part = NULL){
 		i = find_group(i);
 		j = find_group(j);
 
 		if(i == j)
 			return true;
 
+		if(part){
+			part->start  = cells_[j].next;
+			part->size   = cells_[j].size;
+			part->corner = cells_[j].corner;
+			part->edge   = cells_[j].edge;
+		}
+
 		if(cells_[i].size < cells_[j].size) //force i's subtree to be bigger
 			std::swap(i, j);
 
+		if(undo){
+			int n = undo->joins++;
+			undo->merged[n] = j;
+			undo->root[n] = i;
+			undo->rootcell[n] = cells_[i];
+		}
+
 		cells_[j].parent = i;
 		cells_[i].size   += cells_[j].size;
 		cells_[i].corner |= cells_[j].corner;
 		cells_[i].edge   |= cells_[j].edge;
+		std::swap(cells_[i].next, cells_[j].next); //splice the lists together
 
 		return false;
 	}
 
+	bool rings_win() const { return check_rings && perm_rings == 0; }
+
+	//A move can only make new wins for the side that made it. A new fork or bridge is next to
+	//the stone, or to a joined group that reached a new edge or corner. A new ring is next to
+	//the stone, or to two of the joined groups, or is the last gap around one of the stone's
+	//neighbors. So one joined group that reached nothing new can be skipped, and skipping the
+	//biggest keeps it to a few scans per stone over a whole game.
+	void update_wins(const MoveValid & pos, const Part * parts, int numparts) {
+		for(int p = 0; p < 2; p++) //it isn't empty anymore
+			for(int k = 0; k < 2; k++)
+				win_count_[p][k] -= (cells_[pos.xy].wins >> (p + 2*k)) & 1;
+
+		if(outcome_ >= Outcome::DRAW)
+			return;
+
+		const Cell * g = & cells_[find_group(pos.xy)];
+		int skip = -1;
+		for(int n = 0; n < numparts; n++)
+			if(parts[n].corner == g->corner && parts[n].edge == g->edge &&
+			   (skip < 0 || parts[n].size > parts[skip].size))
+				skip = n;
+
+		uint64_t seen[(max_vec_size + 63) / 64] = {}; //test each cell once
+		for (auto n : neighbors_small(pos.xy)){
+			add_win(n, seen);
+
+			//a neighbor that's now surrounded except for one empty cell makes a ring there
+			if(!n.on_board() || get(n) != to_play_)
+				continue;
+			MoveValid hole;
+			int open = 0;
+			for (auto m : neighbors_small(n)){
+				if(!m.on_board() || get(m) == ~to_play_)
+					open = 2;
+				else if(get(m) == Side::NONE){
+					hole = m;
+					open++;
+				}
+			}
+			if(open == 1)
+				add_win(hole, seen);
+		}
+		for(int n = 0; n < numparts; n++){
+			if(n == skip)
+				continue;
+			int s = parts[n].start;
+			for(int k = 0; k < parts[n].size; k++){
+				for (auto m : neighbors_small(s))
+					add_win(m, seen);
+				s = cells_[s].next;
+			}
+		}
+	}
+
+	//add pos if it's empty and the side to play would win there, to the list without rings
+	//if it's a fork or bridge, and to the list with rings if it's any of them
+	void add_win(const MoveValid & pos, uint64_t * seen) {
+		if(!pos.on_board() || get(pos.xy) != Side::NONE || (seen[pos.xy >> 6] >> (pos.xy & 63)) & 1)
+			return;
+		seen[pos.xy >> 6] |= 1ull << (pos.xy & 63);
+
+		if(!(cells_[pos.xy].wins & (1 << (to_play_.to_i() - 1)))) //or it's already in both
+			add_win(pos.xy, to_play_, test_win(pos, to_play_));
+	}
+
+	//add i to side's lists for a win of the kind test_win returned, if it isn't there yet
+	void add_win(int i, Side side, int win) {
+		int p = side.to_i() - 1;
+		bool found[2] = {(win & 1) != 0, win != 0};
+		for(int k = 0; k < 2; k++){
+			int bit = 1 << (p + 2*k);
+			if(found[k] && !(cells_[i].wins & bit)){
+				cells_[i].wins |= bit;
+				cells_[win_len_[p][k]++].winlist[p][k] = i;
+				win_count_[p][k]++;
+			}
+		}
+	}
+
+	//how turn would win by playing at the empty cell pos: 1 for a fork or bridge, 2 for a ring.
+	//The same as move() would find, joining the neighbors the same way, but ignoring perm_rings
+	int test_win(const MoveValid & pos, Side turn) const {
+		const MoveValid * nb = neighbors(pos);
+		int roots[3], groups = 0, size = 1;
+		bool alreadyjoined = false;
+		uint8_t corner = cells_[pos.xy].corner, edge = cells_[pos.xy].edge;
+		for(int i = 0; i < 6; i++){
+			if(nb[i].on_board() && turn == get(nb[i])){
+				int r = find_group(nb[i]);
+				bool joined = false;
+				for(int k = 0; k < groups; k++)
+					joined |= (roots[k] == r);
+				if(joined){
+					alreadyjoined = true;
+				}else{
+					roots[groups++] = r;
+					corner |= cells_[r].corner;
+					edge   |= cells_[r].edge;
+					size   += cells_[r].size;
+				}
+				i++; //skip the next one, like move()
+			}
+		}
+
+		int win = (BitsSetTable256[corner] >= 2 || BitsSetTable256[edge] >= 3 ? 1 : 0);
+		if(alreadyjoined && size >= 6 && ring_local(pos, turn, groups))
+			win |= 2;
+		return win;
+	}
+
+	//checkring_local for a stone that isn't there yet
+	bool ring_local(const MoveValid & pos, const Side turn, int groups) const {
+		const MoveValid * nb = neighbors(pos);
+		int mine = 0; //bit i is set if neighbor i is turn's
+		for(int i = 0; i < 6; i++)
+			if(nb[i].on_board() && get(nb[i]) == turn)
+				mine |= 1 << i;
+
+		int starts = mine & ~(((mine << 1) | (mine >> 5)) & 63); //the neighbors that start a run
+		if(BitsSetTable256[starts] > groups)
+			return true;
+
+		for(int i = 0; i < 6; i++){ //a neighbor surrounded by turn's stones and pos
+			if(!(mine & (1 << i)))
+				continue;
+			bool surrounded = true;
+			for (auto m : neighbors_small(nb[i]))
+				surrounded &= (m.xy == pos.xy || (m.on_board() && get(m) == turn));
+			if(surrounded)
+				return true;
+		}
+		return false;
+	}
+
+	RawArray<Cell, max_vec_size> cells_; //last, so copies can skip the unused tail
+
 	friend class BoardGridHex;
 	friend class BoardShapeHex;
 	friend class BoardBase;
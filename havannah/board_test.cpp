@@ -1,6 +1,8 @@
 
 #include "../lib/catch.hpp"
 #include "../lib/string.h"
+#include "../lib/time.h"
+#include "../lib/xorshift.h"
 
 #include "board.h"
 
@@ -36,6 +38,34 @@ void test_game(Board b, std::string moves, Outcome outcome, int win_type) {
 	test_game(b, explode(moves, " "), outcome, win_type);
 }
 
+//the winning cells the board keeps for the side to play must be the ones where move() wins,
+//with and without rings, returns how many win with a ring
+static int require_wins(const Board & board) {
+	int rings = 0;
+	for(bool check_rings : {true, false}){
+		Board b = board;
+		b.check_rings = check_rings;
+		Side turn = b.to_play();
+		std::vector<Move> expected, found;
+		for(auto m : board){
+			Board::Undo u;
+			REQUIRE(b.move(m, u));
+			if(b.outcome() == +turn){
+				expected.push_back(m);
+				rings += (b.win_type() == 2);
+			}
+			b.undo(u);
+		}
+		for(int n = 0; n < b.wins(turn); n++)
+			found.push_back(b.win(turn, n));
+		std::sort(found.begin(), found.end());
+		CAPTURE(board);
+		CAPTURE(check_rings);
+		REQUIRE(found == expected);
+	}
+	return rings;
+}
+
 TEST_CASE("Havannah::Board", "[havannah][board]") {
 	Board b("4");
 
@@ -197,3 +227,217 @@ TEST_CASE("Havannah::Board", "[havannah][board]") {
 		}, Outcome::DRAW, -1);
 	}
 }
+
+TEST_CASE("Havannah::Board::undo", "[havannah][board]") {
+	XORShift_uint32 rand(42);
+	for(int game = 0; game < 20; game++){
+		Board b("5");
+		b.track_wins(true);
+		std::vector<Board> boards;
+		std::vector<Board::Undo> undos;
+
+		//play randomly to the end, keeping a copy of each position
+		while(!b.outcome().solved()){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			if(moves.empty())
+				break;
+			boards.push_back(b);
+			undos.push_back(Board::Undo());
+			REQUIRE(b.move(moves[rand() % moves.size()], undos.back()));
+		}
+
+		//take them all back, checking each position including the groups against the copy
+		while(!undos.empty()){
+			b.undo(undos.back());
+			undos.pop_back();
+			const Board & o = boards.back();
+			CAPTURE(b);
+			REQUIRE(b.to_s(false) == o.to_s(false));
+			REQUIRE(b.gethash() == o.gethash());
+			REQUIRE(b.to_play() == o.to_play());
+			REQUIRE(b.moves_made() == o.moves_made());
+			REQUIRE(b.outcome() == o.outcome());
+			REQUIRE(b.win_type() == o.win_type());
+			for(auto m : o){
+				REQUIRE(b.test_outcome(m) == o.test_outcome(m));
+				REQUIRE(b.test_outcome(m, ~o.to_play()) == o.test_outcome(m, ~o.to_play()));
+			}
+			require_wins(b);
+			boards.pop_back();
+		}
+	}
+}
+
+TEST_CASE("Havannah::Board::wins", "[havannah][board]") {
+	XORShift_uint32 rand(13);
+	int rings = 0;
+	for(int size = 4; size <= 8; size += 2){
+		for(int game = 0; game < 30; game++){
+			Board b(to_str(size));
+			int start = (game % 2 ? 0 : rand() % b.num_cells()); //turn it on mid game in half of them
+			while(!b.outcome().solved()){
+				if(b.moves_made() == start)
+					b.track_wins(true);
+				if(b.moves_made() >= start)
+					rings += require_wins(b);
+				std::vector<Move> moves;
+				for(auto m : b)
+					moves.push_back(m);
+				REQUIRE(b.move(moves[rand() % moves.size()]));
+			}
+		}
+	}
+	REQUIRE(rings > 20); //make sure it saw some rings
+}
+
+TEST_CASE("Havannah::Board::checkring_local", "[havannah][board]") {
+	//the same random games with the rings found by the depth first search, which is used if a
+	//ring needs a permanent stone, and all of them are here, or by the local check
+	int rings = 0;
+	for(int size : {4, 6, 8, 10}){
+		XORShift_uint32 rand(size);
+		Board root(to_str(size));
+		std::vector<Move> moves;
+		for(auto m : root)
+			moves.push_back(m);
+
+		for(int game = 0; game < 300; game++){
+			for(int i = moves.size() - 1; i > 0; i--)
+				std::swap(moves[i], moves[rand() % (i + 1)]);
+			Board df = root, local = root;
+			df.perm_rings = 1;
+			for(int i = 0; local.outcome() < Outcome::DRAW; i++){
+				CAPTURE(local);
+				CAPTURE(moves[i]);
+				REQUIRE(df.move(moves[i]));
+				REQUIRE(local.move(moves[i]));
+				REQUIRE(local.outcome() == df.outcome());
+				REQUIRE(local.win_type() == df.win_type());
+			}
+			rings += (local.win_type() == 2);
+		}
+	}
+	REQUIRE(rings > 300);
+}
+
+TEST_CASE("Havannah::Board::bitboard_wins", "[havannah][board]") {
+	//the same random games with the wins found on the bitboards and on the groups, the same
+	//with perm_rings, and after undoing back to halfway and playing on. test_outcome on the
+	//bitboards has to agree with what the move then finds
+	int wins[3] = {};
+	for(int size : {4, 6, 8, 10}){
+		XORShift_uint32 rand(size);
+		Board root(to_str(size));
+		std::vector<Move> moves;
+		for(auto m : root)
+			moves.push_back(m);
+
+		for(int game = 0; game < 200; game++){
+			for(int i = moves.size() - 1; i > 0; i--)
+				std::swap(moves[i], moves[rand() % (i + 1)]);
+			Board groups = root, bits = root;
+			bits.bitboard_wins(true);
+			if(game % 4 == 3)
+				groups.perm_rings = bits.perm_rings = 1;
+
+			std::vector<Board::Undo> undos(moves.size());
+			int end = 0;
+			for(int pass = 0; pass < 2; pass++){
+				for(int i = end; bits.outcome() < Outcome::DRAW; i++){
+					CAPTURE(bits);
+					CAPTURE(moves[i]);
+					Outcome expected = bits.test_outcome(moves[i]);
+					REQUIRE(groups.move(moves[i]));
+					REQUIRE(bits.move(moves[i], undos[i]));
+					REQUIRE(bits.outcome() == groups.outcome());
+					REQUIRE(bits.win_type() == groups.win_type());
+					if(bits.perm_rings == 0)
+						REQUIRE(expected == bits.outcome());
+					end = i + 1;
+				}
+				if(pass == 0){
+					wins[bits.win_type()]++;
+					groups = root;
+					groups.perm_rings = bits.perm_rings;
+					for(int i = 0; i < end / 2; i++)
+						groups.move(moves[i]);
+					while(bits.moves_made() > end / 2)
+						bits.undo(undos[bits.moves_made() - 1]);
+					end /= 2;
+					std::reverse(moves.begin() + end, moves.end()); //play on differently
+				}
+			}
+		}
+	}
+	REQUIRE(wins[0] > 50);
+	REQUIRE(wins[1] > 50);
+	REQUIRE(wins[2] > 50);
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Havannah::Board::checkring benchmark", "[.][benchmark][havannah][board]") {
+	//random games, with the rings found by the depth first search (any ring has a permanent stone),
+	//the local check, or not at all
+	for(int size : {6, 10}){
+		Board root(to_str(size));
+		std::string result = "size " + to_str(size) + ":";
+		for(int mode = 0; mode < 3; mode++){
+			XORShift_uint32 rand(size); //the same games each time
+			std::vector<Move> moves;
+			for(auto m : root)
+				moves.push_back(m);
+
+			const int games = 20000;
+			int rings = 0;
+			Time start;
+			for(int game = 0; game < games; game++){
+				for(int i = moves.size() - 1; i > 0; i--)
+					std::swap(moves[i], moves[rand() % (i + 1)]);
+				Board b = root;
+				b.perm_rings = (mode == 0 ? 1 : 0);
+				b.check_rings = (mode < 2);
+				for(int i = 0; b.outcome() < Outcome::DRAW; i++)
+					b.move(moves[i]);
+				rings += (b.win_type() == 2);
+			}
+			double time = Time() - start;
+			result += std::string(mode == 0 ? " depth first " : mode == 1 ? ", local " : ", no rings ") +
+			          to_str(games/time/1000, 1) + "k games/s (" + to_str(rings) + " rings)";
+		}
+		WARN(result);
+	}
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Havannah::Board::bitboard_wins benchmark", "[.][benchmark][havannah][board]") {
+	//random games, with the wins found on the groups or the bitboards
+	for(int size : {4, 6, 8, 10}){
+		Board root(to_str(size));
+		std::string result = "size " + to_str(size) + ":";
+		for(bool bits : {false, true}){
+			XORShift_uint32 rand(size); //the same games each time
+			std::vector<Move> moves;
+			for(auto m : root)
+				moves.push_back(m);
+
+			const int games = 20000;
+			int rings = 0;
+			Time start;
+			for(int game = 0; game < games; game++){
+				for(int i = moves.size() - 1; i > 0; i--)
+					std::swap(moves[i], moves[rand() % (i + 1)]);
+				Board b = root;
+				b.bitboard_wins(bits);
+				for(int i = 0; b.outcome() < Outcome::DRAW; i++)
+					b.move(moves[i]);
+				rings += (b.win_type() == 2);
+			}
+			double time = Time() - start;
+			result += std::string(bits ? ", bitboards " : " groups ") +
+			          to_str(games/time/1000, 1) + "k games/s (" + to_str(rings) + " rings)";
+		}
+		WARN(result);
+	}
+}
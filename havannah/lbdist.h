@@ -9,13 +9,18 @@
 namespace Morat {
 namespace Havannah {
 
-class LBDists : public LBDistsBase<LBDists, Board> {
+class LBDists : public LBDistsBase<LBDists, Board, BitBoard<2*Board::max_size - 1, 2*Board::max_size - 1, 1>> {
 
 public:
 	LBDists() : LBDistsBase() {}
 	LBDists(const Board * b) : LBDistsBase(b) { }
 
 	void init_player(bool crossvcs, Side player) {
+		init_player_bits(crossvcs, player);
+	}
+
+	//the flood fills one cell at a time, as the reference for init_player_bits
+	void init_player_flood(bool crossvcs, Side player) {
 		int e = board->lines() - 1;
 		int m = e / 2;
 
@@ -34,6 +39,32 @@ public:
 		for(int y = 1; y < m; y++)   { init(0,   y, 11, player, 2+(y==m-1)); } flood(11, player, crossvcs); //edge 5
 	}
 
+	//the same distances as the flood fills, but found a whole layer at a time on bitboards
+	void init_player_bits(bool crossvcs, Side player) {
+		int e = board->lines() - 1;
+		int m = e / 2;
+
+		start_bits(player);
+
+		Bits start[12];
+		seed_bits(start[0], 0, 0, 0, player); //corner 0
+		seed_bits(start[1], m, 0, 1, player); //corner 1
+		seed_bits(start[2], e, m, 2, player); //corner 2
+		seed_bits(start[3], e, e, 3, player); //corner 3
+		seed_bits(start[4], m, e, 4, player); //corner 4
+		seed_bits(start[5], 0, m, 5, player); //corner 5
+
+		for(int x = 1; x < m; x++)   { seed_bits(start[6],  x,   0, 6,  player); } //edge 0
+		for(int y = 1; y < m; y++)   { seed_bits(start[7],  m+y, y, 7,  player); } //edge 1
+		for(int y = m+1; y < e; y++) { seed_bits(start[8],  e,   y, 8,  player); } //edge 2
+		for(int x = m+1; x < e; x++) { seed_bits(start[9],  x,   e, 9,  player); } //edge 3
+		for(int x = 1; x < m; x++)   { seed_bits(start[10], x, m+x, 10, player); } //edge 4
+		for(int y = 1; y < m; y++)   { seed_bits(start[11], 0,   y, 11, player); } //edge 5
+
+		for(int edge = 0; edge < 12; edge++)
+			flood_bits(edge, player, start[edge]);
+	}
+
 	Outcome isdraw() {
 		Outcome outcome = Outcome::DRAW;  // assume neither side can win
 		for(int y = 0; y < board->lines(); y++) {
@@ -52,6 +83,7 @@ public:
 		return -outcome; // this isn't certainty, so negate
 	}
 
+public:
 	int _get(int pos, Side player) {
 		int list[6];
 		for(int i = 0; i < 6; i++)
@@ -1,5 +1,8 @@
 
 #include "../lib/catch.hpp"
+#include "../lib/string.h"
+#include "../lib/time.h"
+#include "../lib/xorshift.h"
 
 #include "agentmcts.h"
 
@@ -14,3 +17,326 @@ TEST_CASE("Hex::AgentMCTS::Node::to_s/from_s", "[hex][agentmcts]") {
 	REQUIRE(k.from_s(s));
 	REQUIRE(n.to_s() == k.to_s());
 }
+
+//in the compact layout know and bestmove share bits, so a partial proof has to keep know
+TEST_CASE("Hex::AgentMCTS::Node keeps know through partial proofs", "[hex][agentmcts]") {
+	AgentMCTS::Node n(Move("a1"));
+	n.set_know(-7);
+	REQUIRE(n.cas_proof(Outcome::UNKNOWN, Outcome::P1_DRAW, Move("b2"), 3));
+	REQUIRE(n.outcome() == Outcome::P1_DRAW);
+	REQUIRE(n.proofdepth() == 3);
+	REQUIRE(n.move() == Move("a1"));
+	REQUIRE(n.know() == -7);
+
+	n.set_outcome(Outcome::P2_DRAW);
+	REQUIRE(n.know() == -7);
+	n.set_proof(Outcome::P1_DRAW, Move("b2"), 4);
+	REQUIRE(n.know() == -7);
+
+	REQUIRE(!n.cas_proof(Outcome::UNKNOWN, Outcome::P2, Move("b2"), 5));
+	REQUIRE(n.cas_proof(Outcome::P1_DRAW, Outcome::P1, Move("b2"), 5));
+	REQUIRE(n.outcome() == Outcome::P1);
+	REQUIRE(n.bestmove() == Move("b2"));
+}
+
+//the one child at a time loop that ChildSelect replaced
+static AgentMCTS::Node * choose_reference(std::vector<AgentMCTS::Node> & children, Side to_play, const ChildSelectParams & p){
+	float val, maxval = -1000000000;
+	int dynwidenlim = p.dynwidenlim;
+	AgentMCTS::Node * ret = NULL;
+	for(auto child = children.begin(); child != children.end() && dynwidenlim >= 0; ++child){
+		if(child->outcome() >= Outcome::DRAW){
+			if(child->outcome() == to_play)
+				return &*child;
+			val = (child->outcome() == Outcome::DRAW ? -1 : -2);
+		}else{
+			val = child->value(p.ravefactor, p.knowledge, p.fpurgency);
+			if(p.explore > 0)
+				val += p.explore*sqrt(p.logvisits/(child->exp.num() + 1));
+			dynwidenlim--;
+		}
+		if(maxval < val){
+			maxval = val;
+			ret = &*child;
+		}
+	}
+	return ret;
+}
+
+TEST_CASE("Hex::AgentMCTS ChildSelect matches Node::value", "[hex][agentmcts]") {
+	XORShift_uint32 rand(13);
+	for(int iter = 0; iter < 500; iter++){
+		std::vector<AgentMCTS::Node> children;
+		int num = 1 + rand() % 150;
+		uint64_t visits = 0;
+		for(int i = 0; i < num; i++){
+			AgentMCTS::Node n(Move(i % 11, i / 11));
+			ExpPair e, r;
+			int scale = 1 << (rand() % 12);
+			e.addwins(rand() % scale);
+			e.addlosses(rand() % scale);
+			r.addwins(rand() % (4*scale));
+			r.addlosses(rand() % (4*scale));
+			if(rand() % 8) n.exp.addv(e);
+			if(rand() % 4) n.rave.addv(r);
+			n.set_know((int)(rand() % 60) - 10);
+			int solved = rand() % 50;
+			if(solved == 0) n.set_outcome(Outcome::DRAW);
+			if(solved == 1) n.set_outcome(Outcome::P2);
+			if(solved == 2 && iter % 10 == 0) n.set_outcome(Outcome::P1);
+			visits += n.exp.num();
+			children.push_back(n);
+		}
+
+		ChildSelectParams p;
+		p.logvisits = log(visits + 1);
+		p.dynwidenlim = (iter % 3 == 0 ? (int)(rand() % 20) : Board::max_vec_size);
+		p.ravefactor = (iter % 4 == 0 ? 0 : 500 + rand() % 5000);
+		p.min_rave = AgentMCTS::min_rave;
+		p.fpurgency = 1;
+		p.knowledge = (iter % 5 != 0);
+		p.explore = (iter % 2 ? 0 : 0.25f * (1 + rand() % 4));
+
+		AgentMCTS::Node * expected = choose_reference(children, Side::P1, p);
+		AgentMCTS::Node * chosen = ChildSelect<AgentMCTS::Node>::choose(children.data(), children.data() + children.size(), Side::P1, p);
+		CAPTURE(iter);
+		REQUIRE(chosen == expected);
+	}
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Hex::AgentMCTS choose_move benchmark", "[.][benchmark][hex][agentmcts]") {
+	XORShift_uint32 rand(17);
+	for(int num : {10, 50, 121, 361}){
+		std::vector<AgentMCTS::Node> children;
+		for(int i = 0; i < num; i++){
+			AgentMCTS::Node n(Move(i % 19, i / 19));
+			ExpPair e, r;
+			e.addwins(rand() % 1000);
+			e.addlosses(rand() % 1000);
+			r.addwins(rand() % 5000);
+			r.addlosses(rand() % 5000);
+			n.exp.addv(e);
+			n.rave.addv(r);
+			n.set_know(rand() % 30);
+			children.push_back(n);
+		}
+		ChildSelectParams p;
+		p.logvisits = log(1000000);
+		p.dynwidenlim = Board::max_vec_size;
+		p.ravefactor = 2500;
+		p.min_rave = AgentMCTS::min_rave;
+		p.fpurgency = 1;
+		p.knowledge = true;
+		p.explore = 0.5;
+
+		const int reps = 20000000 / num;
+		uintptr_t sum = 0;
+		Time start;
+		for(int i = 0; i < reps; i++)
+			sum += (uintptr_t)choose_reference(children, Side::P1, p);
+		double reference = Time() - start;
+		start = Time();
+		for(int i = 0; i < reps; i++)
+			sum += (uintptr_t)ChildSelect<AgentMCTS::Node>::choose(children.data(), children.data() + children.size(), Side::P1, p);
+		double blocked = Time() - start;
+		REQUIRE(sum != 0);
+		WARN(to_str(num) + " children: one at a time " + to_str(reference*1000000000/reps/num, 2) +
+		     " ns/child, blocked " + to_str(blocked*1000000000/reps/num, 2) + " ns/child");
+	}
+}
+
+TEST_CASE("Hex::AgentMCTS DistSync shares the top of the tree", "[hex][agentmcts]") {
+	Board board("5");
+	AgentMCTS a(board), b(board);
+	a.distvisits = b.distvisits = 0; //so a node can't pass the limit by receiving experience and send its older experience
+	a.set_board(board);
+	b.set_board(board);
+	a.search(10, 2000, 0);
+	b.search(10, 2000, 0);
+
+	std::vector<uint64_t> before;
+	for(auto & child : a.root.children)
+		before.push_back(child.exp.num());
+	uint64_t rootbefore = a.root.exp.num();
+
+	std::string sa = a.dist_collect(), sb = b.dist_collect();
+	REQUIRE(sa != "");
+	REQUIRE(sb != "");
+	REQUIRE(a.dist_collect() == ""); //nothing new since the last collect
+
+	a.dist_apply(explode(sb, " "));
+	REQUIRE(a.root.exp.num() == rootbefore + b.root.exp.num());
+	int i = 0;
+	for(auto & child : a.root.children){
+		uint64_t expect = before[i++];
+		for(auto & other : b.root.children)
+			if(other.move() == child.move())
+				expect += other.exp.num();
+		REQUIRE(child.exp.num() == expect);
+	}
+
+	//the received experience isn't sent back, even after following a move,
+	//where only the new root's initial experience and the newly shared ply are new
+	REQUIRE(a.dist_collect() == "");
+	Move best = a.return_move(0);
+	a.move(best);
+	std::string moved = a.dist_collect();
+	REQUIRE(moved.compare(0, 6, " :2:4 ") == 0);
+	for(auto & token : explode(moved.substr(6), " "))
+		REQUIRE(explode(explode(token, ":")[0], ",").size() == 2);
+
+	//but new experience is
+	a.search(10, 500, 0);
+	REQUIRE(a.dist_collect() != "");
+
+	//and a node freed by the gc and grown again shares its new experience, without waiting to pass its old counts
+	AgentMCTS::Node & regrown = *a.root.children.begin();
+	regrown.exp.clear();
+	regrown.exp.addwins(3);
+	REQUIRE(a.dist_collect() == " " + regrown.move().to_s() + ":3:6");
+}
+
+TEST_CASE("Hex::AgentMCTS treegroup merges the tops of the trees", "[hex][agentmcts]") {
+	Board board("5");
+	AgentMCTS a(board);
+	a.treevisits = 0;
+	a.set_threads(2, 1, 0);
+	a.set_board(board);
+	REQUIRE(a.sidetrees.size() == 1);
+	a.search(10, 2000, 0);
+
+	//after the final merge both trees have all the experience at the top
+	const AgentMCTS::Node & side = a.sidetrees[0]->root;
+	REQUIRE(a.root.exp.num() == side.exp.num());
+	REQUIRE(a.root.children.num() == side.children.num());
+	for(auto & child : a.root.children)
+		for(auto & other : side.children)
+			if(other.move() == child.move())
+				REQUIRE(child.exp.num() == other.exp.num());
+
+	//and nothing is merged twice
+	uint64_t rootnum = a.root.exp.num();
+	a.search(10, 1, 0);
+	REQUIRE(a.root.exp.num() == side.exp.num());
+	REQUIRE(a.root.exp.num() < rootnum + 100);
+
+	a.set_threads(1, 0, 0);
+}
+
+TEST_CASE("Hex::AgentMCTS pipelined rollouts balance their virtual losses", "[hex][agentmcts]") {
+	Board board("5");
+	AgentMCTS a(board);
+	a.set_board(board);
+
+	//expand the root first, otherwise a thread that finds it being expanded by the other plays its leaves at the root
+	a.search(10, 1, 0);
+	REQUIRE(a.root.children.num() > 0);
+
+	a.set_threads(2, 0, 2);
+	REQUIRE(a.rollouts == 5); //so each simulation fans out to several workers
+	a.search(10, 2000, 0);
+
+	REQUIRE(a.lastruns >= 2000);
+	REQUIRE(a.leavesout == 0);
+	REQUIRE(a.leavesmade > 0);
+
+	//every simulation passes through a child of the root, and all the virtual losses were taken back
+	uint64_t children = 0;
+	for(auto & child : a.root.children)
+		children += child.exp.num();
+	REQUIRE(a.root.exp.num() == a.visitexpand + 1 + children);
+	REQUIRE(children >= 2000 * 4); //nearly all with 5 rollouts
+
+	//the leaves are freed along with the workers, and it searches inline again
+	a.set_threads(1, 0, 0);
+	REQUIRE(a.leavesmade == 0);
+	a.search(10, 2500, 0);
+	REQUIRE(a.leavesmade == 0);
+	REQUIRE(a.root.exp.num() > a.visitexpand + 1 + children);
+}
+
+//the runs a node's children got beyond the ones that went through the node after it expanded
+//the root starts with visitexpand+1 visits and expands before the first run, the other nodes
+//expand on their visitexpand+1th visit and pass that run on to a child
+static int64_t extra_child_visits(const AgentMCTS::Node & node, int64_t visitexpand, bool root = true){
+	if(node.children.empty())
+		return 0;
+	int64_t extra = visitexpand + (root ? 1 : 0) - node.exp.num();
+	for(auto & child : node.children)
+		extra += child.exp.num() + extra_child_visits(child, visitexpand, false);
+	return extra;
+}
+
+TEST_CASE("Hex::AgentMCTS dag counts a transposed run for the leaf and the shared node", "[hex][agentmcts]") {
+	Board board("5");
+	AgentMCTS a(board);
+	a.minimax = 0; //so every run ends at a leaf, instead of stopping at a proof
+	a.rollouts = 1; //and counts once in each node
+	a.set_board(board);
+
+	SECTION("Without transpositions the children have exactly the runs through their parent") {
+		a.search(10, 5000, 0);
+		REQUIRE(extra_child_visits(a.root, a.visitexpand) == 0);
+	}
+
+	SECTION("A shared node's parent doesn't count the runs that reached it through a transposition") {
+		a.transpositions.resize(1024*1024);
+		a.search(10, 5000, 0);
+		REQUIRE(a.transposed.exact() > 0);
+		REQUIRE(extra_child_visits(a.root, a.visitexpand) == (int64_t)a.transposed.exact());
+	}
+}
+
+TEST_CASE("Hex::AgentMCTS incremental gc waits for the tree to grow before starting again", "[hex][agentmcts]") {
+	Board board("7");
+	AgentMCTS a(board);
+	a.gcincremental = true;
+	a.set_board(board);
+	a.search(10, 2000, 0);
+
+	//past where an incremental gc starts, but short of a full one
+	a.maxmem = a.ctmem.memalloced() + 1;
+	REQUIRE(a.ctmem.memalloced() >= AgentMCTS::gc_start*a.maxmem);
+
+	a.gclastalloced = a.ctmem.memalloced(); //the last cycle left this much
+	REQUIRE(!a.gc_concurrent());
+	REQUIRE(a.gcphase == AgentMCTS::GC_Idle);
+
+	a.gclastalloced = a.ctmem.memalloced() - 1;
+	REQUIRE(a.gc_concurrent());
+}
+
+//exposes the board the rollouts start from
+class RootAgent : public AgentMCTS {
+public:
+	RootAgent(const Board & b) : AgentMCTS(b) { }
+	const Board & root_board() const { return rootboard; }
+};
+
+TEST_CASE("Hex::AgentMCTS -w still takes the old depths", "[hex][agentmcts]") {
+	//play random moves until the side to move has a winning cell
+	XORShift_uint32 rand(7);
+	Board board("5");
+	for(;;){
+		Board tracked = board;
+		tracked.track_wins(true);
+		if(tracked.wins(board.to_play()) > 0)
+			break;
+		std::vector<Move> moves;
+		for(auto m : board)
+			moves.push_back(m);
+		REQUIRE(board.move(moves[rand() % moves.size()]));
+		REQUIRE(board.outcome() < Outcome::DRAW);
+	}
+
+	//-w was the depth to look to, now anything but 0 turns it on for the whole rollout
+	RootAgent a(board);
+	for(const char * arg : {"0", "1", "3", "100", "0"}){
+		CAPTURE(arg);
+		a.instantwin = from_str<int>(arg); //as -w arg sets it
+		a.set_board(board);
+		REQUIRE((a.root_board().wins(board.to_play()) > 0) == (a.instantwin != 0));
+		a.search(10, 100, 0); //and the rollouts run with it
+	}
+}
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <ostream>
@@ -16,6 +17,7 @@
 #include "../lib/hashset.h"
 #include "../lib/move.h"
 #include "../lib/outcome.h"
+#include "../lib/rawarray.h"
 #include "../lib/string.h"
 #include "../lib/types.h"
 #include "../lib/zobrist.h"
@@ -44,21 +46,45 @@ public:
 	struct Cell {
 		Side     piece;   //who controls this cell, 0 for none, 1,2 for players
 		uint16_t size;    //size of this group of cells
-mutable uint16_t parent;  //parent for this group of cells
+		uint16_t parent;  //parent for this group of cells
 		uint8_t  edge;    //which edges are this group connected to
 		uint8_t  perm;    //is this a permanent piece or a randomly placed piece?
 		Pattern  pattern; //the pattern of pieces for neighbors, but from their perspective. Rotate 180 for my perpective
+		uint16_t next;    //the next stone in this group, in a circular list through the whole group
+		uint8_t  wins;    //bit side-1 is set if side would win by playing here, see win()
+		uint16_t winlist[2]; //entry i of each side's list of winning cells, a column sized like the board
 
-		Cell() : piece(Side::NONE), size(0), parent(0), edge(0), perm(0), pattern(0) { }
+		Cell() : piece(Side::NONE), size(0), parent(0), edge(0), perm(0), pattern(0), next(0), wins(0) { }
 		Cell(Side p, unsigned int a, unsigned int s, unsigned int e, Pattern t) :
-			piece(p), size(s), parent(a), edge(e), perm(0), pattern(t) { }
+			piece(p), size(s), parent(a), edge(e), perm(0), pattern(t), next(a), wins(0) { }
 
 		int numedges()   const { return BitsSetTable256[edge]; }
 
 		std::string to_s(int i) const;
 	};
 
+	//What a move changed, so undo() can take it back instead of copying the whole board.
+	//A stone touches at most 3 separate groups, so causes at most 3 merges.
+	struct Undo {
+		MoveValid pos;
+		Move      last_move;
+		Outcome   outcome;
+		int8_t    joins;       //how many groups were merged
+		uint16_t  merged[3];   //the root that was attached to another group
+		uint16_t  root[3];     //the root it was attached to
+		Cell      rootcell[3]; //that root before the merge
+		int16_t   win_count[2];
+		int16_t   win_len[2];
+	};
+
 private:
+	//a group joined by a move, as it was before the move
+	struct Part {
+		uint16_t start; //the stone after its root in its list, so its own stones come next
+		uint16_t size;
+		uint8_t  edge;
+	};
+
 	int8_t size_;  // the length of one side of the board
 	int8_t sizem1_;  // size_ - 1
 
@@ -67,10 +93,12 @@ private:
 	Move last_move_;
 	Side to_play_;
 	Outcome outcome_;
+	int16_t win_count_[2]; //how many empty cells would win for each side
+	int16_t win_len_[2];   //the length of each side's list of winning cells, including filled ones
+	bool track_wins_;      //whether the winning cells are kept up to date
 
-	std::vector<Cell> cells_;
 	Zobrist<2> hash;
-	std::shared_ptr<MoveValid> neighbor_list_;
+	const MoveValid * neighbor_list_; //shared by all boards of this size
 
 public:
 	Board() = delete;
@@ -78,6 +106,13 @@ public:
 		assert(size(s));
 	}
 
+	//copy just the part in use with one memcpy, the cells are last and sized for the biggest board
+	Board(const Board & o) { *this = o; }
+	Board & operator = (const Board & o) {
+		memcpy((void *)this, (const void *)&o, o.mem_size());
+		return *this;
+	}
+
 	bool size(std::string s) {
 		if (!valid_size(s))
 			return false;
@@ -85,7 +120,6 @@ public:
 		sizem1_ = size_ - 1;
 		neighbor_list_ = gen_neighbor_list();
 		num_cells_ = vec_size();
-		cells_.resize(vec_size());
 		clear();
 		return true;
 	}
@@ -95,6 +129,9 @@ public:
 		num_moves_ = 0;
 		to_play_ = Side::P1;
 		outcome_ = Outcome::UNKNOWN;
+		win_count_[0] = win_count_[1] = 0;
+		win_len_[0] = win_len_[1] = 0;
+		track_wins_ = false;
 		hash.clear();
 
 		for(int y = 0; y < size_; y++){
@@ -115,7 +152,7 @@ public:
 		return (min_size <= size && size <= max_size);
 	}
 
-	int mem_size() const { return sizeof(Board) + sizeof(Cell)*vec_size(); }
+	int mem_size() const { return (const char *)(cells_.data() + vec_size()) - (const char *)this; } //the part in use
 	int vec_size() const { return size_*size_; }
 	int num_cells() const { return num_cells_; }
 
@@ -169,6 +206,40 @@ public:
 
 	int8_t win_type() const { return 0; }
 
+	//Keep the empty cells that would win the game for each side up to date as the groups merge,
+	//for wins() and win(). It costs a few tests per move, so is off until asked for. Turning it
+	//on mid game tests every empty cell once.
+	void track_wins(bool on) {
+		if(on && !track_wins_){
+			for(int p = 0; p < 2; p++){
+				while(win_len_[p] > 0)
+					cells_[cells_[--win_len_[p]].winlist[p]].wins &= ~(1 << p);
+				win_count_[p] = 0;
+			}
+			if(outcome_ < Outcome::DRAW)
+				for(int i = 0; i < vec_size(); i++)
+					if(get(i) == Side::NONE)
+						for(Side side : {Side::P1, Side::P2})
+							if(test_outcome(yx(i), side) == +side)
+								add_win(i, side);
+		}
+		track_wins_ = on;
+	}
+
+	//how many empty cells would win the game for side if it played there, while tracking them
+	//and the game is in progress
+	int wins(Side side) const { return win_count_[side.to_i() - 1]; }
+
+	//the n-th of those cells, newest first, for n < wins(side)
+	MoveValid win(Side side, int n = 0) const {
+		int p = side.to_i() - 1;
+		for(int i = win_len_[p] - 1; ; i--){
+			int w = cells_[i].winlist[p];
+			if(get(w) == Side::NONE && n-- == 0)
+				return yx(w);
+		}
+	}
+
 	Side to_play() const {
 		return to_play_;
 	}
@@ -206,6 +277,10 @@ public:
 	hash_t gethash() const {
 		return (num_moves_ > unique_depth ? hash.get(0) : hash.get());
 	}
+	//the hash of this exact position, gethash() merges the symmetric positions near the start
+	hash_t gethash_exact() const {
+		return hash.get(0);
+	}
 
 	void update_hash(const MoveValid & pos, Side side) {
 		int turn = side.to_i();
@@ -231,12 +306,26 @@ public:
 	bool move(const Move & pos, bool checkwin = true, bool permanent = true) {
 		return move(MoveValid(pos, xy(pos)), checkwin, permanent);
 	}
-	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true) {
+	//make a move that undo(u) can take back
+	bool move(const Move & pos, Undo & u)      { return move(MoveValid(pos, xy(pos)), true, true, &u); }
+	bool move(const MoveValid & pos, Undo & u) { return move(pos, true, true, &u); }
+	bool move(const MoveValid & pos, bool checkwin = true, bool permanent = true, Undo * undo = NULL) {
 		assert(!outcome_.solved());
 
 		if(!valid_move(pos))
 			return false;
 
+		if(undo){
+			undo->pos = pos;
+			undo->last_move = last_move_;
+			undo->outcome = outcome_;
+			undo->joins = 0;
+			for(int p = 0; p < 2; p++){
+				undo->win_count[p] = win_count_[p];
+				undo->win_len[p] = win_len_[p];
+			}
+		}
+
 		last_move_ = pos;
 		num_moves_++;
 
@@ -248,10 +337,13 @@ public:
 		update_pattern(pos, to_play_);
 
 		// join the groups for win detection
+		Part parts[3];
+		int numparts = 0;
 		auto it = neighbors_small(pos);
 		for (const MoveValid *i = it.begin(), *e = it.end(); i < e; i++) {
 			if(i->on_board() && to_play_ == get(i->xy)){
-				join_groups(pos.xy, i->xy);
+				if(!join_groups(pos.xy, i->xy, undo, parts + numparts))
+					numparts++;
 				i++; //skip the next one. If it is the same group,
 					 //it is already connected and forms a corner, which we can ignore
 			}
@@ -264,11 +356,81 @@ public:
 			outcome_ = +to_play_;
 		}
 
+		if(track_wins_)
+			update_wins(pos, g->edge & winmask, winmask, parts, numparts);
+
 		to_play_ = ~to_play_;
 
 		return true;
 	}
 
+	//take back the move that filled in u, which must be the last move made
+	void undo(const Undo & u) {
+		to_play_ = ~to_play_;
+
+		//before the roots are restored, since the lists are stored in the cells
+		for(int p = 0; p < 2; p++){
+			while(win_len_[p] > u.win_len[p])
+				cells_[cells_[--win_len_[p]].winlist[p]].wins &= ~(1 << p);
+			win_count_[p] = u.win_count[p];
+		}
+
+		for(int n = u.joins - 1; n >= 0; n--){
+			cells_[u.merged[n]].parent = u.merged[n];
+			std::swap(cells_[u.merged[n]].next, cells_[u.root[n]].next);
+			cells_[u.root[n]] = u.rootcell[n];
+		}
+
+		Cell & cell = cells_[u.pos.xy];
+		cell.piece = Side::NONE;
+		cell.perm = 0;
+
+		update_hash(u.pos, to_play_); //xor it back out while num_moves_ still matches the move
+		undo_pattern(u.pos);
+
+		num_moves_--;
+		last_move_ = u.last_move;
+		outcome_ = u.outcome;
+	}
+
+	//The outcome once the empty cells are all filled in, in the order of moves, alternating from
+	//the side to play. A full board has exactly one winner, so instead of joining groups on every
+	//move, one flood fill at the end checks whether P1 connects its edges.
+	Outcome fill_outcome(const Move * moves, int num) const {
+		Side pieces[max_vec_size];
+		for(int i = 0; i < vec_size(); i++)
+			pieces[i] = cells_[i].piece;
+		Side turn = to_play_;
+		for(int i = 0; i < num; i++){
+			pieces[xy(moves[i])] = turn;
+			turn = ~turn;
+		}
+
+		//flood fill from P1's stones on the first row, looking for the last row
+		uint16_t stack[max_vec_size];
+		int top = 0;
+		for(int x = 0; x < size_; x++){
+			if(pieces[x] == Side::P1){
+				pieces[x] = Side::NONE; //visited
+				stack[top++] = x;
+			}
+		}
+		const int last = vec_size() - size_;
+		while(top > 0){
+			int i = stack[--top];
+			if(i >= last)
+				return Outcome::P1;
+			auto it = neighbors_small(i);
+			for (const MoveValid *n = it.begin(), *e = it.end(); n < e; n++) {
+				if(n->on_board() && pieces[n->xy] == Side::P1){
+					pieces[n->xy] = Side::NONE;
+					stack[top++] = n->xy;
+				}
+			}
+		}
+		return Outcome::P2;
+	}
+
 	//test if making this move would win, but don't actually make the move
 	Outcome test_outcome(const Move & pos) const { return test_outcome(pos, to_play()); }
 	Outcome test_outcome(const Move & pos, Side turn) const { return test_outcome(MoveValid(pos, xy(pos)), turn); }
@@ -299,39 +461,97 @@ public:
 private:
 	int edges(int x, int y) const;
 
-	std::shared_ptr<MoveValid> gen_neighbor_list() const;
+	const MoveValid * gen_neighbor_list() const;
 
 	int find_group(const MoveValid & m) const { return find_group(m.xy); }
+	//no path compression, so the merges can be undone, but union by size keeps the groups shallow
 	int find_group(unsigned int i) const {
-		unsigned int p = cells_[i].parent;
-		if(p != i){
-			do{
-				p = cells_[p].parent;
-			}while(p != cells_[p].parent);
-			cells_[i].parent = p; //do path compression, but only the current one, not all, to avoid recursion
-		}
-		return p;
+		while(cells_[i].parent != i)
+			i = cells_[i].parent;
+		return i;
 	}
 
 	//join the groups of two positions, propagating group size, and edge connections
-	//returns true if they're already the same group, false if they are now joined
-	bool join_groups(int i, int j){
+	//returns true if they're already the same group, false if they are now joined,
+	//in which case part gets j's group as it was before
+	bool join_groups(int i, int j, Undo * undo = NULL, Part * part = NULL){
 		i = find_group(i);
 		j = find_group(j);
 
 		if(i == j)
 			return true;
 
+		if(part){
+			part->start = cells_[j].next;
+			part->size  = cells_[j].size;
+			part->edge  = cells_[j].edge;
+		}
+
 		if(cells_[i].size < cells_[j].size) //force i's subtree to be bigger
 			std::swap(i, j);
 
+		if(undo){
+			int n = undo->joins++;
+			undo->merged[n] = j;
+			undo->root[n] = i;
+			undo->rootcell[n] = cells_[i];
+		}
+
 		cells_[j].parent = i;
 		cells_[i].size   += cells_[j].size;
 		cells_[i].edge   |= cells_[j].edge;
+		std::swap(cells_[i].next, cells_[j].next); //splice the lists together
 
 		return false;
 	}
 
+	//A move can only make new wins for the side that made it, at the empty cells next to it or
+	//to the groups it joined. A group that already had all the joined group's edges, of the
+	//ones that side needs, doesn't change anything for the cells next to it, so only the groups
+	//that reach a new edge are scanned, and each stone is scanned at most once per edge. Nothing
+	//changes at all until the group reaches one of them.
+	void update_wins(const MoveValid & pos, uint8_t edge, uint8_t winmask, const Part * parts, int numparts) {
+		for(int p = 0; p < 2; p++) //it isn't empty anymore
+			if(cells_[pos.xy].wins & (1 << p))
+				win_count_[p]--;
+
+		if(outcome_ >= Outcome::DRAW || edge == 0)
+			return;
+
+		uint64_t seen[(max_vec_size + 63) / 64] = {}; //test each cell once
+		add_wins(pos.xy, seen);
+		for(int n = 0; n < numparts; n++){
+			if((parts[n].edge & winmask) == edge)
+				continue;
+			int s = parts[n].start;
+			for(int k = 0; k < parts[n].size; k++){
+				add_wins(s, seen);
+				s = cells_[s].next;
+			}
+		}
+	}
+
+	//add the empty neighbors of i where the side to play would win
+	void add_wins(int i, uint64_t * seen) {
+		int p = to_play_.to_i() - 1;
+		for (auto n : neighbors_small(i)) {
+			if(!n.on_board() || get(n.xy) != Side::NONE || (seen[n.xy >> 6] >> (n.xy & 63)) & 1)
+				continue;
+			seen[n.xy >> 6] |= 1ull << (n.xy & 63);
+			if(!(cells_[n.xy].wins & (1 << p)) && test_outcome(n, to_play_) == +to_play_)
+				add_win(n.xy, to_play_);
+		}
+	}
+
+	void add_win(int i, Side side) {
+		int p = side.to_i() - 1;
+		cells_[i].wins |= 1 << p;
+		cells_[win_len_[p]++].winlist[p] = i;
+		win_count_[p]++;
+	}
+
+	RawArray<Cell, max_vec_size> cells_; //last, so copies can skip the unused tail
+
 	friend class BoardGridHex;
 	friend class BoardShapeSquare;
 	friend class BoardBase;
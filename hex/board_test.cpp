@@ -1,6 +1,8 @@
 
 #include "../lib/catch.hpp"
 #include "../lib/string.h"
+#include "../lib/time.h"
+#include "../lib/xorshift.h"
 
 #include "board.h"
 
@@ -35,6 +37,22 @@ void test_game(Board b, std::string moves, Outcome outcome) {
 	test_game(b, explode(moves, " "), outcome);
 }
 
+//the winning cells the board keeps must be the ones test_outcome finds on the whole board
+static void require_wins(const Board & b) {
+	for(Side side : {Side::P1, Side::P2}){
+		std::vector<Move> expected, found;
+		for(auto m : b)
+			if(b.test_outcome(m, side) == +side)
+				expected.push_back(m);
+		for(int n = 0; n < b.wins(side); n++)
+			found.push_back(b.win(side, n));
+		std::sort(found.begin(), found.end());
+		CAPTURE(b);
+		CAPTURE(side.to_i());
+		REQUIRE(found == expected);
+	}
+}
+
 TEST_CASE("Hex::Board", "[hex][board]") {
 	Board b("7");
 
@@ -155,3 +173,135 @@ TEST_CASE("Hex::Board", "[hex][board]") {
 			Outcome::P2);
 	}
 }
+
+TEST_CASE("Hex::Board::undo", "[hex][board]") {
+	XORShift_uint32 rand(42);
+	for(int game = 0; game < 20; game++){
+		Board b("7");
+		b.track_wins(true);
+		std::vector<Board> boards;
+		std::vector<Board::Undo> undos;
+
+		//play randomly to the end, keeping a copy of each position
+		while(!b.outcome().solved()){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			if(moves.empty())
+				break;
+			boards.push_back(b);
+			undos.push_back(Board::Undo());
+			REQUIRE(b.move(moves[rand() % moves.size()], undos.back()));
+		}
+
+		//take them all back, checking each position including the groups against the copy
+		while(!undos.empty()){
+			b.undo(undos.back());
+			undos.pop_back();
+			const Board & o = boards.back();
+			CAPTURE(b);
+			REQUIRE(b.to_s(false) == o.to_s(false));
+			REQUIRE(b.gethash() == o.gethash());
+			REQUIRE(b.to_play() == o.to_play());
+			REQUIRE(b.moves_made() == o.moves_made());
+			REQUIRE(b.outcome() == o.outcome());
+			REQUIRE(b.win_type() == o.win_type());
+			for(auto m : o){
+				REQUIRE(b.test_outcome(m) == o.test_outcome(m));
+				REQUIRE(b.test_outcome(m, ~o.to_play()) == o.test_outcome(m, ~o.to_play()));
+			}
+			require_wins(b);
+			boards.pop_back();
+		}
+	}
+}
+
+TEST_CASE("Hex::Board::wins", "[hex][board]") {
+	XORShift_uint32 rand(13);
+	for(int size = 3; size <= 11; size += 2){
+		for(int game = 0; game < 50; game++){
+			Board b(to_str(size));
+			int start = (game % 2 ? 0 : rand() % b.num_cells()); //turn it on mid game in half of them
+			while(!b.outcome().solved()){
+				if(b.moves_made() == start)
+					b.track_wins(true);
+				if(b.moves_made() >= start)
+					require_wins(b);
+				std::vector<Move> moves;
+				for(auto m : b)
+					moves.push_back(m);
+				REQUIRE(b.move(moves[rand() % moves.size()]));
+			}
+		}
+	}
+}
+
+TEST_CASE("Hex::Board::fill_outcome", "[hex][board]") {
+	XORShift_uint32 rand(7);
+	for(int game = 0; game < 200; game++){
+		Board b("7");
+
+		//start from a random unfinished position
+		int start = rand() % 20;
+		for(int i = 0; i < start && !b.outcome().solved(); i++){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			Board o = b;
+			o.move(moves[rand() % moves.size()]);
+			if(o.outcome().solved())
+				break;
+			b = o;
+		}
+
+		//fill the rest in random order, and play the same moves until someone wins
+		std::vector<Move> fill;
+		for(auto m : b)
+			fill.push_back(m);
+		for(int i = fill.size() - 1; i > 0; i--)
+			std::swap(fill[i], fill[rand() % (i + 1)]);
+
+		Board played = b;
+		for(auto m : fill){
+			if(played.outcome().solved())
+				break;
+			REQUIRE(played.move(m));
+		}
+		CAPTURE(b);
+		REQUIRE(played.outcome().solved());
+		REQUIRE(b.fill_outcome(fill.data(), fill.size()) == played.outcome());
+	}
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Hex::Board::fill_outcome benchmark", "[.][benchmark][hex][board]") {
+	XORShift_uint32 rand(7);
+	const int playouts = 100000;
+	Board root("11");
+	std::vector<Move> fill;
+	for(auto m : root)
+		fill.push_back(m);
+
+	int wins = 0;
+	Time start;
+	for(int n = 0; n < playouts; n++){
+		for(int i = fill.size() - 1; i > 0; i--)
+			std::swap(fill[i], fill[rand() % (i + 1)]);
+		Board b = root;
+		for(unsigned int i = 0; b.outcome() < Outcome::DRAW; i++)
+			b.move(fill[i], true, false);
+		wins += (b.outcome() == Outcome::P1);
+	}
+	double movetime = Time() - start;
+
+	start = Time();
+	for(int n = 0; n < playouts; n++){
+		for(int i = fill.size() - 1; i > 0; i--)
+			std::swap(fill[i], fill[rand() % (i + 1)]);
+		wins += (root.fill_outcome(fill.data(), fill.size()) == Outcome::P1);
+	}
+	double filltime = Time() - start;
+
+	WARN("11x11 from empty: move by move " + to_str(playouts/movetime/1000, 0) + "k playouts/s, " +
+	     "fill then evaluate " + to_str(playouts/filltime/1000, 0) + "k playouts/s (" + to_str(wins) + " P1 wins)");
+}
@@ -14,6 +14,13 @@ GTPResponse GTP::gtp_move_stats(vecstr args){
 	return GTPResponse(true, agent->move_stats(moves));
 }
 
+GTPResponse GTP::gtp_gc_stats(vecstr args){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	if(!mcts)
+		return GTPResponse(false, "Only the mcts agent has gc stats");
+	return GTPResponse(true, mcts->gc_stats());
+}
+
 GTPResponse GTP::gtp_solve(vecstr args){
 	if(hist->outcome() >= 0)
 		return GTPResponse(true, "resign");
@@ -27,7 +34,7 @@ GTPResponse GTP::gtp_solve(vecstr args){
 		logerr("time remain: " + to_str(time_control.remain, 1) + ", time: " + to_str(use_time, 3) + ", sims: " + to_str(time_control.max_sims) + "\n");
 
 	Time start;
-	agent->search(use_time, time_control.max_sims, verbose);
+	search(use_time);
 	time_control.use(Time() - start);
 
 
@@ -54,7 +61,7 @@ GTPResponse GTP::gtp_genmove(vecstr args){
 		logerr("time:        remain: " + to_str(time_control.remain, 1) + ", use: " + to_str(use_time, 3) + ", sims: " + to_str(time_control.max_sims) + "\n");
 
 	Time start;
-	agent->search(use_time, time_control.max_sims, verbose);
+	search(use_time);
 	time_control.use(Time() - start);
 
 
@@ -82,7 +89,12 @@ GTPResponse GTP::gtp_pv(vecstr args){
 
 GTPResponse GTP::gtp_params(vecstr args){
 //	if(dynamic_cast<AgentAB   *>(agent)) return gtp_ab_params(args);
-	if(dynamic_cast<AgentMCTS *>(agent)) return gtp_mcts_params(args);
+	if(dynamic_cast<AgentMCTS *>(agent)){
+		GTPResponse ret = gtp_mcts_params(args);
+		if(ret.success && args.size() > 0 && !workers.empty()) //keep the workers' settings the same
+			workers.run("params " + implode(args, " "));
+		return ret;
+	}
 	if(dynamic_cast<AgentPNS  *>(agent)) return gtp_pns_params(args);
 
 	return GTPResponse(false, "Unknown Agent type");
@@ -122,10 +134,21 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			"Processing:\n" +
 #ifndef SINGLE_THREAD
 			"  -t --threads     Number of MCTS threads                            [" + to_str(mcts->numthreads) + "]\n" +
+			"     --treegroup   Threads per tree, 0 for all threads in one tree   [" + to_str(mcts->treegroup) + "]\n" +
+			"     --treesync    Seconds between merging trees, 0 for at the end   [" + to_str(mcts->treesync) + "]\n" +
+			"     --treedepth   Plies of the trees to merge                       [" + to_str(mcts->treedepth) + "]\n" +
+			"     --treevisits  Only merge nodes with at least this many visits   [" + to_str(mcts->treevisits) + "]\n" +
+			"     --pipeline    Rollout worker threads, 0 for inline rollouts     [" + to_str(mcts->pipeline) + "]\n" +
 #endif
 			"  -o --ponder      Continue to ponder during the opponents time      [" + to_str(mcts->ponder) + "]\n" +
 			"  -M --maxmem      Max memory in Mb to use for the tree              [" + to_str(mcts->maxmem/(1024*1024)) + "]\n" +
+			"     --chunksize   Size in Mb of each block of memory for the tree   [" + to_str(mcts->ctmem.chunksize()/(1024*1024)) + "]\n" +
+			"     --hugepages   Tree memory: 0 heap, 1 transparent, 2 reserved    [" + to_str(mcts->ctmem.chunkalloc()) + "]\n" +
 			"     --profile     Output the time used by each phase of MCTS        [" + to_str(mcts->profile) + "]\n" +
+			"Distributed search:\n" +
+			"     --distdepth   Plies of the tree to share with the workers       [" + to_str(mcts->distdepth) + "]\n" +
+			"     --distvisits  Only share nodes with at least this many visits   [" + to_str(mcts->distvisits) + "]\n" +
+			"     --distsync    Seconds between exchanges, 0 for once at the end  [" + to_str(mcts->distsync) + "]\n" +
 			"Final move selection:\n" +
 			"  -E --msexplore   Lower bound constant in final move selection      [" + to_str(mcts->msexplore) + "]\n" +
 			"  -F --msrave      Rave factor, 0 for pure exp, -1 # sims, -2 # wins [" + to_str(mcts->msrave) + "]\n" +
@@ -142,10 +165,13 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			"  -I --dynwiden    Dynamic widening, consider log_wid(exp) children  [" + to_str(mcts->dynwiden) + "]\n" +
 			"Tree building:\n" +
 			"  -s --shortrave   Only use moves from short rollouts for rave       [" + to_str(mcts->shortrave) + "]\n" +
+			"     --ravebatch   Apply rave updates every n simulations, 0 for now [" + to_str(mcts->ravebatch) + "]\n" +
 			"  -k --keeptree    Keep the tree from the previous move              [" + to_str(mcts->keeptree) + "]\n" +
 			"  -m --minimax     Backup the minimax proof in the UCT tree          [" + to_str(mcts->minimax) + "]\n" +
 			"  -x --visitexpand Number of visits before expanding a node          [" + to_str(mcts->visitexpand) + "]\n" +
 			"     --gcsolved    Garbage collect solved nodes with fewer sims than [" + to_str(mcts->gcsolved) + "]\n" +
+			"     --gcinc       Garbage collect while searching, pausing briefly  [" + to_str(mcts->gcincremental) + "]\n" +
+			"     --dag         Share transposed subtrees, table size in Mb       [" + to_str(mcts->transpositions.memsize()/(1024*1024)) + "]\n" +
 			"  -L --longestloss For known losses take longest over hardest solve  [" + to_str(mcts->longestloss) + "]\n"+
 			"Node initialization knowledge, Give a bonus:\n" +
 			"  -l --localreply  based on the distance to the previous move        [" + to_str(mcts->localreply) + "]\n" +
@@ -158,7 +184,8 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			"  -h --weightrand  Weight the moves according to computed gammas     [" + to_str(mcts->weightedrandom) + "]\n" +
 			"  -p --pattern     Maintain the virtual connection pattern           [" + to_str(mcts->rolloutpattern) + "]\n" +
 			"  -g --goodreply   Reuse the last good reply (1), remove losses (2)  [" + to_str(mcts->lastgoodreply) + "]\n" +
-			"  -w --instantwin  Look for instant wins to this depth               [" + to_str(mcts->instantwin) + "]\n"
+			"  -w --instantwin  Take or block instant wins if > 0 (was a depth)   [" + to_str(mcts->instantwin) + "]\n" +
+			"     --fill        Fill the board, then find the winner, if no -p/g/w [" + to_str(mcts->fillrollout) + "]\n"
 			);
 
 	string errs;
@@ -166,17 +193,36 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 		string arg = args[i];
 
 		if((arg == "-t" || arg == "--threads") && i+1 < args.size()){
-			mcts->pool.pause();
-			mcts->numthreads = from_str<int>(args[++i]);
-			mcts->pool.set_num_threads(mcts->numthreads);
-			if(mcts->ponder)
-				mcts->pool.resume();
+			mcts->set_threads(from_str<int>(args[++i]), mcts->treegroup, mcts->pipeline);
+		}else if((               arg == "--treegroup") && i+1 < args.size()){
+			mcts->set_threads(mcts->numthreads, from_str<int>(args[++i]), mcts->pipeline);
+		}else if((               arg == "--treesync") && i+1 < args.size()){
+			mcts->treesync = from_str<float>(args[++i]);
+		}else if((               arg == "--treedepth") && i+1 < args.size()){
+			mcts->treedepth = from_str<int>(args[++i]);
+		}else if((               arg == "--treevisits") && i+1 < args.size()){
+			mcts->treevisits = from_str<uint>(args[++i]);
+		}else if((               arg == "--pipeline") && i+1 < args.size()){
+			mcts->set_threads(mcts->numthreads, mcts->treegroup, from_str<int>(args[++i]));
 		}else if((arg == "-o" || arg == "--ponder") && i+1 < args.size()){
 			mcts->set_ponder(from_str<bool>(args[++i]));
 		}else if((arg == "--profile") && i+1 < args.size()){
 			mcts->profile = from_str<bool>(args[++i]);
+		}else if((arg == "--distdepth") && i+1 < args.size()){
+			mcts->distdepth = from_str<int>(args[++i]);
+		}else if((arg == "--distvisits") && i+1 < args.size()){
+			mcts->distvisits = from_str<uint>(args[++i]);
+		}else if((arg == "--distsync") && i+1 < args.size()){
+			mcts->distsync = from_str<float>(args[++i]);
 		}else if((arg == "-M" || arg == "--maxmem") && i+1 < args.size()){
 			mcts->maxmem = from_str<uint64_t>(args[++i])*1024*1024;
+		}else if((arg == "--chunksize") && i+1 < args.size()){
+			mcts->ctmem.set_chunksize(from_str<uint64_t>(args[++i])*1024*1024);
+		}else if((arg == "--hugepages") && i+1 < args.size()){
+			int source = from_str<int>(args[++i]);
+			if(source < ChunkAlloc_Heap || source > ChunkAlloc_HugeTLB)
+				return GTPResponse(false, "Hugepages must be 0, 1 or 2");
+			mcts->ctmem.set_chunkalloc(ChunkAlloc(source));
 		}else if((arg == "-E" || arg == "--msexplore") && i+1 < args.size()){
 			mcts->msexplore = from_str<float>(args[++i]);
 		}else if((arg == "-F" || arg == "--msrave") && i+1 < args.size()){
@@ -193,6 +239,8 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			mcts->knowledge = from_str<bool>(args[++i]);
 		}else if((arg == "-s" || arg == "--shortrave") && i+1 < args.size()){
 			mcts->shortrave = from_str<bool>(args[++i]);
+		}else if((               arg == "--ravebatch") && i+1 < args.size()){
+			mcts->ravebatch = from_str<int>(args[++i]);
 		}else if((arg == "-k" || arg == "--keeptree") && i+1 < args.size()){
 			mcts->keeptree = from_str<bool>(args[++i]);
 		}else if((arg == "-m" || arg == "--minimax") && i+1 < args.size()){
@@ -201,6 +249,13 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			mcts->longestloss = from_str<bool>(args[++i]);
 		}else if((               arg == "--gcsolved") && i+1 < args.size()){
 			mcts->gcsolved = from_str<uint>(args[++i]);
+		}else if((               arg == "--gcinc") && i+1 < args.size()){
+			mcts->gcincremental = from_str<bool>(args[++i]);
+		}else if((               arg == "--dag") && i+1 < args.size()){
+			mcts->pool.pause();
+			mcts->transpositions.resize(from_str<uint64_t>(args[++i])*1024*1024);
+			if(mcts->ponder)
+				mcts->pool.resume();
 		}else if((arg == "-r" || arg == "--userave") && i+1 < args.size()){
 			mcts->userave = from_str<float>(args[++i]);
 		}else if((arg == "-X" || arg == "--useexplore") && i+1 < args.size()){
@@ -236,6 +291,8 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			mcts->lastgoodreply = from_str<int>(args[++i]);
 		}else if((arg == "-w" || arg == "--instantwin") && i+1 < args.size()){
 			mcts->instantwin = from_str<int>(args[++i]);
+		}else if((               arg == "--fill") && i+1 < args.size()){
+			mcts->fillrollout = from_str<bool>(args[++i]);
 		}else{
 			return GTPResponse(false, "Missing or unknown parameter");
 		}
@@ -285,5 +342,189 @@ GTPResponse GTP::gtp_pns_params(vecstr args){
 	return GTPResponse(true, errs);
 }
 
+
+//search with the agent, and with the workers of a distributed search if there are any
+//the search is split into rounds of distsync seconds, and after each one all the processes
+//share the experience they gained in the top of their trees, so the move is chosen from the
+//experience of all of them
+void GTP::search(double time){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	if(!mcts || workers.empty()){
+		agent->search(time, time_control.max_sims, verbose);
+		return;
+	}
+
+	Time start;
+	uint64_t runs = 0;
+	double remain = time;
+	while(true){
+		double round = (mcts->distsync > 0 ? std::min<double>(mcts->distsync, remain) : remain);
+		bool last = (remain - round < 0.001);
+
+		workers.send("dist_search " + to_str(round, 3));
+		mcts->search(round, time_control.max_sims, (last ? verbose : 0));
+		runs += mcts->lastruns;
+
+		//each process gets the experience of all the others
+		vecstr stats(1, mcts->dist_collect());
+		for(unsigned int i = 0; i < workers.size(); i++){
+			GTPResponse r = workers.response(i);
+			vecstr parts = explode(r.response, " ", 2);
+			if(r.success)
+				runs += from_str<uint64_t>(parts[0]);
+			stats.push_back(r.success && parts.size() == 2 ? " " + parts[1] : "");
+		}
+		for(unsigned int i = 0; i < workers.size(); i++){
+			string others;
+			for(unsigned int j = 0; j < stats.size(); j++)
+				if(j != i + 1)
+					others += stats[j];
+			workers.send(i, "dist_merge" + others);
+		}
+		string others;
+		for(unsigned int j = 1; j < stats.size(); j++)
+			others += stats[j];
+		mcts->dist_apply(explode(others, " "));
+		for(unsigned int i = 0; i < workers.size(); i++)
+			workers.response(i);
+
+		remain = time - (Time() - start);
+		if(last || remain < 0.001 || mcts->root.outcome() >= Outcome::DRAW ||
+		   (time_control.max_sims > 0 && runs >= (uint64_t)time_control.max_sims))
+			break;
+	}
+
+	if(verbose){
+		double time_used = Time() - start;
+		logerr("Distributed: " + to_str(runs) + " runs by " + to_str(workers.size() + 1) + " processes in " +
+			to_str(time_used*1000, 0) + " msec: " + to_str(runs/time_used, 0) + " Games/s\n");
+	}
+}
+
+//the current mcts settings as arguments to params, so the workers search the same way
+string GTP::mcts_params_args(){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	return string() +
+		" --threads "     + to_str(mcts->numthreads) +
+		" --treegroup "   + to_str(mcts->treegroup) +
+		" --treesync "    + to_str(mcts->treesync) +
+		" --treedepth "   + to_str(mcts->treedepth) +
+		" --treevisits "  + to_str(mcts->treevisits) +
+		" --pipeline "    + to_str(mcts->pipeline) +
+		" --ponder "      + to_str(mcts->ponder) +
+		" --maxmem "      + to_str(mcts->maxmem/(1024*1024)) +
+		" --chunksize "   + to_str(mcts->ctmem.chunksize()/(1024*1024)) +
+		" --hugepages "   + to_str(mcts->ctmem.chunkalloc()) +
+		" --profile "     + to_str(mcts->profile) +
+		" --distdepth "   + to_str(mcts->distdepth) +
+		" --distvisits "  + to_str(mcts->distvisits) +
+		" --distsync "    + to_str(mcts->distsync) +
+		" --msexplore "   + to_str(mcts->msexplore) +
+		" --msrave "      + to_str(mcts->msrave) +
+		" --explore "     + to_str(mcts->explore) +
+		" --parexplore "  + to_str(mcts->parentexplore) +
+		" --ravefactor "  + to_str(mcts->ravefactor) +
+		" --decrrave "    + to_str(mcts->decrrave) +
+		" --knowledge "   + to_str(mcts->knowledge) +
+		" --userave "     + to_str(mcts->userave) +
+		" --useexplore "  + to_str(mcts->useexplore) +
+		" --fpurgency "   + to_str(mcts->fpurgency) +
+		" --rollouts "    + to_str(mcts->rollouts) +
+		" --dynwiden "    + to_str(mcts->dynwiden) +
+		" --shortrave "   + to_str(mcts->shortrave) +
+		" --ravebatch "   + to_str(mcts->ravebatch) +
+		" --keeptree "    + to_str(mcts->keeptree) +
+		" --minimax "     + to_str(mcts->minimax) +
+		" --visitexpand " + to_str(mcts->visitexpand) +
+		" --gcsolved "    + to_str(mcts->gcsolved) +
+		" --gcinc "       + to_str(mcts->gcincremental) +
+		" --dag "         + to_str(mcts->transpositions.memsize()/(1024*1024)) +
+		" --longestloss " + to_str(mcts->longestloss) +
+		" --localreply "  + to_str(mcts->localreply) +
+		" --locality "    + to_str(mcts->locality) +
+		" --connect "     + to_str(mcts->connect) +
+		" --size "        + to_str(mcts->size) +
+		" --bridge "      + to_str(mcts->bridge) +
+		" --distance "    + to_str(mcts->dists) +
+		" --weightrand "  + to_str(mcts->weightedrandom) +
+		" --pattern "     + to_str(mcts->rolloutpattern) +
+		" --goodreply "   + to_str(mcts->lastgoodreply) +
+		" --instantwin "  + to_str(mcts->instantwin) +
+		" --fill "        + to_str(mcts->fillrollout);
+}
+
+//give new workers the same settings
+void GTP::dist_set_params(){
+	if(workers.empty())
+		return;
+
+	if(dynamic_cast<AgentMCTS *>(agent))
+		workers.run("params" + mcts_params_args());
+	workers.run("time " + time_control.to_args());
+}
+
+//put the workers on the same position
+void GTP::dist_set_board(){
+	if(workers.empty())
+		return;
+
+	string moves;
+	for(auto m : hist)
+		moves += " " + m.to_s();
+
+	workers.run("boardsize " + hist->size());
+	if(!moves.empty())
+		workers.run("playgame" + moves);
+}
+
+GTPResponse GTP::gtp_dist_spawn(vecstr args){
+	if(args.size() != 1)
+		return GTPResponse(false, "Wrong number of arguments");
+
+	string error;
+	if(!workers.spawn(from_str<int>(args[0]), error))
+		return GTPResponse(false, error);
+	dist_set_params();
+	dist_set_board();
+	return GTPResponse(true, to_str(workers.size()) + " workers");
+}
+
+GTPResponse GTP::gtp_dist_listen(vecstr args){
+	if(args.size() != 2)
+		return GTPResponse(false, "Wrong number of arguments");
+
+	string error;
+	if(!workers.listen(args[0], from_str<int>(args[1]), error))
+		return GTPResponse(false, error);
+	dist_set_params();
+	dist_set_board();
+	return GTPResponse(true, to_str(workers.size()) + " workers");
+}
+
+GTPResponse GTP::gtp_dist_stop(vecstr args){
+	workers.stop();
+	return GTPResponse(true);
+}
+
+GTPResponse GTP::gtp_dist_search(vecstr args){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	if(!mcts)
+		return GTPResponse(false, "A distributed search needs the mcts agent");
+	if(args.size() != 1)
+		return GTPResponse(false, "Wrong number of arguments");
+
+	mcts->search(from_str<double>(args[0]), 0, 0);
+	return GTPResponse(true, to_str(mcts->lastruns) + mcts->dist_collect());
+}
+
+GTPResponse GTP::gtp_dist_merge(vecstr args){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	if(!mcts)
+		return GTPResponse(false, "A distributed search needs the mcts agent");
+
+	mcts->dist_apply(args);
+	return GTPResponse(true);
+}
+
 }; // namespace Hex
 }; // namespace Morat
@@ -313,5 +313,69 @@ GTPResponse GTP::gtp_load_sgf(vecstr args){
 	return true;
 }
 
+GTPResponse GTP::gtp_save_tree(vecstr args){
+	if(args.size() == 0)
+		return GTPResponse(true, "save_tree <filename>");
+
+	std::ifstream infile(args[0].c_str());
+
+	if(infile) {
+		infile.close();
+		return GTPResponse(false, "File " + args[0] + " already exists");
+	}
+
+	std::vector<Move> moves;
+	for(auto m : hist)
+		moves.push_back(m);
+
+	std::string error;
+	if(!agent->save_tree(args[0], moves, error))
+		return GTPResponse(false, error);
+	return true;
+}
+
+GTPResponse GTP::gtp_load_tree(vecstr args){
+	if(args.size() == 0)
+		return GTPResponse(true, "load_tree <filename>");
+
+	TreeFile file;
+	std::string error;
+	if(!file.open(args[0], error))
+		return GTPResponse(false, error);
+
+	if(file.game() != Board::name)
+		return GTPResponse(false, "File is for the wrong game: " + file.game());
+
+	if(!file.matches_moves<Move>())
+		return GTPResponse(false, "File is from a different build");
+
+	if(!agent->can_load(file, error))
+		return GTPResponse(false, error);
+
+	auto size = file.size();
+	if(size != hist->size() && hist.len() != 0)
+		return GTPResponse(false, "File has the wrong boardsize to match the existing game");
+
+	// play the moves on a copy first, so a bad file leaves the game untouched
+	Board board = (size == hist->size() ? *hist : Board(size));
+	auto moves = file.moves<Move>();
+	for(auto m : moves)
+		if(!board.move(m))
+			return GTPResponse(false, "File has an illegal move: " + m.to_s());
+
+	if(size != hist->size()){
+		hist = History<Board>(Board(size));
+		set_board();
+		time_control.new_game();
+	}
+
+	for(auto m : moves)
+		move(m); // push the game forward
+
+	if(!agent->load_tree(file, error))
+		return GTPResponse(false, error);
+	return true;
+}
+
 }; // namespace Hex
 }; // namespace Morat
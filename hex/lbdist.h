@@ -9,13 +9,18 @@
 namespace Morat {
 namespace Hex {
 
-class LBDists : public LBDistsBase<LBDists, Board> {
+class LBDists : public LBDistsBase<LBDists, Board, BitBoard<Board::max_size, Board::max_size, -1>> {
 
 public:
 	LBDists() : LBDistsBase() {}
 	LBDists(const Board * b) : LBDistsBase(b) { }
 
 	void init_player(bool crossvcs, Side player){
+		init_player_bits(crossvcs, player);
+	}
+
+	//the flood fills one cell at a time, as the reference for init_player_bits
+	void init_player_flood(bool crossvcs, Side player){
 		int m = board->lines();
 		int m1 = m-1;
 
@@ -28,6 +33,26 @@ public:
 		}
 	}
 
+	//the same distances as the flood fills, but found a whole layer at a time on bitboards
+	void init_player_bits(bool crossvcs, Side player){
+		int m = board->lines();
+		int m1 = m-1;
+
+		start_bits(player);
+
+		Bits start[2];
+		if (player == Side::P1) {
+			for(int y = 0; y < m; y++) { seed_bits(start[0], 0,  y, 0,  player); }  // p1 edge 0
+			for(int y = 0; y < m; y++) { seed_bits(start[1], m1, y, 1,  player); }  // p1 edge 1
+		} else {
+			for(int x = 0; x < m; x++) { seed_bits(start[0], x,  0, 0,  player); }  // p2 edge 0
+			for(int x = 0; x < m; x++) { seed_bits(start[1], x, m1, 1,  player); }  // p2 edge 1
+		}
+
+		for(int edge = 0; edge < 2; edge++)
+			flood_bits(edge, player, start[edge]);
+	}
+
 	int _get(int pos, Side player){
 		return dist(0, player, pos) + dist(1, player, pos);
 	}
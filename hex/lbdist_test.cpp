@@ -0,0 +1,131 @@
+
+#include "../lib/catch.hpp"
+#include "../lib/string.h"
+#include "../lib/time.h"
+#include "../lib/xorshift.h"
+
+#include "board.h"
+#include "lbdist.h"
+
+
+using namespace Morat;
+using namespace Hex;
+
+namespace Morat {
+namespace Hex {
+
+//exposes the raw distances of each edge, and the original flood fills
+class TestDists : public LBDists {
+public:
+	int raw(int edge, Side player, int xy) { return dist(edge, player, xy); }
+
+	void run_flood(const Board * b, bool crossvcs) {
+		run(b, crossvcs, Side::NONE);
+		init_player_flood(crossvcs, Side::P1);
+		init_player_flood(crossvcs, Side::P2);
+	}
+};
+
+}; // namespace Hex
+}; // namespace Morat
+
+//the edges/players/cells where a and b differ
+static std::string dist_diffs(TestDists & a, TestDists & b, const Board & board) {
+	std::string diffs;
+	for(int edge = 0; edge < Board::LBDist_directions; edge++)
+		for(Side player : {Side::P1, Side::P2})
+			for(int xy = 0; xy < board.vec_size(); xy++)
+				if(board.get(xy) != Side::UNDEF && a.raw(edge, player, xy) != b.raw(edge, player, xy))
+					diffs += " " + to_str(edge) + "/" + player.to_s() + "/" + board.yx(xy).to_s();
+	return diffs;
+}
+
+TEST_CASE("Hex::LBDists bitboards", "[hex][LBDists]") {
+	XORShift_uint32 rand(24);
+	for(int size : {5, 11, 25}){
+		for(bool crossvcs : {true, false}){
+			for(int game = 0; game < 10; game++){
+				Board b(to_str(size));
+				std::vector<Move> moves;
+				for(auto m : b)
+					moves.push_back(m);
+				for(int i = moves.size() - 1; i > 0; i--)
+					std::swap(moves[i], moves[rand() % (i + 1)]);
+
+				TestDists bits, flood;
+				for(int i = 0; b.outcome() < Outcome::DRAW; i++){
+					REQUIRE(b.move(moves[i]));
+					bits.run(&b, crossvcs);
+					flood.run_flood(&b, crossvcs);
+					CAPTURE(b);
+					REQUIRE(dist_diffs(bits, flood, b) == "");
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("Hex::LBDists::move", "[hex][LBDists]") {
+	XORShift_uint32 rand(42);
+	for(int size : {5, 8, 11}){
+		for(bool crossvcs : {true, false}){
+			for(int game = 0; game < 30; game++){
+				Board b(to_str(size));
+				std::vector<Move> moves;
+				for(auto m : b)
+					moves.push_back(m);
+				for(int i = moves.size() - 1; i > 0; i--)
+					std::swap(moves[i], moves[rand() % (i + 1)]);
+
+				TestDists inc, full;
+				inc.run(&b, crossvcs);
+				for(int i = 0; b.outcome() < Outcome::DRAW; i++){
+					REQUIRE(b.move(moves[i]));
+					inc.move(&b, MoveValid(moves[i], b.xy(moves[i])));
+					full.run(&b, crossvcs);
+
+					CAPTURE(b);
+					CAPTURE(moves[i]);
+					REQUIRE(dist_diffs(inc, full, b) == "");
+				}
+			}
+		}
+	}
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Hex::LBDists bitboards benchmark", "[.][benchmark][hex][LBDists]") {
+	//the distances of positions from random games, found by the flood fills or on bitboards
+	for(int size : {8, 13, 19, 25}){
+		XORShift_uint32 rand(size);
+		Board root(to_str(size));
+		std::vector<Move> moves;
+		for(auto m : root)
+			moves.push_back(m);
+
+		std::vector<Board> positions;
+		for(int game = 0; game < 20; game++){
+			for(int i = moves.size() - 1; i > 0; i--)
+				std::swap(moves[i], moves[rand() % (i + 1)]);
+			Board b = root;
+			for(int i = 0; b.outcome() < Outcome::DRAW; i++){
+				b.move(moves[i]);
+				positions.push_back(b);
+			}
+		}
+
+		TestDists d;
+		Time start;
+		for(const Board & b : positions)
+			d.run_flood(&b, true);
+		double floodtime = Time() - start;
+
+		start = Time();
+		for(const Board & b : positions)
+			d.run(&b, true);
+		double bitstime = Time() - start;
+
+		WARN("size " + to_str(size) + ": flood " + to_str(floodtime*1000000/positions.size(), 1) +
+		     " us/run, bits " + to_str(bitstime*1000000/positions.size(), 1) + " us/run");
+	}
+}
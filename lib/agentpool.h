@@ -75,6 +75,11 @@ public:
 		return num_threads;
 	}
 
+	//whether the threads are searching, as opposed to paused, stopping or garbage collecting
+	bool running() const {
+		return thread_state == Thread_Running;
+	}
+
 	typename std::vector<typename AgentType::AgentThread *>::const_iterator begin() const { return threads.begin(); }
 	typename std::vector<typename AgentType::AgentThread *>::const_iterator end()   const { return threads.end(); }
 
@@ -181,6 +186,7 @@ public:
 
 	virtual void init() { }  // for setting up the subclass's variables
 	virtual void reset() { } // for getting ready for the next search
+	virtual void pausing() { } // about to wait while the tree may be changed, so drop any pointers into it
 
 	int join(){ return thread.join(); }
 
@@ -200,6 +206,7 @@ private:
 				break;
 
 			case Thread_Wait_End:   //threads are waiting to end
+				pausing();
 				pool->run_barrier.wait();
 				CAS(pool->thread_state, Thread_Wait_End, Thread_Wait_Start);
 				break;
@@ -218,6 +225,7 @@ private:
 
 			case Thread_GC:         //one thread is running garbage collection, the rest are waiting
 			case Thread_GC_End:     //once done garbage collecting, go to wait_end instead of back to running
+				pausing();
 				if(pool->gc_barrier.wait()){
 					agent->start_gc();
 					CAS(pool->thread_state, Thread_GC,     Thread_Running);
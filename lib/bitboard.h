@@ -0,0 +1,239 @@
+#pragma once
+
+//A set of cells of a hex grid board, one bit per cell, so whole groups and regions can be
+//grown and tested with shifts and masks instead of walking them cell by cell.
+//
+//Cell x,y is bit y*stride + x. The rows have a spare bit past the widest row of the biggest
+//board, so a shift by 1 never steps from the end of one row onto the start of the next, or the
+//start of the row before. The 6 direct neighbors are then the shifts by 1, stride, and stride+1
+//or stride-1 each way, depending on which diagonal the grid connects: Havannah's neighbors are
+//x+1,y+1 and x-1,y-1, while Hex, Y and Rex have x+1,y-1 and x-1,y+1. Shifts can leave bits off
+//the board, so mask the results with the board.
+//
+//The words are the lanes of one gcc vector, 8 lanes for up to 512 bits, like a size 10 Havannah
+//board, or 16 for up to 1024, like a 25x25 Hex or Y board. Built for AVX-512, as the default
+//-march=native does on hardware that has it, each operation is one or two instructions, or a few
+//with AVX2, and otherwise gcc splits them into SSE or scalar ops. A shift carries between the
+//words by moving every lane over by one. The lanes past the last word are always zero.
+//
+//The vectors are only ever passed by reference or inside a BitBoard, since passing a 64 byte
+//vector by value depends on whether AVX-512 is enabled, which gcc warns about without it.
+
+#include <stdint.h>
+
+
+namespace Morat {
+
+//the vector types and lane shuffles for a number of lanes
+template<int Lanes> struct BitLanes;
+
+template<> struct BitLanes<8> {
+	typedef uint64_t Vec    __attribute__((vector_size(64)));
+	typedef uint64_t Stored __attribute__((vector_size(64), aligned(8))); //so boards don't need an over-aligned new
+	typedef int64_t  Index  __attribute__((vector_size(64)));
+
+	//each lane replaced by the one below or above it, with zero shifted in
+	static void up(const Vec & v, Vec & out) {
+		Vec z = {};
+#if defined(__clang__)
+		out = __builtin_shufflevector(v, z, 8, 0, 1, 2, 3, 4, 5, 6);
+#else
+		Index i = {8, 0, 1, 2, 3, 4, 5, 6};
+		out = __builtin_shuffle(v, z, i);
+#endif
+	}
+	static void down(const Vec & v, Vec & out) {
+		Vec z = {};
+#if defined(__clang__)
+		out = __builtin_shufflevector(v, z, 1, 2, 3, 4, 5, 6, 7, 8);
+#else
+		Index i = {1, 2, 3, 4, 5, 6, 7, 8};
+		out = __builtin_shuffle(v, z, i);
+#endif
+	}
+};
+
+template<> struct BitLanes<16> {
+	typedef uint64_t Vec    __attribute__((vector_size(128)));
+	typedef uint64_t Stored __attribute__((vector_size(128), aligned(8)));
+	typedef int64_t  Index  __attribute__((vector_size(128)));
+
+	static void up(const Vec & v, Vec & out) {
+		Vec z = {};
+#if defined(__clang__)
+		out = __builtin_shufflevector(v, z, 16, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);
+#else
+		Index i = {16, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14};
+		out = __builtin_shuffle(v, z, i);
+#endif
+	}
+	static void down(const Vec & v, Vec & out) {
+		Vec z = {};
+#if defined(__clang__)
+		out = __builtin_shufflevector(v, z, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+#else
+		Index i = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+		out = __builtin_shuffle(v, z, i);
+#endif
+	}
+};
+
+//Width is the widest row of the biggest board, Rows the number of rows, and Diagonal is 1 if
+//the diagonal neighbors are x+1,y+1 and x-1,y-1, or -1 if they're x+1,y-1 and x-1,y+1
+template<int Width, int Rows, int Diagonal>
+class BitBoard {
+public:
+	static const int stride = Width + 1;
+	static const int words  = (stride * Rows + 63) / 64;
+
+private:
+	static const int nlanes = (words <= 8 ? 8 : 16);
+	static_assert(words <= 16, "too many cells for a BitBoard");
+	static_assert(Diagonal == 1 || Diagonal == -1, "a hex grid connects one of the diagonals");
+
+	typedef BitLanes<nlanes>        L;
+	typedef typename L::Vec         Vec;
+	typedef typename L::Stored      Stored;
+
+	Stored w;
+
+	static void lanes(Vec & m) { //all the bits of the real words
+		Vec z = {};
+		m = z;
+		for(int i = 0; i < words; i++)
+			m[i] = ~0ull;
+	}
+
+	BitBoard(const Vec & v) : w(v) { }
+
+public:
+	BitBoard() {
+		clear();
+	}
+
+	static int index(int x, int y) { return y*stride + x; }
+
+	static BitBoard cell(int i) {
+		BitBoard b;
+		b.set(i);
+		return b;
+	}
+
+	void clear() {
+		Vec z = {};
+		w = z;
+	}
+
+	bool get(int i) const { return (w[i >> 6] >> (i & 63)) & 1; }
+	void set(int i)       { w[i >> 6] |=  (1ull << (i & 63)); }
+	void unset(int i)     { w[i >> 6] &= ~(1ull << (i & 63)); }
+
+	bool none() const {
+		uint64_t r = 0;
+		for(int i = 0; i < words; i++)
+			r |= w[i];
+		return r == 0;
+	}
+	bool any() const { return !none(); }
+
+	int count() const {
+		int c = 0;
+		for(int i = 0; i < words; i++)
+			c += __builtin_popcountll(w[i]);
+		return c;
+	}
+
+	bool operator == (const BitBoard & o) const { return (*this ^ o).none(); }
+	bool operator != (const BitBoard & o) const { return !(*this == o); }
+
+	BitBoard operator & (const BitBoard & o) const { return BitBoard((Vec)w & (Vec)o.w); }
+	BitBoard operator | (const BitBoard & o) const { return BitBoard((Vec)w | (Vec)o.w); }
+	BitBoard operator ^ (const BitBoard & o) const { return BitBoard((Vec)w ^ (Vec)o.w); }
+	BitBoard operator ~ () const {
+		Vec m;
+		lanes(m);
+		return BitBoard(~(Vec)w & m);
+	}
+	BitBoard & operator &= (const BitBoard & o) { w = (Vec)w & (Vec)o.w; return *this; }
+	BitBoard & operator |= (const BitBoard & o) { w = (Vec)w | (Vec)o.w; return *this; }
+	BitBoard & operator ^= (const BitBoard & o) { w = (Vec)w ^ (Vec)o.w; return *this; }
+
+	//these cells, without the ones in o
+	BitBoard andnot(const BitBoard & o) const { return BitBoard((Vec)w & ~(Vec)o.w); }
+
+	//move every cell n bits up or down, 0 < n < 64
+	BitBoard operator << (int n) const {
+		Vec v = w, u, m;
+		L::up(v, u);
+		lanes(m);
+		return BitBoard(((v << n) | (u >> (64 - n))) & m);
+	}
+	BitBoard operator >> (int n) const {
+		Vec v = w, d;
+		L::down(v, d);
+		return BitBoard((v >> n) | (d << (64 - n)));
+	}
+
+	//move every cell one step in direction dir, in the order of the first 6 neighbor_offsets
+	BitBoard shift(int dir) const {
+		if(Diagonal > 0){
+			switch(dir){ //-1,-1  0,-1  1,0  1,1  0,1  -1,0
+				case 0:  return *this >> (stride + 1);
+				case 1:  return *this >> stride;
+				case 2:  return *this << 1;
+				case 3:  return *this << (stride + 1);
+				case 4:  return *this << stride;
+				default: return *this >> 1;
+			}
+		}else{
+			switch(dir){ //0,-1  1,-1  1,0  0,1  -1,1  -1,0
+				case 0:  return *this >> stride;
+				case 1:  return *this >> (stride - 1);
+				case 2:  return *this << 1;
+				case 3:  return *this << stride;
+				case 4:  return *this << (stride - 1);
+				default: return *this >> 1;
+			}
+		}
+	}
+
+	//call f with the index of each set bit, lowest first
+	template<class Func> void each(Func f) const {
+		for(int i = 0; i < words; i++)
+			for(uint64_t b = w[i]; b; b &= b - 1)
+				f(i*64 + __builtin_ctzll(b));
+	}
+
+	//these cells and all their neighbors: the ones beside them in the row, and those shifted
+	//a row up or down, which with the ones beside them covers the diagonal shifts too
+	BitBoard grow() const {
+		BitBoard left = *this | (*this << 1), right = *this | (*this >> 1);
+		if(Diagonal > 0)
+			return left | right | (left << stride) | (right >> stride);
+		else
+			return left | right | (right << stride) | (left >> stride);
+	}
+
+	//the cells of mask connected to these ones through mask, which should include these
+	BitBoard flood(const BitBoard & mask) const {
+		BitBoard cur = *this, next;
+		while((next = cur.grow() & mask) != cur)
+			cur = next;
+		return cur;
+	}
+
+	//flood through mask like flood, but stop as soon as it reaches any of the cells in stop,
+	//returning whether it did, with the cells it got to in filled
+	bool floods_to(const BitBoard & mask, const BitBoard & stop, BitBoard & filled) const {
+		filled = *this;
+		while((filled & stop).none()){
+			BitBoard next = filled.grow() & mask;
+			if(next == filled)
+				return false;
+			filled = next;
+		}
+		return true;
+	}
+};
+
+}; // namespace Morat
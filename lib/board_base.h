@@ -32,6 +32,17 @@ protected:
 		}
 	}
 
+	//clear the pattern bits of a position that was just emptied by an undo
+	void undo_pattern(const MoveValid& pos) {
+		Pattern p = 3;
+		for (auto m : self()->neighbors_large(pos)) {
+			if(m.on_board()){
+				self()->cells_[m.xy].pattern &= ~p;
+			}
+			p <<= 2;
+		}
+	}
+
 	Pattern init_pattern(const MoveValid& pos) {
 		Pattern p = 0, j = 3;
 		for (const MoveValid m : self()->neighbors_large(pos)) {
@@ -0,0 +1,212 @@
+
+#pragma once
+
+//Picks the child to descend into during the tree walk, scoring a block of children at a time.
+//
+//The counts of a block of children are gathered into arrays first, which also deals with the
+//solved children and the dynamic widening limit, then the values are computed over the arrays,
+//8 children per instruction with AVX2, and the best is kept across blocks.
+//
+//The children of each child that takes the lead in visits while gathering, and then in value,
+//get prefetched, so the descent into the winner usually doesn't stall on a cache miss,
+//without loading the children of every child.
+//
+//The value is the same as Node::value() plus the UCT exploration term, with the same float and
+//double operations in the same order, so it picks the same child as scoring them one at a time.
+
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "outcome.h"
+
+namespace Morat {
+
+struct ChildSelectParams {
+	float ravefactor;  //rave factor for this node, <= min_rave to ignore rave
+	float min_rave;
+	float fpurgency;   //value of an unplayed child
+	bool  knowledge;
+	float explore;     //UCT constant, 0 to skip exploration
+	float logvisits;   //log of the parent's visits
+	int   dynwidenlim; //how many more unsolved children to look at
+};
+
+template<class Node>
+class ChildSelect {
+	static const int BLOCK = 64;
+
+	struct Block {
+		float expnum[BLOCK];
+		float expsum[BLOCK]; //wins count as 2
+		float ravenum[BLOCK];
+		float ravesum[BLOCK];
+		float know[BLOCK];
+		float solved[BLOCK]; //0 for unsolved, else the value of the solved child
+		float val[BLOCK];
+		Node * node[BLOCK];
+		int num;
+	};
+
+	//the value of one child, the same operations as Node::value() and the exploration in choose_move
+	static float score(const Block & b, int i, const ChildSelectParams & p){
+		if(b.solved[i] != 0)
+			return b.solved[i];
+
+		float expnum = b.expnum[i], ravenum = b.ravenum[i];
+		float val = p.fpurgency;
+		if(p.ravefactor <= p.min_rave){
+			if(expnum > 0)
+				val = 0.5f*b.expsum[i]/expnum;
+		}else if(ravenum > 0 || expnum > 0){
+			float alpha = p.ravefactor/(p.ravefactor + expnum);
+			val = 0;
+			if(ravenum > 0) val += alpha*(0.5f*b.ravesum[i]/ravenum);
+			if(expnum  > 0) val += (1.0f-alpha)*(0.5f*b.expsum[i]/expnum);
+		}
+
+		if(p.knowledge && b.know[i] > 0){
+			if(expnum <= 1)
+				val += 0.01f * b.know[i];
+			else if(expnum < 1000)
+				val += 0.01f * b.know[i] / sqrt((double)expnum);
+		}
+
+		if(p.explore > 0)
+			val += p.explore*sqrt((double)(p.logvisits/(expnum + 1)));
+
+		return val;
+	}
+
+#ifdef __AVX2__
+	static __m256 add_double(__m256 val, __m256d lo, __m256d hi){
+		__m256d vlo = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(val)), lo);
+		__m256d vhi = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(val, 1)), hi);
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(vlo)), _mm256_cvtpd_ps(vhi), 1);
+	}
+	static __m256d lo_pd(__m256 v){ return _mm256_cvtps_pd(_mm256_castps256_ps128(v)); }
+	static __m256d hi_pd(__m256 v){ return _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)); }
+
+	//score children [i, i+8)
+	static void score8(Block & b, int i, const ChildSelectParams & p){
+		const __m256 zero = _mm256_setzero_ps(),
+		             half = _mm256_set1_ps(0.5f),
+		             one  = _mm256_set1_ps(1.0f);
+
+		__m256 expnum  = _mm256_loadu_ps(b.expnum + i),
+		       ravenum = _mm256_loadu_ps(b.ravenum + i);
+		__m256 expplayed  = _mm256_cmp_ps(expnum, zero, _CMP_GT_OQ),
+		       raveplayed = _mm256_cmp_ps(ravenum, zero, _CMP_GT_OQ);
+		__m256 expavg = _mm256_div_ps(_mm256_mul_ps(half, _mm256_loadu_ps(b.expsum + i)), expnum);
+
+		__m256 val = _mm256_set1_ps(p.fpurgency);
+		if(p.ravefactor <= p.min_rave){
+			val = _mm256_blendv_ps(val, expavg, expplayed);
+		}else{
+			__m256 rf = _mm256_set1_ps(p.ravefactor);
+			__m256 alpha = _mm256_div_ps(rf, _mm256_add_ps(rf, expnum));
+			__m256 raveavg = _mm256_div_ps(_mm256_mul_ps(half, _mm256_loadu_ps(b.ravesum + i)), ravenum);
+			__m256 v = _mm256_and_ps(_mm256_mul_ps(alpha, raveavg), raveplayed);
+			v = _mm256_blendv_ps(v, _mm256_add_ps(v, _mm256_mul_ps(_mm256_sub_ps(one, alpha), expavg)), expplayed);
+			val = _mm256_blendv_ps(val, v, _mm256_or_ps(expplayed, raveplayed));
+		}
+
+		if(p.knowledge){
+			__m256 know = _mm256_loadu_ps(b.know + i);
+			__m256 useknow = _mm256_cmp_ps(know, zero, _CMP_GT_OQ);
+			if(_mm256_movemask_ps(useknow)){
+				__m256 k = _mm256_mul_ps(_mm256_set1_ps(0.01f), know);
+				__m256 fresh = _mm256_cmp_ps(expnum, one, _CMP_LE_OQ);
+				__m256 young = _mm256_andnot_ps(fresh, _mm256_cmp_ps(expnum, _mm256_set1_ps(1000), _CMP_LT_OQ));
+				__m256 v1 = _mm256_add_ps(val, k);
+				__m256 v2 = add_double(val,
+					_mm256_div_pd(lo_pd(k), _mm256_sqrt_pd(lo_pd(expnum))),
+					_mm256_div_pd(hi_pd(k), _mm256_sqrt_pd(hi_pd(expnum))));
+				val = _mm256_blendv_ps(val, v1, _mm256_and_ps(useknow, fresh));
+				val = _mm256_blendv_ps(val, v2, _mm256_and_ps(useknow, young));
+			}
+		}
+
+		if(p.explore > 0){
+			__m256 t = _mm256_div_ps(_mm256_set1_ps(p.logvisits), _mm256_add_ps(expnum, one));
+			__m256d explore = _mm256_set1_pd(p.explore);
+			val = add_double(val,
+				_mm256_mul_pd(explore, _mm256_sqrt_pd(lo_pd(t))),
+				_mm256_mul_pd(explore, _mm256_sqrt_pd(hi_pd(t))));
+		}
+
+		__m256 solved = _mm256_loadu_ps(b.solved + i);
+		val = _mm256_blendv_ps(val, solved, _mm256_cmp_ps(solved, zero, _CMP_NEQ_OQ));
+		_mm256_storeu_ps(b.val + i, val);
+	}
+#endif
+
+	static void score_block(Block & b, const ChildSelectParams & p){
+		int i = 0;
+#ifdef __AVX2__
+		for(; i + 8 <= b.num; i += 8)
+			score8(b, i, p);
+#endif
+		for(; i < b.num; i++)
+			b.val[i] = score(b, i, p);
+	}
+
+public:
+	//returns the child with the highest value, or a winning child as soon as it's found
+	static Node * choose(Node * child, Node * end, Side to_play, const ChildSelectParams & p){
+		Block b;
+		Node * ret = NULL;
+		float maxval = -1000000000;
+		int dynwidenlim = p.dynwidenlim;
+		float mostvisits = 0;
+
+		while(child != end && dynwidenlim >= 0){
+			//gather a block of children, the same ones the one at a time loop would look at
+			b.num = 0;
+			for(; child != end && dynwidenlim >= 0 && b.num < BLOCK; child++){
+				int i = b.num++;
+				b.node[i] = child;
+
+				Outcome outcome = child->outcome();
+				if(outcome >= Outcome::DRAW){
+					if(outcome == to_play) //return a win immediately
+						return child;
+					b.solved[i] = (outcome == Outcome::DRAW ? -1 : -2); //-1 for tie so any unknown is better, -2 for loss so it's even worse
+					b.expnum[i] = b.expsum[i] = b.ravenum[i] = b.ravesum[i] = b.know[i] = 0;
+				}else{
+					auto exp = child->exp;   //copy so packed counters are read consistently
+					auto rave = child->rave;
+					b.solved[i]  = 0;
+					b.expnum[i]  = exp.num();
+					b.expsum[i]  = exp.sum2();
+					b.ravenum[i] = rave.num();
+					b.ravesum[i] = rave.sum2();
+					b.know[i]    = child->know();
+					dynwidenlim--;
+
+					if(mostvisits < b.expnum[i]){ //the most visited child is usually the one chosen
+						mostvisits = b.expnum[i];
+						child->children.prefetch();
+					}
+				}
+			}
+
+			score_block(b, p);
+
+			//each new best is a likely descent, so start loading its children while the scan goes on
+			for(int i = 0; i < b.num; i++){
+				if(maxval < b.val[i]){
+					maxval = b.val[i];
+					ret = b.node[i];
+					ret->children.prefetch();
+				}
+			}
+		}
+
+		return ret;
+	}
+};
+
+}; // namespace Morat
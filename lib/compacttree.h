@@ -1,38 +1,206 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstring> //for memmove
 #include <new>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <vector>
 
 #include "thread.h"
 
 namespace Morat {
 
+//where CompactTree gets the memory for its chunks
+enum ChunkAlloc {
+	ChunkAlloc_Heap,    //plain new[]
+	ChunkAlloc_THP,     //mmap aligned to huge pages, advising the kernel to back it with transparent huge pages
+	ChunkAlloc_HugeTLB, //mmap from the reserved huge page pool, falls back to ChunkAlloc_THP if there aren't enough
+};
+
 /* CompactTree is a Tree of Nodes. It malloc's one chunk at a time, and has a very efficient allocation strategy.
  * It maintains a freelist of empty segments, but never assigns a segment to a smaller amount of memory,
  * completely avoiding fragmentation, but potentially having empty space in sizes that are no longer popular.
  * Since it maintains forward and backward pointers within the tree structure, it can move nodes around,
  * compacting the empty space and freeing it back to the OS. It can scan memory since it is a contiguous block
  * of memory with no fragmentation.
+ * Each search thread should allocate through its own Arena, which takes memory from the shared chunks and
+ * freelist in bulk, so the threads don't all fight over the same chunk offset and freelist lock.
  * Your tree Node should include an instance of CompactTree<Node>::Children named 'children'
+ *
+ * Compiled with COMPACT_HANDLES, the references between Children and Data are 32 bit handles of
+ * (chunk slot, offset) instead of pointers, which saves 4 bytes in every Node and Data header.
+ * The chunk slots are shared by all trees of the same Node type, and limit chunks to 16Mb each and
+ * to 1023 chunks in total, see maxmemory(). Children that live outside of the chunks, like the root, are
+ * tracked in a separate table so they can still be found when moving. Temporaries used to create children
+ * should use alloc_temp, which skips that since they're swapped into the tree before anything moves.
  */
 template <class Node> class CompactTree {
-	static const unsigned int CHUNK_SIZE = 16*1024*1024;
+	static const unsigned int CHUNK_SIZE = 16*1024*1024; //default chunk size
+	static const unsigned int HUGE_PAGE = 2*1024*1024; //chunks are a multiple of this, and aligned to it when mmap'd
+	static const unsigned int OS_PAGE = 4096;
+	static const uint32_t     GAP = 0xFEED0000; //header of a gap, with the size in GAP_UNITs in the low 16 bits
+
+#ifdef COMPACT_HANDLES
+	static const unsigned int HANDLE_BITS = 22; //bits of a handle used for the offset, the rest are the chunk slot
+	static const uint32_t     HANDLE_MASK = (1 << HANDLE_BITS) - 1;
+	static const unsigned int HANDLE_UNIT = 4; //offsets are in this many bytes
+	static const unsigned int MAX_SLOTS = 1 << (32 - HANDLE_BITS); //slot 0 is for NULL, LOCK and external Children
+	static const unsigned int MAX_CHUNK_SIZE = HANDLE_UNIT << HANDLE_BITS;
+	static const unsigned int GAP_UNIT = 4; //all block sizes are a multiple of this, so gaps can be measured in it
+#else
+	static const unsigned int MAX_CHUNK_SIZE = 1024*1024*1024;
+	static const unsigned int GAP_UNIT = 8; //all block sizes are a multiple of this, so gaps can be measured in it
+#endif
+
+	struct Data;
+public:
 	static const unsigned int MAX_NUM = 25*25 + 1; //maximum amount of Node's to allocate at once, needed for size of freelist
 
+	class Children;
+private:
+
+#ifdef COMPACT_HANDLES
+	typedef uint32_t DataRef;   //handle of a Data block
+	typedef uint32_t ParentRef; //handle of the Children that references a Data block
+
+	static char *   slotmem[MAX_SLOTS];  //memory of the chunk in each slot
+	static uint32_t slotsize[MAX_SLOTS]; //capacity of the chunk in each slot
+	static uint32_t numslots;            //slots in use are all below this
+	static std::vector<Children *> externals; //Children outside of the chunks, with handles by index
+	static std::vector<uint32_t> freeexternals;
+	static SpinLock slotlock;
+
+	//the slots of the chunks overlapping each 2Mb granule of address space, so finding the chunk of an address
+	//doesn't need to scan the slots. Chunks are at least a huge page, so a granule overlaps at most two of them.
+	//The table wraps every 128Gb of address space and the entries are only hints, checked against slotmem.
+	static const unsigned int GRANULE_BITS = 21;
+	static const unsigned int GRANULES = 1 << 16;
+	static uint16_t granules[GRANULES][2];
+
+	static bool in_slot(uint32_t s, const char * p){
+		const char * m = slotmem[s];
+		return (m && p >= m && p < m + slotsize[s]);
+	}
+
+	static Data * deref(DataRef r){
+		return (Data *)(slotmem[r >> HANDLE_BITS] + (r & HANDLE_MASK) * HANDLE_UNIT);
+	}
+	static Children * deref_parent(ParentRef p){
+		if(p >> HANDLE_BITS)
+			return (Children *)(slotmem[p >> HANDLE_BITS] + (p & HANDLE_MASK) * HANDLE_UNIT);
+		return externals[p];
+	}
+	static DataRef ref_add(DataRef r, unsigned int bytes){
+		return r + bytes / HANDLE_UNIT;
+	}
+
+	//find the handle for a Children, registering it as external if it isn't in a chunk
+	//only falls back to scanning the chunks for addresses outside of them, like the root
+	static ParentRef parent_ref(Children * c){
+		assert(c != NULL);
+		const char * p = (const char *)c;
+		const uint16_t * g = granules[((uintptr_t)p >> GRANULE_BITS) % GRANULES];
+		for(int i = 0; i < 2; i++)
+			if(g[i] && in_slot(g[i], p))
+				return (g[i] << HANDLE_BITS) | ((p - slotmem[g[i]]) / HANDLE_UNIT);
+		for(uint32_t s = numslots; s-- > 1; )
+			if(in_slot(s, p))
+				return (s << HANDLE_BITS) | ((p - slotmem[s]) / HANDLE_UNIT);
+
+		slotlock.lock();
+		uint32_t i;
+		if(freeexternals.empty()){
+			i = externals.size();
+			externals.push_back(c);
+		}else{
+			i = freeexternals.back();
+			freeexternals.pop_back();
+			externals[i] = c;
+		}
+		slotlock.unlock();
+		assert(i <= HANDLE_MASK);
+		return i;
+	}
+	//a temporary Children that is swapped into the tree before anything can move, so it never needs to be found
+	//external 0 is reserved for it, so creating children doesn't need to scan the chunks or take the lock
+	static const ParentRef TEMP_PARENT = 0;
+	static ParentRef temp_parent(Children * c){
+		return TEMP_PARENT;
+	}
+	static void release_parent(ParentRef p){
+		if((p >> HANDLE_BITS) || p == TEMP_PARENT)
+			return;
+		slotlock.lock();
+		externals[p] = NULL;
+		freeexternals.push_back(p);
+		slotlock.unlock();
+	}
+	//the handle of a Children within the Data block d, which has the handle self
+	static ParentRef child_parent(DataRef self, const Data * d, const Children * c){
+		return self + ((const char *)c - (const char *)d) / HANDLE_UNIT;
+	}
+
+	//returns 0 if all the slots are in use
+	static uint32_t add_slot(char * mem, uint32_t size){
+		assert(size <= MAX_CHUNK_SIZE);
+		slotlock.lock();
+		uint32_t s = 1;
+		while(s < numslots && slotmem[s] != NULL)
+			s++;
+		if(s >= MAX_SLOTS){
+			slotlock.unlock();
+			return 0;
+		}
+		slotsize[s] = size;
+		slotmem[s] = mem;
+		if(s == numslots)
+			numslots++;
+
+		//take an entry in each granule that has no slot or one that moved away, the lookup checks them anyway
+		for(uintptr_t a = (uintptr_t)mem >> GRANULE_BITS, e = ((uintptr_t)mem + size - 1) >> GRANULE_BITS; a <= e; a++){
+			uint16_t * g = granules[a % GRANULES];
+			char * start = (char *)(a << GRANULE_BITS);
+			int i = ((g[0] == 0 || (!in_slot(g[0], start) && !in_slot(g[0], start + (1 << GRANULE_BITS) - 1))) ? 0 : 1);
+			g[i] = s;
+		}
+		slotlock.unlock();
+		return s;
+	}
+	static void remove_slot(uint32_t s){
+		slotlock.lock();
+		slotmem[s] = NULL;
+		slotsize[s] = 0;
+		slotlock.unlock();
+	}
+#else
+	typedef Data *     DataRef;
+	typedef Children * ParentRef;
+
+	static Data *     deref(DataRef r)          { return r; }
+	static Children * deref_parent(ParentRef p) { return p; }
+	static DataRef    ref_add(DataRef r, unsigned int bytes) { return (Data *)((char *)r + bytes); }
+	static ParentRef  parent_ref(Children * c)  { return c; }
+	static ParentRef  temp_parent(Children * c) { return c; }
+	static void       release_parent(ParentRef p) { }
+	static ParentRef  child_parent(DataRef self, const Data * d, Children * c) { return c; }
+#endif
+
+	static DataRef nullref() { return (DataRef)0; }
+
 	//Hold a list of children within the compact tree
 	struct Data {
 		const static uint32_t oldcount = 4; //how many generations it needs to be empty before it's considered old
-		uint32_t    header;   //sanity check value, <= oldcount means it's empty
+		uint32_t    header;   //sanity check value, <= oldcount means it's empty, GAP | size means it's a gap
 		uint16_t    capacity; //number of Node's worth of memory to follow
 		uint16_t    used;     //number of children to follow that are actually used, num <= capacity
 		//sizes are chosen such that they add to a multiple of word size on 32bit and 64bit machines.
 
 		union {
-			Data ** parent;  //pointer to the Data* in the parent Node that references this Data instance
-			Data *  nextfree; //next free Data block of this size when in the free list
+			ParentRef parent;   //the Children in the parent Node that references this Data instance
+			DataRef   nextfree; //next free Data block of this size when in the free list
 		};
 
 		// array of Nodes, runs past the end of the data block. Should be size [0] or even []
@@ -40,7 +208,7 @@ template <class Node> class CompactTree {
 		// 1 member, allocate enough for the full capacity, and run off the end of the array.
 		Node        children[1];
 
-		Data(unsigned int n, Data ** p) : capacity(n), used(n), parent(p) {
+		Data(unsigned int n, ParentRef p) : capacity(n), used(n), parent(p) {
 			header = (((unsigned long)this >> 2) & 0xFFFF) | (0xBEEF << 16);
 			if(empty()) header += 0xABCD;
 
@@ -51,15 +219,29 @@ template <class Node> class CompactTree {
 		~Data(){
 			for(Node * i = begin(), * e = end(); i != e; ++i)
 				i->~Node();
+			release_parent(parent);
 			header = 0;
 		}
 
 		//how big is this structure in bytes by capacity or used
-		size_t mem_size() const { return sizeof(Data) + sizeof(Node)*capacity; }
+		size_t mem_size() const { return (gap() ? (header & 0xFFFF)*GAP_UNIT : sizeof(Data) + sizeof(Node)*capacity); }
 		size_t memused() const { return sizeof(Data) + sizeof(Node)*used; }
 
 		bool empty() const { return (header <= oldcount); }
 		bool old()   const { return (header == oldcount); }
+		bool gap()   const { return ((header & 0xFFFF0000) == GAP); }
+
+		//mark unused space left behind by an Arena so compact() can skip over it
+		//only writes the header, so it fits in any leftover space
+		static void make_gap(char * mem, size_t size){
+			assert(size > 0 && size % GAP_UNIT == 0);
+			while(size > 0){
+				size_t s = std::min<size_t>(size, 0xFFFF*GAP_UNIT);
+				((Data *)mem)->header = GAP | (s / GAP_UNIT);
+				mem += s;
+				size -= s;
+			}
+		}
 
 		Node * begin(){
 			return children;
@@ -85,16 +267,23 @@ template <class Node> class CompactTree {
 
 		//make sure the parent points back to the same place
 		bool parent_consistent() const {
-			return (header == (*parent)->header);
+			return (header == deref(deref_parent(parent)->data)->header);
+		}
+
+		//give this block to a different Children
+		void set_parent(Children * p){
+			release_parent(parent);
+			parent = parent_ref(p);
 		}
 
 		//called after moving the memory to update the parent pointers for this node and its children
-		void move(Data * s){
+		//self is the reference to the new location
+		void move(Data * s, DataRef self){
 			assert(!empty()); //don't move an empty Data segment
-			assert(*parent == s); //my parent points to my old location
+			assert(deref(deref_parent(parent)->data) == s); //my parent points to my old location
 
 			//update my parent with my new location
-			*parent = this;
+			deref_parent(parent)->data = self;
 
 			//make sure the parent points back to the same place
 			assert(parent_consistent());
@@ -102,8 +291,9 @@ template <class Node> class CompactTree {
 			//update my children
 			for(Node * i = begin(), * e = end(); i != e; ++i){
 				if(i->children.data){
-					i->children.data->parent = &(i->children.data);
-					assert(i->children.data->parent_consistent());
+					Data * c = deref(i->children.data);
+					c->parent = child_parent(self, this, &(i->children));
+					assert(c->parent_consistent());
 				}
 			}
 		}
@@ -112,32 +302,44 @@ template <class Node> class CompactTree {
 public:
 	//Sits in Node to manage the children, which are actually stored in a Data struct
 	class Children {
-		static const int LOCK = 1; //must be cast to (Data *) at usage point
-		Data * data;
+		DataRef data;
 		friend struct Data;
 
+		static DataRef locked() { return (DataRef)1; } //the value of data while the children are being created
+
 	public:
 		typedef Node * iterator;
-		Children() : data(NULL) { }
-		~Children() { assert(data == NULL); }
+		Children() : data(nullref()) { }
+		~Children() { assert(data == nullref()); }
 
 		//lock the children, so only one thread creates them at a time, returns false if another thread already has the lock
-		bool lock()   { return CAS(data, (Data *) NULL, (Data *) LOCK); }
-		bool unlock() { return CAS(data, (Data *) LOCK, (Data *) NULL); }
+		bool lock()   { return CAS(data, nullref(), locked()); }
+		bool unlock() { return CAS(data, locked(), nullref()); }
 
 		//allocate n nodes, likely best used in a temporary node and swapped in
-		unsigned int alloc(unsigned int n, CompactTree & ct){
-			assert(data == NULL);
-			data = ct.alloc(n, &data);
+		//Allocator is either the CompactTree itself or a thread's Arena
+		template <class Allocator>
+		unsigned int alloc(unsigned int n, Allocator & ct){
+			assert(data == nullref());
+			data = ct.alloc(n, parent_ref(this));
+			return n;
+		}
+		//allocate n nodes in a temporary that will be swapped into the tree before the next compact or evacuate_step
+		//the nodes can't be moved until then, but it saves finding where the temporary lives
+		template <class Allocator>
+		unsigned int alloc_temp(unsigned int n, Allocator & ct){
+			assert(data == nullref());
+			data = ct.alloc(n, temp_parent(this));
 			return n;
 		}
 
 		//deallocate the children
-		unsigned int dealloc(CompactTree & ct){
-			Data * t = data;
+		template <class Allocator>
+		unsigned int dealloc(Allocator & ct){
+			DataRef t = data;
 			int n = 0;
-			if(t && CAS(data, t, (Data*)NULL)){
-				n = t->used;
+			if(t && CAS(data, t, nullref())){
+				n = deref(t)->used;
 				ct.dealloc(t);
 			}
 			return n;
@@ -145,25 +347,34 @@ public:
 		//swap children with the other node, used for threadsafe child creation
 		void swap(Children & other){
 			//swap data pointer
-			Data * temp;
-			temp = data;
+			DataRef temp = data;
 			data = other.data;
 			other.data = temp;
-			temp = NULL;
 
 			//update parent pointer
-			if(data > (Data*)LOCK)
-				data->parent = &data;
-			if(other.data > (Data*)LOCK)
-				other.data->parent = &(other.data);
+			if(data > locked())
+				deref(data)->set_parent(this);
+			if(other.data > locked())
+				deref(other.data)->set_parent(&other);
 		}
 		//keep only the first n children, used if too many children were allocated
 		int shrink(int n){
-			return data->shrink(n);
+			return deref(data)->shrink(n);
+		}
+		//start loading the first lines of the children into the cache, before they're needed
+		//lines beyond the first few are left to the hardware prefetcher, which follows the scan
+		void prefetch(unsigned int lines = 2) const {
+			DataRef d = data;
+			if(d > locked()){
+				const char * p = (const char *)deref(d);
+				for(unsigned int i = 0; i < lines; i++)
+					__builtin_prefetch(p + i*64, 0, 3);
+			}
 		}
 		//how many children are there?
 		unsigned int num() const {
-			return (data > (Data *) LOCK ? data->used : 0);
+			DataRef d = data;
+			return (d > locked() ? deref(d)->used : 0);
 		}
 		//does this node have any children?
 		bool empty() const {
@@ -171,20 +382,22 @@ public:
 		}
 		//access a child at a specific offset
 		Node & operator[](unsigned int offset){
-			assert(data > (Data *) LOCK);
-			assert(offset >= 0 && offset < data->used);
-			return data->children[offset];
+			assert(data > locked());
+			assert(offset >= 0 && offset < deref(data)->used);
+			return deref(data)->children[offset];
 		}
 		//iterator through the children
 		Node * begin() const {
-			if(data > (Data *) LOCK)
-				return data->begin();
+			DataRef d = data;
+			if(d > locked())
+				return deref(d)->begin();
 			return NULL;
 		}
 		//end of the iterator through the children
 		Node * end() const {
-			if(data > (Data *) LOCK)
-				return data->end();
+			DataRef d = data;
+			if(d > locked())
+				return deref(d)->end();
 			return NULL;
 		}
 	};
@@ -196,17 +409,30 @@ private:
 		uint32_t id;   //number of chunks before this one
 		uint32_t capacity; //in bytes
 		uint32_t used;     //in bytes
+		uint64_t offset;   //capacity of all the chunks before this one, in bytes
+		ChunkAlloc source; //where mem came from, so it can be returned the same way
 		char *   mem;  //actual memory
+#ifdef COMPACT_HANDLES
+		uint32_t slot; //which slot the handles into this chunk use
+#endif
 
-		Chunk()               : next(NULL), id(0), capacity(0), used(0), mem(NULL) { }
-		Chunk(unsigned int c) : next(NULL), id(0), capacity(0), used(0), mem(NULL) { alloc(c); }
+		Chunk() : next(NULL), id(0), capacity(0), used(0), offset(0), source(ChunkAlloc_Heap), mem(NULL) { }
+		Chunk(unsigned int c, ChunkAlloc s) : next(NULL), id(0), capacity(0), used(0), offset(0), source(s), mem(NULL) { alloc(c, s); }
 		~Chunk() { assert_empty(); }
 
-		void alloc(unsigned int c){
+		void alloc(unsigned int c, ChunkAlloc s){
 			assert_empty();
 			capacity = c;
 			used = 0;
-			mem = (char*) new uint64_t[capacity / sizeof(uint64_t)]; //use uint64_t instead of char to guarantee alignment
+			source = s;
+			mem = map(capacity, source);
+#ifdef COMPACT_HANDLES
+			slot = add_slot(mem, capacity);
+			if(slot == 0){ //out of handles, which is as good as out of memory
+				unmap();
+				throw std::bad_alloc();
+			}
+#endif
 		}
 		void dealloc(bool deallocnext = false){
 			assert(capacity > 0 && mem != NULL);
@@ -216,20 +442,88 @@ private:
 				next = NULL;
 			}
 			assert(next == NULL);
+#ifdef COMPACT_HANDLES
+			remove_slot(slot);
+#endif
+			unmap();
+		}
+		void unmap(){
+			if(source == ChunkAlloc_Heap)
+				delete[] (uint64_t *)mem;
+			else
+				munmap(mem, capacity);
 			capacity = 0;
 			used = 0;
-			delete[] (uint64_t *)mem;
 			mem = NULL;
 		}
 		void assert_empty(){ assert(capacity == 0 && used == 0 && mem == NULL && next == NULL); }
+
+		//reference to the Data block at this offset
+		DataRef ref(uint32_t off) const {
+#ifdef COMPACT_HANDLES
+			return (slot << HANDLE_BITS) | (off / HANDLE_UNIT);
+#else
+			return (Data *)(mem + off);
+#endif
+		}
+
+		//zero the memory past used
+		//mmap'd chunks give the whole pages back to the OS instead, which zeros them and drops them
+		//from the resident memory until they're used again, while keeping the address space
 		void clear_unused(){
-			for(char * i = mem + used, * iend = mem + capacity ; i != iend; i++)
-				*i = 0;
+			char * start = mem + used, * iend = mem + capacity;
+			if(source != ChunkAlloc_Heap){
+				uint32_t pagesize = (source == ChunkAlloc_HugeTLB ? HUGE_PAGE : OS_PAGE);
+				char * page = mem + ((used + pagesize - 1) / pagesize) * pagesize;
+				if(page < iend && madvise(page, iend - page, MADV_DONTNEED) == 0)
+					iend = page;
+			}
+			memset(start, 0, iend - start);
+		}
+
+		//get size bytes of memory from where source asks for, updating source with where it actually came from
+		static char * map(size_t size, ChunkAlloc & source){
+#ifdef MAP_HUGETLB
+			if(source == ChunkAlloc_HugeTLB){
+				void * m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if(m != MAP_FAILED)
+					return (char *)m;
+			}
+#endif
+			if(source != ChunkAlloc_Heap){
+				source = ChunkAlloc_THP;
+				if(char * m = map_aligned(size))
+					return m;
+			}
+
+			source = ChunkAlloc_Heap;
+			return (char*) new uint64_t[size / sizeof(uint64_t)]; //use uint64_t instead of char to guarantee alignment
+		}
+
+		//mmap size bytes aligned to a huge page, returns NULL on failure
+		static char * map_aligned(size_t size){
+			//map extra so there is room to align it, then trim off the ends
+			size_t len = size + HUGE_PAGE;
+			void * m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(m == MAP_FAILED)
+				return NULL;
+
+			char * start = (char *)m;
+			char * aligned = (char *)((((uintptr_t)start) + HUGE_PAGE - 1) & ~((uintptr_t)HUGE_PAGE - 1));
+			if(aligned > start)
+				munmap(start, aligned - start);
+			if(aligned + size < start + len)
+				munmap(aligned + size, (start + len) - (aligned + size));
+
+#ifdef MADV_HUGEPAGE
+			madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+			return aligned;
 		}
 	};
 
 	class Freelist {
-		Data * list[MAX_NUM];
+		DataRef list[MAX_NUM];
 		SpinLock lock;
 	public:
 		Freelist(){
@@ -237,69 +531,354 @@ private:
 		}
 		void clear(){
 			for(unsigned int i = 0; i < MAX_NUM; i++)
-				list[i] = NULL;
+				list[i] = nullref();
 		}
 
-		void push_nolock(Data * d){
+		void push_nolock(DataRef r){
+			Data * d = deref(r);
 			unsigned int num = d->capacity;
 			d->nextfree = list[num];
-			list[num] = d;
+			list[num] = r;
 		}
-		void push(Data * d){
-			assert(d->empty());
+		void push(DataRef r){
+			assert(deref(r)->empty());
 			lock.lock();
-			push_nolock(d);
+			push_nolock(r);
 			lock.unlock();
 		}
 
-		Data * pop_nolock(unsigned int num){
-			Data * t = list[num];
+		DataRef pop_nolock(unsigned int num){
+			DataRef t = list[num];
 			if(t)
-				list[num] = t->nextfree;
+				list[num] = deref(t)->nextfree;
 			return t;
 		}
-		Data * pop(unsigned int num){
+		DataRef pop(unsigned int num){
 			lock.lock();
-			Data * t = pop_nolock(num);
+			DataRef t = pop_nolock(num);
 			lock.unlock();
 			return t;
 		}
+
+		//push a chain of blocks of the same size linked through nextfree
+		void push_list(DataRef head, DataRef tail){
+			unsigned int num = deref(head)->capacity;
+			lock.lock();
+			deref(tail)->nextfree = list[num];
+			list[num] = head;
+			lock.unlock();
+		}
+		//pop up to max blocks of this size as a chain linked through nextfree, returns how many in count
+		DataRef pop_list(unsigned int num, unsigned int max, unsigned int & count){
+			count = 0;
+			if(!list[num]) //racy, but avoids taking the lock when there's obviously nothing there
+				return nullref();
+
+			lock.lock();
+			DataRef head = list[num], tail = head;
+			if(head){
+				count = 1;
+				while(count < max && deref(tail)->nextfree){
+					tail = deref(tail)->nextfree;
+					count++;
+				}
+				list[num] = deref(tail)->nextfree;
+				deref(tail)->nextfree = nullref();
+			}
+			lock.unlock();
+			return head;
+		}
+
+		//drop all the blocks that match pred, assumes this is the only thread running
+		template <class Pred>
+		void remove_if(Pred pred){
+			for(unsigned int i = 0; i < MAX_NUM; i++){
+				DataRef * d = &list[i];
+				while(*d){
+					Data * t = deref(*d);
+					if(pred(t))
+						*d = t->nextfree;
+					else
+						d = &(t->nextfree);
+				}
+			}
+		}
 	};
 
 
+public:
+	//Thread local allocation state. Takes a slab of a chunk at a time and a batch of freelist entries
+	//at a time so the shared Chunk::used and Freelist lock are touched rarely. Freed blocks are cached
+	//locally by size and spill back to the shared freelist when the cache gets long.
+	//Not thread safe itself, so each thread needs its own.
+	class Arena {
+		static const unsigned int SLAB_SIZE = 256*1024; //how much of a chunk to take at a time
+		static const unsigned int CACHE_FILL = 16; //how many blocks to take from the shared freelist at a time
+		static const unsigned int CACHE_MAX = 64;  //how many blocks of one size to cache before spilling half
+
+		CompactTree & ct;
+		Arena * next;    //list of arenas registered with the tree
+		char * cur,      //where the next allocation in the slab goes
+		     * end;      //end of the slab
+		DataRef curref;  //reference to cur
+		int64_t memused; //memory accounting not yet pushed to the tree
+		DataRef list[MAX_NUM];     //local freelist by capacity
+		uint16_t count[MAX_NUM];   //length of each local freelist
+
+		friend class CompactTree;
+
+		Arena(const Arena & a) = delete;
+		Arena & operator = (const Arena & a) = delete;
+
+	public:
+		Arena(CompactTree & c) : ct(c), next(NULL), cur(NULL), end(NULL), curref(nullref()), memused(0) {
+			for(unsigned int i = 0; i < MAX_NUM; i++){
+				list[i] = nullref();
+				count[i] = 0;
+			}
+			ct.add_arena(this);
+		}
+		~Arena(){
+			flush();
+			ct.remove_arena(this);
+		}
+
+		DataRef alloc(unsigned int num, ParentRef parent){
+			assert(num > 0 && num < MAX_NUM);
+
+			unsigned int size = sizeof(Data) + sizeof(Node)*num;
+			memused += size;
+
+		//check the local freelist, refilling it from the shared one if needed
+			if(!list[num]){
+				unsigned int n;
+				list[num] = ct.freelist.pop_list(num, CACHE_FILL, n);
+				count[num] = n;
+			}
+			if(DataRef r = list[num]){
+				Data * t = deref(r);
+				list[num] = t->nextfree;
+				count[num]--;
+				assert(t->empty() && t->capacity == num);
+				new(t) Data(num, parent);
+				return r;
+			}
+
+		//allocate out of the slab, getting a new slab if needed
+			if(cur + size > end){
+				release_slab();
+				unsigned int got;
+				cur = ct.reserve(size, SLAB_SIZE, got, curref);
+				end = cur + got;
+				push_memused();
+			}
+			DataRef r = curref;
+			new(cur) Data(num, parent);
+			cur += size;
+			curref = ref_add(curref, size);
+			return r;
+		}
+
+		void dealloc(DataRef r){
+			Data * d = deref(r);
+			assert(!d->empty() && d->capacity > 0 && d->capacity < MAX_NUM);
+
+			memused -= d->mem_size();
+
+			d->~Data();
+			d->used = 0;
+
+			if(ct.evacuate != NULL && ct.evacuating(d))
+				return;
+
+			unsigned int num = d->capacity;
+			d->nextfree = list[num];
+			list[num] = r;
+
+			//spill half of them back to the shared freelist so other threads can use them
+			if(++count[num] >= CACHE_MAX){
+				DataRef head = list[num], tail = head;
+				for(unsigned int i = 1; i < CACHE_MAX/2; i++)
+					tail = deref(tail)->nextfree;
+				list[num] = deref(tail)->nextfree;
+				count[num] -= CACHE_MAX/2;
+				ct.freelist.push_list(head, tail);
+			}
+		}
+
+		//give back the unused part of the slab and the cached free blocks, and update the memory accounting
+		//compact() calls this on all arenas, so only call it when no other thread is using this arena
+		void flush(){
+			release_slab();
+			cur = end = NULL;
+
+			for(unsigned int i = 0; i < MAX_NUM; i++){
+				if(list[i]){
+					DataRef tail = list[i];
+					while(deref(tail)->nextfree)
+						tail = deref(tail)->nextfree;
+					ct.freelist.push_list(list[i], tail);
+				}
+				list[i] = nullref();
+				count[i] = 0;
+			}
+
+			push_memused();
+		}
+
+	private:
+		void release_slab(){
+			if(cur < end)
+				Data::make_gap(cur, end - cur);
+		}
+		void push_memused(){
+			if(memused)
+				PLUS(ct.memused, memused);
+			memused = 0;
+		}
+	};
+
+private:
 	Chunk * head,    //start of the chunk list
 	      * current, //where memory is currently being allocated
-	      * last;    //last chunk that isn't empty
+	      * last,    //last chunk that isn't empty
+	      * evacuate; //chunks being emptied by evacuate_step, no longer allocated from
+	uint64_t evacuatemem; //capacity of the chunks in evacuate
 	unsigned int numchunks;
+	uint32_t chunk_size;    //how big new chunks should be
+	ChunkAlloc chunk_alloc; //where new chunks get their memory
 	Freelist freelist;
 	uint64_t memused;
+	Arena * arenas;  //arenas that allocate from this tree
+	SpinLock arenalock;
+
+	void add_arena(Arena * a){
+		arenalock.lock();
+		a->next = arenas;
+		arenas = a;
+		arenalock.unlock();
+	}
+	void remove_arena(Arena * a){
+		arenalock.lock();
+		Arena ** i = &arenas;
+		while(*i != a)
+			i = &((*i)->next);
+		*i = a->next;
+		a->next = NULL;
+		arenalock.unlock();
+	}
+
+	//is this block in one of the chunks being evacuated
+	bool evacuating(const Data * d) const {
+		for(Chunk * c = evacuate; c != NULL; c = c->next)
+			if((const char *)d >= c->mem && (const char *)d < c->mem + c->capacity)
+				return true;
+		return false;
+	}
+
+	//reserve between minsize and maxsize bytes of contiguous memory at the end of the current chunk
+	//returns the start of the memory, how much was reserved in got, and a reference to the start in ref
+	char * reserve(unsigned int minsize, unsigned int maxsize, unsigned int & got, DataRef & ref){
+		assert(minsize <= maxsize && maxsize <= chunk_size);
+		while(1){
+			Chunk * c = current;
+			uint32_t used = c->used;
+			if(used + minsize <= c->capacity){ //if there is room, try to use it
+				got = std::min(maxsize, c->capacity - used);
+				if(CAS(c->used, used, used+got)){
+					ref = c->ref(used);
+					return c->mem + used;
+				}
+				else
+					continue;
+			}else if(c->next != NULL){ //if there is a next chunk, advance to it and try again
+				CAS(current, c, c->next); //CAS to avoid skipping a chunk
+				CAS(last, c, c->next); //most last forward too
+				continue;
+			}else{ //need to allocate a new chunk
+				Chunk * next = new Chunk(chunk_size, chunk_alloc);
+
+				while(1){
+					while(c->next != NULL) //advance to the end
+						c = c->next;
+
+					next->id = c->id+1;
+					next->offset = c->offset + c->capacity;
+					if(CAS(c->next, (Chunk *)NULL, next)){ //put it in place
+						INCR(numchunks);
+						//note that this doesn't move current forward since this may not be the next chunk
+						// if there is a race condition where two threads allocate chunks at the same time
+						break;
+					}
+				}
+				continue;
+			}
+		}
+		assert(false && "How'd CompactTree::reserve get here?");
+		return NULL;
+	}
 
 public:
 
-	CompactTree() {
+	CompactTree(ChunkAlloc source = ChunkAlloc_THP) {
+		static_assert(sizeof(Data) % GAP_UNIT == 0 && sizeof(Node) % GAP_UNIT == 0, "Node size must be a multiple of GAP_UNIT");
+
+		chunk_size = CHUNK_SIZE;
+		chunk_alloc = source;
+
 		//allocate the first chunk
-		head = current = last = new Chunk(CHUNK_SIZE);
+		head = current = last = new Chunk(chunk_size, chunk_alloc);
+		evacuate = NULL;
+		evacuatemem = 0;
 		numchunks = 1;
 		memused = 0;
+		arenas = NULL;
 	}
 	~CompactTree(){
+		assert(arenas == NULL);
 		head->dealloc(true);
 		delete head;
-		head = current = last = NULL;
+		if(evacuate){
+			evacuate->dealloc(true);
+			delete evacuate;
+		}
+		head = current = last = evacuate = NULL;
 		numchunks = 0;
 	}
 
+	//size of the chunks, only affects chunks allocated after it's set
+	//rounded to a multiple of the huge page size so they can be backed by huge pages
+	uint64_t chunksize() const { return chunk_size; }
+	void set_chunksize(uint64_t size){
+		size = std::max<uint64_t>(HUGE_PAGE, std::min<uint64_t>(MAX_CHUNK_SIZE, size));
+		chunk_size = (size / HUGE_PAGE) * HUGE_PAGE;
+	}
+
+	//how much memory all the trees of this Node type can have in chunks of chunksize() together
+	//COMPACT_HANDLES limits the number of chunks, and running out throws std::bad_alloc
+	uint64_t maxmemory() const {
+#ifdef COMPACT_HANDLES
+		return (uint64_t)(MAX_SLOTS - 1) * chunk_size;
+#else
+		return ~(uint64_t)0;
+#endif
+	}
+
+	//where chunks get their memory, only affects chunks allocated after it's set
+	ChunkAlloc chunkalloc() const { return chunk_alloc; }
+	void set_chunkalloc(ChunkAlloc source){ chunk_alloc = source; }
+
 	//how much memory is malloced and available for use
 	uint64_t memarena() const {
 		Chunk * c = current;
 		while(c->next)
 			c = c->next;
-		return ((uint64_t)(c->id+1))*((uint64_t)CHUNK_SIZE);
+		return c->offset + c->capacity + evacuatemem;
 	}
 
 	//how much memory is in use or in a freelist, a good approximation of real memory usage from the OS perspective
 	uint64_t memalloced() const {
-		return ((uint64_t)(last->id))*((uint64_t)CHUNK_SIZE) + current->used;
+		return last->offset + current->used + evacuatemem;
 	}
 
 	//how much memory is actually in use by nodes in the tree, plus the overhead of the Data struct
@@ -309,64 +888,40 @@ public:
 		return memused;
 	}
 
-	Data * alloc(unsigned int num, Data ** parent){
+	DataRef alloc(unsigned int num, ParentRef parent){
 		assert(num > 0 && num < MAX_NUM);
 
 		unsigned int size = sizeof(Data) + sizeof(Node)*num;
 		PLUS(memused, size);
 
 	//check freelist
-		if(Data * t = freelist.pop(num)){
+		if(DataRef r = freelist.pop(num)){
+			Data * t = deref(r);
 			assert(t->empty() && t->capacity == num);
-			return new(t) Data(num, parent);
+			new(t) Data(num, parent);
+			return r;
 		}
 
 	//allocate new memory
-		while(1){
-			Chunk * c = current;
-			uint32_t used = c->used;
-			if(used + size <= c->capacity){ //if there is room, try to use it
-				if(CAS(c->used, used, used+size))
-					return new((Data *)(c->mem + used)) Data(num, parent);
-				else
-					continue;
-			}else if(c->next != NULL){ //if there is a next chunk, advance to it and try again
-				CAS(current, c, c->next); //CAS to avoid skipping a chunk
-				CAS(last, c, c->next); //most last forward too
-				continue;
-			}else{ //need to allocate a new chunk
-				Chunk * next = new Chunk(CHUNK_SIZE);
-
-				while(1){
-					while(c->next != NULL) //advance to the end
-						c = c->next;
-
-					next->id = c->id+1;
-					if(CAS(c->next, (Chunk *)NULL, next)){ //put it in place
-						INCR(numchunks);
-						//note that this doesn't move current forward since this may not be the next chunk
-						// if there is a race condition where two threads allocate chunks at the same time
-						break;
-					}
-				}
-				continue;
-			}
-		}
-		assert(false && "How'd CompactTree::alloc get here?");
-		return NULL;
+		unsigned int got;
+		DataRef r;
+		new(reserve(size, size, got, r)) Data(num, parent);
+		return r;
 	}
-	void dealloc(Data * d){
+	void dealloc(DataRef r){
+		Data * d = deref(r);
 		assert(!d->empty() && d->capacity > 0 && d->capacity < MAX_NUM);
 
-		unsigned int size = d->mem_size();
-		PLUS(memused, -size);
+		uint64_t size = d->mem_size();
+		PLUS(memused, -size); //wraps around, but that's fine for unsigned math
 
 		//call the destructor
 		d->~Data();
 		d->used = 0;
 
-		//add to the freelist
-		freelist.push(d);
+		//add to the freelist, unless it's about to be evacuated
+		if(evacuate == NULL || !evacuating(d))
+			freelist.push(r);
 	}
 
 	//assume this is the only thread running
@@ -378,6 +933,12 @@ public:
 		assert(arenasize >= 0 && arenasize <= 1);
 		assert(generationsize >= 0 && generationsize <= 1);
 
+		while(evacuate_step()) ;
+
+		//the arenas' slabs and cached blocks are about to be moved or put back on the freelist
+		for(Arena * a = arenas; a != NULL; a = a->next)
+			a->flush();
+
 		memused = 0;
 
 		if(head->used == 0)
@@ -398,19 +959,22 @@ public:
 		while(schunk != NULL){
 			//iterate over each Data block
 			Data * s = (Data *)(schunk->mem + soff);
-			assert(s->capacity > 0 && s->capacity < MAX_NUM);
+			assert(s->gap() || s->capacity < MAX_NUM);
 
 			int ssize = s->mem_size(); //how much to move the source pointer
 
 			//move from -> to, update parent pointer
-			if(s->empty()){
+			if(s->gap()){
+				//unused space left by an arena, nothing to keep
+				//if this chunk is being compacted it'll be overwritten, otherwise it stays a gap
+			}else if(s->empty()){
 				if(!compactthischunk){
 					if(s->old()){//this empty segment is an unpopular size, lets compact this chunk to clean up this segment
 						compactthischunk = true;
 						dchunk = schunk;
 						doff = soff;
 					}else{ //freed recently, add to the free list
-						freelist.push_nolock(s);
+						freelist.push_nolock(schunk->ref(soff));
 						s->header++; //empty, but a generation old
 					}
 				}//else this position will be overwritten by the next full chunk
@@ -420,15 +984,15 @@ public:
 				}else{
 					assert(s->used > 0 && s->used <= s->capacity);
 					int dsize = s->memused(); //how much to move the dest pointer
-					Data * d = NULL;
+					DataRef dref;
 
 					//where to move
 					while(1){
-						if((d = freelist.pop_nolock(s->used))){ //allocate off the freelist if possible
+						if((dref = freelist.pop_nolock(s->used))){ //allocate off the freelist if possible
 							break;
 						}else if(doff + dsize <= dchunk->capacity){ //if space, allocate from this chunk
 							assert(schunk->id > dchunk->id || (schunk == dchunk && soff >= doff)); //make sure I'm moving left
-							d = (Data *)(dchunk->mem + doff);
+							dref = dchunk->ref(doff);
 							doff += dsize;
 							break;
 						}else{ //otherwise finish this chunk and prepare the next
@@ -441,10 +1005,11 @@ public:
 					}
 
 					//move!
+					Data * d = deref(dref);
 					s->capacity = s->used;
 					if(s != d){
 						memmove(reinterpret_cast<void*>(d), reinterpret_cast<void*>(s), dsize);
-						d->move(s);
+						d->move(s, dref);
 					}
 					memused += dsize;
 				}
@@ -477,10 +1042,13 @@ public:
 		dchunk->clear_unused();
 
 		//free unused chunks
+		//the ones kept around for the arena keep their address space, but give their pages back to the OS
 		Chunk * del = dchunk;
 		while(del->next && del->id < arenasize*current->id){
 			del = del->next;
 			del->used = 0;
+			if(del->source != ChunkAlloc_Heap)
+				del->clear_unused();
 		}
 
 		if(del->next != NULL){
@@ -494,6 +1062,103 @@ public:
 		current = head;
 		last = dchunk;
 	}
+
+	//Incremental alternative to compact, so the other threads only need to stop for a short time.
+	//evacuate_start picks the chunks past the first keep fraction and stops allocating from them,
+	//then each call to evacuate_step moves the live blocks out of one of them and frees it.
+	//The other threads can allocate and free between steps. Freed blocks in the evacuating chunks are
+	//not reused, so they're simply skipped. Both assume this is the only thread running.
+	//returns how many chunks will be evacuated
+	unsigned int evacuate_start(float keep){
+		assert(keep >= 0 && keep <= 1);
+
+		while(evacuate_step()) ;
+
+		//the arenas may have slabs or cached blocks in the chunks about to be evacuated
+		for(Arena * a = arenas; a != NULL; a = a->next)
+			a->flush();
+
+		Chunk * c = head;
+		while(c->next)
+			c = c->next;
+		unsigned int keepid = std::max(1u, (unsigned int)(keep * (c->id + 1)));
+
+		c = head;
+		while(c->next && c->next->id < keepid)
+			c = c->next;
+
+		evacuate = c->next;
+		c->next = NULL;
+		if(evacuate == NULL)
+			return 0;
+
+		unsigned int num = 0;
+		for(Chunk * e = evacuate; e != NULL; e = e->next){
+			evacuatemem += e->capacity;
+			num++;
+		}
+		numchunks -= num;
+
+		freelist.remove_if([this](const Data * d){ return evacuating(d); });
+
+		current = head;
+		if(last->id >= keepid)
+			last = c;
+		return num;
+	}
+
+	//empty and free one of the evacuating chunks, returns whether there are any left
+	bool evacuate_step(){
+		if(evacuate == NULL)
+			return false;
+
+		Chunk * c = evacuate;
+		for(uint32_t off = 0; off < c->used; ){
+			Data * s = (Data *)(c->mem + off);
+			assert(s->gap() || s->capacity < MAX_NUM);
+			off += s->mem_size();
+
+			if(s->gap() || s->empty())
+				continue;
+
+			//the destination comes from the chunks being kept, shrunk to fit like compact does
+			unsigned int dsize = s->memused();
+			DataRef dref = freelist.pop_nolock(s->used);
+			if(!dref){
+				unsigned int got;
+				reserve(dsize, dsize, got, dref);
+			}
+			Data * d = deref(dref);
+
+			memused += dsize;
+			memused -= s->mem_size();
+
+			s->capacity = s->used;
+			memcpy(reinterpret_cast<void*>(d), reinterpret_cast<void*>(s), dsize);
+			d->move(s, dref);
+		}
+
+		evacuate = c->next;
+		c->next = NULL;
+		evacuatemem -= c->capacity;
+		c->dealloc();
+		delete c;
+
+		return (evacuate != NULL);
+	}
+
+	//are there chunks waiting for evacuate_step
+	bool evacuating() const { return (evacuate != NULL); }
 };
 
+#ifdef COMPACT_HANDLES
+template <class Node> char *   CompactTree<Node>::slotmem[CompactTree<Node>::MAX_SLOTS];
+template <class Node> uint32_t CompactTree<Node>::slotsize[CompactTree<Node>::MAX_SLOTS];
+template <class Node> uint32_t CompactTree<Node>::numslots = 1;
+template <class Node> std::vector<typename CompactTree<Node>::Children *> CompactTree<Node>::externals(1, NULL); //TEMP_PARENT
+template <class Node> std::vector<uint32_t> CompactTree<Node>::freeexternals;
+template <class Node> SpinLock CompactTree<Node>::slotlock;
+template <class Node> uint16_t CompactTree<Node>::granules[CompactTree<Node>::GRANULES][2];
+#endif
+
 }; // namespace Morat
@@ -0,0 +1,280 @@
+#include <vector>
+
+#include "catch.hpp"
+
+#include "compacttree.h"
+#include "string.h"
+#include "time.h"
+
+namespace Morat {
+
+struct TestNode {
+	uint64_t value;
+	CompactTree<TestNode>::Children children;
+
+	TestNode() : value(0) { }
+
+	unsigned int dealloc(CompactTree<TestNode> & ct){
+		unsigned int num = 0;
+		for(TestNode * i = children.begin(); i != children.end(); i++)
+			num += i->dealloc(ct);
+		return num + children.dealloc(ct);
+	}
+};
+
+// build a two level tree with the values set to something checkable
+template <class Allocator>
+void build_tree(TestNode & root, Allocator & alloc, unsigned int width, uint64_t base){
+	root.children.alloc(width, alloc);
+	for(unsigned int i = 0; i < width; i++){
+		TestNode & child = root.children[i];
+		child.value = base + i;
+		child.children.alloc(i % 7 + 1, alloc);
+		for(auto & grandchild : child.children)
+			grandchild.value = child.value * 1000;
+	}
+}
+
+bool check_tree(const TestNode & root, unsigned int width, uint64_t base){
+	if(root.children.num() != width)
+		return false;
+	for(unsigned int i = 0; i < width; i++){
+		const TestNode & child = root.children.begin()[i];
+		if(child.value != base + i || child.children.num() != i % 7 + 1)
+			return false;
+		for(auto & grandchild : child.children)
+			if(grandchild.value != child.value * 1000)
+				return false;
+	}
+	return true;
+}
+
+TEST_CASE("CompactTree::Arena", "[compacttree]") {
+	CompactTree<TestNode> ct;
+
+	SECTION("Reuses freed blocks locally") {
+		CompactTree<TestNode>::Arena arena(ct);
+		TestNode a, b;
+		a.children.alloc(5, arena);
+		TestNode * first = a.children.begin();
+		a.children.dealloc(arena);
+		b.children.alloc(5, arena);
+		REQUIRE(b.children.begin() == first);
+		b.children.dealloc(arena);
+	}
+
+	SECTION("Matches the shared allocator's accounting") {
+		CompactTree<TestNode> ct2;
+		TestNode root, root2;
+		{
+			CompactTree<TestNode>::Arena arena(ct);
+			build_tree(root, arena, 100, 1);
+		}
+		build_tree(root2, ct2, 100, 1);
+		REQUIRE(ct.meminuse() == ct2.meminuse());
+
+		root.dealloc(ct);
+		root2.dealloc(ct2);
+		REQUIRE(ct.meminuse() == 0);
+		REQUIRE(ct2.meminuse() == 0);
+	}
+
+	SECTION("Compact moves arena allocations and skips gaps") {
+		CompactTree<TestNode>::Arena arena1(ct), arena2(ct);
+		const int num = 20;
+		TestNode roots[num];
+		for(int i = 0; i < num; i++)
+			build_tree(roots[i], (i % 2 ? arena1 : arena2), 200, i*1000);
+
+		//free every third tree so there are holes to compact
+		for(int i = 0; i < num; i += 3)
+			roots[i].dealloc(ct);
+
+		uint64_t before = ct.meminuse();
+		ct.compact();
+		REQUIRE(ct.meminuse() <= before);
+
+		for(int i = 0; i < num; i++){
+			if(i % 3 == 0)
+				REQUIRE(roots[i].children.num() == 0);
+			else
+				REQUIRE(check_tree(roots[i], 200, i*1000));
+		}
+
+		//the arenas are still usable after compacting
+		for(int i = 0; i < num; i += 3)
+			build_tree(roots[i], arena1, 200, i*1000);
+		ct.compact(0, 0.5);
+		for(int i = 0; i < num; i++)
+			REQUIRE(check_tree(roots[i], 200, i*1000));
+
+		for(int i = 0; i < num; i++)
+			roots[i].dealloc(ct);
+		ct.compact();
+		REQUIRE(ct.meminuse() == 0);
+	}
+}
+
+TEST_CASE("CompactTree::Children::swap", "[compacttree]") {
+	CompactTree<TestNode> ct;
+	const int num = 30;
+	TestNode roots[num];
+
+	//build in temporaries and swap them into place like the agents do, so the parents move around
+	for(int i = 0; i < num; i++){
+		TestNode temp;
+		build_tree(temp, ct, 100, i*1000);
+		roots[i].children.swap(temp.children);
+		REQUIRE(temp.children.empty());
+	}
+
+	//free some so compact has to move the rest
+	for(int i = 0; i < num; i += 2)
+		roots[i].dealloc(ct);
+	ct.compact();
+
+	for(int i = 1; i < num; i += 2)
+		REQUIRE(check_tree(roots[i], 100, i*1000));
+
+	//swap between roots after moving, and compact again
+	for(int i = 1; i + 2 < num; i += 4)
+		roots[i].children.swap(roots[i+2].children);
+	ct.compact();
+
+	for(int i = 1; i < num; i += 2){
+		int j = (i % 4 == 1 && i + 2 < num ? i + 2 : (i % 4 == 3 ? i - 2 : i));
+		REQUIRE(check_tree(roots[i], 100, j*1000));
+	}
+
+	for(int i = 0; i < num; i++)
+		roots[i].dealloc(ct);
+	ct.compact();
+	REQUIRE(ct.meminuse() == 0);
+}
+
+TEST_CASE("CompactTree::Children::alloc_temp", "[compacttree]") {
+	CompactTree<TestNode> ct;
+	const int num = 30;
+	TestNode roots[num];
+	{
+		CompactTree<TestNode>::Arena arena(ct);
+		for(int i = 0; i < num; i++){
+			CompactTree<TestNode>::Children temp;
+			temp.alloc_temp(10, arena);
+			for(unsigned int j = 0; j < 10; j++){
+				temp[j].value = i*1000 + j;
+				temp[j].children.alloc(j + 1, arena);
+			}
+			REQUIRE(roots[i].children.lock());
+			roots[i].children.swap(temp);
+			REQUIRE(temp.unlock());
+		}
+
+		//a temporary that isn't needed after all
+		CompactTree<TestNode>::Children temp;
+		temp.alloc_temp(5, arena);
+		temp.dealloc(arena);
+	}
+
+	//once swapped in they move like any others
+	for(int i = 0; i < num; i += 2)
+		roots[i].dealloc(ct);
+	ct.compact();
+
+	for(int i = 1; i < num; i += 2){
+		REQUIRE(roots[i].children.num() == 10);
+		for(unsigned int j = 0; j < 10; j++){
+			REQUIRE(roots[i].children[j].value == i*1000 + j);
+			REQUIRE(roots[i].children[j].children.num() == j + 1);
+		}
+	}
+
+	for(int i = 0; i < num; i++)
+		roots[i].dealloc(ct);
+	ct.compact();
+	REQUIRE(ct.meminuse() == 0);
+}
+
+TEST_CASE("CompactTree::evacuate", "[compacttree]") {
+	CompactTree<TestNode> ct(ChunkAlloc_Heap);
+	ct.set_chunksize(0); //the smallest chunks, so there are several to evacuate
+
+	CompactTree<TestNode>::Arena arena(ct);
+	const int num = 400;
+	TestNode roots[num];
+	for(int i = 0; i < num; i++)
+		build_tree(roots[i], arena, 600, i*1000);
+
+	uint64_t arenasize = ct.memarena();
+	REQUIRE(arenasize > 16*1024*1024 + 3*ct.chunksize());
+
+	//free every other tree so the evacuated blocks have somewhere to go
+	for(int i = 0; i < num; i += 2)
+		roots[i].dealloc(ct);
+
+	unsigned int chunks = ct.evacuate_start(0.5);
+	REQUIRE(chunks > 0);
+	REQUIRE(ct.evacuating());
+	REQUIRE(ct.memarena() == arenasize);
+
+	//allocating and freeing between steps is allowed, but doesn't touch the evacuating chunks
+	roots[1].dealloc(ct);
+	build_tree(roots[0], arena, 600, 0);
+
+	unsigned int steps = 1;
+	while(ct.evacuate_step())
+		steps++;
+	REQUIRE(steps == chunks);
+	REQUIRE(!ct.evacuating());
+	REQUIRE(ct.memarena() < arenasize);
+
+	REQUIRE(check_tree(roots[0], 600, 0));
+	REQUIRE(roots[1].children.num() == 0);
+	for(int i = 2; i < num; i++){
+		if(i % 2 == 0)
+			REQUIRE(roots[i].children.num() == 0);
+		else
+			REQUIRE(check_tree(roots[i], 600, i*1000));
+	}
+
+	for(int i = 0; i < num; i++)
+		roots[i].dealloc(ct);
+	arena.flush();
+	REQUIRE(ct.meminuse() == 0);
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+// expanding nodes that live in an early chunk, with many chunks after it, which is the slow case for
+// finding the handle of the node when built with COMPACT_HANDLES
+TEST_CASE("CompactTree::Children::swap benchmark", "[.][benchmark][compacttree]") {
+	CompactTree<TestNode> ct(ChunkAlloc_Heap);
+	ct.set_chunksize(0);
+	CompactTree<TestNode>::Arena arena(ct);
+
+	const unsigned int width = 500, fillers = 50000, rounds = 200;
+	TestNode root;
+	root.children.alloc(width, arena);
+	std::vector<TestNode> filler(fillers);
+	for(auto & f : filler)
+		f.children.alloc(CompactTree<TestNode>::MAX_NUM - 1, arena);
+
+	Time start;
+	for(unsigned int r = 0; r < rounds; r++){
+		for(auto & child : root.children){
+			CompactTree<TestNode>::Children temp;
+			temp.alloc_temp(1, arena);
+			child.children.swap(temp);
+		}
+		for(auto & child : root.children)
+			child.children.dealloc(arena);
+	}
+	double elapsed = Time() - start;
+	WARN(to_str(ct.memalloced()/(1024*1024)) + " Mb of chunks: " + to_str(rounds*width/elapsed/1000000, 2) + " M swaps/s");
+
+	for(auto & f : filler)
+		f.children.dealloc(arena);
+	root.dealloc(ct);
+	arena.flush();
+}
+
+}; // namespace Morat
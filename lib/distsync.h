@@ -0,0 +1,127 @@
+
+#pragma once
+
+//Shares the experience of the top of the tree between the processes of a distributed search.
+//
+//Each process grows its own tree. Every so often each one collects the experience it gained
+//since the last exchange in the nodes near the root, and adds the experience the others
+//collected to the same nodes in its own tree, so they all steer towards the same moves.
+//Nodes are keyed by their path of moves from the root, so the trees don't need to match,
+//and experience for a node another process hasn't expanded is dropped.
+//
+//The experience received from the others is remembered per node so it isn't sent back.
+//The stats are sent as text, one "path:num:sum2" token per node, with the moves in the path
+//separated by commas and an empty path for the root.
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include "move.h"
+#include "string.h"
+
+namespace Morat {
+
+template<class Node>
+class DistSync {
+	struct Entry {
+		uint64_t sentnum, sentsum2;         //own experience already sent
+		uint64_t receivednum, receivedsum2; //experience added from the other processes
+		Entry() : sentnum(0), sentsum2(0), receivednum(0), receivedsum2(0) { }
+	};
+
+	std::map<std::string, Entry> entries;
+
+	void collect(const Node & node, const std::string & path, int depth, uint64_t minvisits, std::string & out){
+		Entry & e = entries[path];
+		uint64_t num = node.exp.num(), sum2 = node.exp.sum2();
+		if(num < e.receivednum + e.sentnum || sum2 < e.receivedsum2 + e.sentsum2)
+			e = Entry(); //freed by a gc and grown again, so the record is stale
+		uint64_t newnum  = num  - e.receivednum  - e.sentnum,
+		         newsum2 = sum2 - e.receivedsum2 - e.sentsum2;
+		if(newnum > 0){
+			out += " " + path + ":" + to_str(newnum) + ":" + to_str(newsum2);
+			e.sentnum += newnum;
+			e.sentsum2 += newsum2;
+		}
+
+		if(depth > 0){
+			for(const auto & child : node.children)
+				if(child.exp.num() >= minvisits)
+					collect(child, (path.empty() ? "" : path + ",") + child.move().to_s(), depth - 1, minvisits, out);
+		}
+	}
+
+	static Node * find(Node & root, const std::string & path){
+		Node * node = &root;
+		if(path.empty())
+			return node;
+		for(const auto & m : explode(path, ",")){
+			Move move(m);
+			Node * next = NULL;
+			for(auto & child : node->children){
+				if(child.move() == move){
+					next = &child;
+					break;
+				}
+			}
+			if(!next)
+				return NULL;
+			node = next;
+		}
+		return node;
+	}
+
+public:
+	//forget everything, for a new position
+	void clear(){
+		entries.clear();
+	}
+
+	//follow the root to its child for move m
+	void move(const Move & m){
+		std::string prefix = m.to_s();
+		std::map<std::string, Entry> kept;
+		for(const auto & e : entries){
+			const std::string & path = e.first;
+			if(path == prefix)
+				kept[""] = e.second;
+			else if(path.compare(0, prefix.size() + 1, prefix + ",") == 0)
+				kept[path.substr(prefix.size() + 1)] = e.second;
+		}
+		entries.swap(kept);
+	}
+
+	//the experience gained since the last call in the top depth plies, for nodes with at least minvisits
+	std::string collect(const Node & root, int depth, uint64_t minvisits){
+		std::string out;
+		collect(root, "", depth, minvisits, out);
+		return out;
+	}
+
+	//add the experience collected by the other processes
+	void apply(Node & root, const vecstr & stats){
+		for(const auto & s : stats){
+			vecstr parts = explode(s, ":");
+			if(parts.size() != 3)
+				continue;
+
+			Node * node = find(root, parts[0]);
+			uint64_t num = from_str<uint64_t>(parts[1]), sum2 = from_str<uint64_t>(parts[2]);
+			if(!node || num == 0 || sum2 > 2*num)
+				continue;
+
+			uint64_t wins = sum2 / 2;
+			node->exp.addwins(wins);
+			node->exp.addlosses(num - wins);
+			if(sum2 % 2)
+				node->exp.addtie();
+
+			Entry & e = entries[parts[0]];
+			e.receivednum += num;
+			e.receivedsum2 += sum2;
+		}
+	}
+};
+
+}; // namespace Morat
@@ -0,0 +1,190 @@
+
+#pragma once
+
+//The worker processes of a distributed search, as seen by the coordinator.
+//
+//A worker is a normal GTP engine started with --worker <address>, which connects to the
+//coordinator and reads its GTP commands from the socket instead of stdin, or one started by
+//spawn, which gets a socket as its stdin and stdout. The coordinator
+//keeps the workers on the same position as itself, and has them search alongside it,
+//see DistSync for how the trees share their experience.
+//
+//The commands can be sent to all the workers before reading any of the responses,
+//so the workers run a long command like a search at the same time as the coordinator.
+
+#include <climits>
+#include <cstdlib>
+#include <string>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "gtpbase.h"
+#include "socket.h"
+#include "string.h"
+
+namespace Morat {
+
+class DistWorkers {
+	struct Worker {
+		Socket sock;
+		pid_t pid; //the process if it was started by spawn, otherwise 0
+		Worker() : pid(0) { }
+	};
+
+	std::vector<Worker *> workers;
+
+	static std::string & exe_path(){
+		static std::string path;
+		return path;
+	}
+
+	bool accept(Socket & listener, int num, std::string & error){
+		unsigned int start = workers.size();
+		for(int i = 0; i < num; i++){
+			Worker * w = new Worker();
+			if(!listener.accept(w->sock, 30)){
+				delete w;
+				error = "Only " + to_str(i) + " of " + to_str(num) + " workers connected";
+				stop(start);
+				return false;
+			}
+			workers.push_back(w);
+		}
+		return true;
+	}
+
+public:
+	~DistWorkers(){ stop(); }
+
+	//remember how this program was started, so spawn can start more of it. Call it with argv[0]
+	//before anything changes the directory. A name without a / is looked up in the PATH again.
+	static void set_exe(const char * argv0){
+		char buf[PATH_MAX];
+		std::string name = argv0;
+		if(name.find('/') != std::string::npos && realpath(argv0, buf) != NULL)
+			name = buf;
+		exe_path() = name;
+	}
+
+	unsigned int size() const { return workers.size(); }
+	bool empty() const { return workers.empty(); }
+
+	//wait for num workers started by hand with --worker address to connect
+	bool listen(const std::string & address, int num, std::string & error){
+		Socket listener;
+		if(!listener.listen(address)){
+			error = "Failed to listen on " + address;
+			return false;
+		}
+		return accept(listener, num, error);
+	}
+
+	//start num worker processes of this program on this machine. Each talks gtp over its stdin
+	//and stdout, which are one end of a socket pair, so no other process can pose as a worker.
+	//If any of them fail, the ones it started are stopped again, leaving the workers as they were.
+	bool spawn(int num, std::string & error){
+		const std::string & exe = exe_path();
+		if(exe.empty()){
+			error = "Don't know which program to start the workers with";
+			return false;
+		}
+		unsigned int start = workers.size();
+		for(int i = 0; i < num; i++){
+			Worker * w = new Worker();
+			Socket theirs;
+			if(!w->sock.pair(theirs)){
+				delete w;
+				error = "Failed to create a socket for worker " + to_str(i);
+				stop(start);
+				return false;
+			}
+			pid_t pid = fork();
+			if(pid == 0){
+				dup2(theirs.get_fd(), 0);
+				dup2(theirs.get_fd(), 1);
+				execlp(exe.c_str(), exe.c_str(), "--nocolor", (char *)NULL);
+				_exit(127);
+			}
+			if(pid < 0){
+				delete w;
+				error = "Failed to start worker " + to_str(i);
+				stop(start);
+				return false;
+			}
+			w->pid = pid;
+			workers.push_back(w);
+		}
+
+		//make sure they all started
+		for(unsigned int i = start; i < workers.size(); i++)
+			send(i, "name");
+		bool ok = true;
+		for(unsigned int i = start; i < workers.size(); i++){
+			if(!response(i).success && ok){ //read the rest, so the quits go to idle workers
+				error = "Worker " + to_str(i - start) + " failed to start";
+				ok = false;
+			}
+		}
+		if(!ok)
+			stop(start);
+		return ok;
+	}
+
+	//tell the workers from start on to quit, and wait for the ones this process started
+	void stop(unsigned int start = 0){
+		for(unsigned int i = start; i < workers.size(); i++)
+			workers[i]->sock.write("quit\n");
+		for(unsigned int i = start; i < workers.size(); i++){
+			Worker * w = workers[i];
+			w->sock.close();
+			if(w->pid > 0)
+				waitpid(w->pid, NULL, 0);
+			delete w;
+		}
+		workers.resize(start);
+	}
+
+	//send a command without waiting for the response
+	void send(unsigned int i, const std::string & cmd){
+		workers[i]->sock.write(cmd + "\n");
+	}
+	void send(const std::string & cmd){
+		for(unsigned int i = 0; i < workers.size(); i++)
+			send(i, cmd);
+	}
+
+	//read the response to the oldest command sent to worker i that hasn't been read yet
+	GTPResponse response(unsigned int i){
+		std::string line, text;
+		bool first = true, success = false;
+		while(workers[i]->sock.readline(line)){
+			if(line.empty()){
+				if(first) //a gtp response is never empty
+					continue;
+				return GTPResponse(success, text);
+			}
+			if(first){
+				success = (line[0] == '=');
+				std::string::size_type space = line.find(' ');
+				text = (space == std::string::npos ? "" : line.substr(space + 1));
+				first = false;
+			}else{
+				text += "\n" + line;
+			}
+		}
+		return GTPResponse(false, "Lost the connection to worker " + to_str(i));
+	}
+
+	//send a command to all the workers and wait for them all, returns false if any failed
+	bool run(const std::string & cmd){
+		send(cmd);
+		bool ok = true;
+		for(unsigned int i = 0; i < workers.size(); i++)
+			ok &= response(i).success;
+		return ok;
+	}
+};
+
+}; // namespace Morat
@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "distworkers.h"
+#include "string.h"
+
+namespace Morat {
+
+//write a shell script that acts as a worker, answering every command with answer until quit
+static std::string fake_worker(const std::string & answer){
+	std::string path = "/tmp/morat-fake-worker-" + to_str(getpid()) + "-" + answer;
+	std::ofstream f(path.c_str());
+	f << "#!/bin/sh\n"
+	     "while read cmd; do\n"
+	     "\techo '" << answer << "'; echo\n"
+	     "\t[ \"$cmd\" = quit ] && exit 0\n"
+	     "done\n";
+	f.close();
+	chmod(path.c_str(), 0700);
+	return path;
+}
+
+TEST_CASE("DistWorkers spawn failures leave the workers as they were", "[distworkers]"){
+	std::string good = fake_worker("="), bad = fake_worker("?");
+	DistWorkers workers;
+	std::string error;
+
+	DistWorkers::set_exe(good.c_str());
+	REQUIRE(workers.spawn(2, error));
+	REQUIRE(workers.size() == 2);
+
+	//the workers start but fail the name check
+	DistWorkers::set_exe(bad.c_str());
+	REQUIRE_FALSE(workers.spawn(3, error));
+	CHECK(error == "Worker 0 failed to start");
+	REQUIRE(workers.size() == 2);
+
+	//the program doesn't exist, so the children exit without answering
+	DistWorkers::set_exe("/nonexistent/morat");
+	REQUIRE_FALSE(workers.spawn(2, error));
+	REQUIRE(workers.size() == 2);
+
+	REQUIRE(workers.run("name"));
+	workers.stop();
+	REQUIRE(workers.empty());
+
+	DistWorkers::set_exe("");
+	unlink(good.c_str());
+	unlink(bad.c_str());
+}
+
+}; // namespace Morat
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include "string.h"
@@ -7,23 +6,32 @@
 
 namespace Morat {
 
-class ExpPair {
-	uword s, n;
-	ExpPair(uword S, uword N) : s(S), n(N) { }
+class ExpPairPacked;
+
+//sum and number of outcomes, where a win counts as 2, a tie as 1 and a loss as 0
+//Count is the type of the counters, uword normally, uint32_t for compact tree nodes
+template <typename Count>
+class ExpPairT {
+	Count s, n;
+	ExpPairT(Count S, Count N) : s(S), n(N) { }
+	template <typename C> friend class ExpPairT;
+	friend class ExpPairPacked;
+	friend class ExpPair16;
 public:
-	ExpPair() : s(0), n(0) { }
+	ExpPairT() : s(0), n(0) { }
 	float avg() const { return (n ? 0.5f*s/n : 0); }
-	uword num() const { return n; }
-	uword sum() const { return s/2; }
+	Count num() const { return n; }
+	Count sum() const { return s/2; }
+	Count sum2() const { return s; } //with wins counted as 2, so avg() == 0.5*sum2()/num()
 
 	std::string to_s() const {
 		return to_str(avg(), 3) + "/" + to_str(num());
 	}
 
-	ExpPair(std::string str) {
+	ExpPairT(std::string str) {
 		auto parts = explode(str, "/");
 		assert(parts.size() == 2);
-		n = from_str<uword>(parts[1]);
+		n = from_str<Count>(parts[1]);
 		s = 2.0*from_str<float>(parts[0])*n;
 	}
 
@@ -32,36 +40,172 @@ public:
 	void addvloss(){ INCR(n); }
 	void addvtie() { INCR(s); }
 	void addvwin() { PLUS(s, 2); }
-	void addv(const ExpPair & a){
-		if(a.s) PLUS(s, a.s);
-		if(a.n) PLUS(n, a.n);
+	template <typename C>
+	void addv(const ExpPairT<C> & a){
+		if(a.s) PLUS(s, (Count)a.s);
+		if(a.n) PLUS(n, (Count)a.n);
 	}
+	void addv(const ExpPairPacked & a);
 
 	void addloss(){ n++; }
 	void addtie() { s++; }
 	void addwin() { s += 2; }
-	void add(const ExpPair & a){
+	void add(const ExpPairT & a){
 		s += a.s;
 		n += a.n;
 	}
 
-	void addwins(uword num)  { n += num; s += 2*num; }
-	void addlosses(uword num){ n += num; }
-	ExpPair & operator+=(const ExpPair & a){
+	void addwins(Count num)  { n += num; s += 2*num; }
+	void addlosses(Count num){ n += num; }
+	ExpPairT & operator+=(const ExpPairT & a){
 		s += a.s;
 		n += a.n;
 		return *this;
 	}
-	ExpPair operator + (const ExpPair & a){
-		return ExpPair(s + a.s, n + a.n);
+	ExpPairT operator + (const ExpPairT & a){
+		return ExpPairT(s + a.s, n + a.n);
 	}
-	ExpPair & operator*=(uword m){
+	ExpPairT & operator*=(Count m){
 		s *= m;
 		n *= m;
 		return *this;
 	}
-	ExpPair invert(){ //return it from the other player's perspective
-		return ExpPair(n*2 - s, n);
+	ExpPairT invert(){ //return it from the other player's perspective
+		return ExpPairT(n*2 - s, n);
+	}
+};
+
+//ExpPair with both counters in one 64 bit word, n in the high half and s in the low half,
+//so the atomic updates on the tree walk are one add instead of one per counter, and reads
+//always see a consistent pair. s <= 2n, so it's good for 2^31 simulations per node.
+//Select it with -DEXPPAIR_PACKED.
+class ExpPairPacked {
+	static const uint64_t S_MASK = 0xFFFFFFFFull;
+
+	uint64_t sn; //s in the low 32 bits, n in the high 32 bits
+
+	ExpPairPacked(uint64_t SN) : sn(SN) { }
+	static uint64_t pack(uint64_t s, uint64_t n){ return s | (n << 32); }
+	uint32_t s() const { return sn & S_MASK; }
+	uint32_t n() const { return sn >> 32; }
+	template <typename C> friend class ExpPairT;
+	friend class ExpPair16;
+public:
+	ExpPairPacked() : sn(0) { }
+	float    avg() const { uint64_t v = sn, n = v >> 32; return (n ? 0.5f*(v & S_MASK)/n : 0); }
+	uint32_t num() const { return n(); }
+	uint32_t sum() const { return s()/2; }
+	uint32_t sum2() const { return s(); }
+
+	std::string to_s() const {
+		return to_str(avg(), 3) + "/" + to_str(num());
+	}
+
+	ExpPairPacked(std::string str) {
+		ExpPairT<uword> e(str);
+		sn = pack(e.s, e.n);
+	}
+
+	void clear() { sn = 0; }
+
+	void addvloss(){ PLUS(sn, pack(0, 1)); }
+	void addvtie() { INCR(sn); }
+	void addvwin() { PLUS(sn, 2); }
+	template <typename C>
+	void addv(const ExpPairT<C> & a){
+		if(a.n || a.s) PLUS(sn, pack(a.s, a.n)); //a win that took back its virtual loss has no n
+	}
+	void addv(const ExpPairPacked & a){
+		if(a.sn) PLUS(sn, a.sn);
+	}
+
+	void addloss(){ sn += pack(0, 1); }
+	void addtie() { sn++; }
+	void addwin() { sn += 2; }
+	void add(const ExpPairPacked & a){
+		sn += a.sn;
+	}
+
+	void addwins(uint32_t num)  { sn += pack(2*num, num); }
+	void addlosses(uint32_t num){ sn += pack(0, num); }
+	ExpPairPacked & operator+=(const ExpPairPacked & a){
+		sn += a.sn;
+		return *this;
+	}
+	ExpPairPacked operator + (const ExpPairPacked & a){
+		return ExpPairPacked(sn + a.sn);
+	}
+	ExpPairPacked & operator*=(uint32_t m){
+		sn *= m;
+		return *this;
+	}
+	ExpPairPacked invert(){ //return it from the other player's perspective
+		return ExpPairPacked(pack(n()*2 - s(), n()));
+	}
+};
+
+template <typename Count>
+void ExpPairT<Count>::addv(const ExpPairPacked & a){
+	if(a.s()) PLUS(s, (Count)a.s());
+	if(a.n()) PLUS(n, (Count)a.n());
+}
+
+#ifdef EXPPAIR_PACKED
+typedef ExpPairPacked      ExpPair;
+#else
+typedef ExpPairT<uword>    ExpPair;
+#endif
+typedef ExpPairT<uint32_t> ExpPair32;
+
+//Quantized ExpPair packed into one 32 bit word with 16 bit counters, for rave stats in compact tree nodes.
+//Once the count fills up, both halves are halved, keeping the average, so the older experience slowly decays.
+//Updates are a CAS on the whole word, so it stays lock free.
+class ExpPair16 {
+	static const uint32_t MAX_N = 0x7FFF; //so s <= 2*n fits in 16 bits
+
+	uint32_t sn; //s in the low 16 bits, n in the high 16 bits
+
+	static uint32_t pack(uint32_t s, uint32_t n){
+		while(n > MAX_N){
+			s >>= 1;
+			n = (n + 1) >> 1;
+		}
+		return s | (n << 16);
+	}
+
+public:
+	ExpPair16() : sn(0) { }
+	float    avg() const { uint32_t v = sn, n = v >> 16; return (n ? 0.5f*(v & 0xFFFF)/n : 0); }
+	uint32_t num() const { return sn >> 16; }
+	uint32_t sum() const { return (sn & 0xFFFF)/2; }
+	uint32_t sum2() const { return sn & 0xFFFF; }
+
+	std::string to_s() const {
+		return to_str(avg(), 3) + "/" + to_str(num());
+	}
+
+	ExpPair16(std::string str) {
+		ExpPairT<uword> e(str);
+		sn = pack(e.s, e.n);
+	}
+
+	void clear() { sn = 0; }
+
+	template <typename C>
+	void addv(const ExpPairT<C> & a){
+		if(a.n == 0)
+			return;
+		uint32_t old, val;
+		do{
+			old = sn;
+			val = pack((old & 0xFFFF) + a.s, (old >> 16) + a.n);
+		}while(!CAS(sn, old, val));
+	}
+	void addv(const ExpPairPacked & a){
+		addv(ExpPairT<uint32_t>(a.s(), a.n()));
+	}
+	void addv(const ExpPair16 & a){
+		addv(ExpPairT<uint32_t>(a.sum2(), a.num()));
 	}
 };
 
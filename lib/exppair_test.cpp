@@ -0,0 +1,182 @@
+
+#include <vector>
+
+#include "catch.hpp"
+
+#include "exppair.h"
+#include "string.h"
+#include "thread.h"
+#include "time.h"
+
+namespace Morat {
+
+TEST_CASE("ExpPair", "[exppair]"){
+	ExpPair e;
+	REQUIRE(e.num() == 0);
+	REQUIRE(e.avg() == 0);
+	e.addwin();
+	e.addtie();
+	e.addloss();
+	e.addloss();
+	REQUIRE(e.num() == 2);
+	REQUIRE(e.avg() == 0.75f);
+	REQUIRE(e.invert().avg() == 0.25f);
+
+	ExpPair32 c;
+	c.addv(e);
+	c.addv(e);
+	REQUIRE(c.num() == 4);
+	REQUIRE(c.avg() == 0.75f);
+	REQUIRE(ExpPair(e.to_s()).num() == e.num());
+}
+
+TEST_CASE("ExpPair16", "[exppair]"){
+	ExpPair win, loss;
+	win.addwins(1);
+	loss.addlosses(1);
+
+	ExpPair16 q;
+	REQUIRE(q.num() == 0);
+	REQUIRE(q.avg() == 0);
+
+	SECTION("Exact while it fits") {
+		for(int i = 0; i < 1000; i++){
+			q.addv(win);
+			q.addv(loss);
+			q.addv(loss);
+			q.addv(loss);
+		}
+		REQUIRE(q.num() == 4000);
+		REQUIRE(q.avg() == 0.25f);
+		REQUIRE(ExpPair16(q.to_s()).num() == 4000);
+	}
+
+	SECTION("Merges with another") {
+		ExpPair16 r;
+		q.addv(win);
+		r.addv(loss);
+		r.addv(loss);
+		r.addv(loss);
+		q.addv(r);
+		REQUIRE(q.num() == 4);
+		REQUIRE(q.avg() == 0.25f);
+	}
+
+	SECTION("Keeps the average when it saturates") {
+		for(int i = 0; i < 100000; i++){
+			q.addv(win);
+			q.addv(loss);
+			q.addv(loss);
+			q.addv(loss);
+		}
+		REQUIRE(q.num() > 16000);
+		REQUIRE(q.num() < 32768);
+		REQUIRE(q.avg() == Approx(0.25f).epsilon(0.01));
+
+		//and new experience still moves it
+		for(int i = 0; i < 100000; i++)
+			q.addv(win);
+		REQUIRE(q.avg() > 0.95f);
+	}
+}
+
+TEST_CASE("ExpPairPacked", "[exppair]"){
+	ExpPairT<uword> e;
+	ExpPairPacked p;
+	for(int i = 0; i < 100; i++){
+		//a win, a tie and a loss, then a win with the virtual loss
+		e.addloss();  p.addloss();
+		e.addwin();   p.addwin();
+		e.addloss();  p.addloss();
+		e.addtie();   p.addtie();
+		e.addloss();  p.addloss();
+		e.addvloss(); p.addvloss();
+		e.addvwin();  p.addvwin();
+	}
+	e.addlosses(7); p.addlosses(7);
+	e.addwins(3);   p.addwins(3);
+	REQUIRE(p.num() == e.num());
+	REQUIRE(p.sum() == e.sum());
+	REQUIRE(p.avg() == e.avg());
+	REQUIRE(p.invert().avg() == e.invert().avg());
+	REQUIRE(ExpPairPacked(p.to_s()).num() == p.num());
+
+	//and converting between the representations
+	ExpPairPacked q;
+	q.addv(e);
+	q.addv(p);
+	REQUIRE(q.num() == 2*e.num());
+	REQUIRE(q.avg() == e.avg());
+
+	ExpPair32 c;
+	ExpPair16 r;
+	c.addv(p);
+	r.addv(p);
+	REQUIRE(c.num() == p.num());
+	REQUIRE(c.avg() == p.avg());
+	REQUIRE(r.num() == p.num());
+	REQUIRE(r.avg() == p.avg());
+
+	//a win after the virtual loss was taken back, as backup passes it, still counts
+	ExpPairT<uword> v;
+	v.addwin(); //the visit was counted by the virtual loss, which is on the node already
+	REQUIRE(v.num() == 0);
+	ExpPairPacked w;
+	w.addv(v);
+	REQUIRE(w.sum() == 1);
+	REQUIRE(w.num() == 0);
+
+	SECTION("Concurrent updates are not lost") {
+		ExpPairPacked shared;
+		const int threads = 4, updates = 100000;
+		std::vector<Thread> pool(threads);
+		for(auto & t : pool)
+			t([&](){
+				for(int i = 0; i < updates; i++){
+					shared.addvloss();
+					shared.addvwin();
+				}
+			});
+		for(auto & t : pool)
+			t.join();
+		REQUIRE(shared.num() == threads*updates);
+		REQUIRE(shared.avg() == 1.0f);
+	}
+}
+
+// update the same pair from many threads, like the root during a search: a virtual loss on the
+// way down, then the result of the rollout on the way back up
+template <class Pair>
+double contended_updates(int threads, int updates){
+	ExpPairT<uword> result;
+	result.addwins(1);
+
+	Pair shared;
+	std::vector<Thread> pool(threads);
+	Time start;
+	for(auto & t : pool)
+		t([&](){
+			for(int i = 0; i < updates; i++){
+				shared.addvloss();
+				shared.addv(result);
+			}
+		});
+	for(auto & t : pool)
+		t.join();
+	double elapsed = Time() - start;
+	REQUIRE(shared.num() == (uint64_t)2*threads*updates);
+	return threads*updates/elapsed;
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("ExpPair contended update benchmark", "[.][benchmark][exppair]"){
+	const int updates = 2000000;
+	for(int threads : {1, 8, 32}){
+		double separate = contended_updates<ExpPairT<uword>>(threads, updates/threads);
+		double packed   = contended_updates<ExpPairPacked>(threads, updates/threads);
+		WARN(to_str(threads) + " threads: separate counters " + to_str(separate/1000000, 2) +
+		     " M updates/s, packed " + to_str(packed/1000000, 2) + " M updates/s");
+	}
+}
+
+}; // namespace Morat
@@ -125,6 +125,8 @@ public:
 
 		while(running && fgets(buf, 1000, in)){
 			std::string line(buf);
+			while(line.back() != '\n' && fgets(buf, 1000, in)) //longer than the buffer
+				line += buf;
 
 			trim(line);
 
@@ -11,6 +11,7 @@ namespace Morat {
 template<class Board>
 class History {
 	std::vector<Move> hist;
+	std::vector<typename Board::Undo> undos;
 	Board board;
 
 public:
@@ -41,6 +42,7 @@ public:
 
 	void clear() {
 		hist.clear();
+		undos.clear();
 		board.clear();
 	}
 
@@ -49,17 +51,15 @@ public:
 			return false;
 
 		hist.pop_back();
-
-		board.clear();
-		for(auto m : hist) {
-			board.move(m);
-		}
+		board.undo(undos.back());
+		undos.pop_back();
 		return true;
 	}
 
 	bool move(const Move & m) {
 		if(board.valid_move(m)){
-			board.move(m);
+			undos.push_back(typename Board::Undo());
+			board.move(m, undos.back());
 			hist.push_back(m);
 			return true;
 		}
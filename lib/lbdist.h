@@ -8,16 +8,29 @@ Done using floodfills from each edge/corner for each side, only going in the 3 f
 
 Increase distance when crossing an opponent virtual connection?
 Decrease distance when crossing your own virtual connection?
+
+A turn sharper than 60 degrees is never shorter than cutting straight across to the cell after it,
+so the forward only floods give the plain shortest paths, where entering an empty cell costs 1 and
+entering your own stone costs 0. That lets the floods run a whole layer at a time on bitboards: the
+cells at distance d+1 are the empty cells next to the ones within d, plus your own stones connected
+to any of those for free. It also lets move() repair the distances after a single stone instead
+of running all the floods again: the side that moved can only get closer, so its distances just
+spread out from the new stone, while the other side can only get further away, so only the cells
+that lose every shortest path get reset and filled back in from their neighbors.
 */
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
+#include <vector>
 
+#include "bitboard.h"
 #include "move.h"
 
 
 namespace Morat {
 
-template<class SubClass, class Board>
+template<class SubClass, class Board, class BitSet>
 class LBDistsBase {
 /*
 This uses the Curiously recurring template pattern: https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern
@@ -25,7 +38,7 @@ so that this class, the super class, can call init_player and _get on the subcla
 would be to use virtual functions, which would work, but could be significantly slower.
 
 Subclasses must implement init_player and _get which define which flood fills to run,
-and how to look up the value for a given cell.
+and how to look up the value for a given cell. BitSet is the BitBoard that fits the biggest board.
 */
 
 	SubClass* self() {
@@ -33,6 +46,8 @@ and how to look up the value for a given cell.
 	}
 
 protected:
+	typedef BitSet Bits;
+
 	struct MoveDist {
 		MoveValid pos;
 		int dist;
@@ -83,9 +98,27 @@ protected:
 	};
 
 	int dists[Board::LBDist_directions][2][Board::max_vec_size]; //[edge/corner][player][cell]
+	uint8_t seeds[Board::LBDist_directions][2][Board::max_vec_size]; //whether the cell is on that edge/corner
 	static const int maxdist = 1000;
 	IntPQueue Q;
 	const Board * board;
+	bool crossvcs;
+	Side sides; //which players have distances
+
+	//the bitboards of the cells, rebuilt when the board size changes
+	Bits onboard;
+	int16_t bitxy[Bits::words * 64]; //the cell of each bit on the board
+	int bitsize;                     //the vec_size they were built for
+
+	//the bitboards for the floods of one player, from start_bits
+	Bits own, halo, empty; //your stones, the cells next to them, and the empty cells
+	Bits blocked[6];       //the cells that can't step in each direction, as it passes between two opponent stones
+
+	//scratch space for move()
+	std::vector<MoveValid> work;
+	std::vector<std::pair<int, int>> heap; //cells that may have lost their distance, by distance
+	std::vector<int> lost;
+	uint8_t affected[Board::max_vec_size];
 
 	int & dist(int edge, Side player, int i)               { return dists[edge][player.to_i() - 1][i]; }
 	int & dist(int edge, Side player, const MoveValid & m) { return dist(edge, player, m.xy); }
@@ -94,6 +127,7 @@ protected:
 
 	void init(int x, int y, int edge, Side player, int dir){
 		Side val = board->get(x, y);
+		seeds[edge][player.to_i() - 1][board->xy(x, y)] = 1;
 		if(val != ~player){
 			bool empty = (val == Side::NONE);
 			MoveValid move(x, y, board->xy(x, y));
@@ -104,22 +138,64 @@ protected:
 
 public:
 
-	LBDistsBase() : board(NULL) {}
-	LBDistsBase(const Board * b) { run(b); }
+	LBDistsBase() : board(NULL), crossvcs(true), sides(Side::NONE), bitsize(0) {
+		memset(affected, 0, sizeof(affected));
+	}
+	LBDistsBase(const Board * b) : bitsize(0) {
+		memset(affected, 0, sizeof(affected));
+		run(b);
+	}
 
 	void run(const Board * b, bool crossvcs = true, Side side = Side::BOTH) {
 	// run the flood fills needed to generate the distances
 		board = b;
+		this->crossvcs = crossvcs;
+		sides = side;
 
-		for(int i = 0; i < Board::LBDist_directions; i++)
-			for(int j = 0; j < 2; j++)
-				for(int k = 0; k < board->vec_size(); k++)
+		for(int i = 0; i < Board::LBDist_directions; i++){
+			for(int j = 0; j < 2; j++){
+				for(int k = 0; k < board->vec_size(); k++){
 					dists[i][j][k] = maxdist; //far far away!
+					seeds[i][j][k] = 0;
+				}
+			}
+		}
 
-		if((side & Side::P1) == Side::P1) self()->init_player(crossvcs, Side::P1);
-		if((side & Side::P2) == Side::P2) self()->init_player(crossvcs, Side::P2);
+		if(has(Side::P1)) self()->init_player(crossvcs, Side::P1);
+		if(has(Side::P2)) self()->init_player(crossvcs, Side::P2);
+	}
+
+	// start from the distances of o for side, run on a board in the same position as b
+	void copy(const LBDistsBase & o, const Board * b, Side side = Side::BOTH) {
+		board = b;
+		crossvcs = o.crossvcs;
+		sides = Side::NONE;
+		int size = board->vec_size();
+		for(Side player : {Side::P1, Side::P2}){
+			if((side & player) != player || !o.has(player))
+				continue;
+			sides |= player;
+			int j = player.to_i() - 1;
+			for(int i = 0; i < Board::LBDist_directions; i++){
+				std::copy(o.dists[i][j], o.dists[i][j] + size, dists[i][j]);
+				std::copy(o.seeds[i][j], o.seeds[i][j] + size, seeds[i][j]);
+			}
+		}
+	}
+
+	// update the distances for the stone just placed at pos on b, which must otherwise be in the
+	// same position as the board they were run on, giving the same distances as running them again
+	void move(const Board * b, const MoveValid & pos) {
+		board = b;
+		Side turn = board->get(pos);
+		for(int edge = 0; edge < Board::LBDist_directions; edge++){
+			if(has(turn))  closer(edge, turn, pos);
+			if(has(~turn)) further(edge, ~turn, pos);
+		}
 	}
 
+	bool has(Side player) const { return (sides & player) == player; }
+
 	// return the distance to for a single cell, either the minimum of both sides or for the chosen side
 	int get(Move      pos) { return get(MoveValid(pos, board->xy(pos))); }
 	int get(MoveValid pos) { return std::min(get(pos, Side::P1), get(pos, Side::P2)); }
@@ -162,9 +238,7 @@ protected:
 						continue;
 
 					if(colour == Side::NONE){
-						if(!crossvcs && //forms a vc
-						   board->get(neighbors[(nd + 5) % 6]) == otherplayer &&
-						   board->get(neighbors[(nd + 7) % 6]) == otherplayer)
+						if(!crossvcs && crosses_vc(neighbors, nd, otherplayer))
 							continue;
 
 						next.dist++;
@@ -179,6 +253,270 @@ protected:
 		}
 	}
 
+	//set up the bitboards for the floods of player on the current board
+	void start_bits(Side player) {
+		if(bitsize != board->vec_size()){
+			bitsize = board->vec_size();
+			onboard.clear();
+			for(int y = 0; y < board->lines(); y++){
+				for(int x = board->line_start(y); x < board->line_end(y); x++){
+					onboard.set(Bits::index(x, y));
+					bitxy[Bits::index(x, y)] = board->xy(x, y);
+				}
+			}
+		}
+
+		Bits opp;
+		own.clear();
+		onboard.each([&](int i){
+			Side s = board->get(bitxy[i]);
+			if(s == player)
+				own.set(i);
+			else if(s == ~player)
+				opp.set(i);
+		});
+		halo = own.grow().andnot(own);
+		empty = onboard.andnot(own | opp);
+
+		if(!crossvcs){
+			for(int dir = 0; dir < 6; dir++)
+				blocked[dir] = opp.shift((dir + 2) % 6) & opp.shift((dir + 4) % 6);
+		}
+	}
+
+	//add x,y to the cells of the edge/corner that the bit flood starts from
+	void seed_bits(Bits & start, int x, int y, int edge, Side player) {
+		start.set(Bits::index(x, y));
+		seeds[edge][player.to_i() - 1][board->xy(x, y)] = 1;
+	}
+
+	//set the distances of all the cells reached from start, one layer at a time, giving the same
+	//distances as init and flood. Your own stones only need to be flooded when a layer reaches the
+	//halo of cells around them.
+	void flood_bits(int edge, Side player, const Bits & start) {
+		int * d = dists[edge][player.to_i() - 1];
+		Bits reached = start & own;
+		if(reached.any())
+			reached = reached.flood(own);
+		set_layer(d, reached, 0);
+
+		Bits last = reached; //only the newest layer can reach further
+		for(int layer = 1; ; layer++){
+			Bits next;
+			if(!crossvcs){
+				for(int dir = 0; dir < 6; dir++)
+					next |= last.andnot(blocked[dir]).shift(dir);
+			}else{
+				next = last.grow();
+			}
+			next = (next & empty).andnot(reached);
+			if(layer == 1)
+				next |= start & empty;
+			if(next.none())
+				break;
+			if((next & halo).any())
+				next = next.flood(next | own).andnot(reached);
+
+			set_layer(d, next, layer);
+			reached |= next;
+			last = next;
+		}
+	}
+
+	void set_layer(int * d, const Bits & cells, int layer) {
+		cells.each([&](int i){ d[bitxy[i]] = layer; });
+	}
+
+	//whether the step between a cell and its neighbor i passes between two of otherplayer's stones,
+	//which are then virtually connected. The two stones are the neighbors on either side of i, so
+	//it's the same from either end of the step.
+	bool crosses_vc(const MoveValid * neighbors, int i, Side otherplayer) const {
+		const MoveValid & a = neighbors[(i + 5) % 6], & b = neighbors[(i + 1) % 6];
+		return board->on_board(a) && board->on_board(b) &&
+		       board->get(a) == otherplayer && board->get(b) == otherplayer;
+	}
+
+	//the cost for player to step onto pos from its neighbor i, or -1 if it can't
+	int cost(const MoveValid & pos, const MoveValid * neighbors, int i, Side player) const {
+		Side colour = board->get(pos);
+		if(colour == ~player)
+			return -1;
+		if(colour != Side::NONE)
+			return 0;
+		if(!crossvcs && crosses_vc(neighbors, i, ~player))
+			return -1;
+		return 1;
+	}
+
+	//the distance the cell would start at as part of the edge/corner, or maxdist if it isn't
+	int seed(int edge, Side player, const MoveValid & pos) const {
+		if(!seeds[edge][player.to_i() - 1][pos.xy])
+			return maxdist;
+		Side colour = board->get(pos);
+		return (colour == ~player ? maxdist : colour == Side::NONE);
+	}
+
+	//spread the distances of the cells in work to their neighbors, until nothing gets closer
+	void relax(int edge, Side player){
+		for(unsigned int w = 0; w < work.size(); w++){
+			MoveValid cur = work[w];
+			int d = dist(edge, player, cur);
+			const MoveValid * neighbors = board->neighbors(cur);
+			for(int i = 0; i < 6; i++){
+				const MoveValid & next = neighbors[i];
+				if(!board->on_board(next))
+					continue;
+				int c = cost(next, neighbors, i, player);
+				if(c >= 0 && dist(edge, player, next) > d + c){
+					dist(edge, player, next) = d + c;
+					work.push_back(next);
+				}
+			}
+		}
+		work.clear();
+	}
+
+	//player placed a stone at pos, which can only bring cells closer, and only through pos
+	void closer(int edge, Side player, const MoveValid & pos){
+		int d = seed(edge, player, pos);
+		const MoveValid * neighbors = board->neighbors(pos);
+		for(int i = 0; i < 6; i++)
+			if(board->on_board(neighbors[i]))
+				d = std::min(d, dist(edge, player, neighbors[i])); //stepping onto your own stone is free
+		if(d < dist(edge, player, pos)){
+			dist(edge, player, pos) = d;
+			work.push_back(pos);
+			relax(edge, player);
+		}
+	}
+
+	//the cells that might lose their distance, closest first, and your own stones after the empty
+	//cells at the same distance, as those could be what they're reached from
+	void push_affected(int edge, Side player, const MoveValid & pos){
+		int d = dist(edge, player, pos);
+		heap.push_back(std::make_pair(-(2*d + (board->get(pos) == player)), pos.xy));
+		std::push_heap(heap.begin(), heap.end());
+	}
+
+	//whether next could be reached from a neighbor at distance d
+	bool follows(int edge, Side player, int d, const MoveValid & next){
+		return d < maxdist && dist(edge, player, next) == d + (board->get(next) == Side::NONE);
+	}
+
+	//whether pos still has a neighbor it can be reached from at its current distance
+	bool supported(int edge, Side player, const MoveValid & pos){
+		int d = dist(edge, player, pos);
+		if(seed(edge, player, pos) == d)
+			return true;
+		const MoveValid * neighbors = board->neighbors(pos);
+		for(int i = 0; i < 6; i++){
+			const MoveValid & prev = neighbors[i];
+			if(board->on_board(prev) && !affected[prev.xy] && dist(edge, player, prev) < maxdist){
+				int c = cost(pos, neighbors, i, player);
+				if(c >= 0 && dist(edge, player, prev) + c == d)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	//the opponent placed a stone at pos, which blocks it and may complete virtual connections
+	//around it, so cells can only get further away. Find the ones that lost all their shortest
+	//paths, going outwards from pos, then fill them back in from the cells around them.
+	void further(int edge, Side player, const MoveValid & pos){
+		//the neighbors that could have been reached through pos, or all of them if the new stone
+		//can block the step between two of them by completing a virtual connection
+		int old = dist(edge, player, pos);
+		const MoveValid * neighbors = board->neighbors(pos);
+		for(int i = 0; i < 6; i++){
+			const MoveValid & next = neighbors[i];
+			if(board->on_board(next) && (follows(edge, player, old, next) ||
+			   (!crossvcs && dist(edge, player, next) < maxdist)))
+				push_affected(edge, player, next);
+		}
+
+		dist(edge, player, pos) = maxdist;
+		affected[pos.xy] = 1;
+		lost.push_back(pos.xy);
+		unsigned int found = 1; //cells in lost that had their dependents checked
+
+		while(!heap.empty()){
+			std::pop_heap(heap.begin(), heap.end());
+			MoveValid cur = board->yx(heap.back().second);
+			heap.pop_back();
+			if(affected[cur.xy])
+				continue;
+
+			if(board->get(cur) == player){
+				//your own stones are all the same distance as the rest of their group, so it
+				//only loses its distance if none of the group can be reached at that distance
+				unsigned int start = lost.size();
+				affected[cur.xy] = 1;
+				lost.push_back(cur.xy);
+				for(unsigned int j = start; j < lost.size(); j++){
+					const MoveValid * gn = board->neighbors(lost[j]);
+					for(int i = 0; i < 6; i++){
+						if(board->on_board(gn[i]) && !affected[gn[i].xy] && board->get(gn[i]) == player){
+							affected[gn[i].xy] = 1;
+							lost.push_back(gn[i].xy);
+						}
+					}
+				}
+				bool keep = false;
+				for(unsigned int j = start; j < lost.size() && !keep; j++)
+					keep = supported(edge, player, board->yx(lost[j]));
+				if(keep){
+					for(unsigned int j = start; j < lost.size(); j++)
+						affected[lost[j]] = 0;
+					lost.resize(start);
+					continue;
+				}
+			}else{
+				if(supported(edge, player, cur))
+					continue;
+				affected[cur.xy] = 1;
+				lost.push_back(cur.xy);
+			}
+
+			//anything further away could have been reached through these
+			for(; found < lost.size(); found++){
+				MoveValid l = board->yx(lost[found]);
+				int d = dist(edge, player, l);
+				const MoveValid * ln = board->neighbors(l);
+				for(int i = 0; i < 6; i++){
+					const MoveValid & next = ln[i];
+					if(board->on_board(next) && !affected[next.xy] && follows(edge, player, d, next))
+						push_affected(edge, player, next);
+				}
+			}
+		}
+
+		for(int xy : lost)
+			dists[edge][player.to_i() - 1][xy] = maxdist;
+
+		//start the lost cells from their closest neighbor that kept its distance, then spread
+		for(int xy : lost){
+			MoveValid l = board->yx(xy);
+			int d = seed(edge, player, l);
+			const MoveValid * ln = board->neighbors(l);
+			for(int i = 0; i < 6; i++){
+				const MoveValid & prev = ln[i];
+				if(board->on_board(prev) && dist(edge, player, prev) < maxdist){
+					int c = cost(l, ln, i, player);
+					if(c >= 0)
+						d = std::min(d, dist(edge, player, prev) + c);
+				}
+			}
+			if(d < maxdist){
+				dist(edge, player, l) = d;
+				work.push_back(l);
+			}
+			affected[xy] = 0;
+		}
+		lost.clear();
+		relax(edge, player);
+	}
+
 	void partialsort(int * list, int max){
 	//partially sort the list with selection sort
 		for(int i = 0; i < max; i++){
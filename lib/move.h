@@ -44,6 +44,13 @@ struct Move {
 		return std::string() + char(x + 'a') + to_str(y + 1);
 	}
 
+	//pack into 10 bits for compact storage, works for boards up to 28x32
+	uint16_t to_bits() const { return (y < 0 ? (32 + y) : (y | (x << 5))); }
+	static Move from_bits(uint16_t b) {
+		int y = b & 31;
+		return (y >= 28 ? Move(MoveSpecial(y - 32)) : Move((b >> 5) & 31, y));
+	}
+
 	friend std::ostream& operator<< (std::ostream &out, const Move & m) { return out << m.to_s(); }
 
 	bool operator< (const Move & b) const { return (y == b.y ? x <  b.x : y <  b.y); }
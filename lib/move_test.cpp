@@ -25,6 +25,20 @@ TEST_CASE("Move", "[move]"){
 	REQUIRE((Move("b2") - Move(1, 1)) == Move("a1"));
 }
 
+TEST_CASE("Move bits", "[move]"){
+	for(Move m : {Move(M_SWAP), Move(M_RESIGN), Move(M_NONE), Move(M_UNKNOWN)}){
+		REQUIRE(m.to_bits() < 1024);
+		REQUIRE(Move::from_bits(m.to_bits()) == m);
+	}
+	for(int y = 0; y < 28; y++){
+		for(int x = 0; x < 32; x++){
+			Move m(x, y);
+			REQUIRE(m.to_bits() < 1024);
+			REQUIRE(Move::from_bits(m.to_bits()) == m);
+		}
+	}
+}
+
 TEST_CASE("MoveValid", "[move]"){
 	REQUIRE(MoveValid() == M_UNKNOWN);
 	REQUIRE(MoveValid(M_UNKNOWN) == M_UNKNOWN);
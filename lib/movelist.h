@@ -1,22 +1,31 @@
 
 #pragma once
 
+#include <cstring>
+
 #include "exppair.h"
 #include "move.h"
 
 
 namespace Morat {
 
+//The rave stats are only valid for the cells stamped with the current generation, so reset()
+//just starts a new generation instead of clearing the whole board worth of stats, and
+//finishrollout() clears each cell the first time it's played in a generation.
 template<class Board>
 struct MoveList {
 	ExpPair    exp[2];       //aggregated outcomes overall
-	ExpPair    rave[2][Board::max_vec_size]; //aggregated outcomes per move
+	ExpPair    rave[2][Board::max_vec_size]; //aggregated outcomes per move, if stamped with gen
+	uint32_t   stamp[Board::max_vec_size];   //generation in which rave[*][xy] was last cleared
+	uint32_t   gen;          //current generation, bumped by reset()
 	MovePlayer moves[Board::max_vec_size];   //moves made in order
 	int        tree;         //number of moves in the tree
 	int        rollout;      //number of moves in the rollout
 	Board *    board;        //reference to rootboard for xy()
 
-	MoveList() : tree(0), rollout(0), board(NULL) { }
+	MoveList() : gen(0), tree(0), rollout(0), board(NULL) {
+		memset(stamp, 0, sizeof(stamp));
+	}
 
 	void addtree(const Move & move, Side player){
 		moves[tree++] = MovePlayer(move, player);
@@ -30,11 +39,18 @@ struct MoveList {
 		board = b;
 		exp[0].clear();
 		exp[1].clear();
-		for(int i = 0; i < b->vec_size(); i++){
-			rave[0][i].clear();
-			rave[1][i].clear();
+		if(++gen == 0){ //wrapped, so old stamps could look current
+			memset(stamp, 0, sizeof(stamp));
+			gen = 1;
 		}
 	}
+	//reset, but start from the same tree moves as o, to play more rollouts from its leaf
+	void reset(const MoveList & o){
+		reset(o.board);
+		tree = o.tree;
+		for(int i = 0; i < tree; i++)
+			moves[i] = o.moves[i];
+	}
 	void finishrollout(Outcome won){
 		exp[0].addloss();
 		exp[1].addloss();
@@ -45,7 +61,13 @@ struct MoveList {
 			exp[won.to_i() - 1].addwin();
 
 			for(MovePlayer * i = begin(), * e = end(); i != e; i++){
-				ExpPair & r = rave[i->player.to_i() - 1][board->xy(*i)];
+				int xy = board->xy(*i);
+				if(stamp[xy] != gen){
+					stamp[xy] = gen;
+					rave[0][xy].clear();
+					rave[1][xy].clear();
+				}
+				ExpPair & r = rave[i->player.to_i() - 1][xy];
 				r.addloss();
 				if(+i->player == won)
 					r.addwin();
@@ -70,7 +92,9 @@ struct MoveList {
 		exp[1].addlosses(-n);
 	}
 	const ExpPair & getrave(Side player, const Move & move) const {
-		return rave[player.to_i() - 1][board->xy(move)];
+		static const ExpPair empty;
+		int xy = board->xy(move);
+		return (stamp[xy] == gen ? rave[player.to_i() - 1][xy] : empty);
 	}
 	const ExpPair & getexp(Side player) const {
 		return exp[player.to_i() - 1];
@@ -0,0 +1,159 @@
+#include <vector>
+
+#include "catch.hpp"
+
+#include "movelist.h"
+#include "string.h"
+#include "time.h"
+#include "xorshift.h"
+
+namespace Morat {
+
+//just enough of a square board for MoveList
+struct MoveListBoard {
+	static const int max_size = 25;
+	static const int max_vec_size = max_size * max_size;
+	int size;
+	MoveListBoard(int s) : size(s) { }
+	int vec_size() const { return size * size; }
+	int xy(const Move & m) const { return m.y * size + m.x; }
+};
+
+//the old MoveList rave stats, cleared in full on every reset, as a reference
+struct DenseRave {
+	ExpPair rave[2][MoveListBoard::max_vec_size];
+
+	void reset(const MoveListBoard & b){
+		for(int i = 0; i < b.vec_size(); i++){
+			rave[0][i].clear();
+			rave[1][i].clear();
+		}
+	}
+	void finishrollout(const MoveListBoard & b, const MovePlayer * begin, const MovePlayer * end, Outcome won){
+		if(won == Outcome::DRAW)
+			return;
+		for(const MovePlayer * i = begin; i != end; i++){
+			ExpPair & r = rave[i->player.to_i() - 1][b.xy(*i)];
+			r.addloss();
+			if(+i->player == won)
+				r.addwin();
+		}
+	}
+};
+
+//play num random moves with alternating players, some of them repeated
+static void random_moves(MoveList<MoveListBoard> & ml, MoveListBoard & b, XORShift_uint32 & rand, int num){
+	Side side = Side::P1;
+	for(int i = 0; i < num; i++){
+		Move m(rand() % b.size, rand() % b.size);
+		if(i < num/4)
+			ml.addtree(m, side);
+		else
+			ml.addrollout(m, side);
+		side = ~side;
+	}
+}
+
+TEST_CASE("MoveList::getrave", "[movelist]"){
+	XORShift_uint32 rand(7);
+	MoveListBoard b(9);
+	MoveList<MoveListBoard> ml;
+	DenseRave dense;
+
+	for(int iter = 0; iter < 50; iter++){
+		ml.reset(&b);
+		dense.reset(b);
+		for(int r = 0; r < (iter % 3) + 1; r++){
+			random_moves(ml, b, rand, 20 + iter % 10);
+			Outcome won = (iter % 5 == 0 ? Outcome::DRAW : (rand() % 2 ? Outcome::P1 : Outcome::P2));
+			dense.finishrollout(b, ml.begin(), ml.end(), won);
+			ml.finishrollout(won);
+		}
+
+		for(int y = 0; y < b.size; y++){
+			for(int x = 0; x < b.size; x++){
+				Move m(x, y);
+				for(Side side : {Side::P1, Side::P2}){
+					const ExpPair & r = ml.getrave(side, m);
+					const ExpPair & d = dense.rave[side.to_i() - 1][b.xy(m)];
+					REQUIRE(r.num() == d.num());
+					REQUIRE(r.sum() == d.sum());
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("MoveList::reset from another list's leaf", "[movelist]"){
+	XORShift_uint32 rand(11);
+	MoveListBoard b(9);
+	MoveList<MoveListBoard> leaf, ml;
+	leaf.reset(&b);
+	random_moves(leaf, b, rand, 40); //10 tree moves, 30 rollout moves
+	leaf.finishrollout(Outcome::P1);
+
+	//stale rave from an earlier rollout of its own
+	ml.reset(&b);
+	random_moves(ml, b, rand, 40);
+	ml.finishrollout(Outcome::P2);
+
+	ml.reset(leaf);
+	REQUIRE(ml.tree == 10);
+	REQUIRE(ml.end() == ml.begin() + 10);
+	for(int i = 0; i < 10; i++){
+		REQUIRE(ml.begin()[i] == leaf.begin()[i]);
+		REQUIRE(ml.begin()[i].player == leaf.begin()[i].player);
+	}
+	REQUIRE(ml.getexp(Side::P1).num() == 0);
+	for(int y = 0; y < b.size; y++)
+		for(int x = 0; x < b.size; x++)
+			REQUIRE(ml.getrave(Side::P1, Move(x, y)).num() == 0);
+
+	//a rollout from the leaf counts the tree moves too
+	ml.addrollout(Move(8, 8), Side::P1);
+	ml.finishrollout(Outcome::P1);
+	REQUIRE(ml.getexp(Side::P1).num() == 1);
+	REQUIRE(ml.getexp(Side::P1).avg() == 1);
+	REQUIRE(ml.getrave(ml.begin()[0].player, *ml.begin()).num() >= 1);
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("MoveList reset benchmark", "[.][benchmark][movelist]"){
+	const int playouts = 200000;
+	for(int size : {5, 13, 19, 25}){
+		MoveListBoard b(size);
+		int moves = b.vec_size() / 2;
+		XORShift_uint32 rand(size);
+
+		MoveList<MoveListBoard> ml;
+		ml.reset(&b);
+		random_moves(ml, b, rand, moves);
+		std::vector<MovePlayer> game(ml.begin(), ml.end());
+
+		DenseRave * dense = new DenseRave();
+		std::vector<MovePlayer> played(game.size());
+		Time start;
+		for(int i = 0; i < playouts; i++){
+			dense->reset(b);
+			for(unsigned int j = 0; j < game.size(); j++) //record the moves like MoveList does
+				played[j] = game[j];
+			dense->finishrollout(b, played.data(), played.data() + played.size(), Outcome::P1);
+		}
+		double densetime = Time() - start;
+		delete dense;
+
+		start = Time();
+		for(int i = 0; i < playouts; i++){
+			ml.reset(&b);
+			for(const MovePlayer & m : game)
+				ml.addrollout(m, m.player);
+			ml.finishrollout(Outcome::P1);
+		}
+		double stamptime = Time() - start;
+
+		WARN("size " + to_str(size) + ": full clear " + to_str(densetime*1000000000/playouts, 0) +
+		     " ns/playout, stamped " + to_str(stamptime*1000000000/playouts, 0) + " ns/playout");
+	}
+}
+
+}; // namespace Morat
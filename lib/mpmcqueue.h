@@ -0,0 +1,128 @@
+
+#pragma once
+
+//A bounded lock-free queue that any number of threads can push to and pop from at once.
+//
+//It's a ring of cells, each with a sequence number that says whether it's ready to be written
+//or read for the current lap of the ring, so a push or pop only has to win a CAS on the shared
+//position and then works on its own cell. push fails when the queue is full and pop fails when
+//it's empty instead of waiting, so the callers can go do something else useful instead.
+//
+//Based on Dmitry Vyukov's bounded MPMC queue.
+//
+//resize() and the destructor aren't thread safe, and drop anything left in the queue.
+
+#include <cassert>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "thread.h"
+
+namespace Morat {
+
+template<class T>
+class MPMCQueue {
+	static const unsigned int LINE = 64; //cache line size
+
+	struct Cell {
+		uint64_t seq;
+		T data;
+	};
+
+	Cell *   cells;
+	uint64_t mask;
+	char pad0[LINE];
+	uint64_t pushpos; //the pushers and poppers each get their own cache line
+	char pad1[LINE - sizeof(uint64_t)];
+	uint64_t poppos;
+	char pad2[LINE - sizeof(uint64_t)];
+
+	MPMCQueue(const MPMCQueue &) = delete;
+	MPMCQueue & operator = (const MPMCQueue &) = delete;
+
+	static uint64_t load(const uint64_t & v){ return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+	static void store(uint64_t & v, uint64_t n){ __atomic_store_n(&v, n, __ATOMIC_RELEASE); }
+
+public:
+	MPMCQueue(unsigned int size = 0) : cells(NULL), mask(0), pushpos(0), poppos(0) {
+		resize(size);
+	}
+	~MPMCQueue(){
+		delete[] cells;
+	}
+
+	//room for at least size entries, rounded up to a power of 2
+	void resize(unsigned int size){
+		delete[] cells;
+		cells = NULL;
+		mask = 0;
+		pushpos = poppos = 0;
+		if(size == 0)
+			return;
+
+		uint64_t cap = 1;
+		while(cap < size)
+			cap *= 2;
+		cells = new Cell[cap];
+		mask = cap - 1;
+		for(uint64_t i = 0; i < cap; i++)
+			cells[i].seq = i;
+	}
+
+	unsigned int capacity() const {
+		return (cells ? mask + 1 : 0);
+	}
+
+	//approximate while other threads are using it
+	unsigned int size() const {
+		return load(pushpos) - load(poppos);
+	}
+
+	bool push(const T & v){
+		if(!cells)
+			return false;
+		uint64_t pos = load(pushpos);
+		Cell * cell;
+		while(true){
+			cell = &cells[pos & mask];
+			int64_t diff = (int64_t)load(cell->seq) - (int64_t)pos;
+			if(diff == 0){ //free for this lap
+				if(CAS(pushpos, pos, pos + 1))
+					break;
+				pos = load(pushpos);
+			}else if(diff < 0){ //still holds the entry from the previous lap
+				return false;
+			}else{ //another thread pushed here first
+				pos = load(pushpos);
+			}
+		}
+		cell->data = v;
+		store(cell->seq, pos + 1);
+		return true;
+	}
+
+	bool pop(T & v){
+		if(!cells)
+			return false;
+		uint64_t pos = load(poppos);
+		Cell * cell;
+		while(true){
+			cell = &cells[pos & mask];
+			int64_t diff = (int64_t)load(cell->seq) - (int64_t)(pos + 1);
+			if(diff == 0){ //filled for this lap
+				if(CAS(poppos, pos, pos + 1))
+					break;
+				pos = load(poppos);
+			}else if(diff < 0){ //not filled yet
+				return false;
+			}else{ //another thread popped here first
+				pos = load(poppos);
+			}
+		}
+		v = cell->data;
+		store(cell->seq, pos + mask + 1);
+		return true;
+	}
+};
+
+}; // namespace Morat
@@ -0,0 +1,76 @@
+#include <sched.h>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "mpmcqueue.h"
+#include "thread.h"
+
+namespace Morat {
+
+TEST_CASE("MPMCQueue", "[mpmcqueue]") {
+	MPMCQueue<int> q(3);
+	REQUIRE(q.capacity() == 4);
+
+	int v = 0;
+	REQUIRE_FALSE(q.pop(v));
+
+	//fifo, and wraps around the ring
+	for(int lap = 0; lap < 3; lap++){
+		for(int i = 0; i < 4; i++)
+			REQUIRE(q.push(lap*10 + i));
+		REQUIRE_FALSE(q.push(99)); //full
+		REQUIRE(q.size() == 4);
+		for(int i = 0; i < 4; i++){
+			REQUIRE(q.pop(v));
+			REQUIRE(v == lap*10 + i);
+		}
+		REQUIRE_FALSE(q.pop(v));
+	}
+
+	SECTION("Empty until resized") {
+		MPMCQueue<int> e;
+		REQUIRE(e.capacity() == 0);
+		REQUIRE_FALSE(e.push(1));
+		REQUIRE_FALSE(e.pop(v));
+		e.resize(2);
+		REQUIRE(e.push(1));
+		REQUIRE(e.pop(v));
+		REQUIRE(v == 1);
+	}
+
+	SECTION("Each value is popped exactly once with concurrent pushers and poppers") {
+		const int threads = 4, values = 20000;
+		MPMCQueue<int> shared(64);
+		std::vector<int> seen(threads*values, 0);
+		std::vector<Thread> pool(2*threads);
+		for(int t = 0; t < threads; t++){
+			pool[t]([&, t](){
+				for(int i = 0; i < values; i++)
+					while(!shared.push(t*values + i))
+						sched_yield();
+			});
+			pool[threads + t]([&](){
+				int got = 0, x;
+				while(got < values){
+					if(shared.pop(x)){
+						INCR(seen[x]);
+						got++;
+					}else{
+						sched_yield();
+					}
+				}
+			});
+		}
+		for(auto & t : pool)
+			t.join();
+
+		int wrong = 0;
+		for(int s : seen)
+			wrong += (s != 1);
+		REQUIRE(wrong == 0);
+		REQUIRE_FALSE(shared.pop(v));
+	}
+}
+
+}; // namespace Morat
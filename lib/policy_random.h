@@ -31,7 +31,7 @@ public:
 	}
 
 	// reset the set of moves to make from above. Since they're used in random order they don't need to be in iterator order
-	void rollout_start(Board & board) {
+	void rollout_start(const Board & board) {
 		cur = num;
 	}
 
@@ -46,6 +46,23 @@ public:
 				return m;
 		}
 	}
+
+	// like above, but skip the moves where avoid(m) is true. There must be a move left that isn't
+	// avoided. The skipped ones go back in the set, so a later move can still pick them.
+	template<class Avoid>
+	Move choose_move(const Board & board, const Move & prev, Avoid avoid) {
+		int start = cur;
+		Move m;
+		do{
+			m = choose_move(board, prev);
+		}while(avoid(m));
+
+		// the drawn moves are in [cur, start), with m at cur, so keep just m out of the set
+		moves[cur] = moves[start - 1];
+		moves[start - 1] = m;
+		cur = start - 1;
+		return m;
+	}
 };
 
 }; // namespace Morat
@@ -0,0 +1,69 @@
+
+#pragma once
+
+//Rave updates buffered by one thread and applied to the shared tree in batches.
+//
+//Backing up rave after every simulation does an atomic add to each child played in the
+//simulation at each level of the tree walk, and the nodes near the root get hit by every thread.
+//Buffering them for a few simulations lets the updates to the same node be merged into one add,
+//at the cost of the other threads seeing those rave stats a bit later.
+//
+//The buffer holds pointers into the tree, so it must be flushed before the tree can be changed,
+//ie before the thread waits for a pause or garbage collection.
+
+#include <algorithm>
+#include <vector>
+
+#include "exppair.h"
+
+namespace Morat {
+
+template<class Node>
+class RaveBatch {
+	struct Update {
+		Node *  node;
+		ExpPair rave;
+
+		bool operator < (const Update & o) const { return node < o.node; }
+	};
+
+	std::vector<Update> updates;
+	int iterations; //simulations since the last flush
+
+public:
+	RaveBatch() : iterations(0) { }
+
+	bool empty() const { return updates.empty(); }
+	unsigned int size() const { return updates.size(); }
+
+	void add(Node * node, const ExpPair & rave){
+		updates.push_back({node, rave});
+	}
+
+	//call at the end of each simulation, flushes once batch simulations have been buffered
+	void finish_iteration(int batch){
+		if(++iterations >= batch)
+			flush();
+	}
+
+	//apply all the buffered updates, merging the ones for the same node first
+	void flush(){
+		iterations = 0;
+		if(updates.empty())
+			return;
+
+		std::sort(updates.begin(), updates.end());
+
+		auto i = updates.begin(), e = updates.end();
+		while(i != e){
+			Node * node = i->node;
+			ExpPair sum = i->rave;
+			for(++i; i != e && i->node == node; ++i)
+				sum.add(i->rave);
+			node->rave.addv(sum);
+		}
+		updates.clear();
+	}
+};
+
+}; // namespace Morat
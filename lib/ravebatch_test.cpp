@@ -0,0 +1,59 @@
+#include "catch.hpp"
+
+#include "ravebatch.h"
+
+namespace Morat {
+
+struct RaveNode {
+	ExpPair rave;
+};
+
+TEST_CASE("RaveBatch", "[ravebatch]"){
+	RaveNode nodes[3];
+	RaveBatch<RaveNode> batch;
+
+	ExpPair win, loss;
+	win.addwins(1);
+	loss.addlosses(1);
+
+	SECTION("Applies nothing until flushed") {
+		batch.add(&nodes[0], win);
+		batch.add(&nodes[1], loss);
+		batch.finish_iteration(3);
+		batch.finish_iteration(3);
+		REQUIRE(nodes[0].rave.num() == 0);
+		REQUIRE(nodes[1].rave.num() == 0);
+		REQUIRE(batch.size() == 2);
+
+		batch.finish_iteration(3);
+		REQUIRE(batch.empty());
+		REQUIRE(nodes[0].rave.num() == 1);
+		REQUIRE(nodes[0].rave.avg() == 1);
+		REQUIRE(nodes[1].rave.num() == 1);
+		REQUIRE(nodes[1].rave.avg() == 0);
+	}
+
+	SECTION("Merges the updates to the same node") {
+		for(int i = 0; i < 10; i++){
+			batch.add(&nodes[i % 3], (i % 2 ? win : loss));
+			batch.add(&nodes[2], win);
+		}
+		batch.flush();
+		REQUIRE(batch.empty());
+		REQUIRE(nodes[0].rave.num() == 4);
+		REQUIRE(nodes[0].rave.sum() == 2);
+		REQUIRE(nodes[1].rave.num() == 3);
+		REQUIRE(nodes[1].rave.sum() == 2);
+		REQUIRE(nodes[2].rave.num() == 13);
+		REQUIRE(nodes[2].rave.sum() == 11);
+	}
+
+	SECTION("Batch 0 applies them right away") {
+		batch.add(&nodes[0], win);
+		batch.finish_iteration(0);
+		REQUIRE(batch.empty());
+		REQUIRE(nodes[0].rave.num() == 1);
+	}
+}
+
+}; // namespace Morat
@@ -0,0 +1,22 @@
+
+#pragma once
+
+//A fixed size array that leaves its elements uninitialized, for arrays sized for the biggest
+//case that are filled before use, like the cells of a board. Constructing or copying the owner
+//doesn't have to touch the unused tail. T must be trivially copyable.
+
+namespace Morat {
+
+template <class T, int N>
+class RawArray {
+	alignas(T) char mem[sizeof(T) * N];
+
+public:
+	T       & operator[](int i)       { return data()[i]; }
+	const T & operator[](int i) const { return data()[i]; }
+
+	T       * data()       { return (T *)mem; }
+	const T * data() const { return (const T *)mem; }
+};
+
+}; // namespace Morat
@@ -0,0 +1,104 @@
+
+#pragma once
+
+//A counter that many threads update all the time but that is rarely read exactly, like the
+//number of runs or nodes in an agent. Each thread adds to its own shard on its own cache line,
+//and the shards only fold into the shared total once they've built up enough, so the updates
+//don't bounce a shared cache line between the cores.
+//
+//approx() reads just the total, which lags by up to FLUSH per thread, good enough for progress.
+//exact() sums all the shards, which is exact once the updating threads are paused.
+//reached() is a cheap stop condition that only reads the shards once the total is close.
+
+#include <cassert>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "thread.h"
+
+namespace Morat {
+
+class ShardedCounter {
+	static const unsigned int SHARDS = 64;    //threads beyond this share shards, which still works
+	static const unsigned int LINE = 64;      //cache line size
+	static const int64_t      FLUSH = 256;    //fold a shard into the total once it gets this far from 0
+
+	struct Shard {
+		int64_t value;
+		char pad[LINE - sizeof(int64_t)];
+	};
+
+	Shard * shards;  //cache line aligned, with the total in the line after the last shard
+
+	int64_t & total() const { return shards[SHARDS].value; }
+
+	//each thread gets its own shard the first time it touches any counter
+	static unsigned int & threads_seen(){
+		static unsigned int seen = 0;
+		return seen;
+	}
+	static unsigned int shard(){
+		static thread_local unsigned int id = INCR(threads_seen()) - 1;
+		return id % SHARDS;
+	}
+	static int64_t slack(){
+		unsigned int threads = threads_seen();
+		return FLUSH * (threads < SHARDS ? threads : SHARDS);
+	}
+
+	ShardedCounter(const ShardedCounter &) = delete;
+	ShardedCounter & operator = (const ShardedCounter &) = delete;
+
+public:
+	ShardedCounter(int64_t v = 0) {
+		void * mem;
+		if(posix_memalign(&mem, LINE, sizeof(Shard) * (SHARDS + 1)) != 0)
+			abort();
+		shards = (Shard *)mem;
+		set(v);
+	}
+	~ShardedCounter(){
+		free(shards);
+	}
+
+	void add(int64_t n){
+		Shard & s = shards[shard()];
+		int64_t v = PLUS(s.value, n);
+		if(v >= FLUSH || v <= -FLUSH){
+			PLUS(s.value, -v);
+			PLUS(total(), v);
+		}
+	}
+	void incr(){ add(1); }
+
+	ShardedCounter & operator += (int64_t n){ add(n); return *this; }
+	ShardedCounter & operator -= (int64_t n){ add(-n); return *this; }
+
+	//only while nothing else is updating it
+	void set(int64_t v){
+		for(unsigned int i = 0; i < SHARDS; i++)
+			shards[i].value = 0;
+		total() = v;
+	}
+	ShardedCounter & operator = (int64_t v){ set(v); return *this; }
+
+	uint64_t approx() const {
+		int64_t t = total();
+		return (t > 0 ? t : 0);
+	}
+
+	uint64_t exact() const {
+		int64_t t = total();
+		for(unsigned int i = 0; i < SHARDS; i++)
+			t += shards[i].value;
+		return (t > 0 ? t : 0);
+	}
+
+	bool reached(uint64_t target) const {
+		if((int64_t)approx() + slack() < (int64_t)target)
+			return false;
+		return exact() >= target;
+	}
+};
+
+}; // namespace Morat
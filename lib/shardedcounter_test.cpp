@@ -0,0 +1,52 @@
+
+#include <vector>
+
+#include "catch.hpp"
+
+#include "shardedcounter.h"
+#include "thread.h"
+
+namespace Morat {
+
+TEST_CASE("ShardedCounter", "[shardedcounter]") {
+	ShardedCounter c;
+	REQUIRE(c.exact() == 0);
+
+	c.incr();
+	c += 10;
+	c -= 3;
+	REQUIRE(c.exact() == 8);
+	REQUIRE(c.approx() <= 8);
+	REQUIRE(c.reached(8));
+	REQUIRE_FALSE(c.reached(9));
+
+	//big updates go straight to the total
+	c += 100000;
+	REQUIRE(c.approx() >= 100000);
+	REQUIRE(c.exact() == 100008);
+
+	c = 5;
+	REQUIRE(c.exact() == 5);
+
+	SECTION("Exact after concurrent updates") {
+		ShardedCounter shared;
+		const int threads = 8, updates = 100000;
+		std::vector<Thread> pool(threads);
+		for(int t = 0; t < threads; t++)
+			pool[t]([&, t](){
+				for(int i = 0; i < updates; i++){
+					shared.incr();
+					if(i % 4 == t % 4)
+						shared -= 1;
+				}
+			});
+		for(auto & t : pool)
+			t.join();
+		REQUIRE(shared.exact() == threads*updates*3/4);
+		REQUIRE(shared.reached(threads*updates*3/4));
+		REQUIRE_FALSE(shared.reached(threads*updates*3/4 + 1));
+		REQUIRE(shared.approx() <= shared.exact() + 256*threads);
+	}
+}
+
+}; // namespace Morat
@@ -0,0 +1,190 @@
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "socket.h"
+
+namespace Morat {
+
+//a write to a closed connection should fail, not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;
+static void nosigpipe(int fd){ }
+#else
+static const int send_flags = 0;
+static void nosigpipe(int fd){
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+#endif
+
+//fill in the address for either a unix socket path or a host:port, returns the address family or -1
+static int parse_address(const std::string & address, sockaddr_storage & addr, socklen_t & len){
+	memset(&addr, 0, sizeof(addr));
+
+	std::string::size_type colon = address.rfind(':');
+	if(colon == std::string::npos || address.find('/') != std::string::npos){
+		sockaddr_un * un = (sockaddr_un *)&addr;
+		if(address.empty() || address.size() >= sizeof(un->sun_path))
+			return -1;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, address.c_str());
+		len = sizeof(sockaddr_un);
+		return AF_UNIX;
+	}
+
+	std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+	addrinfo hints, * res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo((host.empty() ? "127.0.0.1" : host.c_str()), port.c_str(), &hints, &res) != 0)
+		return -1;
+	memcpy(&addr, res->ai_addr, res->ai_addrlen);
+	len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return AF_INET;
+}
+
+bool Socket::listen(const std::string & address){
+	close();
+
+	sockaddr_storage addr;
+	socklen_t len;
+	int family = parse_address(address, addr, len);
+	if(family < 0)
+		return false;
+
+	fd = socket(family, SOCK_STREAM, 0);
+	if(fd < 0)
+		return false;
+	fcntl(fd, F_SETFD, FD_CLOEXEC); //don't leak it into the worker processes
+
+	if(family == AF_UNIX){
+		struct stat st; //left over from an earlier run, but don't delete anything that isn't a socket
+		if(lstat(address.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(address.c_str());
+	}else{
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	}
+
+	if(bind(fd, (sockaddr *)&addr, len) != 0 || ::listen(fd, 16) != 0){
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool Socket::accept(Socket & client, double timeout){
+	if(timeout > 0){
+		pollfd p = {fd, POLLIN, 0};
+		if(poll(&p, 1, (int)(timeout*1000)) <= 0)
+			return false;
+	}
+
+	client.close();
+	client.fd = ::accept(fd, NULL, NULL);
+	if(client.fd < 0)
+		return false;
+	fcntl(client.fd, F_SETFD, FD_CLOEXEC);
+	nosigpipe(client.fd);
+
+	int on = 1; //the messages are small and need a reply, so don't wait to fill a packet
+	setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); //fails harmlessly on unix sockets
+	return true;
+}
+
+bool Socket::connect(const std::string & address){
+	close();
+
+	sockaddr_storage addr;
+	socklen_t len;
+	int family = parse_address(address, addr, len);
+	if(family < 0)
+		return false;
+
+	fd = socket(family, SOCK_STREAM, 0);
+	if(fd < 0)
+		return false;
+	fcntl(fd, F_SETFD, FD_CLOEXEC); //don't leak it into the worker processes
+	nosigpipe(fd);
+
+	if(::connect(fd, (sockaddr *)&addr, len) != 0){
+		close();
+		return false;
+	}
+
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return true;
+}
+
+bool Socket::pair(Socket & other){
+	close();
+	other.close();
+
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return false;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC); //a worker process gets its end with dup2, which clears this
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	nosigpipe(fds[0]); //the worker's end is its stdout, which it treats like any other
+	fd = fds[0];
+	other.fd = fds[1];
+	return true;
+}
+
+void Socket::close(){
+	if(fd >= 0)
+		::close(fd);
+	fd = -1;
+	buf.clear();
+}
+
+bool Socket::write(const std::string & data){
+	const char * p = data.c_str();
+	size_t left = data.size();
+	while(left > 0){
+		ssize_t n = send(fd, p, left, send_flags);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		p += n;
+		left -= n;
+	}
+	return true;
+}
+
+bool Socket::readline(std::string & line){
+	std::string::size_type end;
+	while((end = buf.find('\n')) == std::string::npos){
+		char chunk[4096];
+		ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		buf.append(chunk, n);
+	}
+	line = buf.substr(0, end);
+	buf.erase(0, end + 1);
+	return true;
+}
+
+}; // namespace Morat
@@ -0,0 +1,36 @@
+
+#pragma once
+
+//A line based stream socket, for talking to the other processes of a distributed search.
+//
+//Addresses are either "host:port" for TCP, or a path for a unix domain socket.
+
+#include <string>
+
+namespace Morat {
+
+class Socket {
+	int fd;
+	std::string buf; //read but not yet returned by readline
+
+	Socket(const Socket &) = delete;
+	Socket & operator = (const Socket &) = delete;
+
+public:
+	Socket() : fd(-1) { }
+	~Socket(){ close(); }
+
+	bool valid() const { return fd >= 0; }
+	int  get_fd() const { return fd; }
+
+	bool listen(const std::string & address);
+	bool accept(Socket & client, double timeout); //timeout in seconds, <= 0 to wait forever
+	bool connect(const std::string & address);
+	bool pair(Socket & other); //connect this and other to each other, with no address to find them by
+	void close();
+
+	bool write(const std::string & data);
+	bool readline(std::string & line); //without the newline, false once the other end closed it
+};
+
+}; // namespace Morat
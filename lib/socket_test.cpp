@@ -0,0 +1,94 @@
+#include <string>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "socket.h"
+#include "string.h"
+#include "thread.h"
+
+namespace Morat {
+
+//connect to address from another thread and echo each line back, until the connection is closed
+static void echo_round_trip(const std::string & address){
+	Socket listener;
+	REQUIRE(listener.listen(address));
+
+	Thread client([&](){
+		Socket s;
+		if(!s.connect(address))
+			return;
+		std::string line;
+		while(s.readline(line))
+			s.write(line + "\n");
+	});
+
+	Socket server;
+	REQUIRE(listener.accept(server, 10));
+
+	//several lines in one write, and a line longer than any buffer
+	REQUIRE(server.write("hello\nworld\n"));
+	std::string big(100000, 'x');
+	REQUIRE(server.write(big + "\n"));
+
+	std::string line;
+	REQUIRE(server.readline(line));
+	REQUIRE(line == "hello");
+	REQUIRE(server.readline(line));
+	REQUIRE(line == "world");
+	REQUIRE(server.readline(line));
+	REQUIRE(line == big);
+
+	server.close();
+	client.join();
+}
+
+TEST_CASE("Socket unix", "[socket]"){
+	std::string address = "/tmp/morat-test-" + to_str(getpid()) + ".sock";
+	echo_round_trip(address);
+	unlink(address.c_str());
+}
+
+TEST_CASE("Socket tcp", "[socket]"){
+	echo_round_trip("127.0.0.1:" + to_str(20000 + getpid() % 20000));
+}
+
+TEST_CASE("Socket failures", "[socket]"){
+	Socket s;
+	REQUIRE_FALSE(s.valid());
+	REQUIRE_FALSE(s.connect("/tmp/morat-test-nothing-listening.sock"));
+	REQUIRE_FALSE(s.valid());
+
+	Socket listener;
+	REQUIRE(listener.listen("/tmp/morat-test-" + to_str(getpid()) + "-timeout.sock"));
+	REQUIRE_FALSE(listener.accept(s, 0.05)); //nobody connects
+	unlink(("/tmp/morat-test-" + to_str(getpid()) + "-timeout.sock").c_str());
+}
+
+TEST_CASE("Socket listen doesn't replace other files", "[socket]"){
+	std::string address = "/tmp/morat-test-" + to_str(getpid()) + "-file";
+	FILE * f = fopen(address.c_str(), "w");
+	REQUIRE(f != NULL);
+	fclose(f);
+
+	Socket listener;
+	REQUIRE_FALSE(listener.listen(address));
+	REQUIRE(access(address.c_str(), F_OK) == 0);
+	unlink(address.c_str());
+}
+
+TEST_CASE("Socket pair", "[socket]"){
+	Socket a, b;
+	REQUIRE(a.pair(b));
+	REQUIRE(a.write("ping\n"));
+	std::string line;
+	REQUIRE(b.readline(line));
+	REQUIRE(line == "ping");
+	REQUIRE(b.write("pong\n"));
+	REQUIRE(a.readline(line));
+	REQUIRE(line == "pong");
+	b.close();
+	REQUIRE_FALSE(a.readline(line));
+}
+
+}; // namespace Morat
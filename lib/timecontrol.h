@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <string>
 
+#include "string.h"
+
 namespace Morat {
 
 struct TimeControl {
@@ -27,6 +29,12 @@ struct TimeControl {
 		remain   = game;
 	}
 
+	//the settings as arguments to the time command, to give another process the same ones
+	std::string to_args() const {
+		return "--" + method_name() + " " + to_str(param) + " --move " + to_str(move) + " --game " + to_str(game) +
+			" --flexible " + to_str(flexible) + " --maxsims " + to_str(max_sims) + " --remain " + to_str(remain);
+	}
+
 	std::string method_name() const {
 		switch(method){
 			case PERCENT: return "percent";
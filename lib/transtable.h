@@ -0,0 +1,132 @@
+
+#pragma once
+
+//A lossy concurrent hash table from positions to the tree node that holds their expanded subtree,
+//so the MCTS can treat a transposition as the same node, making the tree a DAG.
+//
+//Each bucket is one cache line holding a few entries. Lookups are lock free: an entry is read as
+//hash, node, hash again, and only used if the hash didn't change in between. Inserts take the
+//bucket's spin lock, and once a bucket is full they replace its least visited node.
+//
+//The nodes are pointers into the tree, which are only valid until the tree changes, so clear()
+//must be called once the searching threads have stopped and before the tree is changed.
+//It just starts a new generation, which makes all the buckets look empty.
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include "thread.h"
+#include "types.h"
+
+namespace Morat {
+
+template<class Node>
+class TransTable {
+	static const unsigned int WAYS = 3;
+
+	struct Bucket {
+		SpinLock lock;
+		volatile uint32_t gen;           //the buckets from older generations are empty
+		volatile hash_t   hash[WAYS];    //0 for an empty entry
+		Node * volatile   node[WAYS];
+	};
+	static_assert(sizeof(Bucket) <= 64, "a TransTable bucket should fit in a cache line");
+
+	Bucket * buckets;
+	uint64_t mask;  //number of buckets - 1, a power of 2
+	uint32_t gen;
+
+	TransTable(const TransTable &) = delete;
+	TransTable & operator = (const TransTable &) = delete;
+
+	static hash_t fix(hash_t h){ return (h ? h : 1); } //0 means empty
+
+	Bucket & bucket(hash_t h) const { return buckets[(h ^ (h >> 32)) & mask]; }
+
+public:
+	TransTable() : buckets(NULL), mask(0), gen(1) { }
+	~TransTable(){ free(buckets); }
+
+	//use about this many bytes, 0 to disable, only while nothing else is using it
+	void resize(uint64_t bytes){
+		free(buckets);
+		buckets = NULL;
+		mask = 0;
+		if(bytes < 64)
+			return;
+
+		uint64_t num = 1;
+		while(num * 2 * 64 <= bytes)
+			num *= 2;
+
+		void * mem;
+		if(posix_memalign(&mem, 64, num * 64) != 0)
+			abort();
+		memset(mem, 0, num * 64); //generation 0 is older than any generation in use
+		buckets = (Bucket *)mem;
+		mask = num - 1;
+	}
+
+	bool enabled() const { return buckets != NULL; }
+	uint64_t memsize() const { return (buckets ? (mask + 1) * 64 : 0); }
+
+	//forget all the entries, call once the tree pointers are about to become invalid
+	void clear(){
+		INCR(gen);
+	}
+
+	//the node expanded for this position, or NULL
+	Node * find(hash_t h) const {
+		h = fix(h);
+		const Bucket & b = bucket(h);
+		if(b.gen != gen)
+			return NULL;
+		for(unsigned int i = 0; i < WAYS; i++){
+			if(b.hash[i] == h){
+				Node * n = b.node[i];
+				__sync_synchronize();
+				if(b.hash[i] == h)
+					return n;
+			}
+		}
+		return NULL;
+	}
+
+	//remember node as the one for this position, unless there already is one
+	void insert(hash_t h, Node * node){
+		h = fix(h);
+		if(find(h))
+			return;
+
+		Bucket & b = bucket(h);
+		b.lock.lock();
+		if(b.gen != gen){
+			for(unsigned int i = 0; i < WAYS; i++)
+				b.hash[i] = 0;
+			b.gen = gen;
+		}
+
+		//pick an empty entry, or the least visited one, and give up if another thread beat us to it
+		unsigned int slot = 0;
+		bool found = false;
+		for(unsigned int i = 0; i < WAYS; i++){
+			if(b.hash[i] == h){
+				found = true;
+				break;
+			}
+			if(b.hash[i] == 0 || (b.hash[slot] != 0 && b.node[i]->exp.num() < b.node[slot]->exp.num()))
+				slot = i;
+		}
+		if(!found){
+			b.hash[slot] = 0; //so a concurrent find can't match the old hash with the new node
+			__sync_synchronize();
+			b.node[slot] = node;
+			__sync_synchronize();
+			b.hash[slot] = h;
+		}
+		b.lock.unlock();
+	}
+};
+
+}; // namespace Morat
@@ -0,0 +1,63 @@
+#include "catch.hpp"
+
+#include "exppair.h"
+#include "transtable.h"
+
+namespace Morat {
+
+struct TransNode {
+	ExpPair exp;
+};
+
+TEST_CASE("TransTable", "[transtable]"){
+	TransTable<TransNode> table;
+	REQUIRE(!table.enabled());
+
+	table.resize(64*1024);
+	REQUIRE(table.enabled());
+	REQUIRE(table.memsize() == 64*1024);
+
+	const int num = 500;
+	TransNode nodes[num];
+	for(int i = 0; i < num; i++)
+		nodes[i].exp.addlosses(i);
+
+	SECTION("Finds what was inserted") {
+		for(int i = 0; i < num; i++)
+			table.insert(i * 0x9E3779B97F4A7C15ull, &nodes[i]);
+		for(int i = 0; i < num; i++)
+			REQUIRE(table.find(i * 0x9E3779B97F4A7C15ull) == &nodes[i]);
+		REQUIRE(table.find(12345) == NULL);
+	}
+
+	SECTION("Keeps the first node for a position") {
+		table.insert(42, &nodes[1]);
+		table.insert(42, &nodes[2]);
+		REQUIRE(table.find(42) == &nodes[1]);
+	}
+
+	SECTION("Clear forgets everything") {
+		for(int i = 0; i < num; i++)
+			table.insert(i * 0x9E3779B97F4A7C15ull, &nodes[i]);
+		table.clear();
+		for(int i = 0; i < num; i++)
+			REQUIRE(table.find(i * 0x9E3779B97F4A7C15ull) == NULL);
+
+		table.insert(7, &nodes[7]);
+		REQUIRE(table.find(7) == &nodes[7]);
+	}
+
+	SECTION("A full bucket replaces its least visited node") {
+		table.resize(64); //one bucket
+		table.insert(1, &nodes[10]);
+		table.insert(2, &nodes[5]);
+		table.insert(3, &nodes[20]);
+		table.insert(4, &nodes[30]);
+		REQUIRE(table.find(1) == &nodes[10]);
+		REQUIRE(table.find(2) == NULL);
+		REQUIRE(table.find(3) == &nodes[20]);
+		REQUIRE(table.find(4) == &nodes[30]);
+	}
+}
+
+}; // namespace Morat
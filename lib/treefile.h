@@ -0,0 +1,271 @@
+
+#pragma once
+
+//Binary snapshot of a search tree, much faster to save and load than an sgf of the tree.
+//The Nodes are written as raw bytes with the children sizes alongside, so a file can only be
+//loaded by a build with the same Node layout, which the header checks.
+//
+//Layout: header, the moves to the root position, the nodes, then the number of children of each node.
+//The nodes are ordered so that every child list is contiguous: the root, then recursively
+//each node's children followed by each child's subtree. Loading copies each child list with one memcpy.
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "compacttree.h"
+
+namespace Morat {
+
+class TreeFile {
+	static const uint32_t VERSION = 1;
+
+	struct Header {
+		char     magic[8];  //"MORATREE"
+		uint32_t version;
+		uint32_t nodesize;  //sizeof(Node), to catch files from a different build
+		char     game[16];  //Board::name
+		char     agent[8];  //which agent's Node this is
+		char     size[16];  //Board::size()
+		uint32_t movesize;  //sizeof(Move)
+		uint32_t nummoves;  //moves from the start of the game to the root
+		uint64_t numnodes;  //including the root
+	};
+
+	Header header;
+	const char * mem;
+	size_t len;
+
+	const char * moves_start() const { return mem + sizeof(Header); }
+	const char * nodes_start() const { return moves_start() + pad(header.movesize * header.nummoves); }
+	const uint16_t * counts() const { return (const uint16_t *)(nodes_start() + header.nodesize * header.numnodes); }
+
+	static size_t pad(size_t s) { return (s + 7) & ~(size_t)7; }
+
+	static void set_str(char * dest, size_t len, const std::string & s){
+		memset(dest, 0, len);
+		strncpy(dest, s.c_str(), len - 1);
+	}
+	static std::string get_str(const char * s, size_t len){
+		return std::string(s, strnlen(s, len));
+	}
+
+	//write the children of node, then recurse into each child
+	template <class Node>
+	static void write_children(FILE * fd, const Node & node, std::vector<uint16_t> & counts){
+		for(const Node & child : node.children){
+			write_node(fd, child);
+			counts.push_back(child.children.num());
+		}
+		for(const Node & child : node.children)
+			write_children(fd, child, counts);
+	}
+	//the raw bytes of the node, with the children reset since they're stored separately
+	template <class Node>
+	static void write_node(FILE * fd, const Node & node){
+		char buf[sizeof(Node)];
+		memcpy(buf, (const void *)&node, sizeof(Node));
+		new(&(((Node *)buf)->children)) typename CompactTree<Node>::Children();
+		fwrite(buf, sizeof(Node), 1, fd);
+	}
+
+	//walk the counts in the order load_children uses them, checking that they use up exactly the
+	//nodes in the file, that no node has more children than can be allocated at once, and that
+	//the tree is no deeper than a game can be, so a bad file can't make load read past the end
+	bool check_counts() const {
+		const uint16_t * c = counts();
+		uint64_t next = 1;
+		std::vector<std::pair<uint64_t, unsigned int>> stack; //node, depth, children in reverse order
+		stack.push_back(std::make_pair(0, 0));
+		while(!stack.empty()){
+			uint64_t index = stack.back().first;
+			unsigned int depth = stack.back().second;
+			stack.pop_back();
+
+			unsigned int num = c[index];
+			if(num == 0)
+				continue;
+			if(num >= CompactTree<char>::MAX_NUM || num > header.numnodes - next || depth >= CompactTree<char>::MAX_NUM)
+				return false;
+
+			uint64_t first = next;
+			next += num;
+			for(unsigned int i = num; i > 0; i--)
+				stack.push_back(std::make_pair(first + i - 1, depth + 1));
+		}
+		return next == header.numnodes;
+	}
+
+	template <class Node, class Allocator>
+	void load_children(Node & node, uint64_t index, uint64_t & next, Allocator & ct) const {
+		unsigned int num = counts()[index];
+		if(num == 0)
+			return;
+
+		uint64_t first = next;
+		next += num;
+		node.children.alloc(num, ct);
+		memcpy((void *)node.children.begin(), nodes_start() + header.nodesize * first, sizeof(Node) * num);
+
+		for(unsigned int i = 0; i < num; i++)
+			load_children(node.children[i], first + i, next, ct);
+	}
+
+	TreeFile(const TreeFile & t) = delete;
+	TreeFile & operator = (const TreeFile & t) = delete;
+
+public:
+	TreeFile() : mem(NULL), len(0) { }
+	~TreeFile() { close(); }
+
+	//write the tree at root to filename, returns false with the reason in error on failure
+	template <class Node, class Move>
+	static bool save(const std::string & filename, const std::string & game, const std::string & agent,
+	                 const std::string & size, const std::vector<Move> & moves, const Node & root, std::string & error){
+		FILE * fd = fopen(filename.c_str(), "wb");
+		if(fd == NULL){
+			error = "Opening file " + filename + " for writing failed";
+			return false;
+		}
+
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "MORATREE", 8);
+		h.version = VERSION;
+		h.nodesize = sizeof(Node);
+		set_str(h.game, sizeof(h.game), game);
+		set_str(h.agent, sizeof(h.agent), agent);
+		set_str(h.size, sizeof(h.size), size);
+		h.movesize = sizeof(Move);
+		h.nummoves = moves.size();
+		h.numnodes = 0;
+		fwrite(&h, sizeof(h), 1, fd);
+
+		std::vector<char> movebuf(pad(sizeof(Move) * moves.size()), 0);
+		if(moves.size())
+			memcpy(movebuf.data(), moves.data(), sizeof(Move) * moves.size());
+		fwrite(movebuf.data(), 1, movebuf.size(), fd);
+
+		std::vector<uint16_t> counts;
+		write_node(fd, root);
+		counts.push_back(root.children.num());
+		write_children(fd, root, counts);
+		fwrite(counts.data(), sizeof(uint16_t), counts.size(), fd);
+
+		//now that the size is known, fill it in
+		h.numnodes = counts.size();
+		fseek(fd, 0, SEEK_SET);
+		fwrite(&h, sizeof(h), 1, fd);
+
+		bool ok = !ferror(fd);
+		if(fclose(fd) != 0 || !ok){
+			error = "Writing file " + filename + " failed";
+			return false;
+		}
+		return true;
+	}
+
+	//mmap the file and check the header, returns false with the reason in error on failure
+	bool open(const std::string & filename, std::string & error){
+		close();
+
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd < 0){
+			error = "Error opening file " + filename + " for reading";
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)){
+			::close(fd);
+			error = "File " + filename + " is too short to be a tree";
+			return false;
+		}
+		len = st.st_size;
+		void * m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(m == MAP_FAILED){
+			len = 0;
+			error = "Error mapping file " + filename;
+			return false;
+		}
+		mem = (const char *)m;
+		memcpy(&header, mem, sizeof(Header)); //len was checked above
+
+		if(memcmp(header.magic, "MORATREE", 8) != 0 || header.version != VERSION){
+			close();
+			error = "File " + filename + " isn't a tree file or is from an incompatible version";
+			return false;
+		}
+
+		//compare against what's left one section at a time, so a bad header can't overflow
+		size_t left = len - sizeof(Header);
+		uint64_t movebytes = (uint64_t)header.movesize * header.nummoves;
+		if(movebytes > left || pad(movebytes) > left || header.nodesize == 0 || header.numnodes == 0 ||
+		   header.numnodes > (left - pad(movebytes)) / (header.nodesize + sizeof(uint16_t))){
+			close();
+			error = "File " + filename + " is truncated";
+			return false;
+		}
+		if(!check_counts()){
+			close();
+			error = "File " + filename + " is corrupt";
+			return false;
+		}
+		madvise((void *)mem, len, MADV_SEQUENTIAL);
+		return true;
+	}
+
+	void close(){
+		if(mem)
+			munmap((void *)mem, len);
+		mem = NULL;
+		len = 0;
+	}
+
+	std::string game()  const { return get_str(header.game, sizeof(header.game)); }
+	std::string agent() const { return get_str(header.agent, sizeof(header.agent)); }
+	std::string size()  const { return get_str(header.size, sizeof(header.size)); }
+	uint64_t num_nodes() const { return header.numnodes; }
+
+	template <class Move>
+	std::vector<Move> moves() const {
+		assert(header.movesize == sizeof(Move));
+		std::vector<Move> m(header.nummoves);
+		if(header.nummoves)
+			memcpy((void *)m.data(), moves_start(), sizeof(Move) * header.nummoves);
+		return m;
+	}
+
+	//whether moves<Move>() can read the moves to the root
+	template <class Move>
+	bool matches_moves() const {
+		return header.movesize == sizeof(Move);
+	}
+
+	//whether this file holds Nodes of this type
+	template <class Node>
+	bool matches(const std::string & agentname) const {
+		return header.nodesize == sizeof(Node) && agent() == agentname;
+	}
+
+	//replace root, which must not have children, with the tree in the file
+	//returns the number of nodes allocated below the root
+	template <class Node, class Allocator>
+	uint64_t load(Node & root, Allocator & ct) const {
+		assert(mem && header.nodesize == sizeof(Node));
+		assert(root.children.empty());
+
+		memcpy((void *)&root, nodes_start(), sizeof(Node));
+		uint64_t next = 1;
+		load_children(root, 0, next, ct);
+		assert(next == header.numnodes);
+		return next - 1;
+	}
+};
+
+}; // namespace Morat
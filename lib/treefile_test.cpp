@@ -0,0 +1,166 @@
+
+#include <cstdio>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "move.h"
+#include "treefile.h"
+
+namespace Morat {
+
+struct TreeNode {
+	uint32_t value;
+	Move move;
+	CompactTree<TreeNode>::Children children;
+
+	TreeNode(uint32_t v = 0) : value(v) { }
+
+	unsigned int size() const {
+		unsigned int num = children.num();
+		for(auto & child : children)
+			num += child.size();
+		return num;
+	}
+
+	unsigned int dealloc(CompactTree<TreeNode> & ct){
+		unsigned int num = 0;
+		for(auto & child : children)
+			num += child.dealloc(ct);
+		return num + children.dealloc(ct);
+	}
+};
+
+// a tree of uneven width and depth, with values that depend on the path to the node
+void build_tree(TreeNode & node, CompactTree<TreeNode> & ct, int depth){
+	if(depth <= 0)
+		return;
+	unsigned int num = (node.value % 5) + 1;
+	node.children.alloc(num, ct);
+	for(unsigned int i = 0; i < num; i++){
+		TreeNode & child = node.children[i];
+		child.value = node.value * 7 + i + 1;
+		child.move = Move(i, depth);
+		build_tree(child, ct, depth - (i % 2) - 1);
+	}
+}
+
+bool same_tree(const TreeNode & a, const TreeNode & b){
+	if(a.value != b.value || a.move != b.move || a.children.num() != b.children.num())
+		return false;
+	for(unsigned int i = 0; i < a.children.num(); i++)
+		if(!same_tree(a.children.begin()[i], b.children.begin()[i]))
+			return false;
+	return true;
+}
+
+static std::string read_file(const char * name){
+	std::string s;
+	FILE * f = fopen(name, "rb");
+	char buf[4096];
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		s.append(buf, n);
+	fclose(f);
+	return s;
+}
+static void write_file(const char * name, const std::string & s){
+	FILE * f = fopen(name, "wb");
+	fwrite(s.data(), 1, s.size(), f);
+	fclose(f);
+}
+
+TEST_CASE("TreeFile", "[treefile]") {
+	char name[] = "/tmp/morat-treefile-XXXXXX";
+	int fd = mkstemp(name);
+	REQUIRE(fd >= 0);
+	close(fd);
+
+	CompactTree<TreeNode> ct;
+	TreeNode root(3);
+	build_tree(root, ct, 8);
+
+	std::vector<Move> moves = {Move("a1"), Move("c3"), M_SWAP};
+	std::string error;
+	REQUIRE(TreeFile::save(name, "havannah", "test", "5", moves, root, error));
+
+	TreeFile file;
+	REQUIRE(file.open(name, error));
+	REQUIRE(file.game() == "havannah");
+	REQUIRE(file.size() == "5");
+	REQUIRE(file.num_nodes() == root.size() + 1);
+	REQUIRE(file.moves<Move>() == moves);
+	REQUIRE(file.matches<TreeNode>("test"));
+	REQUIRE_FALSE(file.matches<TreeNode>("mcts"));
+
+	TreeNode loaded;
+	REQUIRE(file.load(loaded, ct) == root.size());
+	REQUIRE(same_tree(root, loaded));
+
+	//the loaded tree is independent of the file
+	file.close();
+	REQUIRE(same_tree(root, loaded));
+
+	SECTION("Rejects files that aren't trees") {
+		FILE * f = fopen(name, "wb");
+		fputs("(;FF[4]SZ[5])", f);
+		fclose(f);
+		REQUIRE_FALSE(file.open(name, error));
+	}
+
+	SECTION("Rejects damaged files") {
+		std::string data = read_file(name);
+		const size_t numnodes = 64; //the offset of numnodes in the header
+		uint64_t n = root.size() + 1;
+		size_t countstart = data.size() - 2*n;
+
+		SECTION("truncated") {
+			for(size_t cut : {(size_t)10, (size_t)80, data.size() / 2, data.size() - 1}){
+				write_file(name, data.substr(0, cut));
+				REQUIRE_FALSE(file.open(name, error));
+			}
+		}
+		SECTION("more nodes than fit") {
+			for(uint64_t bad : {n + 1, (uint64_t)1 << 62, ~(uint64_t)0}){
+				std::string d = data;
+				memcpy(&d[numnodes], &bad, sizeof(bad));
+				write_file(name, d);
+				REQUIRE_FALSE(file.open(name, error));
+			}
+		}
+		SECTION("counts that don't match the nodes") {
+			for(uint16_t bad : {(uint16_t)0, (uint16_t)1, (uint16_t)1000, (uint16_t)0xFFFF}){
+				for(size_t i : {(size_t)0, (size_t)(n - 1)}){ //the root, and the last node, a leaf
+					std::string d = data;
+					uint16_t c;
+					memcpy(&c, &d[countstart + 2*i], 2);
+					if(c == bad)
+						continue;
+					memcpy(&d[countstart + 2*i], &bad, 2);
+					write_file(name, d);
+					REQUIRE_FALSE(file.open(name, error));
+				}
+			}
+		}
+	}
+
+	SECTION("Rejects trees deeper than a game") {
+		TreeNode chain;
+		TreeNode * node = &chain;
+		for(unsigned int i = 0; i <= CompactTree<TreeNode>::MAX_NUM; i++){
+			node->children.alloc(1, ct);
+			node = &node->children[0];
+		}
+		REQUIRE(TreeFile::save(name, "havannah", "test", "5", moves, chain, error));
+		REQUIRE_FALSE(file.open(name, error));
+		chain.dealloc(ct);
+	}
+
+	unlink(name);
+	root.dealloc(ct);
+	loaded.dealloc(ct);
+	ct.compact();
+	REQUIRE(ct.meminuse() == 0);
+}
+
+}; // namespace Morat
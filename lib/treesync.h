@@ -0,0 +1,160 @@
+
+#pragma once
+
+//Merges the experience at the top of the trees of the thread groups of an MCTS agent, see treegroup.
+//
+//Each tree gets the experience the others gained in their top plies since the last merge.
+//The trees are walked side by side, matching the children by move, so it's the same exchange as
+//DistSync without going through text. What each node sent and received is remembered in a tree
+//of records that mirrors the top of its tree, indexed like the node's children, so nothing is
+//counted twice. Experience for a node a tree hasn't expanded is dropped.
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "move.h"
+
+namespace Morat {
+
+template<class Node>
+class TreeSync {
+	struct Entry {
+		Move move;
+		uint64_t sentnum, sentsum2;         //own experience already sent
+		uint64_t receivednum, receivedsum2; //experience added from the other trees
+		std::vector<Entry> children;        //in the same order as the children of the node
+
+		Entry(const Move & m = M_UNKNOWN) : move(m), sentnum(0), sentsum2(0), receivednum(0), receivedsum2(0) { }
+
+		//the record for the child at index i of the node, which has num children
+		Entry * child(const Move & m, unsigned int i, unsigned int num){
+			if(children.size() < num)
+				children.resize(num);
+			if(children[i].move != m) //new, or the node was freed and grown again in a different order
+				children[i] = Entry(m);
+			return &children[i];
+		}
+	};
+
+	Entry root;
+
+	static Node * find(Node * node, const Move & m, unsigned int hint){
+		if(!node)
+			return NULL;
+		Node * begin = node->children.begin();
+		unsigned int num = node->children.num();
+		if(hint < num && begin[hint].move() == m) //the trees usually have their children in the same order
+			return begin + hint;
+		for(unsigned int i = 0; i < num; i++)
+			if(begin[i].move() == m)
+				return begin + i;
+		return NULL;
+	}
+
+	//exchange the experience of the same node in each tree, NULL where a tree doesn't have it,
+	//only sending from the nodes with at least minsend visits
+	static void exchange(const std::vector<Node *> & nodes, const std::vector<Entry *> & entries, uint64_t minsend){
+		uint64_t totalnum = 0, totalsum2 = 0;
+		std::vector<uint64_t> newnum(nodes.size(), 0), newsum2(nodes.size(), 0);
+		for(unsigned int i = 0; i < nodes.size(); i++){
+			if(!nodes[i])
+				continue;
+			Entry & e = *entries[i];
+			uint64_t num = nodes[i]->exp.num(), sum2 = nodes[i]->exp.sum2();
+			if(num < e.receivednum + e.sentnum || sum2 < e.receivedsum2 + e.sentsum2){
+				//freed by a gc and grown again, so the records are stale
+				e.sentnum = e.sentsum2 = e.receivednum = e.receivedsum2 = 0;
+			}
+			if(num < minsend)
+				continue;
+			newnum[i]  = num  - e.receivednum  - e.sentnum;
+			newsum2[i] = sum2 - e.receivedsum2 - e.sentsum2;
+			e.sentnum  += newnum[i];
+			e.sentsum2 += newsum2[i];
+			totalnum  += newnum[i];
+			totalsum2 += newsum2[i];
+		}
+
+		for(unsigned int i = 0; i < nodes.size(); i++){
+			uint64_t num = totalnum - newnum[i], sum2 = totalsum2 - newsum2[i];
+			if(!nodes[i] || num == 0)
+				continue;
+
+			uint64_t wins = sum2 / 2;
+			nodes[i]->exp.addwins(wins);
+			nodes[i]->exp.addlosses(num - wins);
+			if(sum2 % 2)
+				nodes[i]->exp.addtie();
+
+			entries[i]->receivednum += num;
+			entries[i]->receivedsum2 += sum2;
+		}
+	}
+
+	static void merge(const std::vector<Node *> & nodes, const std::vector<Entry *> & entries, int depth, uint64_t minvisits){
+		if(depth <= 0)
+			return;
+
+		std::vector<Node *> childnodes(nodes.size());
+		std::vector<Entry *> childentries(nodes.size());
+		for(unsigned int i = 0; i < nodes.size(); i++){
+			if(!nodes[i])
+				continue;
+			Node * begin = nodes[i]->children.begin();
+			unsigned int num = nodes[i]->children.num();
+			for(unsigned int k = 0; k < num; k++){
+				const Node & child = begin[k];
+				if(child.exp.num() < minvisits)
+					continue;
+
+				//skip the moves an earlier tree already sent
+				bool done = false;
+				for(unsigned int j = 0; j < i && !done; j++){
+					const Node * other = find(nodes[j], child.move(), k);
+					done = (other && other->exp.num() >= minvisits);
+				}
+				if(done)
+					continue;
+
+				for(unsigned int j = 0; j < nodes.size(); j++){
+					childnodes[j] = find(nodes[j], child.move(), k);
+					childentries[j] = (childnodes[j] ?
+						entries[j]->child(child.move(), childnodes[j] - nodes[j]->children.begin(), nodes[j]->children.num()) : NULL);
+				}
+				exchange(childnodes, childentries, minvisits);
+				merge(childnodes, childentries, depth - 1, minvisits);
+			}
+		}
+	}
+
+public:
+	//forget everything, for a new position or tree
+	void clear(){
+		root = Entry();
+	}
+
+	//follow the root to its child for move m
+	void move(const Move & m){
+		Entry next;
+		for(auto & child : root.children)
+			if(child.move == m)
+				next = std::move(child);
+		root = std::move(next);
+	}
+
+	//give each tree the experience the others gained in the top depth plies since the last merge,
+	//for nodes with at least minvisits, assumes nothing else is changing the trees
+	static void merge(const std::vector<std::pair<TreeSync *, Node *>> & trees, int depth, uint64_t minvisits){
+		std::vector<Node *> nodes;
+		std::vector<Entry *> entries;
+		for(auto & t : trees){
+			nodes.push_back(t.second);
+			entries.push_back(&t.first->root);
+		}
+		exchange(nodes, entries, 0);
+		merge(nodes, entries, depth, minvisits);
+	}
+};
+
+}; // namespace Morat
@@ -109,6 +109,20 @@ public:
 		logerr("load_sgf not supported in the ab agent.");
 	}
 
+	bool save_tree(const std::string & filename, const vecmove & moves, std::string & error) {
+		error = "save_tree not supported in the ab agent.";
+		return false;
+	}
+
+	bool can_load(const TreeFile & file, std::string & error) const {
+		error = "load_tree not supported in the ab agent.";
+		return false;
+	}
+
+	bool load_tree(const TreeFile & file, std::string & error) {
+		return can_load(file, error);
+	}
+
 private:
 	int16_t negamax(const Board & board, int16_t alpha, int16_t beta, int depth);
 	Move return_move(const Board & board, int verbose = 0) const;
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cmath>
 #include <string>
 
@@ -15,15 +16,18 @@ namespace Morat {
 namespace Pentago {
 
 const float AgentMCTS::min_rave = 0.1;
+const float AgentMCTS::gc_start = 0.8;
+const float AgentMCTS::gc_duty = 0.1;
+const uword AgentMCTS::gc_slice = 50000;
 
 std::string AgentMCTS::Node::to_s() const {
 	return "AgentMCTS::Node"
-	       ", move " + move.to_s() +
+	       ", move " + move().to_s() +
 	       ", exp " + exp.to_s() +
-	       ", know " + to_str(know) +
-	       ", outcome " + to_str((int)outcome.to_i()) +
-	       ", depth " + to_str((int)proofdepth) +
-	       ", best " + bestmove.to_s() +
+	       ", know " + to_str(know()) +
+	       ", outcome " + to_str((int)outcome().to_i()) +
+	       ", depth " + to_str(proofdepth()) +
+	       ", best " + bestmove().to_s() +
 	       ", children " + to_str(children.num());
 }
 
@@ -31,12 +35,10 @@ bool AgentMCTS::Node::from_s(std::string s) {
 	auto dict = parse_dict(s, ", ", " ");
 
 	if(dict.size() == 8){
-		move = Move(dict["move"]);
-		exp = ExpPair(dict["exp"]);
-		know = from_str<int>(dict["know"]);
-		outcome = Outcome(from_str<int>(dict["outcome"]));
-		proofdepth = from_str<int>(dict["depth"]);
-		bestmove = Move(dict["best"]);
+		*this = Node(Move(dict["move"]));
+		exp = ExpStats(dict["exp"]);
+		set_proof(Outcome(from_str<int>(dict["outcome"])), Move(dict["best"]), from_str<int>(dict["depth"]));
+		set_know(from_str<int>(dict["know"]));
 		// ignore children
 		return true;
 	}
@@ -53,11 +55,12 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 
 	pool.pause();
 
-	if(runs)
-		logerr("Pondered " + to_str(runs) + " runs\n");
+	if(runs.exact())
+		logerr("Pondered " + to_str(runs.exact()) + " runs\n");
 
 	runs = 0;
 	maxruns = max_runs;
+	uint64_t gcpausesbefore = gcpauses;
 	pool.reset();
 
 	//let them run!
@@ -79,16 +82,21 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 				times[a] += t->times[a];
 		}
 
-		logerr("Finished:    " + to_str(runs) + " runs in " + to_str(time_used*1000, 0) + " msec: " + to_str(runs/time_used, 0) + " Games/s\n");
-		if(runs > 0){
+		logerr("Finished:    " + to_str(runs.exact()) + " runs in " + to_str(time_used*1000, 0) + " msec: " + to_str(runs.exact()/time_used, 0) + " Games/s\n");
+		if(runs.exact() > 0){
 			logerr("Game length: " + gamelen.to_s() + "\n");
 			logerr("Tree depth:  " + treelen.to_s() + "\n");
 			if(profile)
 				logerr("Times:       " + to_str(times[0], 3) + ", " + to_str(times[1], 3) + ", " + to_str(times[2], 3) + ", " + to_str(times[3], 3) + "\n");
 		}
 
-		if(root.outcome != Outcome::UNKNOWN)
-			logerr("Solved as a " + root.outcome.to_s_rel(to_play) + "\n");
+		logerr("Memory:      " + mem_stats() + "\n");
+
+		if(gcpauses > gcpausesbefore)
+			logerr("GC:          " + gc_stats() + "\n");
+
+		if(root.outcome() != Outcome::UNKNOWN)
+			logerr("Solved as a " + root.outcome().to_s_rel(to_play) + "\n");
 
 		std::string pvstr;
 		for(auto m : get_pv())
@@ -103,7 +111,7 @@ void AgentMCTS::search(double time, uint64_t max_runs, int verbose){
 	runs = 0;
 
 
-	if(ponder && root.outcome < Outcome::DRAW)
+	if(ponder && root.outcome() < Outcome::DRAW)
 		pool.resume();
 }
 
@@ -112,6 +120,16 @@ AgentMCTS::AgentMCTS() : pool(this) {
 	runs = 0;
 	gclimit = 5;
 
+	gcphase = GC_Idle;
+	gcworker = 0;
+	gcdetached = NULL;
+	gcnumdetached = gcnumfreed = 0;
+	gcnodesbefore = 0;
+	gclastalloced = 0;
+	gclastlen = 0;
+	gcpauses = 0;
+	gcpausetime = gcmaxpause = 0;
+
 	profile     = false;
 	ponder      = false;
 //#ifdef SINGLE_THREAD ... make sure only 1 thread
@@ -131,6 +149,7 @@ AgentMCTS::AgentMCTS() : pool(this) {
 	visitexpand = 1;
 	prunesymmetry = true;
 	gcsolved    = 100000;
+	gcincremental = false;
 
 	win_score = 1;
 
@@ -141,6 +160,7 @@ AgentMCTS::~AgentMCTS(){
 	pool.pause();
 	pool.set_num_threads(0);
 
+	gc_finish();
 	root.dealloc(ctmem);
 	ctmem.compact();
 }
@@ -157,6 +177,7 @@ void AgentMCTS::set_ponder(bool p){
 
 void AgentMCTS::set_board(const Board & board, bool clear){
 	pool.pause();
+	gc_finish();
 
 	nodes -= root.dealloc(ctmem);
 	root = Node();
@@ -169,14 +190,15 @@ void AgentMCTS::set_board(const Board & board, bool clear){
 }
 void AgentMCTS::move(const Move & m){
 	pool.pause();
+	gc_finish();
 
-	uword nodesbefore = nodes;
+	uword nodesbefore = nodes.exact();
 
 	if(keeptree && root.children.num() > 0){
 		Node child;
 
 		for(Node * i = root.children.begin(); i != root.children.end(); i++){
-			if(i->move == m){
+			if(i->move() == m){
 				child = *i;          //copy the child experience to temp
 				child.swap_tree(*i); //move the child tree to temp
 				break;
@@ -188,19 +210,18 @@ void AgentMCTS::move(const Move & m){
 		root.swap_tree(child);
 
 		if(nodesbefore > 0)
-			logerr("Nodes before: " + to_str(nodesbefore) + ", after: " + to_str(nodes) + ", saved " +  to_str(100.0*nodes/nodesbefore, 1) + "% of the tree\n");
+			logerr("Nodes before: " + to_str(nodesbefore) + ", after: " + to_str(nodes.exact()) + ", saved " +  to_str(100.0*nodes.exact()/nodesbefore, 1) + "% of the tree\n");
 	}else{
 		nodes -= root.dealloc(ctmem);
-		root = Node();
-		root.move = m;
+		root = Node(m);
 	}
-	assert(nodes == root.size());
+	assert(nodes.exact() == root.size());
 
 	rootboard.move(m);
 
 	root.exp.addwins(visitexpand+1); //+1 to compensate for the virtual loss
 	if(rootboard.outcome() < Outcome::DRAW)
-		root.outcome = Outcome::UNKNOWN;
+		root.set_outcome(Outcome::UNKNOWN);
 
 	if(ponder)
 		pool.resume();
@@ -254,8 +275,8 @@ std::string AgentMCTS::move_stats(vecmove moves) const {
 }
 
 Move AgentMCTS::return_move(const Node * node, Side to_play, int verbose) const {
-	if(node->outcome >= Outcome::DRAW)
-		return node->bestmove;
+	if(node->outcome() >= Outcome::DRAW)
+		return node->bestmove();
 
 	double val, maxval = -1000000000000.0; //1 trillion
 
@@ -264,9 +285,9 @@ Move AgentMCTS::return_move(const Node * node, Side to_play, int verbose) const
 		 * end = node->children.end();
 
 	for( ; child != end; child++){
-		if(child->outcome >= Outcome::DRAW){
-			if(child->outcome == to_play)             val =  800000000000.0 - child->exp.num(); //shortest win
-			else if(child->outcome == Outcome::DRAW) val = -400000000000.0 + child->exp.num(); //longest tie
+		if(child->outcome() >= Outcome::DRAW){
+			if(child->outcome() == to_play)             val =  800000000000.0 - child->exp.num(); //shortest win
+			else if(child->outcome() == Outcome::DRAW) val = -400000000000.0 + child->exp.num(); //longest tie
 			else                                     val = -800000000000.0 + child->exp.num(); //longest loss
 		}else{ //not proven
 //			val = child->exp.num(); //num simulations
@@ -284,7 +305,149 @@ Move AgentMCTS::return_move(const Node * node, Side to_play, int verbose) const
 	if(verbose)
 		logerr("Score:       " + to_str(ret->exp.avg()*100., 2) + "% / " + to_str(ret->exp.num()) + "\n");
 
-	return ret->move;
+	return ret->move();
+}
+
+void AgentMCTS::start_gc() {
+	Time starttime;
+
+	if(!gcincremental || ctmem.memalloced() >= tree_maxmem()){
+		//out of memory, or not incremental, so do it all at once
+		gc_finish();
+
+		logerr("Starting player GC with limit " + to_str(gclimit) + " ... ");
+		uint64_t nodesbefore = nodes.exact();
+		Board copy = rootboard;
+		garbage_collect(copy, & root);
+		Time gctime;
+		ctmem.compact(1.0, 0.75);
+		Time compacttime;
+		logerr(to_str(100.0*nodes.exact()/nodesbefore, 1) + " % of tree remains - " +
+			to_str((gctime - starttime)*1000, 0)  + " msec gc, " + to_str((compacttime - gctime)*1000, 0) + " msec compact\n");
+
+		gc_adjust_limit();
+	}else if(gcphase == GC_Marked){
+		//detach the marked subtrees so no thread can walk into them, then they can be freed while searching
+		gcnodesbefore = nodes.exact();
+		gcnumdetached = gcmarked.size();
+		gcnumfreed = 0;
+		gcdetached = new Node[gcnumdetached];
+		for(uint i = 0; i < gcnumdetached; i++)
+			gcdetached[i].swap_tree(*gcmarked[i]);
+		gcmarked.clear();
+
+		//stop allocating from the chunks that will be compacted, same as the generation in a full gc
+		ctmem.evacuate_start(0.75);
+		gcphase = GC_Free;
+	}else if(gcphase == GC_Evacuate){
+		if(!ctmem.evacuate_step()){
+			logerr("Incremental GC with limit " + to_str(gclimit) + ": " + to_str(100.0*nodes.exact()/gcnodesbefore, 1) + " % of tree remains\n");
+			gc_adjust_limit_incremental((double)nodes.exact()/gcnodesbefore);
+			gclastalloced = ctmem.memalloced();
+			gcphase = GC_Idle;
+		}
+	}
+
+	Time endtime;
+	gclastpause = endtime;
+	gclastlen = endtime - starttime;
+	gcpauses++;
+	gcpausetime += gclastlen;
+	gcmaxpause = std::max(gcmaxpause, gclastlen);
+}
+
+bool AgentMCTS::gc_concurrent() {
+	if(gcphase == GC_Idle){
+		//a cycle that couldn't get below the start has to wait for the tree to grow, or it would just repeat
+		uint64_t alloced = ctmem.memalloced();
+		if(alloced < gc_start*tree_maxmem() || alloced <= gclastalloced)
+			return false;
+	}else if(gcphase != GC_Free){
+		return false;
+	}
+
+	if(!CAS(gcworker, 0, 1)) //another thread is already on it
+		return false;
+
+	if(gcphase == GC_Idle){
+		//nodes only move or get freed during a pause, so the marks stay valid until the next one
+		gcphase = GC_Mark;
+		Board copy = rootboard;
+		if(root.children.num() > 0 && gc_mark(copy, & root)){
+			gcphase = GC_Marked;
+		}else{ //the search stopped, try again later
+			gcmarked.clear();
+			gcphase = GC_Idle;
+		}
+	}else if(gcphase == GC_Free){
+		//nothing can reach the detached subtrees, so they can be freed while the others search
+		uword freed = 0;
+		while(gcnumfreed < gcnumdetached && freed < gc_slice)
+			freed += gcdetached[gcnumfreed++].dealloc(ctmem);
+		nodes -= freed;
+
+		if(gcnumfreed == gcnumdetached){
+			delete[] gcdetached;
+			gcdetached = NULL;
+			gcnumdetached = gcnumfreed = 0;
+			gcphase = GC_Evacuate;
+		}
+	}
+
+	gcworker = 0;
+	return true;
+}
+
+//finish or abandon the incremental gc, assumes the threads are paused
+void AgentMCTS::gc_finish() {
+	gcmarked.clear();
+	while(gcnumfreed < gcnumdetached)
+		nodes -= gcdetached[gcnumfreed++].dealloc(ctmem);
+	delete[] gcdetached;
+	gcdetached = NULL;
+	gcnumdetached = gcnumfreed = 0;
+	while(ctmem.evacuate_step()) ;
+	gcphase = GC_Idle;
+	gclastalloced = 0;
+}
+
+void AgentMCTS::gc_adjust_limit() {
+	if(ctmem.meminuse() >= tree_maxmem()/2)
+		gclimit = (int)(gclimit*1.3);
+	else if(gclimit > rollouts*5)
+		gclimit = (int)(gclimit*0.9); //slowly decay to a minimum of 5
+}
+
+//the incremental gc starts on memalloced(), so it has to adjust on it too, and raise the limit
+//much more if it freed almost nothing, or the next cycle would start right away and repeat it
+void AgentMCTS::gc_adjust_limit_incremental(double remains) {
+	if(remains > 0.95)
+		gclimit = (int)(gclimit*2);
+	else if(ctmem.memalloced() >= gc_start*tree_maxmem())
+		gclimit = (int)(gclimit*1.3);
+	else if(gclimit > rollouts*5)
+		gclimit = (int)(gclimit*0.9);
+}
+
+std::string AgentMCTS::gc_stats() const {
+	return to_str(gcpauses) + " pauses, " +
+		to_str(gcpausetime*1000, 0) + " msec total, " +
+		to_str(gcmaxpause*1000, 1) + " msec worst, " +
+		to_str(gclastlen*1000, 1) + " msec last";
+}
+
+std::string AgentMCTS::mem_stats() const {
+	uint64_t mem = ctmem.meminuse();
+	uint64_t num = nodes.exact();
+	return to_str(num) + " nodes, " +
+		to_str(mem/(1024.0*1024.0), 1) + " Mb, " +
+		to_str(num ? (double)mem/num : 0.0, 1) + " bytes/node, " +
+		to_str(sizeof(Node)) + " bytes/Node";
+}
+
+bool AgentMCTS::gc_keep(const Node * node, const Node * child, Side to_play) const {
+	return ((node->outcome() >= Outcome::DRAW && child->exp.num() > gcsolved && (node->outcome() != to_play || child->outcome() == to_play || child->outcome() == Outcome::DRAW)) || //parent is solved, only keep the proof tree, plus heavy draws
+	        (node->outcome() <  Outcome::DRAW && child->exp.num() > (child->outcome() >= Outcome::DRAW ? gcsolved : gclimit))); // only keep heavy nodes, with different cutoffs for solved and unsolved
 }
 
 void AgentMCTS::garbage_collect(Board & board, Node * node){
@@ -296,20 +459,46 @@ void AgentMCTS::garbage_collect(Board & board, Node * node){
 		if(child->children.num() == 0)
 			continue;
 
-		if(	(node->outcome >= Outcome::DRAW && child->exp.num() > gcsolved && (node->outcome != to_play || child->outcome == to_play || child->outcome == Outcome::DRAW)) || //parent is solved, only keep the proof tree, plus heavy draws
-			(node->outcome <  Outcome::DRAW && child->exp.num() > (child->outcome >= Outcome::DRAW ? gcsolved : gclimit)) ){ // only keep heavy nodes, with different cutoffs for solved and unsolved
-			board.move(child->move);
+		if(gc_keep(node, child, to_play)){
+			board.move(child->move());
 			garbage_collect(board, child);
-			board.undo(child->move);
+			board.undo(child->move());
 		}else{
 			nodes -= child->dealloc(ctmem);
 		}
 	}
 }
 
+//same as garbage_collect, but only finds the subtrees to collect, so it can run while the other threads search
+//returns false if the search stopped before it finished
+bool AgentMCTS::gc_mark(Board & board, Node * node){
+	Node * child = node->children.begin(),
+		 * end = node->children.end();
+
+	Side to_play = board.to_play();
+	for( ; child != end; child++){
+		if(!pool.running())
+			return false;
+
+		if(child->children.num() == 0)
+			continue;
+
+		if(gc_keep(node, child, to_play)){
+			board.move(child->move());
+			bool finished = gc_mark(board, child);
+			board.undo(child->move());
+			if(!finished)
+				return false;
+		}else{
+			gcmarked.push_back(child);
+		}
+	}
+	return true;
+}
+
 AgentMCTS::Node * AgentMCTS::find_child(const Node * node, const Move & move) const {
 	for(Node * i = node->children.begin(); i != node->children.end(); i++)
-		if(i->move == move)
+		if(i->move() == move)
 			return i;
 
 	return NULL;
@@ -317,9 +506,9 @@ AgentMCTS::Node * AgentMCTS::find_child(const Node * node, const Move & move) co
 
 void AgentMCTS::gen_sgf(SGFPrinter<Move> & sgf, unsigned int limit, const Node & node, Side side) const {
 	for(auto & child : node.children){
-		if(child.exp.num() >= limit && (side != node.outcome || child.outcome == node.outcome)){
+		if(child.exp.num() >= limit && (side != node.outcome() || child.outcome() == node.outcome())){
 			sgf.child_start();
-			sgf.move(side, child.move);
+			sgf.move(side, child.move());
 			sgf.comment(child.to_s());
 			gen_sgf(sgf, limit, child, ~side);
 			sgf.child_end();
@@ -346,7 +535,7 @@ void AgentMCTS::create_children_simple(const Board & board, Node * node){
 	else //both end conditions should happen in parallel
 		assert(moveit.done() && child == end);
 
-	PLUS(nodes, node->children.num());
+	nodes += node->children.num();
 }
 
 void AgentMCTS::load_sgf(SGFParser<Move> & sgf, const Board & board, Node & node) {
@@ -369,5 +558,40 @@ void AgentMCTS::load_sgf(SGFParser<Move> & sgf, const Board & board, Node & node
 	}
 }
 
+bool AgentMCTS::save_tree(const std::string & filename, const vecmove & moves, std::string & error) {
+	pool.pause();
+	gc_finish();
+
+	bool ok = TreeFile::save(filename, Board::name, "mcts", rootboard.size(), moves, root, error);
+
+	if(ponder)
+		pool.resume();
+	return ok;
+}
+
+bool AgentMCTS::can_load(const TreeFile & file, std::string & error) const {
+	if(!file.matches<Node>("mcts")){
+		error = "File is from a different agent or build: " + file.agent();
+		return false;
+	}
+	return true;
+}
+
+bool AgentMCTS::load_tree(const TreeFile & file, std::string & error) {
+	if(!can_load(file, error))
+		return false;
+
+	pool.pause();
+	gc_finish();
+
+	nodes -= root.dealloc(ctmem);
+	nodes = file.load(root, ctmem);
+	assert(nodes.exact() == root.size());
+
+	if(ponder)
+		pool.resume();
+	return true;
+}
+
 }; // namespace Pentago
 }; // namespace Morat
@@ -11,6 +11,7 @@
 #include "../lib/depthstats.h"
 #include "../lib/exppair.h"
 #include "../lib/log.h"
+#include "../lib/shardedcounter.h"
 #include "../lib/thread.h"
 #include "../lib/time.h"
 #include "../lib/types.h"
@@ -19,6 +20,7 @@
 #include "agent.h"
 #include "board.h"
 #include "move.h"
+#include "rolloutbatch.h"
 
 
 namespace Morat {
@@ -29,19 +31,91 @@ public:
 
 	struct Node {
 	public:
-		ExpPair exp;
-		int16_t know;
-		Outcome outcome;
-		uint8_t proofdepth;
-		Move    move;
-		Move    bestmove; //if outcome is set, then bestmove is the way to get there
+#ifdef COMPACT_NODE
+		//24 bytes: 32 bit visit counts, and the small fields packed into one word
+		typedef ExpPair32 ExpStats;
+	private:
+		//move:10, outcome+4:3, proofdepth:7, then the top 12 bits are know while unsolved, or bestmove once solved
+		uint32_t info;
+
+		static uint32_t pack(const Move & m, Outcome o, int depth, uint32_t top){
+			return m.to_bits() | ((o.to_i() + 4) << 10) | (std::min(depth, 127) << 13) | (top << 20);
+		}
+		//the top bits for o: the best move once solved, otherwise the know already in i, unless i
+		//was solved. Partial outcomes don't have room to keep their best move.
+		static uint32_t top(uint32_t i, Outcome o, const Move & best){
+			return (o.solved() ? best.to_bits() : (((i >> 10) & 7) >= 4 ? 0 : i >> 20));
+		}
+	public:
+		ExpStats exp;
+		CompactTree<Node>::Children children;
+
+		Node(const Move & m = M_NONE, Outcome o = Outcome::UNKNOWN) : info(pack(m, o, 0, o.solved() ? Move(M_UNKNOWN).to_bits() : 0)) { }
+
+		Move    move()       const { return Move::from_bits(info & 0x3FF); }
+		Outcome outcome()    const { return Outcome((int)((info >> 10) & 7) - 4); }
+		int     proofdepth() const { return (info >> 13) & 0x7F; }
+		int     know()       const { uint32_t i = info; return (((i >> 10) & 7) >= 4 ? 0 : (int32_t)i >> 20); }
+		Move    bestmove()   const { uint32_t i = info; return (((i >> 10) & 7) >= 4 ? Move::from_bits(i >> 20) : Move(M_UNKNOWN)); }
+
+		void set_know(int k){
+			if(!outcome().solved())
+				info = (info & 0xFFFFF) | ((uint32_t)std::max(-2048, std::min(k, 2047)) << 20);
+		}
+		void set_outcome(Outcome o){
+			info = pack(move(), o, proofdepth(), top(info, o, M_UNKNOWN));
+		}
+		void set_proof(Outcome o, const Move & best, int depth){
+			info = pack(move(), o, depth, top(info, o, best));
+		}
+		//set the outcome with the move and depth that prove it, only if the outcome is still old
+		bool cas_proof(Outcome old, Outcome o, const Move & best, int depth){
+			uint32_t i = info;
+			if(((i >> 10) & 7) != (uint32_t)(old.to_i() + 4))
+				return false;
+			return CAS(info, i, pack(move(), o, depth, top(i, o, best)));
+		}
+#else
+		typedef ExpPair ExpStats;
+
+		ExpStats exp;
+	private:
+		int16_t know_;
+		Outcome outcome_;
+		uint8_t proofdepth_;
+		Move    move_;
+		Move    bestmove_; //if outcome is set, then bestmove is the way to get there
+	public:
 		CompactTree<Node>::Children children;
 //		int padding;
 		//seems to need padding to multiples of 8 bytes or it segfaults?
 		//don't forget to update the copy constructor/operator
 
-		Node() : know(0), outcome(Outcome::UNKNOWN), proofdepth(0), move(M_NONE) { }
-		Node(const Move & m, Outcome o = Outcome::UNKNOWN) : know(0), outcome(o), proofdepth(0), move(m) { }
+		Node(const Move & m = M_NONE, Outcome o = Outcome::UNKNOWN) : know_(0), outcome_(o), proofdepth_(0), move_(m) { }
+
+		Move    move()       const { return move_; }
+		Outcome outcome()    const { return outcome_; }
+		int     proofdepth() const { return proofdepth_; }
+		int     know()       const { return know_; }
+		Move    bestmove()   const { return bestmove_; }
+
+		void set_know(int k){ know_ = k; }
+		void set_outcome(Outcome o){ outcome_ = o; }
+		void set_proof(Outcome o, const Move & best, int depth){
+			outcome_ = o;
+			bestmove_ = best;
+			proofdepth_ = depth;
+		}
+		//set the outcome with the move and depth that prove it, only if the outcome is still old
+		bool cas_proof(Outcome old, Outcome o, const Move & best, int depth){
+			if(!outcome_.cas(old, o))
+				return false;
+			bestmove_ = best;
+			proofdepth_ = depth;
+			return true;
+		}
+#endif
+
 		Node(const Node & n) { *this = n; }
 		Node & operator = (const Node & n){
 			if(this != & n){ //don't copy to self
@@ -49,11 +123,15 @@ public:
 				assert(children.empty());
 
 				exp  = n.exp;
-				know = n.know;
-				move = n.move;
-				bestmove = n.bestmove;
-				outcome = n.outcome;
-				proofdepth = n.proofdepth;
+#ifdef COMPACT_NODE
+				info = n.info;
+#else
+				know_ = n.know_;
+				move_ = n.move_;
+				bestmove_ = n.bestmove_;
+				outcome_ = n.outcome_;
+				proofdepth_ = n.proofdepth_;
+#endif
 				//children = n.children; ignore the children, they need to be swap_tree'd in
 			}
 			return *this;
@@ -101,16 +179,19 @@ public:
 			if(expnum > 0)
 				val = exp.avg();
 
-			if(knowledge && know != 0){
+			if(knowledge && know() != 0){
 				if(expnum <= 1)
-					val += 0.01f * know;
+					val += 0.01f * know();
 				else if(expnum < 1000) //knowledge is only useful with little experience
-					val += 0.01f * know / sqrt(expnum);
+					val += 0.01f * know() / sqrt(expnum);
 			}
 
 			return val;
 		}
 	};
+#ifdef COMPACT_NODE
+	static_assert(sizeof(Node) <= 16 + sizeof(CompactTree<Node>::Children), "The compact node should be 24 bytes, or 20 with handles");
+#endif
 
 	struct MoveList { //intended to be used to track moves for use in rave or similar
 
@@ -146,8 +227,10 @@ public:
 	};
 
 	class AgentThread : public AgentThreadBase<AgentMCTS> {
+		CompactTree<Node>::Arena arena; //allocate tree nodes without contending with the other threads
 		mutable XORShift_uint64 rand64;
 		mutable XORShift_float unitrand;
+		RolloutBatch<native_lanes> batch; //for when there are several rollouts per leaf
 		bool use_explore; //whether to use exploration for this simulation
 		MoveList movelist;
 		int stage; //which of the four MCTS stages is it on
@@ -157,7 +240,7 @@ public:
 		double times[4]; //time spent in each of the stages
 		Time timestamps[4]; //timestamps for the beginning, before child creation, before rollout, after rollout
 
-		AgentThread(AgentThreadPool<AgentMCTS> * p, AgentMCTS * a) : AgentThreadBase<AgentMCTS>(p, a) { }
+		AgentThread(AgentThreadPool<AgentMCTS> * p, AgentMCTS * a) : AgentThreadBase<AgentMCTS>(p, a), arena(a->ctmem), batch(rand64()) { }
 
 
 		void reset(){
@@ -177,12 +260,25 @@ public:
 		Node * choose_move(const Node * node, Side to_play) const;
 
 		Outcome rollout(Board & board, Move move, int depth);
+		void rollout_batch(const Board & board, int num);
 	};
 
 
 public:
 
 	static const float min_rave;
+	static const float gc_start; //fraction of maxmem at which an incremental gc starts
+	static const float gc_duty;  //fraction of the time the incremental gc pauses may take
+	static const uword gc_slice; //how many nodes to free at a time while the others keep searching
+
+	//the stages of an incremental gc
+	enum GCPhase {
+		GC_Idle,     //waiting for enough memory use to start
+		GC_Mark,     //one thread finds the subtrees to collect while the rest search
+		GC_Marked,   //waiting for a pause to detach them
+		GC_Free,     //the detached subtrees are freed a slice at a time while the rest search
+		GC_Evacuate, //compacting one chunk per pause
+	};
 
 	bool  ponder;     //think during opponents time?
 	int   numthreads; //number of player threads to run
@@ -203,6 +299,7 @@ public:
 	uint  visitexpand;//number of visits before expanding a node
 	bool  prunesymmetry; //prune symmetric children from the move list, useful for proving but likely not for playing
 	uint  gcsolved;   //garbage collect solved nodes or keep them in the tree, assuming they meet the required amount of work
+	bool  gcincremental; //garbage collect while searching and compact a chunk per pause instead of one long pause
 
 //knowledge
 	int win_score;
@@ -212,10 +309,23 @@ public:
 
 	Board rootboard;
 	Node  root;
-	uword nodes;
+	ShardedCounter nodes;
 	int   gclimit; //the minimum experience needed to not be garbage collected
 
-	uint64_t runs, maxruns;
+	volatile int gcphase;  //GCPhase of the incremental gc
+	volatile int gcworker; //whether a thread is doing incremental gc work
+	std::vector<Node *> gcmarked; //subtrees found by the mark phase
+	Node * gcdetached;     //subtrees detached from the tree, waiting to be freed
+	uint   gcnumdetached, gcnumfreed;
+	uword  gcnodesbefore;  //tree size when the incremental gc started
+	uint64_t gclastalloced; //memory allocated when the last incremental gc finished, the next waits for more
+	Time   gclastpause;    //when the last gc pause ended, for pacing the incremental gc
+	double gclastlen;      //how long the last gc pause was
+	uint64_t gcpauses;     //gc pause stats since the agent was created
+	double gcpausetime, gcmaxpause;
+
+	ShardedCounter runs;
+	uint64_t maxruns;
 
 	CompactTree<Node> ctmem;
 
@@ -241,32 +351,24 @@ public:
 
 	bool done() {
 		//solved or finished runs
-		return (rootboard.outcome() >= Outcome::DRAW || root.outcome >= Outcome::DRAW || (maxruns > 0 && runs >= maxruns));
+		return (rootboard.outcome() >= Outcome::DRAW || root.outcome() >= Outcome::DRAW || (maxruns > 0 && runs.reached(maxruns)));
 	}
 
 	bool need_gc() {
 		//out of memory, start garbage collection
-		return (ctmem.memalloced() >= maxmem);
-	}
+		if(ctmem.memalloced() >= tree_maxmem())
+			return true;
 
-	void start_gc() {
-		Time starttime;
-		logerr("Starting player GC with limit " + to_str(gclimit) + " ... ");
-		uint64_t nodesbefore = nodes;
-		Board copy = rootboard;
-		garbage_collect(copy, & root);
-		Time gctime;
-		ctmem.compact(1.0, 0.75);
-		Time compacttime;
-		logerr(to_str(100.0*nodes/nodesbefore, 1) + " % of tree remains - " +
-			to_str((gctime - starttime)*1000, 0)  + " msec gc, " + to_str((compacttime - gctime)*1000, 0) + " msec compact\n");
-
-		if(ctmem.meminuse() >= maxmem/2)
-			gclimit = (int)(gclimit*1.3);
-		else if(gclimit > rollouts*5)
-			gclimit = (int)(gclimit*0.9); //slowly decay to a minimum of 5
+		//the incremental gc needs short pauses, spaced out so they only take gc_duty of the time
+		return ((gcphase == GC_Marked || gcphase == GC_Evacuate) &&
+		        Time() - gclastpause >= gclastlen * (1 - gc_duty) / gc_duty);
 	}
 
+	void start_gc();
+	bool gc_concurrent(); //do a slice of the incremental gc instead of a search iteration, returns whether it did
+	std::string gc_stats() const;
+	std::string mem_stats() const;
+
 	void gen_sgf(SGFPrinter<Move> & sgf, int limit) const {
 		if(limit < 0)
 			limit = root.exp.num()/1000;
@@ -277,9 +379,20 @@ public:
 		load_sgf(sgf, rootboard, root);
 	}
 
+	bool save_tree(const std::string & filename, const vecmove & moves, std::string & error);
+	bool can_load(const TreeFile & file, std::string & error) const;
+	bool load_tree(const TreeFile & file, std::string & error);
+
 protected:
+	//at most half of what the chunks can hold, so compacting has room to copy into
+	uint64_t tree_maxmem() const { return std::min<uint64_t>(maxmem, ctmem.maxmemory() / 2); }
 
+	bool gc_keep(const Node * node, const Node * child, Side to_play) const;
 	void garbage_collect(Board & board, Node * node); //destroys the board, so pass in a copy
+	bool gc_mark(Board & board, Node * node); //destroys the board, so pass in a copy
+	void gc_finish();
+	void gc_adjust_limit();
+	void gc_adjust_limit_incremental(double remains);
 	bool do_backup(Node * node, Node * backup, Side to_play);
 	Move return_move(const Node * node, Side to_play, int verbose = 0) const;
 
@@ -12,7 +12,10 @@ namespace Morat {
 namespace Pentago {
 
 void AgentMCTS::AgentThread::iterate(){
-	INCR(agent->runs);
+	if(agent->gcincremental && agent->gc_concurrent())
+		return;
+
+	agent->runs.incr();
 	if(agent->profile){
 		timestamps[0] = Time();
 		stage = 0;
@@ -35,17 +38,17 @@ void AgentMCTS::AgentThread::iterate(){
 void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 	Side to_play = board.to_play();
 
-	if(!node->children.empty() && node->outcome < Outcome::DRAW){
+	if(!node->children.empty() && node->outcome() < Outcome::DRAW){
 	//choose a child and recurse
 		Node * child;
 		do{
 			child = choose_move(node, to_play);
 
-			if(child->outcome < Outcome::DRAW){
-				movelist.addtree(child->move, to_play);
+			if(child->outcome() < Outcome::DRAW){
+				movelist.addtree(child->move(), to_play);
 
-				if(!board.move(child->move)){
-					logerr("move failed: " + child->move.to_s() + "\n" + board.to_s(true));
+				if(!board.move(child->move())){
+					logerr("move failed: " + child->move().to_s() + "\n" + board.to_s(true));
 					assert(false && "move failed");
 				}
 
@@ -67,7 +70,7 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 		timestamps[1] = Time();
 	}
 
-	Outcome won = (agent->minimax ? node->outcome : board.outcome());
+	Outcome won = (agent->minimax ? node->outcome() : board.outcome());
 
 	//if it's not already decided
 	if(won < Outcome::DRAW){
@@ -83,9 +86,11 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 		}
 
 		//do random game on this node
-		for(int i = 0; i < agent->rollouts; i++){
+		if(agent->rollouts > 1){
+			rollout_batch(board, agent->rollouts);
+		}else{
 			Board copy = board;
-			rollout(copy, node->move, depth);
+			rollout(copy, node->move(), depth);
 		}
 	}else{
 		movelist.finishrollout(won); //got to a terminal state, it's worth recording
@@ -106,7 +111,7 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 }
 
 bool sort_node_know(const AgentMCTS::Node & a, const AgentMCTS::Node & b){
-	return (a.know > b.know);
+	return (a.know() > b.know());
 }
 
 bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
@@ -114,7 +119,7 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 		return false;
 
 	CompactTree<Node>::Children temp;
-	temp.alloc(board.moves_avail(), agent->ctmem);
+	temp.alloc_temp(board.moves_avail(), arena);
 
 	Node * child = temp.begin(),
 	     * end   = temp.end();
@@ -125,14 +130,12 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 		const Board & after = move.board();
 
 		if(agent->minimax){
-			child->outcome = after.outcome();
+			child->set_outcome(after.outcome());
 
-			if(child->outcome == board.to_play()){ //proven win from here, don't need children
-				node->outcome = child->outcome;
-				node->proofdepth = 1;
-				node->bestmove = *move;
+			if(child->outcome() == board.to_play()){ //proven win from here, don't need children
+				node->set_proof(child->outcome(), *move, 1);
 				node->children.unlock();
-				temp.dealloc(agent->ctmem);
+				temp.dealloc(arena);
 				return true;
 			}
 		}
@@ -151,7 +154,7 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 	//sort in decreasing order by knowledge
 //	sort(temp.begin(), temp.end(), sort_node_know);
 
-	PLUS(agent->nodes, temp.num());
+	agent->nodes += temp.num();
 	node->children.swap(temp);
 	assert(temp.unlock());
 
@@ -171,11 +174,11 @@ AgentMCTS::Node * AgentMCTS::AgentThread::choose_move(const Node * node, Side to
 		 * end   = node->children.end();
 
 	for(; child != end; child++){
-		if(child->outcome >= Outcome::DRAW){
-			if(child->outcome == to_play) //return a win immediately
+		if(child->outcome() >= Outcome::DRAW){
+			if(child->outcome() == to_play) //return a win immediately
 				return child;
 
-			val = (child->outcome == Outcome::DRAW ? -1 : -2); //-1 for tie so any unknown is better, -2 for loss so it's even worse
+			val = (child->outcome() == Outcome::DRAW ? -1 : -2); //-1 for tie so any unknown is better, -2 for loss so it's even worse
 		}else{
 			val = child->value(agent->knowledge, agent->fpurgency);
 			if(explore > 0)
@@ -204,16 +207,16 @@ backup in this order:
 return true if fully solved, false if it's unknown or partially unknown
 */
 bool AgentMCTS::do_backup(Node * node, Node * backup, Side to_play){
-	Outcome node_outcome = node->outcome;
+	Outcome node_outcome = node->outcome();
 	if(node_outcome >= Outcome::DRAW) //already proven, probably by a different thread
 		return true;
 
-	if(backup->outcome == Outcome::UNKNOWN) //nothing proven by this child, so no chance
+	if(backup->outcome() == Outcome::UNKNOWN) //nothing proven by this child, so no chance
 		return false;
 
 
-	uint8_t proofdepth = backup->proofdepth;
-	if(backup->outcome != to_play){
+	uint8_t proofdepth = backup->proofdepth();
+	if(backup->outcome() != to_play){
 		uint64_t sims = 0, bestsims = 0, outcome = 0, best_outcome = 0;
 		backup = NULL;
 
@@ -221,10 +224,10 @@ bool AgentMCTS::do_backup(Node * node, Node * backup, Side to_play){
 			 * end = node->children.end();
 
 		for( ; child != end; child++){
-			Outcome child_outcome = child->outcome; //save a copy to avoid race conditions
+			Outcome child_outcome = child->outcome(); //save a copy to avoid race conditions
 
-			if(proofdepth < child->proofdepth+1)
-				proofdepth = child->proofdepth+1;
+			if(proofdepth < child->proofdepth()+1)
+				proofdepth = child->proofdepth()+1;
 
 			//these should be sorted in likelyness of matching, most likely first
 			if(child_outcome == Outcome::UNKNOWN){ // win/draw/loss
@@ -232,7 +235,7 @@ bool AgentMCTS::do_backup(Node * node, Node * backup, Side to_play){
 			}else if(child_outcome == to_play){ //win
 				backup = child;
 				outcome = 6;
-				proofdepth = child->proofdepth+1;
+				proofdepth = child->proofdepth()+1;
 				break;
 			}else if(child_outcome == ~to_play){ //loss
 				outcome = 0;
@@ -266,18 +269,15 @@ bool AgentMCTS::do_backup(Node * node, Node * backup, Side to_play){
 			return false;
 	}
 
-	if(node->outcome.cas(node_outcome, backup->outcome)){
-		node->bestmove = backup->move;
-		node->proofdepth = proofdepth;
-	}else //if it was in a race, try again, might promote a partial solve to full solve
+	if(!node->cas_proof(node_outcome, backup->outcome(), backup->move(), proofdepth)) //if it was in a race, try again, might promote a partial solve to full solve
 		return do_backup(node, backup, to_play);
 
-	return (node->outcome >= Outcome::DRAW);
+	return (node->outcome() >= Outcome::DRAW);
 }
 
 void AgentMCTS::AgentThread::add_knowledge(const Board & board, Node * node, Node * child){
 	if(agent->win_score > 0)
-		child->know = agent->win_score * board.score_calc();
+		child->set_know(agent->win_score * board.score_calc());
 }
 
 ///////////////////////////////////////////
@@ -294,5 +294,21 @@ Outcome AgentMCTS::AgentThread::rollout(Board & board, Move move, int depth){
 	return won;
 }
 
+//play num random games from the same board at once, one per SIMD lane
+void AgentMCTS::AgentThread::rollout_batch(const Board & board, int num){
+	const int chunk = 64;
+	Outcome outcomes[chunk];
+	int lengths[chunk];
+	while(num > 0){
+		int n = (num < chunk ? num : chunk);
+		batch.play(board, n, outcomes, lengths);
+		for(int i = 0; i < n; i++){
+			gamelen.add(lengths[i]);
+			movelist.finishrollout(outcomes[i]);
+		}
+		num -= n;
+	}
+}
+
 }; // namespace Pentago
 }; // namespace Morat
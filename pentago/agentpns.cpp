@@ -62,8 +62,8 @@ void AgentPNS::search(double time, uint64_t maxiters, int verbose){
 		for(auto & t : pool)
 			treelen += t->treelen;
 
-		logerr("Finished:    " + to_str(nodes_seen) + " nodes created in " + to_str(time_used*1000, 0) + " msec: " + to_str(nodes_seen/time_used, 0) + " Nodes/s\n");
-		if(nodes_seen > 0){
+		logerr("Finished:    " + to_str(nodes_seen.exact()) + " nodes created in " + to_str(time_used*1000, 0) + " msec: " + to_str(nodes_seen.exact()/time_used, 0) + " Nodes/s\n");
+		if(nodes_seen.exact() > 0){
 			logerr("Tree depth:  " + treelen.to_s() + "\n");
 		}
 
@@ -104,7 +104,7 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 
 		int numnodes = board.moves_avail();
 		CompactTree<Node>::Children temp;
-		temp.alloc(numnodes, agent->ctmem);
+		temp.alloc_temp(numnodes, arena);
 
 		unsigned int i = 0;
 		for(MoveIterator move(board); !move.done(); ++move){
@@ -126,15 +126,15 @@ bool AgentPNS::AgentThread::pns(const Board & board, Node * node, int depth, uin
 			i++;
 		}
 		nodes_seen += i;
-		PLUS(agent->nodes_seen, i);
-		PLUS(agent->nodes, i);
+		agent->nodes_seen += i;
+		agent->nodes += i;
 		temp.shrink(i); //if symmetry, there may be extra moves to ignore
 		node->children.swap(temp);
 		assert(temp.unlock());
 
 		updatePDnum(node);
 
-		return (agent->nodes_seen >= agent->max_nodes_seen);
+		return agent->nodes_seen.reached(agent->max_nodes_seen);
 	}
 
 	bool mem;
@@ -322,7 +322,7 @@ void AgentPNS::create_children_simple(const Board & board, Node * node){
 		node->children[i] = Node(*move).outcome(outcome, board.to_play(), ties, 1);
 		i++;
 	}
-	PLUS(nodes, i);
+	nodes += i;
 	node->children.shrink(i); //if symmetry, there may be extra moves to ignore
 }
 
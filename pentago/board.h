@@ -33,7 +33,11 @@ bits are laid out in this pattern so that:
 - rotating the entire board means rotating the bits by 9
 */
 
+template<int Lanes> class RolloutBatch;
+
 class Board{
+	template<int Lanes> friend class RolloutBatch; //plays on the bitboards directly
+
 	static const int      xytobit[36];      // indexed by xy coordinate, return bit pattern index
 	static const uint64_t xybits[36];       // xybits[i] = (1ull << xytobit[i])
 	static const uint64_t winmaps[32];      // the bit patterns for the 32 win conditions
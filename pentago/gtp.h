@@ -68,11 +68,14 @@ public:
 
 		newcallback("pv",              std::bind(&GTP::gtp_pv,            this, _1), "Output the principle variation for the player tree as it stands now");
 		newcallback("move_stats",      std::bind(&GTP::gtp_move_stats,    this, _1), "Output the move stats for the player tree as it stands now");
+		newcallback("gc_stats",        std::bind(&GTP::gtp_gc_stats,      this, _1), "Output the garbage collection pause stats for the player");
 
 		newcallback("params",          std::bind(&GTP::gtp_params,        this, _1), "Set the options for the player, no args gives options");
 
 		newcallback("save_sgf",        std::bind(&GTP::gtp_save_sgf,      this, _1), "Output an sgf of the current tree");
 		newcallback("load_sgf",        std::bind(&GTP::gtp_load_sgf,      this, _1), "Load an sgf generated by save_sgf");
+		newcallback("save_tree",       std::bind(&GTP::gtp_save_tree,     this, _1), "Save the current tree in a binary format that loads much faster than an sgf");
+		newcallback("load_tree",       std::bind(&GTP::gtp_load_tree,     this, _1), "Load a tree saved by save_tree");
 	}
 
 	void set_board(bool clear = true){
@@ -104,6 +107,7 @@ public:
 	GTPResponse gtp_colorboard(vecstr args);
 
 	GTPResponse gtp_move_stats(vecstr args);
+	GTPResponse gtp_gc_stats(vecstr args);
 	GTPResponse gtp_pv(vecstr args);
 	GTPResponse gtp_genmove(vecstr args);
 	GTPResponse gtp_solve(vecstr args);
@@ -119,6 +123,8 @@ public:
 
 	GTPResponse gtp_save_sgf(vecstr args);
 	GTPResponse gtp_load_sgf(vecstr args);
+	GTPResponse gtp_save_tree(vecstr args);
+	GTPResponse gtp_load_tree(vecstr args);
 };
 
 }; // namespace Pentago
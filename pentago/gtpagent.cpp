@@ -14,6 +14,13 @@ GTPResponse GTP::gtp_move_stats(vecstr args){
 	return GTPResponse(true, agent->move_stats(moves));
 }
 
+GTPResponse GTP::gtp_gc_stats(vecstr args){
+	AgentMCTS * mcts = dynamic_cast<AgentMCTS *>(agent);
+	if(!mcts)
+		return GTPResponse(false, "Only the mcts agent has gc stats");
+	return GTPResponse(true, mcts->gc_stats());
+}
+
 GTPResponse GTP::gtp_solve(vecstr args){
 	if(hist->outcome() >= 0)
 		return GTPResponse(true, "resign");
@@ -122,6 +129,9 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 #endif
 			"  -o --ponder      Continue to ponder during the opponents time      [" + to_str(mcts->ponder) + "]\n" +
 			"  -M --maxmem      Max memory in Mb to use for the tree              [" + to_str(mcts->maxmem/(1024*1024)) + "]\n" +
+			"     --chunksize   Size in Mb of each block of memory for the tree   [" + to_str(mcts->ctmem.chunksize()/(1024*1024)) + "]\n" +
+			"     --hugepages   Tree memory: 0 heap, 1 transparent, 2 reserved    [" + to_str(mcts->ctmem.chunkalloc()) + "]\n" +
+			"     --gcinc       Garbage collect while searching, pausing briefly  [" + to_str(mcts->gcincremental) + "]\n" +
 			"     --profile     Output the time used by each phase of MCTS        [" + to_str(mcts->profile) + "]\n" +
 			"Tree traversal:\n" +
 			"  -e --explore     Exploration rate for UCT                          [" + to_str(mcts->explore) + "]\n" +
@@ -155,6 +165,15 @@ GTPResponse GTP::gtp_mcts_params(vecstr args){
 			mcts->profile = from_str<bool>(args[++i]);
 		}else if((arg == "-M" || arg == "--maxmem") && i+1 < args.size()){
 			mcts->maxmem = from_str<uint64_t>(args[++i])*1024*1024;
+		}else if((arg == "--chunksize") && i+1 < args.size()){
+			mcts->ctmem.set_chunksize(from_str<uint64_t>(args[++i])*1024*1024);
+		}else if((arg == "--hugepages") && i+1 < args.size()){
+			int source = from_str<int>(args[++i]);
+			if(source < ChunkAlloc_Heap || source > ChunkAlloc_HugeTLB)
+				return GTPResponse(false, "Hugepages must be 0, 1 or 2");
+			mcts->ctmem.set_chunkalloc(ChunkAlloc(source));
+		}else if((arg == "--gcinc") && i+1 < args.size()){
+			mcts->gcincremental = from_str<bool>(args[++i]);
 		}else if((arg == "-e" || arg == "--explore") && i+1 < args.size()){
 			mcts->explore = from_str<float>(args[++i]);
 		}else if((arg == "-A" || arg == "--parexplore") && i+1 < args.size()){
@@ -83,6 +83,13 @@ direction = rotation & 1
 		return std::string() + char(y() + 'a') + to_str(x() + 1) + char(r + 's');
 	}
 
+	//pack into 9 bits for compact storage
+	uint16_t to_bits() const { return (l < 0 ? (64 + l) : (l | (r << 6))); }
+	static Move from_bits(uint16_t b) {
+		int l = b & 63;
+		return (l >= 60 ? Move(MoveSpecial(l - 64)) : Move(l, (b >> 6) & 7));
+	}
+
 	friend std::ostream& operator<< (std::ostream &out, const Move & m) { return out << m.to_s(); }
 
 	bool operator< (const Move & b) const { return (l == b.l ? r <  b.r : l <  b.l); }
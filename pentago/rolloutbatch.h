@@ -0,0 +1,214 @@
+
+#pragma once
+
+//Plays many random games from the same position at once, one per SIMD lane.
+//
+//A Pentago position is just two 64 bit bitboards, and a random move is a handful of bit
+//operations, so each lane holds one game and every step plays a move in all of them: picking
+//a random empty bit, placing it for the side to move, rotating a random quadrant and testing
+//the 32 win patterns. Lanes that finish start the next game right away, so a long game only
+//holds up its own lane.
+//
+//The lanes use gcc vector types as wide as the registers the build enables, AVX-512, AVX2 or
+//SSE, so the same code compiles to whole registers. Wider vectors would get split into smaller
+//ops anyway, and passing them by value changes the ABI, which gcc warns about.
+//The lanes have their own random number generators, xorshift128+ since it has no multiply.
+
+#include <stdint.h>
+
+#include "../lib/outcome.h"
+#include "../lib/xorshift.h"
+
+#include "board.h"
+
+
+namespace Morat {
+namespace Pentago {
+
+#if defined(__AVX512F__)
+static const int native_lanes = 8;  //one AVX-512 register
+#elif defined(__AVX2__)
+static const int native_lanes = 4;  //one AVX2 register
+#else
+static const int native_lanes = 2;  //one SSE register
+#endif
+
+//gcc ignores vector_size when it depends on a template parameter, so spell out each width.
+//stored is for members, so the classes holding a batch don't need an over-aligned new.
+template<int Width> struct LaneVec;
+template<> struct LaneVec<2> {
+	typedef uint64_t type   __attribute__((vector_size(16)));
+	typedef uint64_t stored __attribute__((vector_size(16), aligned(8)));
+};
+template<> struct LaneVec<4> {
+	typedef uint64_t type   __attribute__((vector_size(32)));
+	typedef uint64_t stored __attribute__((vector_size(32), aligned(8)));
+};
+template<> struct LaneVec<8> {
+	typedef uint64_t type   __attribute__((vector_size(64)));
+	typedef uint64_t stored __attribute__((vector_size(64), aligned(8)));
+};
+
+//Lanes games at a time, in groups of registers of up to native_lanes each, since wider vectors
+//get split into scalar ops. The groups are independent, which also hides some latency.
+template<int Lanes>
+class RolloutBatch {
+public:
+	static const int lanes  = Lanes;
+	static const int width  = (Lanes < native_lanes ? Lanes : native_lanes); //lanes per register
+	static const int groups = Lanes / width;
+
+	typedef typename LaneVec<width>::type Vec;
+
+private:
+	typename LaneVec<width>::stored r0[groups], r1[groups]; //random state per lane
+
+	//all bits set in the lanes where v is non-zero
+	static Vec mask(Vec v){
+		return (Vec)(v != 0);
+	}
+
+	static bool any(Vec v){
+		uint64_t r = 0;
+		for(int i = 0; i < width; i++)
+			r |= v[i];
+		return r != 0;
+	}
+
+	Vec rand(int g){
+		Vec s1 = r0[g];
+		const Vec s0 = r1[g];
+		r0[g] = s0;
+		s1 ^= s1 << 23;
+		r1[g] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+		return r1[g] + s0;
+	}
+
+public:
+	static Vec splat(uint64_t x){
+		Vec zero = {};
+		return zero + x; //broadcasts x
+	}
+
+	RolloutBatch(uint64_t seed = 0) {
+		XORShift_uint64 r(seed);
+		for(int g = 0; g < groups; g++){
+			for(int i = 0; i < width; i++){
+				do{ r0[g][i] = r(); }while(r0[g][i] == 0);
+				do{ r1[g][i] = r(); }while(r1[g][i] == 0);
+			}
+		}
+	}
+
+	//the bitboard of one side of a board
+	static uint64_t bits(const Board & board, Side side){
+		return board.sides[side.to_i()];
+	}
+
+	//a random empty bit in each lane of group g, like Board::move_rand: keep a random subset
+	//of the empty bits until only one is left, as long as the subset isn't empty
+	Vec rand_empty(int g, Vec empty){
+		Vec move = empty;
+		while(any(move & (move - 1))){
+			Vec t = move & rand(g);
+			Vec keep = mask(t);
+			move = (t & keep) | (move & ~keep);
+		}
+		return move;
+	}
+
+	//rotate quadrant q of each lane, counter-clockwise in the lanes where ccw is set
+	static Vec rotate(Vec b, Vec q, Vec ccw){
+		Vec m = splat(0xFF) << (q * 9);
+		Vec bm = b & m, rest = b & ~m;
+		Vec left  = rest | ((bm >> 2) & m) | ((bm << 6) & m),
+		    right = rest | ((bm >> 6) & m) | ((bm << 2) & m);
+		return (left & ccw) | (right & ~ccw);
+	}
+
+	//lanes where the side has 5 in a row
+	static Vec won(Vec side){
+		Vec w = splat(0);
+		for(int i = 0; i < 32; i++){
+			Vec wm = splat(Board::winmaps[i]);
+			w |= (Vec)((side & wm) == wm);
+		}
+		return w;
+	}
+
+	//play num random games from board, which mustn't be finished, and return the outcome and
+	//the number of moves on the board at the end of each
+	void play(const Board & board, int num, Outcome * outcomes, int * lengths){
+		const uint64_t start1 = bits(board, Side::P1), start2 = bits(board, Side::P2);
+		const uint64_t startturn = (board.to_play() == Side::P1 ? ~0ull : 0);
+		const int startmoves = board.moves_made();
+
+		Vec s1[groups], s2[groups],
+		    turn[groups],   //all set in the lanes where P1 is to play
+		    moves[groups],
+		    active[groups]; //all set in the lanes with a game in progress
+		int game[groups][width];
+
+		int started = 0, finished = 0;
+		for(int g = 0; g < groups; g++){
+			s1[g] = splat(start1);
+			s2[g] = splat(start2);
+			turn[g] = splat(startturn);
+			moves[g] = splat(startmoves);
+			active[g] = splat(0);
+			for(int i = 0; i < width && started < num; i++){
+				active[g][i] = ~0ull;
+				game[g][i] = started++;
+			}
+		}
+
+		while(finished < num){
+			for(int g = 0; g < groups; g++){
+				Vec a = active[g];
+				Vec move = rand_empty(g, ~(s1[g] | s2[g]) & splat(0xFFFFFFFFFull) & a);
+				Vec b1 = s1[g] | (move & turn[g]),
+				    b2 = s2[g] | (move & ~turn[g]);
+
+				Vec r = rand(g) >> 59; //the top bits have the best randomness
+				Vec ccw = mask(r & 4), q = r & 3;
+				b1 = (rotate(b1, q, ccw) & a) | (b1 & ~a);
+				b2 = (rotate(b2, q, ccw) & a) | (b2 & ~a);
+				turn[g] ^= a;
+				moves[g] -= a; //a is -1 in the lanes that moved
+				s1[g] = b1;
+				s2[g] = b2;
+
+				Vec w1 = won(b1), w2 = won(b2);
+				Vec done = a & (w1 | w2 | (Vec)(moves[g] >= 36));
+				if(!any(done))
+					continue;
+
+				for(int i = 0; i < width; i++){
+					if(!done[i])
+						continue;
+
+					int n = game[g][i];
+					if(w1[i] && w2[i]) outcomes[n] = Outcome::DRAW; //both sides win simultaneously
+					else if(w1[i])     outcomes[n] = Outcome::P1;
+					else if(w2[i])     outcomes[n] = Outcome::P2;
+					else               outcomes[n] = Outcome::DRAW;
+					lengths[n] = moves[g][i];
+					finished++;
+
+					if(started < num){ //start the next game in this lane
+						s1[g][i] = start1;
+						s2[g][i] = start2;
+						turn[g][i] = startturn;
+						moves[g][i] = startmoves;
+						game[g][i] = started++;
+					}else{
+						active[g][i] = 0;
+					}
+				}
+			}
+		}
+	}
+};
+
+}; // namespace Pentago
+}; // namespace Morat
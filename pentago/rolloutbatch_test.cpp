@@ -0,0 +1,161 @@
+#include <cmath>
+#include <vector>
+
+#include "../lib/catch.hpp"
+#include "../lib/string.h"
+#include "../lib/time.h"
+#include "../lib/xorshift.h"
+
+#include "board.h"
+#include "rolloutbatch.h"
+
+using namespace Morat;
+using namespace Pentago;
+
+typedef RolloutBatch<4> Batch;
+
+//play n random moves, or fewer if the game ends
+static Board random_board(XORShift_uint64 & rand, int n){
+	Board b;
+	for(int i = 0; i < n && b.outcome() < Outcome::DRAW; i++)
+		b.move_rand(rand);
+	return b;
+}
+
+TEST_CASE("Pentago::RolloutBatch rotates like Board::move", "[pentago][rolloutbatch]") {
+	XORShift_uint64 rand(3);
+	for(int iter = 0; iter < 200; iter++){
+		Board b = random_board(rand, iter % 20);
+		if(b.outcome() >= Outcome::DRAW)
+			continue;
+		Side opponent = ~b.to_play();
+		uint64_t before = Batch::bits(b, opponent);
+
+		int pos;
+		do{ pos = rand() % 36; }while(!b.valid_move_fast(Move(pos, 0)));
+
+		Batch::Vec q, ccw;
+		for(int i = 0; i < Batch::width; i++){ //one rotation per lane
+			Move m(pos, (iter + i) % 8);
+			q[i] = m.quadrant();
+			ccw[i] = (m.direction() == 0 ? ~0ull : 0);
+		}
+		Batch::Vec rotated = Batch::rotate(Batch::splat(before), q, ccw);
+
+		for(int i = 0; i < Batch::width; i++){
+			Board after = b;
+			REQUIRE(after.move(Move(pos, (iter + i) % 8)));
+			REQUIRE(rotated[i] == Batch::bits(after, opponent));
+		}
+	}
+}
+
+TEST_CASE("Pentago::RolloutBatch finds wins like Board::won_calc", "[pentago][rolloutbatch]") {
+	XORShift_uint64 rand(5);
+	int wins = 0;
+	for(int iter = 0; iter < 2000; iter++){
+		Board b = random_board(rand, 10 + iter % 27);
+		Outcome o = b.won_calc();
+		bool w1 = Batch::won(Batch::splat(Batch::bits(b, Side::P1)))[0];
+		bool w2 = Batch::won(Batch::splat(Batch::bits(b, Side::P2)))[0];
+		if(o == Outcome::P1) REQUIRE((w1 && !w2));
+		if(o == Outcome::P2) REQUIRE((w2 && !w1));
+		if(o == Outcome::UNKNOWN) REQUIRE((!w1 && !w2));
+		if(o == Outcome::DRAW) REQUIRE(w1 == w2);
+		wins += (w1 || w2);
+	}
+	REQUIRE(wins > 100);
+}
+
+//the outcome rates and game lengths of the lanes should match the scalar rollouts
+template<int Lanes>
+static void compare_rollouts(const Board & board, int games){
+	XORShift_uint64 rand(7);
+	int scalar[3] = {0, 0, 0}; //draw, p1, p2
+	double scalarlen = 0;
+	for(int i = 0; i < games; i++){
+		Board b = board;
+		while(b.outcome() < Outcome::DRAW)
+			b.move_rand(rand);
+		scalar[b.outcome().to_i()]++;
+		scalarlen += b.moves_made();
+	}
+
+	RolloutBatch<Lanes> batch(11);
+	std::vector<Outcome> outcomes(games);
+	std::vector<int> lengths(games);
+	batch.play(board, games, outcomes.data(), lengths.data());
+	int lanes[3] = {0, 0, 0};
+	double lanelen = 0;
+	for(int i = 0; i < games; i++){
+		REQUIRE(outcomes[i] >= Outcome::DRAW);
+		REQUIRE(lengths[i] > board.moves_made());
+		REQUIRE(lengths[i] <= 36);
+		lanes[outcomes[i].to_i()]++;
+		lanelen += lengths[i];
+	}
+
+	for(int o = 0; o < 3; o++){
+		int diff = std::abs(lanes[o] - scalar[o]);
+		REQUIRE(diff < games / 50);
+	}
+	double avgdiff = std::abs(lanelen - scalarlen) / games;
+	REQUIRE(avgdiff < 0.2);
+}
+
+TEST_CASE("Pentago::RolloutBatch plays like the scalar rollouts", "[pentago][rolloutbatch]") {
+	Board empty;
+	compare_rollouts<4>(empty, 40000);
+	compare_rollouts<8>(empty, 40000);
+	compare_rollouts<16>(empty, 40000);
+
+	XORShift_uint64 rand(13);
+	Board mid = random_board(rand, 14);
+	REQUIRE(mid.outcome() < Outcome::DRAW);
+	compare_rollouts<4>(mid, 40000);
+
+	SECTION("Fewer games than lanes") {
+		RolloutBatch<16> batch(17);
+		Outcome outcomes[3];
+		int lengths[3];
+		batch.play(empty, 3, outcomes, lengths);
+		for(int i = 0; i < 3; i++)
+			REQUIRE(outcomes[i] >= Outcome::DRAW);
+	}
+}
+
+template<int Lanes>
+static double batch_rate(const Board & board, int games){
+	RolloutBatch<Lanes> batch(19);
+	std::vector<Outcome> outcomes(1024);
+	std::vector<int> lengths(1024);
+	Time start;
+	for(int i = 0; i < games; i += 1024)
+		batch.play(board, 1024, outcomes.data(), lengths.data());
+	return games / (Time() - start);
+}
+
+// Not run by default, run with: ./test "[benchmark]"
+TEST_CASE("Pentago::RolloutBatch playouts benchmark", "[.][benchmark][pentago][rolloutbatch]") {
+	const int games = 2000000;
+	XORShift_uint64 rand(23);
+	for(int depth : {0, 12}){
+		Board board = random_board(rand, depth);
+
+		Time start;
+		int wins = 0;
+		for(int i = 0; i < games; i++){
+			Board b = board;
+			while(b.outcome() < Outcome::DRAW)
+				b.move_rand(rand);
+			wins += (b.outcome() == Outcome::P1);
+		}
+		double scalar = games / (Time() - start);
+		REQUIRE(wins > 0);
+
+		WARN("from " + to_str(depth) + " moves: scalar " + to_str(scalar/1000, 0) + "k playouts/s, " +
+		     "4 lanes " + to_str(batch_rate<4>(board, games)/1000, 0) + "k/s, " +
+		     "8 lanes " + to_str(batch_rate<8>(board, games)/1000, 0) + "k/s, " +
+		     "16 lanes " + to_str(batch_rate<16>(board, games)/1000, 0) + "k/s, on one core");
+	}
+}
@@ -1,5 +1,7 @@
 
 #include "../lib/catch.hpp"
+#include "../lib/string.h"
+#include "../lib/xorshift.h"
 
 #include "board.h"
 
@@ -24,6 +26,24 @@ void test_game(Board b, std::vector<std::string> moves, Outcome outcome) {
 	}
 }
 
+//the losing cells the board keeps must be the ones test_outcome finds on the whole board
+static void require_losses(const Board & b) {
+	for(Side side : {Side::P1, Side::P2}){
+		std::vector<Move> expected, found;
+		for(auto m : b)
+			if(b.test_outcome(m, side) == +~side)
+				expected.push_back(m);
+		for(int n = 0; n < b.losses(side); n++)
+			found.push_back(b.loss(side, n));
+		std::sort(found.begin(), found.end());
+		CAPTURE(b);
+		CAPTURE(side.to_i());
+		REQUIRE(found == expected);
+		for(auto m : b)
+			REQUIRE(b.loses(m, side) == (b.test_outcome(m, side) == +~side));
+	}
+}
+
 TEST_CASE("Rex::Board size 3", "[rex][board]") {
 	Board b("3");
 
@@ -228,3 +248,102 @@ TEST_CASE("Rex::Board size 7", "[rex][board]") {
 		 Outcome::P1);
 	}
 }
+
+TEST_CASE("Rex::Board::undo", "[rex][board]") {
+	XORShift_uint32 rand(42);
+	for(int game = 0; game < 20; game++){
+		Board b("7");
+		b.track_losses(true);
+		std::vector<Board> boards;
+		std::vector<Board::Undo> undos;
+
+		//play randomly to the end, keeping a copy of each position
+		while(!b.outcome().solved()){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			if(moves.empty())
+				break;
+			boards.push_back(b);
+			undos.push_back(Board::Undo());
+			REQUIRE(b.move(moves[rand() % moves.size()], undos.back()));
+		}
+
+		//take them all back, checking each position including the groups against the copy
+		while(!undos.empty()){
+			b.undo(undos.back());
+			undos.pop_back();
+			const Board & o = boards.back();
+			CAPTURE(b);
+			REQUIRE(b.to_s(false) == o.to_s(false));
+			REQUIRE(b.gethash() == o.gethash());
+			REQUIRE(b.to_play() == o.to_play());
+			REQUIRE(b.moves_made() == o.moves_made());
+			REQUIRE(b.outcome() == o.outcome());
+			REQUIRE(b.win_type() == o.win_type());
+			for(auto m : o){
+				REQUIRE(b.test_outcome(m) == o.test_outcome(m));
+				REQUIRE(b.test_outcome(m, ~o.to_play()) == o.test_outcome(m, ~o.to_play()));
+			}
+			require_losses(b);
+			boards.pop_back();
+		}
+	}
+}
+
+TEST_CASE("Rex::Board::losses", "[rex][board]") {
+	XORShift_uint32 rand(13);
+	for(int size = 3; size <= 11; size += 2){
+		for(int game = 0; game < 50; game++){
+			Board b(to_str(size));
+			int start = (game % 2 ? 0 : rand() % b.num_cells()); //turn it on mid game in half of them
+			while(!b.outcome().solved()){
+				if(b.moves_made() == start)
+					b.track_losses(true);
+				if(b.moves_made() >= start)
+					require_losses(b);
+				std::vector<Move> moves;
+				for(auto m : b)
+					moves.push_back(m);
+				REQUIRE(b.move(moves[rand() % moves.size()]));
+			}
+		}
+	}
+}
+
+TEST_CASE("Rex::Board::fill_outcome", "[rex][board]") {
+	XORShift_uint32 rand(7);
+	for(int game = 0; game < 200; game++){
+		Board b("7");
+
+		//start from a random unfinished position
+		int start = rand() % 20;
+		for(int i = 0; i < start && !b.outcome().solved(); i++){
+			std::vector<Move> moves;
+			for(auto m : b)
+				moves.push_back(m);
+			Board o = b;
+			o.move(moves[rand() % moves.size()]);
+			if(o.outcome().solved())
+				break;
+			b = o;
+		}
+
+		//fill the rest in random order, and play the same moves until someone wins
+		std::vector<Move> fill;
+		for(auto m : b)
+			fill.push_back(m);
+		for(int i = fill.size() - 1; i > 0; i--)
+			std::swap(fill[i], fill[rand() % (i + 1)]);
+
+		Board played = b;
+		for(auto m : fill){
+			if(played.outcome().solved())
+				break;
+			REQUIRE(played.move(m));
+		}
+		CAPTURE(b);
+		REQUIRE(played.outcome().solved());
+		REQUIRE(b.fill_outcome(fill.data(), fill.size()) == played.outcome());
+	}
+}
@@ -3,22 +3,30 @@
 
 //A Monte-Carlo Tree Search based player
 
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 
 #include "../lib/agentpool.h"
+#include "../lib/childselect.h"
 #include "../lib/compacttree.h"
 #include "../lib/depthstats.h"
+#include "../lib/distsync.h"
 #include "../lib/exppair.h"
 #include "../lib/log.h"
 #include "../lib/move.h"
 #include "../lib/movelist.h"
+#include "../lib/mpmcqueue.h"
 #include "../lib/policy_bridge.h"
 #include "../lib/policy_instantwin.h"
 #include "../lib/policy_lastgoodreply.h"
 #include "../lib/policy_random.h"
+#include "../lib/ravebatch.h"
+#include "../lib/shardedcounter.h"
 #include "../lib/thread.h"
 #include "../lib/time.h"
+#include "../lib/transtable.h"
+#include "../lib/treesync.h"
 #include "../lib/types.h"
 #include "../lib/xorshift.h"
 
@@ -35,20 +43,96 @@ public:
 
 	struct Node {
 	public:
-		ExpPair rave;
-		ExpPair exp;
-		int16_t know;
-		Outcome outcome;
-		uint8_t proofdepth;
-		Move    move;
-		Move    bestmove; //if outcome is set, then bestmove is the way to get there
+#ifdef COMPACT_NODE
+		//24 bytes: 32 bit visit counts, rave quantized to 16 bits, and the small fields packed into one word
+		typedef ExpPair32 ExpStats;
+		typedef ExpPair16 RaveStats;
+
+		RaveStats rave;
+	private:
+		//move:10, outcome+4:3, proofdepth:7, then the top 12 bits are know while unsolved, or bestmove once solved
+		uint32_t info;
+
+		static uint32_t pack(const Move & m, Outcome o, int depth, uint32_t top){
+			return m.to_bits() | ((o.to_i() + 4) << 10) | (std::min(depth, 127) << 13) | (top << 20);
+		}
+		//the top bits for o: the best move once solved, otherwise the know already in i, unless i
+		//was solved. Partial outcomes don't have room to keep their best move.
+		static uint32_t top(uint32_t i, Outcome o, const Move & best){
+			return (o.solved() ? best.to_bits() : (((i >> 10) & 7) >= 4 ? 0 : i >> 20));
+		}
+	public:
+		ExpStats exp;
+		CompactTree<Node>::Children children;
+
+		Node(const Move & m = M_NONE, Outcome o = Outcome::UNKNOWN) : info(pack(m, o, 0, o.solved() ? Move(M_UNKNOWN).to_bits() : 0)) { }
+
+		Move    move()       const { return Move::from_bits(info & 0x3FF); }
+		Outcome outcome()    const { return Outcome((int)((info >> 10) & 7) - 4); }
+		int     proofdepth() const { return (info >> 13) & 0x7F; }
+		int     know()       const { uint32_t i = info; return (((i >> 10) & 7) >= 4 ? 0 : (int32_t)i >> 20); }
+		Move    bestmove()   const { uint32_t i = info; return (((i >> 10) & 7) >= 4 ? Move::from_bits(i >> 20) : Move(M_UNKNOWN)); }
+
+		void set_know(int k){
+			if(!outcome().solved())
+				info = (info & 0xFFFFF) | ((uint32_t)std::max(-2048, std::min(k, 2047)) << 20);
+		}
+		void set_outcome(Outcome o){
+			info = pack(move(), o, proofdepth(), top(info, o, M_UNKNOWN));
+		}
+		void set_proof(Outcome o, const Move & best, int depth){
+			info = pack(move(), o, depth, top(info, o, best));
+		}
+		//set the outcome with the move and depth that prove it, only if the outcome is still old
+		bool cas_proof(Outcome old, Outcome o, const Move & best, int depth){
+			uint32_t i = info;
+			if(((i >> 10) & 7) != (uint32_t)(old.to_i() + 4))
+				return false;
+			return CAS(info, i, pack(move(), o, depth, top(i, o, best)));
+		}
+#else
+		typedef ExpPair ExpStats;
+		typedef ExpPair RaveStats;
+
+		RaveStats rave;
+		ExpStats  exp;
+	private:
+		int16_t know_;
+		Outcome outcome_;
+		uint8_t proofdepth_;
+		Move    move_;
+		Move    bestmove_; //if outcome is set, then bestmove is the way to get there
+	public:
 		CompactTree<Node>::Children children;
 //		int padding;
 		//seems to need padding to multiples of 8 bytes or it segfaults?
 		//don't forget to update the copy constructor/operator
 
-		Node() : know(0), outcome(Outcome::UNKNOWN), proofdepth(0), move(M_NONE) { }
-		Node(const Move & m, Outcome o = Outcome::UNKNOWN) : know(0), outcome(o), proofdepth(0), move(m) { }
+		Node(const Move & m = M_NONE, Outcome o = Outcome::UNKNOWN) : know_(0), outcome_(o), proofdepth_(0), move_(m) { }
+
+		Move    move()       const { return move_; }
+		Outcome outcome()    const { return outcome_; }
+		int     proofdepth() const { return proofdepth_; }
+		int     know()       const { return know_; }
+		Move    bestmove()   const { return bestmove_; }
+
+		void set_know(int k){ know_ = k; }
+		void set_outcome(Outcome o){ outcome_ = o; }
+		void set_proof(Outcome o, const Move & best, int depth){
+			outcome_ = o;
+			bestmove_ = best;
+			proofdepth_ = depth;
+		}
+		//set the outcome with the move and depth that prove it, only if the outcome is still old
+		bool cas_proof(Outcome old, Outcome o, const Move & best, int depth){
+			if(!outcome_.cas(old, o))
+				return false;
+			bestmove_ = best;
+			proofdepth_ = depth;
+			return true;
+		}
+#endif
+
 		Node(const Node & n) { *this = n; }
 		Node & operator = (const Node & n){
 			if(this != & n){ //don't copy to self
@@ -57,11 +141,15 @@ public:
 
 				rave = n.rave;
 				exp  = n.exp;
-				know = n.know;
-				move = n.move;
-				bestmove = n.bestmove;
-				outcome = n.outcome;
-				proofdepth = n.proofdepth;
+#ifdef COMPACT_NODE
+				info = n.info;
+#else
+				know_ = n.know_;
+				move_ = n.move_;
+				bestmove_ = n.bestmove_;
+				outcome_ = n.outcome_;
+				proofdepth_ = n.proofdepth_;
+#endif
 				//children = n.children; ignore the children, they need to be swap_tree'd in
 			}
 			return *this;
@@ -121,19 +209,49 @@ public:
 				if(expnum  > 0) val += (1.0f-alpha)*exp.avg();
 			}
 
-			if(knowledge && know > 0){
+			if(knowledge && know() > 0){
 				if(expnum <= 1)
-					val += 0.01f * know;
+					val += 0.01f * know();
 				else if(expnum < 1000) //knowledge is only useful with little experience
-					val += 0.01f * know / sqrt(expnum);
+					val += 0.01f * know() / sqrt(expnum);
 			}
 
 			return val;
 		}
 	};
+#ifdef COMPACT_NODE
+	static_assert(sizeof(Node) <= 16 + sizeof(CompactTree<Node>::Children), "The compact node should be 24 bytes, or 20 with handles");
+#endif
+
+	//a tree grown by a group of threads on its own, see treegroup
+	struct Tree {
+		Node root;
+		CompactTree<Node> ctmem;
+		ShardedCounter nodes;
+		TreeSync<Node> share; //the experience exchanged with the other trees, see treesync
+	};
+
+	//a node on the path of a simulation, in the order they're backed up to the root
+	struct Step {
+		Node * node;
+		Side side;  //the side that moved into node, whose experience it holds
+		int remain; //moves remaining on the board at the parent, for rave
+		bool trans; //continues from the previous node through a transposition, so no proof to back up
+		Step(Node * n, Side s, int r, bool t) : node(n), side(s), remain(r), trans(t) { }
+	};
 
+	//a simulation waiting for one rollout by a rollout worker, see pipeline
+	struct Leaf {
+		Board board;
+		MoveList<Board> movelist;
+		std::vector<Step> path;
+		Leaf(const Board & b) : board(b) { }
+	};
 
 	class AgentThread : public AgentThreadBase<AgentMCTS> {
+		Tree * tree;                    //the tree of this thread's group, NULL for the main tree
+		bool worker;                    //a rollout worker of the pipeline instead of a search thread
+		CompactTree<Node>::Arena arena; //allocate tree nodes without contending with the other threads
 		mutable XORShift_float unitrand;
 		LastGoodReply<Board> last_good_reply;
 		RandomPolicy<Board> random_policy;
@@ -143,8 +261,14 @@ public:
 		bool use_rave;    //whether to use rave for this simulation
 		bool use_explore; //whether to use exploration for this simulation
 		LBDists dists;    //holds the distances to the various non-ring wins as a heuristic for the minimum moves needed to win
+		LBDists rootdists;    //the distances at the root, updated with the moves to a leaf instead of running them again
+		bool rootdists_valid; //cleared whenever the root may change
+		Board replay;         //the root with the moves to the leaf, what dists was updated on
 
 		MoveList<Board> movelist;
+		std::vector<Step> path;       //the nodes of the current simulation
+		std::vector<Leaf *> reserved; //leaves for the next simulation, so it can always hand off its rollouts
+		RaveBatch<Node> rave_batch; //rave updates waiting to be applied to the tree
 		int stage; //which of the four MCTS stages is it on
 
 	public:
@@ -153,7 +277,9 @@ public:
 		double times[4]; //time spent in each of the stages
 		Time timestamps[4]; //timestamps for the beginning, before child creation, before rollout, after rollout
 
-		AgentThread(AgentThreadPool<AgentMCTS> * p, AgentMCTS * a) : AgentThreadBase<AgentMCTS>(p, a) { }
+		AgentThread(AgentThreadPool<AgentMCTS> * p, AgentMCTS * a) : AgentThreadBase<AgentMCTS>(p, a),
+			tree(a->thread_tree()), worker(a->threadsmade > a->numthreads), arena(tree ? tree->ctmem : a->ctmem),
+			rootdists_valid(false), replay(a->rootboard) { }
 
 
 		void reset(){
@@ -172,16 +298,29 @@ public:
 		}
 
 
+		void pausing(){
+			pipeline_drain(); //the leaves in flight point into the tree
+			rave_batch.flush();
+			rootdists_valid = false;
+		}
+
 	private:
 		void iterate(); //handles each iteration
-		void walk_tree(Board & board, Node * node, int depth);
+		bool walk_tree(Board & board, Node * node, int depth);
+		void backup(const std::vector<Step> & steps, const MoveList<Board> & moves);
+		bool pipeline_help();
+		void pipeline_drain();
+		void play_leaf(Leaf * leaf);
+		void finish_leaf(Leaf * leaf);
 		bool create_children(const Board & board, Node * node);
+		void leaf_dists(const Board & board);
 		void add_knowledge(const Board & board, Node * node, Node * child);
 		Node * choose_move(const Node * node, Side to_play, int remain) const;
-		void update_rave(const Node * node, Side to_play);
+		void update_rave(const Node * node, Side to_play, const MoveList<Board> & moves);
 		bool test_bridge_probe(const Board & board, const Move & move, const Move & test) const;
 
-		Outcome rollout(Board & board, Move move, int depth);
+		Outcome rollout(Board & board, Move move, int depth, MoveList<Board> & moves);
+		Outcome fill_rollout(const Board & board, int depth, MoveList<Board> & moves);
 		Move rollout_choose_move(Board & board, const Move & prev);
 		Move rollout_pattern(const Board & board, const Move & move);
 	};
@@ -190,11 +329,32 @@ public:
 public:
 
 	static const float min_rave;
+	static const float gc_start; //fraction of maxmem at which an incremental gc starts
+	static const float gc_duty;  //fraction of the time the incremental gc pauses may take
+	static const uword gc_slice; //how many nodes to free at a time while the others keep searching
+
+	//the stages of an incremental gc
+	enum GCPhase {
+		GC_Idle,     //waiting for enough memory use to start
+		GC_Mark,     //one thread finds the subtrees to collect while the rest search
+		GC_Marked,   //waiting for a pause to detach them
+		GC_Free,     //the detached subtrees are freed a slice at a time while the rest search
+		GC_Evacuate, //compacting one chunk per pause
+	};
 
 	bool  ponder;     //think during opponents time?
 	int   numthreads; //number of player threads to run
+	int   treegroup;  //threads per tree, each group grows its own tree and the tops of the trees are merged, 0 for one shared tree
+	float treesync;   //seconds between merging the trees while searching, 0 to only merge at the end of the search
+	int   treedepth;  //plies of the trees to merge
+	uint  treevisits; //only merge the nodes with at least this many visits
+	int   pipeline;   //rollout worker threads that play out the leaves the search threads find, 0 to roll out inline
 	u64   maxmem;     //maximum memory for the tree in bytes
 	bool  profile;    //count how long is spent in each stage of MCTS
+//distributed search
+	int   distdepth;  //plies of the tree to share with the other processes
+	uint  distvisits; //only share the nodes with at least this many visits
+	float distsync;   //seconds between exchanges, 0 to only exchange at the end of the search
 //final move selection
 	float msrave;     //rave factor in final move selection, -1 means use number instead of value
 	float msexplore;  //the UCT constant in final move selection
@@ -212,10 +372,12 @@ public:
 	float logdynwiden; // = log(dynwiden), cached for performance
 //tree building
 	bool  shortrave;  //only update rave values on short rollouts
+	int   ravebatch;  //buffer the rave updates for this many simulations before applying them, 0 to apply them right away
 	bool  keeptree;   //reuse the tree from the previous move
 	int   minimax;    //solve the minimax tree within the uct tree
 	uint  visitexpand;//number of visits before expanding a node
 	uint  gcsolved;   //garbage collect solved nodes or keep them in the tree, assuming they meet the required amount of work
+	bool  gcincremental; //garbage collect while searching and compact a chunk per pause instead of one long pause
 	bool  longestloss;//if we have a proven loss, if true backup the longest loss, else backup the hardest loss to solve
 
 //knowledge
@@ -229,18 +391,47 @@ public:
 	int   weightedrandom; //use weighted random for move ordering based on gammas
 	bool  rolloutpattern; //play the response to a virtual connection threat in rollouts
 	int   lastgoodreply;  //use the last-good-reply rollout heuristic
-	int   instantwin;     //how deep to look for instant wins in rollouts
+	int   instantwin;     //take or block instant wins in rollouts if > 0, any old depth now means the whole rollout
+	bool  fillrollout;    //fill the board at random and find the winner at the end, if no other rollout policy is on
 
 	float gammas[4096]; //pattern weights for weighted random
 
 	Node  root;
-	uword nodes;
+	ShardedCounter nodes;
 	int   gclimit; //the minimum experience needed to not be garbage collected
 
-	uint64_t runs, maxruns;
+	volatile int gcphase;  //GCPhase of the incremental gc
+	volatile int gcworker; //whether a thread is doing incremental gc work
+	std::vector<Node *> gcmarked; //subtrees found by the mark phase
+	Node * gcdetached;     //subtrees detached from the tree, waiting to be freed
+	uint   gcnumdetached, gcnumfreed;
+	uword  gcnodesbefore;  //tree size when the incremental gc started
+	uint64_t gclastalloced; //memory allocated when the last incremental gc finished, the next waits for more
+	Time   gclastpause;    //when the last gc pause ended, for pacing the incremental gc
+	double gclastlen;      //how long the last gc pause was
+	uint64_t gcpauses;     //gc pause stats since the agent was created
+	double gcpausetime, gcmaxpause;
+
+	ShardedCounter runs;
+	uint64_t maxruns;
+	uint64_t lastruns; //runs in the last search
+
+	DistSync<Node> dist; //the experience shared with the other processes of a distributed search
+	TreeSync<Node> share; //the experience exchanged with the side trees, see treesync
+	Time lastmerge;       //when the trees were last merged
+
+	TransTable<Node> transpositions; //expanded positions, so transpositions share a subtree, empty unless enabled
+	ShardedCounter transposed;       //simulations this search that continued through a transposition
 
 	CompactTree<Node> ctmem;
 
+	std::vector<Tree *> sidetrees; //the trees of the thread groups after the first, which grows root
+	int   threadsmade;             //threads assigned to a group so far
+
+	MPMCQueue<Leaf *> leaffree, leaftodo, leafdone; //the pipeline: leaves ready to use, waiting for a rollout, waiting for backup
+	volatile int leavesmade; //leaves allocated so far, up to leaf_limit()
+	volatile int leavesout;  //leaves taken from leaffree and not yet returned
+
 	AgentThreadPool<AgentMCTS> pool;
 
 	AgentMCTS() = delete;
@@ -251,12 +442,15 @@ public:
 	void clear_mem() { };
 
 	void set_ponder(bool p);
+	void set_threads(int threads, int group, int workers);
 	void set_board(const Board & board, bool clear = true);
 
 	void move(const Move & m);
 
 	void search(double time, uint64_t maxruns, int verbose);
-	Move return_move(int verbose) const { return return_move(& root, rootboard.to_play(), verbose); }
+	std::string dist_collect();
+	void dist_apply(const vecstr & stats);
+	Move return_move(int verbose) const;
 
 	double gamelen() const;
 	vecmove get_pv(const vecmove& moves) const;
@@ -264,31 +458,41 @@ public:
 
 	bool done() {
 		//solved or finished runs
-		return (rootboard.outcome() >= Outcome::DRAW || root.outcome >= Outcome::DRAW || (maxruns > 0 && runs >= maxruns));
+		if(rootboard.outcome() >= Outcome::DRAW || root.outcome() >= Outcome::DRAW || (maxruns > 0 && runs.reached(maxruns)))
+			return true;
+		for(const Tree * t : sidetrees)
+			if(t->root.outcome() >= Outcome::DRAW)
+				return true;
+		return false;
 	}
 
 	bool need_gc() {
-		//out of memory, start garbage collection
-		return (ctmem.memalloced() >= maxmem);
+		return gc_due() || merge_due();
 	}
 
-	void start_gc() {
-		Time starttime;
-		logerr("Starting player GC with limit " + to_str(gclimit) + " ... ");
-		uint64_t nodesbefore = nodes;
-		garbage_collect(root, rootboard.to_play());
-		Time gctime;
-		ctmem.compact(1.0, 0.75);
-		Time compacttime;
-		logerr(to_str(100.0*nodes/nodesbefore, 1) + " % of tree remains - " +
-			to_str((gctime - starttime)*1000, 0)  + " msec gc, " + to_str((compacttime - gctime)*1000, 0) + " msec compact\n");
-
-		if(ctmem.meminuse() >= maxmem/2)
-			gclimit = (int)(gclimit*1.3);
-		else if(gclimit > rollouts*5)
-			gclimit = (int)(gclimit*0.9); //slowly decay to a minimum of 5
+	//the trees of the thread groups are merged in the same kind of pause as a gc
+	bool merge_due() const {
+		return (!sidetrees.empty() && treesync > 0 && Time() - lastmerge >= treesync);
 	}
 
+	bool gc_due() const {
+		//out of memory, start garbage collection
+		if(ctmem.memalloced() >= tree_maxmem())
+			return true;
+		for(const Tree * t : sidetrees)
+			if(t->ctmem.memalloced() >= tree_maxmem())
+				return true;
+
+		//the incremental gc needs short pauses, spaced out so they only take gc_duty of the time
+		return ((gcphase == GC_Marked || gcphase == GC_Evacuate) &&
+		        Time() - gclastpause >= gclastlen * (1 - gc_duty) / gc_duty);
+	}
+
+	void start_gc();
+	bool gc_concurrent(); //do a slice of the incremental gc instead of a search iteration, returns whether it did
+	std::string gc_stats() const;
+	std::string mem_stats() const;
+
 	void gen_sgf(SGFPrinter<Move> & sgf, int limit) const {
 		if(limit < 0)
 			limit = root.exp.num()/1000;
@@ -299,10 +503,31 @@ public:
 		load_sgf(sgf, rootboard, root);
 	}
 
+	bool save_tree(const std::string & filename, const vecmove & moves, std::string & error);
+	bool can_load(const TreeFile & file, std::string & error) const;
+	bool load_tree(const TreeFile & file, std::string & error);
+
 protected:
-	void garbage_collect(Node& node, Side to_play);
+	Tree * thread_tree();
+	void merge_trees();
+	int leaf_limit() const { return std::min<int>(leaffree.capacity(), 2 * (numthreads + pipeline) * std::max(rollouts, 1)); }
+	Leaf * get_leaf();
+	void put_leaf(Leaf * leaf);
+	void free_leaves();
+	//each tree gets an equal share, of at most half of what the chunks can hold so compacting has room to copy into
+	uint64_t tree_maxmem() const { return std::min(maxmem, ctmem.maxmemory() / 2) / (sidetrees.size() + 1); }
+	void move_root(Node & node, CompactTree<Node> & ct, ShardedCounter & count, const Move & m);
+	void reset_root(Node & node);
+
+	bool gc_keep(const Node & node, const Node & child, Side to_play) const;
+	void garbage_collect(Node& node, Side to_play, CompactTree<Node> & ct, ShardedCounter & count);
+	bool gc_mark(Node & node, Side to_play);
+	void gc_finish();
+	void gc_adjust_limit();
+	void gc_adjust_limit_incremental(double remains);
 	bool do_backup(Node * node, const Node * backup, Side to_play);
 	Move return_move(const Node * node, Side to_play, int verbose = 0) const;
+	Move return_move(const Node * begin, const Node * end, uword visits, Side to_play, int verbose) const;
 
 	Node * find_child(const Node * node, const Move & move) const ;
 	void create_children_simple(const Board & board, Node * node);
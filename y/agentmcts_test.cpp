@@ -1,5 +1,7 @@
 
 #include "../lib/catch.hpp"
+#include "../lib/string.h"
+#include "../lib/xorshift.h"
 
 #include "agentmcts.h"
 
@@ -14,3 +16,58 @@ TEST_CASE("Y::AgentMCTS::Node::to_s/from_s", "[y][agentmcts]") {
 	REQUIRE(k.from_s(s));
 	REQUIRE(n.to_s() == k.to_s());
 }
+
+//in the compact layout know and bestmove share bits, so a partial proof has to keep know
+TEST_CASE("Y::AgentMCTS::Node keeps know through partial proofs", "[y][agentmcts]") {
+	AgentMCTS::Node n(Move("a1"));
+	n.set_know(-7);
+	REQUIRE(n.cas_proof(Outcome::UNKNOWN, Outcome::P1_DRAW, Move("b2"), 3));
+	REQUIRE(n.outcome() == Outcome::P1_DRAW);
+	REQUIRE(n.proofdepth() == 3);
+	REQUIRE(n.move() == Move("a1"));
+	REQUIRE(n.know() == -7);
+
+	n.set_outcome(Outcome::P2_DRAW);
+	REQUIRE(n.know() == -7);
+	n.set_proof(Outcome::P1_DRAW, Move("b2"), 4);
+	REQUIRE(n.know() == -7);
+
+	REQUIRE(!n.cas_proof(Outcome::UNKNOWN, Outcome::P2, Move("b2"), 5));
+	REQUIRE(n.cas_proof(Outcome::P1_DRAW, Outcome::P1, Move("b2"), 5));
+	REQUIRE(n.outcome() == Outcome::P1);
+	REQUIRE(n.bestmove() == Move("b2"));
+}
+
+//exposes the board the rollouts start from
+class RootAgent : public AgentMCTS {
+public:
+	RootAgent(const Board & b) : AgentMCTS(b) { }
+	const Board & root_board() const { return rootboard; }
+};
+
+TEST_CASE("Y::AgentMCTS -w still takes the old depths", "[y][agentmcts]") {
+	//play random moves until the side to move has a winning cell
+	XORShift_uint32 rand(7);
+	Board board("6");
+	for(;;){
+		Board tracked = board;
+		tracked.track_wins(true);
+		if(tracked.wins(board.to_play()) > 0)
+			break;
+		std::vector<Move> moves;
+		for(auto m : board)
+			moves.push_back(m);
+		REQUIRE(board.move(moves[rand() % moves.size()]));
+		REQUIRE(board.outcome() < Outcome::DRAW);
+	}
+
+	//-w was the depth to look to, now anything but 0 turns it on for the whole rollout
+	RootAgent a(board);
+	for(const char * arg : {"0", "1", "3", "100", "0"}){
+		CAPTURE(arg);
+		a.instantwin = from_str<int>(arg); //as -w arg sets it
+		a.set_board(board);
+		REQUIRE((a.root_board().wins(board.to_play()) > 0) == (a.instantwin != 0));
+		a.search(10, 100, 0); //and the rollouts run with it
+	}
+}
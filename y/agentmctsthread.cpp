@@ -1,7 +1,9 @@
 
 #include <cmath>
+#include <sched.h>
 #include <string>
 
+#include "../lib/assert2.h"
 #include "../lib/string.h"
 
 #include "agentmcts.h"
@@ -11,19 +13,68 @@ namespace Morat {
 namespace Y {
 
 void AgentMCTS::AgentThread::iterate(){
-	INCR(agent->runs);
+	if(agent->gcincremental && agent->gc_concurrent())
+		return;
+
+	if(worker){ //play out the leaves the search threads hand off
+		Leaf * leaf;
+		if(agent->leaftodo.pop(leaf))
+			play_leaf(leaf);
+		else
+			sched_yield();
+		return;
+	}
+
+	bool pipelined = (agent->pipeline > 0 && agent->rollouts > 0);
+	if(pipelined){
+		//back up what the workers finished, and only start a simulation once it can hand off all its rollouts
+		Leaf * leaf;
+		while(agent->leafdone.pop(leaf))
+			finish_leaf(leaf);
+
+		while((int)reserved.size() < agent->rollouts){
+			Leaf * leaf = agent->get_leaf();
+			if(!leaf){ //all in flight, so help them along instead
+				if(!pipeline_help())
+					sched_yield();
+				return;
+			}
+			reserved.push_back(leaf);
+		}
+	}
+
+	agent->runs.incr();
 	if(agent->profile){
 		timestamps[0] = Time();
 		stage = 0;
 	}
 
+	Node & root = (tree ? tree->root : agent->root);
 	movelist.reset(&(agent->rootboard));
-	agent->root.exp.addvloss();
+	path.clear();
+	path.push_back(Step(&root, ~agent->rootboard.to_play(), 0, false));
+	root.exp.addvloss();
 	Board copy = agent->rootboard;
 	use_rave    = (unitrand() < agent->userave);
 	use_explore = (unitrand() < agent->useexplore);
-	walk_tree(copy, & agent->root, 0);
-	agent->root.exp.addv(movelist.getexp(~agent->rootboard.to_play()));
+	if(walk_tree(copy, & root, 0)){
+		//hand off one leaf per rollout, each holding a virtual loss on the path until it's backed up
+		for(int i = 1; i < agent->rollouts; i++)
+			for(const Step & s : path)
+				s.node->exp.addvloss();
+
+		for(Leaf * leaf : reserved){
+			leaf->board = copy;
+			leaf->movelist.reset(movelist);
+			leaf->path = path;
+			agent->leaftodo.push(leaf);
+		}
+		reserved.clear();
+	}else{
+		backup(path, movelist);
+	}
+
+	rave_batch.finish_iteration(agent->ravebatch);
 
 	if(agent->profile){
 		times[0] += timestamps[1] - timestamps[0];
@@ -33,41 +84,38 @@ void AgentMCTS::AgentThread::iterate(){
 	}
 }
 
-void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
+//descend to a leaf and roll it out, adding the nodes on the way to path for the backup
+//returns true if the rollouts are left for the pipeline instead
+bool AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 	Side to_play = board.to_play();
 
-	if(!node->children.empty() && node->outcome < Outcome::DRAW){
+	if(!node->children.empty() && node->outcome() < Outcome::DRAW){
+		//register it for its transpositions, it can take a few moves to reach the same position another way
+		if(depth >= 3 && !tree && agent->transpositions.enabled())
+			agent->transpositions.insert(board.gethash_exact(), node);
+
 	//choose a child and recurse
 		Node * child;
 		do{
 			int remain = board.moves_remain();
 			child = choose_move(node, to_play, remain);
 
-			if(child->outcome < Outcome::DRAW){
-				movelist.addtree(child->move, to_play);
+			if(child->outcome() < Outcome::DRAW){
+				movelist.addtree(child->move(), to_play);
 
-				if(!board.move(child->move)){
-					logerr("move failed: " + child->move.to_s() + "\n" + board.to_s(true));
+				if(!board.move(child->move())){
+					logerr("move failed: " + child->move().to_s() + "\n" + board.to_s(true));
 					assert(false && "move failed");
 				}
 
 				child->exp.addvloss(); //balanced out after rollouts
+				path.push_back(Step(child, to_play, remain, false));
 
-				walk_tree(board, child, depth+1);
-
-				child->exp.addv(movelist.getexp(to_play));
-
-				if(!agent->do_backup(node, child, to_play) && //not solved
-					agent->ravefactor > min_rave &&  //using rave
-					node->children.num() > 1 &&       //not a macro move
-					50*remain*(agent->ravefactor + agent->decrrave*remain) > node->exp.num()) //rave is still significant
-					update_rave(node, to_play);
-
-				return;
+				return walk_tree(board, child, depth+1);
 			}
 		}while(!agent->do_backup(node, child, to_play));
 
-		return;
+		return false;
 	}
 
 	if(agent->profile && stage == 0){
@@ -75,26 +123,49 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 		timestamps[1] = Time();
 	}
 
-	Outcome won = (agent->minimax ? node->outcome : board.outcome());
+	Outcome won = (agent->minimax ? node->outcome() : board.outcome());
+
+	//this position was already expanded through a different move order, so continue in that subtree
+	//instead of growing a copy of it. Both get the result: node holds the stats of this path's edge, which
+	//its parent chooses by, and trans the stats of the position from all paths. There are no separate edge
+	//stats for trans, so unlike UCT3, its own parent counts the runs through here in its children but not itself.
+	Node * trans = NULL;
+	if(won < Outcome::DRAW && depth >= 3 && !tree && agent->transpositions.enabled())
+		trans = agent->transpositions.find(board.gethash_exact());
+	if(trans && trans != node){
+		if(trans->outcome() < Outcome::DRAW){
+			agent->transposed.incr();
+			trans->exp.addvloss();
+			path.push_back(Step(trans, ~to_play, 0, true));
+			return walk_tree(board, trans, depth);
+		}
+		if(agent->minimax){ //take the proof, so the parent can back it up
+			node->cas_proof(node->outcome(), trans->outcome(), trans->bestmove(), trans->proofdepth());
+			won = node->outcome();
+		}
+	}
 
 	//if it's not already decided
+	bool pipelined = false;
 	if(won < Outcome::DRAW){
 		//create children if valid
-		if(node->exp.num() >= agent->visitexpand+1 && create_children(board, node)){
-			walk_tree(board, node, depth);
-			return;
-		}
+		if(node->exp.num() >= agent->visitexpand+1 && create_children(board, node))
+			return walk_tree(board, node, depth);
 
 		if(agent->profile){
 			stage = 2;
 			timestamps[2] = Time();
 		}
 
-		//do random game on this node
-		random_policy.prepare(board);
-		for(int i = 0; i < agent->rollouts; i++){
-			Board copy = board;
-			rollout(copy, node->move, depth);
+		if(agent->pipeline > 0 && agent->rollouts > 0){
+			pipelined = true; //the rollout workers play it out
+		}else{
+			//do random game on this node
+			random_policy.prepare(board);
+			for(int i = 0; i < agent->rollouts; i++){
+				Board copy = board;
+				rollout(copy, node->move(), depth, movelist);
+			}
 		}
 	}else{
 		movelist.finishrollout(won); //got to a terminal state, it's worth recording
@@ -102,7 +173,8 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 
 	treelen.add(depth);
 
-	movelist.subvlosses(1);
+	if(!pipelined)
+		movelist.subvlosses(1);
 
 	if(agent->profile){
 		timestamps[3] = Time();
@@ -111,11 +183,89 @@ void AgentMCTS::AgentThread::walk_tree(Board & board, Node * node, int depth){
 		stage = 3;
 	}
 
-	return;
+	return pipelined;
+}
+
+//add the results to the nodes on the path from the leaf up to the root, and back up any proofs
+void AgentMCTS::AgentThread::backup(const std::vector<Step> & steps, const MoveList<Board> & moves){
+	for(int i = steps.size() - 1; i > 0; i--){
+		const Step & s = steps[i];
+		s.node->exp.addv(moves.getexp(s.side));
+		if(s.trans)
+			continue;
+
+		Node * node = steps[i - 1].node;
+		if(!agent->do_backup(node, s.node, s.side) && //not solved
+			agent->ravefactor > min_rave &&  //using rave
+			node->children.num() > 1 &&       //not a macro move
+			50*s.remain*(agent->ravefactor + agent->decrrave*s.remain) > node->exp.num()) //rave is still significant
+			update_rave(node, s.side, moves);
+	}
+	steps[0].node->exp.addv(moves.getexp(steps[0].side));
+}
+
+//do one step of work for the pipeline, returns false if there was nothing to do
+bool AgentMCTS::AgentThread::pipeline_help(){
+	Leaf * leaf;
+	if(agent->leafdone.pop(leaf)){
+		finish_leaf(leaf);
+		return true;
+	}
+	if(agent->leaftodo.pop(leaf)){
+		play_leaf(leaf);
+		return true;
+	}
+	return false;
+}
+
+//finish all the leaves in flight, so nothing points into the tree while it's paused
+void AgentMCTS::AgentThread::pipeline_drain(){
+	for(Leaf * leaf : reserved)
+		agent->put_leaf(leaf);
+	reserved.clear();
+
+	while(agent->leavesout > 0)
+		if(!pipeline_help())
+			sched_yield(); //the last ones are held by another thread
+}
+
+void AgentMCTS::AgentThread::play_leaf(Leaf * leaf){
+	random_policy.prepare(leaf->board);
+	rollout(leaf->board, leaf->path.back().node->move(), leaf->movelist.tree, leaf->movelist);
+	leaf->movelist.subvlosses(1);
+	agent->leafdone.push(leaf);
+}
+
+void AgentMCTS::AgentThread::finish_leaf(Leaf * leaf){
+	backup(leaf->path, leaf->movelist);
+	agent->put_leaf(leaf);
 }
 
 bool sort_node_know(const AgentMCTS::Node & a, const AgentMCTS::Node & b){
-	return (a.know > b.know);
+	return (a.know() > b.know());
+}
+
+//the distances for the side to play at the leaf. Just below the root it's cheaper to update the
+//root's distances with the moves since then than to run all the flood fills again.
+void AgentMCTS::AgentThread::leaf_dists(const Board & board){
+	//each move costs about half a run on the bitboards at size 8 to 13, and a quarter at 19
+	int maxreplay = board.lines() / 8;
+	if(movelist.tree > maxreplay){
+		dists.run(&board, (agent->dists > 0), board.to_play());
+		return;
+	}
+
+	if(!rootdists_valid){
+		rootdists.run(&agent->rootboard, (agent->dists > 0));
+		rootdists_valid = true;
+	}
+
+	replay = agent->rootboard;
+	dists.copy(rootdists, &replay, board.to_play());
+	for(const MovePlayer * m = movelist.begin(), * end = m + movelist.tree; m != end; m++){
+		replay.move(*m);
+		dists.move(&replay, MoveValid(*m, replay.xy(*m)));
+	}
 }
 
 bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
@@ -123,11 +273,11 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 		return false;
 
 	if(agent->dists){
-		dists.run(&board, (agent->dists > 0), board.to_play());
+		leaf_dists(board);
 	}
 
 	CompactTree<Node>::Children temp;
-	temp.alloc(board.moves_avail(), agent->ctmem);
+	temp.alloc_temp(board.moves_avail(), arena);
 
 	Side to_play = board.to_play();
 	Side opponent = ~to_play;
@@ -139,19 +289,17 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 		*child = Node(move);
 
 		if(agent->minimax){
-			child->outcome = board.test_outcome(move);
+			child->set_outcome(board.test_outcome(move));
 
 			if(agent->minimax >= 2 && board.test_outcome(move, opponent) == +opponent){
 				losses++;
 				loss = child;
 			}
 
-			if(child->outcome == +to_play){ //proven win from here, don't need children
-				node->outcome = child->outcome;
-				node->proofdepth = 1;
-				node->bestmove = move;
+			if(child->outcome() == +to_play){ //proven win from here, don't need children
+				node->set_proof(child->outcome(), move, 1);
 				node->children.unlock();
-				temp.dealloc(agent->ctmem);
+				temp.dealloc(arena);
 				return true;
 			}
 		}
@@ -165,23 +313,21 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 	//Make a macro move, add experience to the move so the current simulation continues past this move
 	if(losses == 1){
 		Node macro = *loss;
-		temp.dealloc(agent->ctmem);
-		temp.alloc(1, agent->ctmem);
+		temp.dealloc(arena);
+		temp.alloc_temp(1, arena);
 		macro.exp.addwins(agent->visitexpand);
 		*(temp.begin()) = macro;
 	}else if(losses >= 2){ //proven loss, but at least try to block one of them
-		node->outcome = +opponent;
-		node->proofdepth = 2;
-		node->bestmove = loss->move;
+		node->set_proof(+opponent, loss->move(), 2);
 		node->children.unlock();
-		temp.dealloc(agent->ctmem);
+		temp.dealloc(arena);
 		return true;
 	}
 
 	if(agent->dynwiden > 0) //sort in decreasing order by knowledge
 		std::sort(temp.begin(), temp.end(), sort_node_know);
 
-	PLUS(agent->nodes, temp.num());
+	(tree ? tree->nodes : agent->nodes) += temp.num();
 	node->children.swap(temp);
 	assert(temp.unlock());
 
@@ -189,39 +335,19 @@ bool AgentMCTS::AgentThread::create_children(const Board & board, Node * node){
 }
 
 AgentMCTS::Node * AgentMCTS::AgentThread::choose_move(const Node * node, Side to_play, int remain) const {
-	float val, maxval = -1000000000;
-	float logvisits = log(node->exp.num());
-	int dynwidenlim = (agent->dynwiden > 0 ? (int)(logvisits/agent->logdynwiden)+2 : Board::max_vec_size);
-
-	float raveval = use_rave * (agent->ravefactor + agent->decrrave*remain);
-	float explore = use_explore * agent->explore;
+	ChildSelectParams p;
+	p.logvisits = log(node->exp.num());
+	p.dynwidenlim = (agent->dynwiden > 0 ? (int)(p.logvisits/agent->logdynwiden)+2 : Board::max_vec_size);
+
+	p.ravefactor = use_rave * (agent->ravefactor + agent->decrrave*remain);
+	p.min_rave = min_rave;
+	p.fpurgency = agent->fpurgency;
+	p.knowledge = agent->knowledge;
+	p.explore = use_explore * agent->explore;
 	if(agent->parentexplore)
-		explore *= node->exp.avg();
-
-	Node * ret   = NULL,
-		 * child = node->children.begin(),
-		 * end   = node->children.end();
-
-	for(; child != end && dynwidenlim >= 0; child++){
-		if(child->outcome >= Outcome::DRAW){
-			if(child->outcome == to_play) //return a win immediately
-				return child;
-
-			val = (child->outcome == Outcome::DRAW ? -1 : -2); //-1 for tie so any unknown is better, -2 for loss so it's even worse
-		}else{
-			val = child->value(raveval, agent->knowledge, agent->fpurgency);
-			if(explore > 0)
-				val += explore*sqrt(logvisits/(child->exp.num() + 1));
-			dynwidenlim--;
-		}
-
-		if(maxval < val){
-			maxval = val;
-			ret = child;
-		}
-	}
+		p.explore *= node->exp.avg();
 
-	return ret;
+	return ChildSelect<Node>::choose(node->children.begin(), node->children.end(), to_play, p);
 }
 
 /*
@@ -237,20 +363,20 @@ backup in this order:
 return true if fully solved, false if it's unknown or partially unknown
 */
 bool AgentMCTS::do_backup(Node * node, const Node * backup, Side to_play){
-	Outcome node_outcome = node->outcome;
+	Outcome node_outcome = node->outcome();
 	if(node_outcome >= Outcome::DRAW) //already proven, probably by a different thread
 		return true;
 
-	if(backup->outcome == Outcome::UNKNOWN) //nothing proven by this child, so no chance
+	if(backup->outcome() == Outcome::UNKNOWN) //nothing proven by this child, so no chance
 		return false;
 
-	uint8_t proofdepth = backup->proofdepth;
-	if(backup->outcome != to_play){
+	uint8_t proofdepth = backup->proofdepth();
+	if(backup->outcome() != to_play){
 		int best_outcome = 0;
 		backup = NULL;
 
 		for (const auto& child : node->children) {
-			Outcome child_outcome = child.outcome; //save a copy to avoid race conditions
+			Outcome child_outcome = child.outcome(); //save a copy to avoid race conditions
 			int outcome = 0;
 
 			//these should be sorted in likelyness of matching, most likely first
@@ -259,7 +385,7 @@ bool AgentMCTS::do_backup(Node * node, const Node * backup, Side to_play){
 			}else if(child_outcome == to_play){ //win
 				backup = &child;
 				best_outcome = 6;
-				proofdepth = child.proofdepth;
+				proofdepth = child.proofdepth();
 				break;
 			}else if(child_outcome == ~to_play){ //loss
 				outcome = 0;
@@ -278,8 +404,8 @@ bool AgentMCTS::do_backup(Node * node, const Node * backup, Side to_play){
 				assert(false && "How'd I get here? All outcomes should be tested above");
 			}
 
-			if(proofdepth < child.proofdepth)
-				proofdepth = child.proofdepth;
+			if(proofdepth < child.proofdepth())
+				proofdepth = child.proofdepth();
 
 			auto better_than_best = [&]() -> bool {
 				// any child is better than nothing
@@ -294,9 +420,9 @@ bool AgentMCTS::do_backup(Node * node, const Node * backup, Side to_play){
 
 				// do we care about depth? if so, take the longest.
 				if (longestloss) {
-					if (backup->proofdepth < child.proofdepth)
+					if (backup->proofdepth() < child.proofdepth())
 						return true;
-					if (backup->proofdepth > child.proofdepth)
+					if (backup->proofdepth() > child.proofdepth())
 						return false;
 				}
 
@@ -314,50 +440,58 @@ bool AgentMCTS::do_backup(Node * node, const Node * backup, Side to_play){
 			return false;
 	}
 
-	if(node->outcome.cas(node_outcome, backup->outcome)){
-		node->bestmove = backup->move;
-		node->proofdepth = proofdepth + 1;
-	}else //if it was in a race, try again, might promote a partial solve to full solve
+	if(!node->cas_proof(node_outcome, backup->outcome(), backup->move(), proofdepth + 1)) //if it was in a race, try again, might promote a partial solve to full solve
 		return do_backup(node, backup, to_play);
 
-	return (node->outcome >= Outcome::DRAW);
+	return (node->outcome() >= Outcome::DRAW);
 }
 
-//update the rave score of all children that were played
-void AgentMCTS::AgentThread::update_rave(const Node * node, Side to_play){
+//update the rave score of all children that were played, now or in the next batch
+void AgentMCTS::AgentThread::update_rave(const Node * node, Side to_play, const MoveList<Board> & moves){
 	Node * child = node->children.begin(),
 	     * childend = node->children.end();
 
-	for( ; child != childend; ++child)
-		child->rave.addv(movelist.getrave(to_play, child->move));
+	for( ; child != childend; ++child){
+		const ExpPair & rave = moves.getrave(to_play, child->move());
+		if(rave.num() == 0)
+			continue;
+		if(agent->ravebatch > 0)
+			rave_batch.add(child, rave);
+		else
+			child->rave.addv(rave);
+	}
 }
 
 
 void AgentMCTS::AgentThread::add_knowledge(const Board & board, Node * node, Node * child){
+	int know = 0;
+
 	if(agent->localreply){ //boost for moves near the previous move
-		int dist = board.dist(node->move, child->move);
+		int dist = board.dist(node->move(), child->move());
 		if(dist < 4)
-			child->know += agent->localreply * (4 - dist);
+			know += agent->localreply * (4 - dist);
 	}
 
 	if(agent->locality) //boost for moves near previous stones
-		child->know += agent->locality * board.local(child->move, board.to_play());
+		know += agent->locality * board.local(child->move(), board.to_play());
 
 	Board::Cell cell;
 	if(agent->connect || agent->size)
-		cell = board.test_cell(child->move);
+		cell = board.test_cell(child->move());
 
 	if(agent->connect) //boost for moves that connect to edges
-		child->know += agent->connect * cell.numedges();
+		know += agent->connect * cell.numedges();
 
 	if(agent->size) //boost for size of the group
-		child->know += agent->size * cell.size;
+		know += agent->size * cell.size;
 
-	if(agent->bridge && test_bridge_probe(board, node->move, child->move)) //boost for maintaining a virtual connection
-		child->know += agent->bridge;
+	if(agent->bridge && test_bridge_probe(board, node->move(), child->move())) //boost for maintaining a virtual connection
+		know += agent->bridge;
 
 	if(agent->dists)
-		child->know += abs(agent->dists) * std::max(0, board.lines() - dists.get(child->move, board.to_play()));
+		know += abs(agent->dists) * std::max(0, board.lines() - dists.get(child->move(), board.to_play()));
+
+	child->set_know(know);
 }
 
 //test whether this move is a forced reply to the opponent probing your virtual connections
@@ -411,11 +545,12 @@ bool AgentMCTS::AgentThread::test_bridge_probe(const Board & board, const Move &
 
 
 //play a random game starting from a board state, and return the results of who won
-Outcome AgentMCTS::AgentThread::rollout(Board & board, Move move, int depth){
-	Outcome won;
+Outcome AgentMCTS::AgentThread::rollout(Board & board, Move move, int depth, MoveList<Board> & moves){
+	//the policies need the board after every move, otherwise fill it all in at once
+	if(agent->fillrollout && !agent->instantwin && !agent->rolloutpattern && !agent->lastgoodreply)
+		return fill_rollout(board, depth, moves);
 
-	if(agent->instantwin)
-		instant_wins.rollout_start(board, agent->instantwin);
+	Outcome won;
 
 	random_policy.rollout_start(board);
 
@@ -424,7 +559,7 @@ Outcome AgentMCTS::AgentThread::rollout(Board & board, Move move, int depth){
 
 		move = rollout_choose_move(board, move);
 
-		movelist.addrollout(move, turn);
+		moves.addrollout(move, turn);
 
 		assert2(board.move(move, true, false), "\n" + board.to_s(true) + "\n" + move.to_s());
 		depth++;
@@ -437,9 +572,32 @@ Outcome AgentMCTS::AgentThread::rollout(Board & board, Move move, int depth){
 
 	//update the last good reply table
 	if(agent->lastgoodreply)
-		last_good_reply.rollout_end(board, movelist, won);
+		last_good_reply.rollout_end(board, moves, won);
+
+	moves.finishrollout(won);
+	return won;
+}
+
+//play the empty cells in random order without updating the board, and only find the winner at
+//the end. The moves after the winning one still count for rave, unlike in a normal rollout.
+Outcome AgentMCTS::AgentThread::fill_rollout(const Board & board, int depth, MoveList<Board> & moves){
+	Move fill[Board::max_vec_size];
+	int num = board.moves_avail();
+	Side turn = board.to_play();
+	random_policy.rollout_start(board);
+	for(int i = 0; i < num; i++){
+		fill[i] = random_policy.choose_move(board, M_NONE);
+		moves.addrollout(fill[i], turn);
+		turn = ~turn;
+	}
+	depth += num;
+
+	Outcome won = board.fill_outcome(fill, num);
+
+	gamelen.add(depth);
+	win_types[won.to_i() - 1][(int)board.win_type()].add(depth);
 
-	movelist.finishrollout(won);
+	moves.finishrollout(won);
 	return won;
 }
 
@@ -9,13 +9,18 @@
 namespace Morat {
 namespace Y {
 
-class LBDists : public LBDistsBase<LBDists, Board> {
+class LBDists : public LBDistsBase<LBDists, Board, BitBoard<Board::max_size, Board::max_size, -1>> {
 
 public:
 	LBDists() : LBDistsBase() {}
 	LBDists(const Board * b) : LBDistsBase(b) { }
 
 	void init_player(bool crossvcs, Side player){
+		init_player_bits(crossvcs, player);
+	}
+
+	//the flood fills one cell at a time, as the reference for init_player_bits
+	void init_player_flood(bool crossvcs, Side player){
 		int m = board->lines();
 		int m1 = m-1;
 
@@ -24,6 +29,22 @@ public:
 		for(int y = 0; y < m; y++) { init(m1-y, y, 2,  player, 5); } flood(2,  player, crossvcs); //edge 2
 	}
 
+	//the same distances as the flood fills, but found a whole layer at a time on bitboards
+	void init_player_bits(bool crossvcs, Side player){
+		int m = board->lines();
+		int m1 = m-1;
+
+		start_bits(player);
+
+		Bits start[3];
+		for(int x = 0; x < m; x++) { seed_bits(start[0], x,    0, 0,  player); } //edge 0
+		for(int y = 0; y < m; y++) { seed_bits(start[1], 0,    y, 1,  player); } //edge 1
+		for(int y = 0; y < m; y++) { seed_bits(start[2], m1-y, y, 2,  player); } //edge 2
+
+		for(int edge = 0; edge < 3; edge++)
+			flood_bits(edge, player, start[edge]);
+	}
+
 	int _get(int pos, Side player){
 		int sum = 0;
 		for(int i = 0; i < 3; i++)
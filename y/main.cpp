@@ -2,6 +2,7 @@
 #include <string>
 #include <unistd.h>
 
+#include "../lib/socket.h"
 #include "../lib/time.h"
 
 #include "gtp.h"
@@ -20,9 +21,11 @@ void die(int code, const string & str){
 int main(int argc, char **argv){
 
 	srand(Time().in_usec());
+	DistWorkers::set_exe(argv[0]);
 	GTP gtp;
 
 	gtp.colorboard = isatty(fileno(stdout));
+	string worker; //address of the coordinator of a distributed search
 
 	for(int i = 1; i < argc; i++) {
 		string arg = argv[i];
@@ -33,6 +36,7 @@ int main(int argc, char **argv){
 				"\t-n --nocolor  Don't output the board in color\n"
 				"\t-c --cmd      Pass a gtp command from the command line\n"
 				"\t-f --file     Run this gtp file before reading from stdin\n"
+				"\t-w --worker   Be a worker for the distributed search at this address\n"
 				);
 		}else if(arg == "-v" || arg == "--verbose"){
 			gtp.verbose = true;
@@ -51,11 +55,30 @@ int main(int argc, char **argv){
 			if(!gtp.run())
 				return 0;
 			fclose(fd);
+		}else if(arg == "-w" || arg == "--worker"){
+			char * ptr = argv[++i];
+			if(ptr == NULL) die(255, "Missing an address to connect to");
+			worker = ptr;
 		}else{
 			die(255, "Unknown argument: " + arg + ", try --help");
 		}
 	}
 
+	if(!worker.empty()){
+		//the coordinator sends the gtp commands over the socket instead of stdin
+		Socket sock;
+		if(!sock.connect(worker))
+			die(1, "Failed to connect to " + worker);
+		FILE * in  = fdopen(dup(sock.get_fd()), "r");
+		FILE * out = fdopen(dup(sock.get_fd()), "w");
+		gtp.setinfile(in);
+		gtp.setoutfile(out);
+		gtp.run();
+		fclose(in);
+		fclose(out);
+		return 0;
+	}
+
 	gtp.setinfile(stdin);
 	gtp.setoutfile(stdout);
 	gtp.run();